@@ -0,0 +1,120 @@
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <stdexcept>
+#include <cstdio>
+#include <cstdlib>
+
+#include "database_connection.h"
+
+// Keeps N requests in flight against a DatabaseConnection with a write-
+// ahead log, two ways:
+//   threads    N threads, each calling insert() and query() in turn
+//   coroutines one thread running N insertAsync()/queryAsync() loops on
+//              an Executor
+// Every insert waits for its write to be durable, so throughput depends
+// on how many writes share each fsync. Reports operations per second and
+// the number of fsyncs for both.
+// Usage: async_benchmark [in_flight] [ops_per_request] [wal_path]
+
+std::string makeKey(size_t client, size_t i) {
+    char key[48];
+    std::snprintf(key, sizeof(key), "client:%06zu:%06zu", client, i);
+    return key;
+}
+
+struct Result {
+    double seconds;
+    uint64_t syncs;
+};
+
+void report(const std::string& label, size_t ops, const Result& result) {
+    std::cout << std::left << std::setw(12) << label << std::right << std::fixed << std::setprecision(0)
+              << std::setw(10) << ops / result.seconds << " ops/s, " << std::setw(7) << result.syncs
+              << " fsyncs, " << std::setprecision(1) << static_cast<double>(ops / 2) / std::max<uint64_t>(1, result.syncs)
+              << " writes per fsync" << std::endl;
+}
+
+Task<void> client(DatabaseConnection& db, Executor& executor, size_t id, size_t ops) {
+    for (size_t i = 0; i < ops; i++) {
+        std::string key = makeKey(id, i);
+        co_await db.insertAsync(executor, key, "value-" + std::to_string(i));
+        if (co_await db.queryAsync(executor, key) != "value-" + std::to_string(i)) {
+            throw std::runtime_error("Read back the wrong value for " + key);
+        }
+    }
+}
+
+Result runThreads(DatabaseConnection& db, size_t in_flight, size_t ops) {
+    uint64_t syncs_before = db.walSyncs();
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (size_t id = 0; id < in_flight; id++) {
+        threads.emplace_back([&db, id, ops] {
+            for (size_t i = 0; i < ops; i++) {
+                std::string key = makeKey(id, i);
+                db.insert(key, "value-" + std::to_string(i));
+                if (db.query(key) != "value-" + std::to_string(i)) {
+                    throw std::runtime_error("Read back the wrong value for " + key);
+                }
+            }
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return {seconds, db.walSyncs() - syncs_before};
+}
+
+Result runCoroutines(DatabaseConnection& db, size_t in_flight, size_t ops) {
+    uint64_t syncs_before = db.walSyncs();
+    auto start = std::chrono::steady_clock::now();
+    Executor executor;
+    for (size_t id = 0; id < in_flight; id++) {
+        executor.spawn(client(db, executor, id, ops));
+    }
+    executor.run();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return {seconds, db.walSyncs() - syncs_before};
+}
+
+int main(int argc, char* argv[]) {
+    size_t in_flight = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 256;
+    size_t ops = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 20;
+    std::string wal_path = argc > 3 ? argv[3] : "async_benchmark.wal";
+    if (in_flight == 0 || ops == 0) {
+        std::cerr << "Usage: async_benchmark [in_flight] [ops_per_request] [wal_path]" << std::endl;
+        return 1;
+    }
+
+    DatabaseConnection& db = DatabaseConnection::getInstance();
+    ConnectionOptions options;
+    options.wal_path = wal_path;
+    options.echo_inserts = false;
+    size_t total = in_flight * ops * 2;
+    std::cout << in_flight << " requests in flight, " << total << " operations each way" << std::endl;
+
+    try {
+        std::remove(wal_path.c_str());
+        db.connect("async://threads", options);
+        Result threads = runThreads(db, in_flight, ops);
+        db.disconnect();
+
+        std::remove(wal_path.c_str());
+        db.connect("async://coroutines", options);
+        Result coroutines = runCoroutines(db, in_flight, ops);
+        db.disconnect();
+
+        report("threads", total, threads);
+        report("coroutines", total, coroutines);
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    std::remove(wal_path.c_str());
+    return 0;
+}
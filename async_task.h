@@ -0,0 +1,357 @@
+#ifndef ASYNC_TASK_H
+#define ASYNC_TASK_H
+
+#include <coroutine>
+#include <deque>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <functional>
+#include <type_traits>
+#include <exception>
+#include <optional>
+#include <utility>
+#include <algorithm>
+#include <stdexcept>
+#include <cstddef>
+
+// A lazily started coroutine that produces a T. It runs when first awaited
+// and resumes its awaiter when it finishes, passing on its result or its
+// exception. Awaiting it a second time is an error.
+template<typename T>
+class Task;
+
+// Resumes whoever awaited the finished coroutine, without growing the stack
+struct TaskFinalAwaiter {
+    bool await_ready() const noexcept { return false; }
+
+    template<typename Promise>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) const noexcept {
+        if (auto next = handle.promise().continuation) {
+            return next;
+        }
+        return std::noop_coroutine();
+    }
+
+    void await_resume() const noexcept {}
+};
+
+struct TaskPromiseBase {
+    std::coroutine_handle<> continuation;
+    std::exception_ptr error;
+
+    std::suspend_always initial_suspend() const noexcept { return {}; }
+    TaskFinalAwaiter final_suspend() const noexcept { return {}; }
+    void unhandled_exception() { error = std::current_exception(); }
+};
+
+template<typename T>
+struct TaskPromise : TaskPromiseBase {
+    std::optional<T> result;
+
+    Task<T> get_return_object();
+
+    template<typename U>
+    void return_value(U&& value) {
+        result.emplace(std::forward<U>(value));
+    }
+
+    T take() {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+        return std::move(*result);
+    }
+};
+
+template<>
+struct TaskPromise<void> : TaskPromiseBase {
+    Task<void> get_return_object();
+
+    void return_void() {}
+
+    void take() {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+};
+
+template<typename T = void>
+class Task {
+public:
+    using promise_type = TaskPromise<T>;
+
+private:
+    std::coroutine_handle<promise_type> handle;
+
+public:
+    explicit Task(std::coroutine_handle<promise_type> h) : handle(h) {}
+
+    Task(Task&& other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+
+    Task& operator=(Task&& other) noexcept {
+        if (this != &other) {
+            if (handle) {
+                handle.destroy();
+            }
+            handle = std::exchange(other.handle, nullptr);
+        }
+        return *this;
+    }
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    ~Task() {
+        if (handle) {
+            handle.destroy();
+        }
+    }
+
+    bool await_ready() const noexcept { return false; }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) {
+        if (!handle || handle.promise().continuation) {
+            throw std::logic_error("Task awaited twice");
+        }
+        handle.promise().continuation = awaiter;
+        return handle;
+    }
+
+    T await_resume() { return handle.promise().take(); }
+};
+
+template<typename T>
+Task<T> TaskPromise<T>::get_return_object() {
+    return Task<T>(std::coroutine_handle<TaskPromise<T>>::from_promise(*this));
+}
+
+inline Task<void> TaskPromise<void>::get_return_object() {
+    return Task<void>(std::coroutine_handle<TaskPromise<void>>::from_promise(*this));
+}
+
+// Runs coroutines on the thread that calls run(), so one thread can keep
+// thousands of requests in flight. A coroutine that cannot make progress,
+// because a lock it needs is taken or its write is not yet durable,
+// suspends with yield() or drained() and the executor resumes it later,
+// meanwhile running the others. post() may be called from any thread,
+// which is how work finished elsewhere hands its waiter back.
+//
+// Coroutines must not hold a lock across a suspension point: the executor
+// may then run another coroutine that needs the same lock on the same
+// thread. Nor should they block; work that has to, like waiting for a
+// disk read, goes through offload().
+class Executor {
+private:
+    static constexpr size_t kOffloadThreads = 4;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<std::coroutine_handle<>> ready;
+    // Resumed once everything ready before them has run
+    std::vector<std::coroutine_handle<>> after_drain;
+    size_t outstanding = 0;           // spawned tasks not yet finished
+    std::exception_ptr first_error;   // from a spawned task
+
+    // Helper threads for offload(), started on first use
+    std::mutex offload_mutex;
+    std::condition_variable offload_wake;
+    std::deque<std::function<void()>> offloaded;
+    std::vector<std::thread> offload_threads;
+    bool offload_stop = false;
+
+    struct ScheduleAwaiter {
+        Executor& executor;
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> handle) { executor.post(handle); }
+        void await_resume() const noexcept {}
+    };
+
+    struct DrainAwaiter {
+        Executor& executor;
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> handle) {
+            std::lock_guard<std::mutex> lock(executor.mutex);
+            executor.after_drain.push_back(handle);
+        }
+        void await_resume() const noexcept {}
+    };
+
+    template<typename F>
+    struct OffloadAwaiter {
+        using Result = std::invoke_result_t<F&>;
+
+        Executor& executor;
+        F function;
+        std::optional<std::conditional_t<std::is_void_v<Result>, bool, Result>> result;
+        std::exception_ptr error;
+
+        bool await_ready() const noexcept { return false; }
+
+        void await_suspend(std::coroutine_handle<> handle) {
+            executor.submitOffloaded([this, handle] {
+                try {
+                    if constexpr (std::is_void_v<Result>) {
+                        function();
+                    } else {
+                        result.emplace(function());
+                    }
+                } catch (...) {
+                    error = std::current_exception();
+                }
+                // The awaiter lives in the coroutine's frame, which may be
+                // gone as soon as the coroutine is resumed
+                executor.post(handle);
+            });
+        }
+
+        Result await_resume() {
+            if (error) {
+                std::rethrow_exception(error);
+            }
+            if constexpr (!std::is_void_v<Result>) {
+                return std::move(*result);
+            }
+        }
+    };
+
+    void submitOffloaded(std::function<void()> work) {
+        std::lock_guard<std::mutex> lock(offload_mutex);
+        offloaded.push_back(std::move(work));
+        if (offload_threads.size() < std::min(offloaded.size(), kOffloadThreads)) {
+            offload_threads.emplace_back([this] { offloadLoop(); });
+        }
+        offload_wake.notify_one();
+    }
+
+    void offloadLoop() {
+        std::unique_lock<std::mutex> lock(offload_mutex);
+        for (;;) {
+            offload_wake.wait(lock, [this] { return offload_stop || !offloaded.empty(); });
+            if (offloaded.empty()) {
+                return;
+            }
+            std::function<void()> work = std::move(offloaded.front());
+            offloaded.pop_front();
+            lock.unlock();
+            work();
+            lock.lock();
+        }
+    }
+
+    // Frame of a spawned task: owns the task, reports its end, and
+    // destroys itself on completion
+    struct Detached {
+        struct promise_type {
+            Detached get_return_object() noexcept { return {}; }
+            std::suspend_never initial_suspend() const noexcept { return {}; }
+            std::suspend_never final_suspend() const noexcept { return {}; }
+            void return_void() noexcept {}
+            void unhandled_exception() noexcept { std::terminate(); }
+        };
+    };
+
+    Detached runDetached(Task<void> task) {
+        co_await schedule();
+        try {
+            co_await std::move(task);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!first_error) {
+                first_error = std::current_exception();
+            }
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--outstanding == 0) {
+            wake.notify_all();
+        }
+    }
+
+public:
+    Executor() = default;
+    Executor(const Executor&) = delete;
+    Executor& operator=(const Executor&) = delete;
+
+    ~Executor() {
+        {
+            std::lock_guard<std::mutex> lock(offload_mutex);
+            offload_stop = true;
+        }
+        offload_wake.notify_all();
+        for (std::thread& thread : offload_threads) {
+            thread.join();
+        }
+    }
+
+    // Queue handle to be resumed by run()
+    void post(std::coroutine_handle<> handle) {
+        std::lock_guard<std::mutex> lock(mutex);
+        ready.push_back(handle);
+        wake.notify_one();
+    }
+
+    // Awaitable that moves the awaiting coroutine onto this executor
+    ScheduleAwaiter schedule() { return ScheduleAwaiter{*this}; }
+
+    // Let every other ready coroutine run before this one continues
+    ScheduleAwaiter yield() { return ScheduleAwaiter{*this}; }
+
+    // Continue only once the ready queue has run dry, so that work which
+    // blocks, like a log flush, is started once on behalf of everything
+    // that was ready instead of once per request
+    DrainAwaiter drained() { return DrainAwaiter{*this}; }
+
+    // Awaitable that runs function() on a helper thread and resumes the
+    // awaiting coroutine on this executor with its result, so a call that
+    // blocks holds up neither run() nor the other coroutines
+    template<typename F>
+    OffloadAwaiter<F> offload(F function) { return OffloadAwaiter<F>{*this, std::move(function), {}, {}}; }
+
+    // Start task on this executor; run() returns once it has finished
+    void spawn(Task<void> task) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            outstanding++;
+        }
+        runDetached(std::move(task));
+    }
+
+    // Resume coroutines until every spawned task has finished, then
+    // rethrow the first exception one of them ended with
+    void run() {
+        std::vector<std::coroutine_handle<>> batch;
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this] { return outstanding == 0 || !ready.empty() || !after_drain.empty(); });
+                if (ready.empty() && after_drain.empty()) {
+                    break;
+                }
+                // What is ready now runs first; coroutines waiting for the
+                // queue to drain run once it has
+                if (!ready.empty()) {
+                    batch.assign(ready.begin(), ready.end());
+                    ready.clear();
+                } else {
+                    batch.swap(after_drain);
+                }
+            }
+            for (std::coroutine_handle<> handle : batch) {
+                handle.resume();
+            }
+            batch.clear();
+        }
+        std::exception_ptr error;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            error = std::exchange(first_error, nullptr);
+        }
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+};
+
+#endif // ASYNC_TASK_H
@@ -0,0 +1,159 @@
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <stdexcept>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "database_connection.h"
+
+// Loads a CSV or TSV file of "key,value" lines into DatabaseConnection
+// with bulkLoad() and reports its throughput next to how fast the file
+// can simply be read, which is the bound the load should approach.
+// --generate first writes that many synthetic rows to the file. --compare
+// also times one insert() per row, the way callers loaded data before.
+// --snapshot checkpoints the loaded table so later connects can map it.
+// Usage: bulk_loader <file> [--generate rows] [--threads n] [--delimiter c]
+//          [--header] [--wal path] [--snapshot path] [--compare]
+
+void generate(const std::string& path, size_t rows, char delimiter) {
+    static const char* plans[] = {"free", "pro", "team", "enterprise"};
+    std::mt19937_64 rng(7);
+    std::ofstream out(path, std::ios::binary);
+    if (!out) {
+        throw std::runtime_error("Cannot create " + path);
+    }
+    std::string buffer;
+    char line[256];
+    for (size_t i = 0; i < rows; i++) {
+        int length = std::snprintf(line, sizeof(line),
+                                   "user:%012zu%c{\"name\":\"user%zu\",\"plan\":\"%s\",\"logins\":%u,\"score\":%u}\n",
+                                   i, delimiter, i, plans[rng() % 4], static_cast<unsigned>(rng() % 5000),
+                                   static_cast<unsigned>(rng() % 1000000));
+        buffer.append(line, length);
+        if (buffer.size() >= (1 << 20)) {
+            out.write(buffer.data(), buffer.size());
+            buffer.clear();
+        }
+    }
+    out.write(buffer.data(), buffer.size());
+}
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Read the whole file once and return the bandwidth in MB/s
+double readBandwidth(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Cannot open " + path);
+    }
+    std::vector<char> buffer(4 << 20);
+    size_t total = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (ssize_t n; (n = ::read(fd, buffer.data(), buffer.size())) > 0;) {
+        total += static_cast<size_t>(n);
+    }
+    double seconds = secondsSince(start);
+    ::close(fd);
+    return total / seconds / 1e6;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        std::cerr << "Usage: bulk_loader <file> [--generate rows] [--threads n] [--delimiter c] [--header] "
+                     "[--wal path] [--snapshot path] [--compare]" << std::endl;
+        return 1;
+    }
+    const std::string path = argv[1];
+    BulkLoadOptions load;
+    ConnectionOptions options;
+    options.echo_inserts = false;
+    size_t generate_rows = 0;
+    bool compare = false;
+
+    try {
+        for (int i = 2; i < argc; i++) {
+            std::string flag = argv[i];
+            auto value = [&]() -> std::string {
+                if (i + 1 >= argc) {
+                    throw std::runtime_error(flag + " needs a value");
+                }
+                return argv[++i];
+            };
+            if (flag == "--generate") {
+                generate_rows = std::stoull(value());
+            } else if (flag == "--threads") {
+                load.threads = std::stoull(value());
+            } else if (flag == "--delimiter") {
+                std::string d = value();
+                load.delimiter = d == "\\t" ? '\t' : d.at(0);
+            } else if (flag == "--header") {
+                load.header = true;
+            } else if (flag == "--wal") {
+                options.wal_path = value();
+            } else if (flag == "--snapshot") {
+                options.snapshot_path = value();
+            } else if (flag == "--compare") {
+                compare = true;
+            } else {
+                throw std::runtime_error("Unknown option " + flag);
+            }
+        }
+        if (generate_rows > 0) {
+            auto start = std::chrono::steady_clock::now();
+            generate(path, generate_rows, load.delimiter ? load.delimiter : delimiterFor(path));
+            std::cout << "Generated " << generate_rows << " rows in " << std::fixed << std::setprecision(2)
+                      << secondsSince(start) << " s" << std::endl;
+        }
+
+        std::cout << std::fixed << std::setprecision(0) << "Reading " << path << ": " << readBandwidth(path)
+                  << " MB/s" << std::endl;
+
+        DatabaseConnection& db = DatabaseConnection::getInstance();
+        db.connect("bulk://" + path, options);
+        BulkLoadStats stats = db.bulkLoad(path, load);
+        std::cout << std::setprecision(2) << "Bulk load: " << stats.rows << " rows (" << stats.malformed
+                  << " malformed) in " << stats.seconds << " s, " << std::setprecision(0)
+                  << stats.rows / stats.seconds << " rows/s, " << stats.bytes / stats.seconds / 1e6 << " MB/s"
+                  << std::endl;
+        if (!options.snapshot_path.empty()) {
+            db.checkpoint();
+        }
+        db.disconnect();
+
+        if (compare) {
+            // The same rows one insert() at a time, parsed up front so only
+            // the inserts are timed
+            MappedFile file(path);
+            std::vector<std::pair<std::string, std::string>> rows;
+            parseRows(file.bytes(), load.delimiter ? load.delimiter : delimiterFor(path),
+                      [&rows](std::string_view key, std::string_view value) { rows.emplace_back(key, value); });
+            if (load.header && !rows.empty()) {
+                rows.erase(rows.begin());
+            }
+            ConnectionOptions plain;
+            plain.echo_inserts = false;
+            db.connect("bulk://compare", plain);
+            auto start = std::chrono::steady_clock::now();
+            for (const auto& [key, value] : rows) {
+                db.insert(key, value);
+            }
+            double seconds = secondsSince(start);
+            std::cout << std::setprecision(2) << "insert() per row: " << rows.size() << " rows in " << seconds
+                      << " s, " << std::setprecision(0) << rows.size() / seconds << " rows/s" << std::endl;
+            db.disconnect();
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
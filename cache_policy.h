@@ -0,0 +1,241 @@
+#ifndef CACHE_POLICY_H
+#define CACHE_POLICY_H
+
+#include <vector>
+#include <array>
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+
+// Count-min sketch of 4-bit counters estimating how often a hash was seen
+// recently. Once the number of increments reaches ten times the width every
+// counter is halved, so old popularity fades.
+class FrequencySketch {
+private:
+    static constexpr size_t kRows = 4;
+
+    std::vector<uint8_t> counters;   // two 4-bit counters per byte, row-major
+    size_t width;                    // counters per row, a power of two
+    size_t additions;
+    size_t sample_size;
+
+    size_t counterIndex(uint64_t hash, size_t row) const {
+        static constexpr std::array<uint64_t, kRows> seeds = {
+            0x9E3779B97F4A7C15ull, 0xC2B2AE3D27D4EB4Full, 0x165667B19E3779F9ull, 0xD6E8FEB86659FD93ull};
+        uint64_t h = (hash + seeds[row]) * seeds[(row + 1) % kRows];
+        return row * width + ((h >> 32) & (width - 1));
+    }
+
+    uint8_t get(size_t i) const {
+        return (counters[i / 2] >> ((i % 2) * 4)) & 0xF;
+    }
+
+    void reset() {
+        for (uint8_t& pair : counters) {
+            pair = (pair >> 1) & 0x77;
+        }
+        additions /= 2;
+    }
+
+public:
+    explicit FrequencySketch(size_t expected_entries) {
+        width = 64;
+        while (width < expected_entries) {
+            width <<= 1;
+        }
+        counters.assign(kRows * width / 2, 0);
+        additions = 0;
+        sample_size = 10 * width;
+    }
+
+    void increment(uint64_t hash) {
+        bool added = false;
+        for (size_t row = 0; row < kRows; row++) {
+            size_t i = counterIndex(hash, row);
+            if (get(i) < 15) {
+                counters[i / 2] += static_cast<uint8_t>(1u << ((i % 2) * 4));
+                added = true;
+            }
+        }
+        if (added && ++additions >= sample_size) {
+            reset();
+        }
+    }
+
+    uint8_t estimate(uint64_t hash) const {
+        uint8_t lowest = 15;
+        for (size_t row = 0; row < kRows; row++) {
+            lowest = std::min(lowest, get(counterIndex(hash, row)));
+        }
+        return lowest;
+    }
+};
+
+// Window TinyLFU eviction under a byte budget. New entries enter a small LRU
+// window (1% of the budget). Entries pushed out of the window become
+// candidates for the main area, a segmented LRU with probation and protected
+// parts. When the budget is exceeded, a candidate is admitted only if the
+// sketch says it is accessed more often than the probation victim it would
+// replace, which keeps one-off scans from flushing the hot set.
+// Each node refers to a table entry by a stable index chosen by the owner.
+class TinyLfuPolicy {
+public:
+    static constexpr uint32_t kNil = UINT32_MAX;
+
+private:
+    enum Queue : uint8_t { kWindow, kProbation, kProtected, kQueueCount };
+
+    struct Node {
+        uint32_t prev;
+        uint32_t next;
+        uint32_t entry;
+        uint32_t bytes;
+        uint64_t hash;
+        Queue queue;
+    };
+
+    struct List {
+        uint32_t head = kNil;   // most recently used
+        uint32_t tail = kNil;   // least recently used
+        size_t bytes = 0;
+    };
+
+    std::vector<Node> nodes;
+    std::vector<uint32_t> free_nodes;
+    std::array<List, kQueueCount> lists;
+    std::vector<uint32_t> candidates;
+    FrequencySketch sketch;
+    size_t budget;
+    size_t window_budget;
+    size_t protected_budget;
+
+    void unlink(uint32_t n) {
+        Node& node = nodes[n];
+        List& list = lists[node.queue];
+        (node.prev == kNil ? list.head : nodes[node.prev].next) = node.next;
+        (node.next == kNil ? list.tail : nodes[node.next].prev) = node.prev;
+        list.bytes -= node.bytes;
+    }
+
+    void pushFront(uint32_t n, Queue queue) {
+        Node& node = nodes[n];
+        List& list = lists[queue];
+        node.queue = queue;
+        node.prev = kNil;
+        node.next = list.head;
+        (list.head == kNil ? list.tail : nodes[list.head].prev) = n;
+        list.head = n;
+        list.bytes += node.bytes;
+    }
+
+    void moveTo(uint32_t n, Queue queue) {
+        unlink(n);
+        pushFront(n, queue);
+    }
+
+    size_t totalBytes() const {
+        return lists[kWindow].bytes + lists[kProbation].bytes + lists[kProtected].bytes;
+    }
+
+    void release(uint32_t n, std::vector<uint32_t>& evicted) {
+        unlink(n);
+        candidates.erase(std::remove(candidates.begin(), candidates.end(), n), candidates.end());
+        evicted.push_back(nodes[n].entry);
+        free_nodes.push_back(n);
+    }
+
+public:
+    TinyLfuPolicy(size_t budget_bytes, size_t expected_entries)
+        : sketch(expected_entries), budget(budget_bytes),
+          window_budget(std::max<size_t>(1, budget_bytes / 100)),
+          protected_budget((budget_bytes - budget_bytes / 100) * 8 / 10) {}
+
+    size_t residentBytes() const { return totalBytes(); }
+
+    // Note a lookup of a key that is not resident, so its frequency counts
+    // when it is inserted later
+    void recordMiss(uint64_t hash) {
+        sketch.increment(hash);
+    }
+
+    void recordHit(uint32_t n) {
+        sketch.increment(nodes[n].hash);
+        Node& node = nodes[n];
+        if (node.queue == kProbation) {
+            moveTo(n, kProtected);
+            // Keep the protected segment within its share
+            while (lists[kProtected].bytes > protected_budget && lists[kProtected].tail != n) {
+                moveTo(lists[kProtected].tail, kProbation);
+            }
+        } else {
+            moveTo(n, node.queue);
+        }
+    }
+
+    uint32_t add(uint32_t entry, uint64_t hash, size_t bytes) {
+        sketch.increment(hash);
+        uint32_t n;
+        if (!free_nodes.empty()) {
+            n = free_nodes.back();
+            free_nodes.pop_back();
+        } else {
+            n = static_cast<uint32_t>(nodes.size());
+            nodes.emplace_back();
+        }
+        nodes[n].entry = entry;
+        nodes[n].hash = hash;
+        nodes[n].bytes = static_cast<uint32_t>(bytes);
+        pushFront(n, kWindow);
+        return n;
+    }
+
+    // An overwrite changes the size and counts as an access
+    void resize(uint32_t n, size_t bytes) {
+        unlink(n);
+        nodes[n].bytes = static_cast<uint32_t>(bytes);
+        pushFront(n, nodes[n].queue);
+        recordHit(n);
+    }
+
+    // The owner removed the entry for its own reasons
+    void remove(uint32_t n) {
+        unlink(n);
+        free_nodes.push_back(n);
+        candidates.erase(std::remove(candidates.begin(), candidates.end(), n), candidates.end());
+    }
+
+    // Bring the footprint back within budget. Appends the entry indices the
+    // owner must drop; the nodes are already gone.
+    void evict(std::vector<uint32_t>& evicted) {
+        while (lists[kWindow].bytes > window_budget && lists[kWindow].tail != kNil) {
+            uint32_t n = lists[kWindow].tail;
+            moveTo(n, kProbation);
+            candidates.push_back(n);
+        }
+        while (totalBytes() > budget) {
+            uint32_t victim = lists[kProbation].tail;
+            if (!candidates.empty() && victim != kNil && victim != candidates.back()) {
+                uint32_t candidate = candidates.back();
+                if (sketch.estimate(nodes[candidate].hash) > sketch.estimate(nodes[victim].hash)) {
+                    release(victim, evicted);
+                } else {
+                    release(candidate, evicted);
+                }
+                continue;
+            }
+            for (Queue queue : {kProbation, kProtected, kWindow}) {
+                if (lists[queue].tail != kNil) {
+                    victim = lists[queue].tail;
+                    break;
+                }
+            }
+            if (victim == kNil) {
+                break;
+            }
+            release(victim, evicted);
+        }
+        candidates.clear();
+    }
+};
+
+#endif // CACHE_POLICY_H
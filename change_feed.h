@@ -0,0 +1,224 @@
+#ifndef CHANGE_FEED_H
+#define CHANGE_FEED_H
+
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <algorithm>
+#include <stdexcept>
+#include <exception>
+#include <cstdint>
+#include <cstddef>
+
+enum class ChangeType : uint8_t {
+    kInsert,   // the key is new
+    kUpdate,   // the key had a value, which this one replaces
+    kRemove,   // the key expired or was evicted; value is empty
+};
+
+struct Change {
+    ChangeType type;
+    std::string key;
+    std::string value;
+};
+
+// What one callback receives: the changes since the previous batch, in
+// order, and how many were dropped before them because the watcher fell
+// too far behind
+struct WatchBatch {
+    std::vector<Change> changes;
+    uint64_t dropped = 0;
+};
+
+// Delivers changes to the watchers whose prefix matches their key. Each
+// watcher has its own queue and its own thread that drains the queue into
+// its callback, one batch per wakeup, so a slow callback only delays its
+// own watcher. publish() never waits for a callback: it appends to the
+// matching queues and returns, and a queue already holding max_pending
+// changes drops the new ones and counts them instead.
+//
+// Changes to one key reach a watcher in the order they were published;
+// the owner keeps that the order they were applied in, without holding
+// the key's lock while it publishes (see DatabaseConnection::deliverChanges).
+class ChangeFeed {
+private:
+    struct Watcher {
+        uint64_t id;
+        std::string prefix;
+        std::function<void(const WatchBatch&)> callback;
+        size_t max_pending;
+        std::mutex mutex;
+        std::condition_variable wake;
+        std::vector<Change> pending;
+        uint64_t dropped = 0;
+        bool stop = false;
+        std::thread thread;
+    };
+
+    using WatcherList = std::vector<std::shared_ptr<Watcher>>;
+
+    // Replaced whole on every subscribe or unsubscribe, so publish() only
+    // holds list_mutex long enough to copy the pointer (as in HotReplicas,
+    // rather than an atomic shared_ptr ThreadSanitizer cannot follow);
+    // changes is the mutex writers of it take
+    mutable std::mutex list_mutex;
+    std::shared_ptr<const WatcherList> watchers = std::make_shared<const WatcherList>();
+    std::atomic<size_t> watcher_count{0};
+    std::mutex changes;
+    uint64_t next_id = 1;
+
+    std::shared_ptr<const WatcherList> loadWatchers() const {
+        std::lock_guard<std::mutex> lock(list_mutex);
+        return watchers;
+    }
+
+    std::shared_ptr<const WatcherList> exchangeWatchers(std::shared_ptr<const WatcherList> next) {
+        std::lock_guard<std::mutex> lock(list_mutex);
+        watchers.swap(next);
+        return next;
+    }
+
+    static void dispatch(Watcher& watcher) {
+        WatchBatch batch;
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(watcher.mutex);
+                watcher.wake.wait(lock, [&watcher] {
+                    return watcher.stop || !watcher.pending.empty() || watcher.dropped != 0;
+                });
+                if (watcher.pending.empty() && watcher.dropped == 0) {
+                    return;
+                }
+                batch.changes.clear();
+                batch.changes.swap(watcher.pending);
+                batch.dropped = watcher.dropped;
+                watcher.dropped = 0;
+            }
+            try {
+                watcher.callback(batch);
+            } catch (const std::exception& e) {
+                std::cerr << "Watcher " << watcher.id << " callback failed: " << e.what() << std::endl;
+            }
+        }
+    }
+
+    static void stopWatcher(Watcher& watcher) {
+        {
+            std::lock_guard<std::mutex> lock(watcher.mutex);
+            watcher.stop = true;
+        }
+        watcher.wake.notify_one();
+        watcher.thread.join();
+    }
+
+public:
+    ChangeFeed() = default;
+    ChangeFeed(const ChangeFeed&) = delete;
+    ChangeFeed& operator=(const ChangeFeed&) = delete;
+
+    ~ChangeFeed() { clear(); }
+
+    // Start delivering changes to keys beginning with prefix ("" for all)
+    // to callback. Returns the id to unsubscribe with.
+    uint64_t subscribe(std::string prefix, std::function<void(const WatchBatch&)> callback, size_t max_pending) {
+        if (!callback || max_pending == 0) {
+            throw std::runtime_error("A watcher needs a callback and room for at least one change!");
+        }
+        auto watcher = std::make_shared<Watcher>();
+        watcher->prefix = std::move(prefix);
+        watcher->callback = std::move(callback);
+        watcher->max_pending = max_pending;
+        std::lock_guard<std::mutex> lock(changes);
+        watcher->id = next_id++;
+        watcher->thread = std::thread([raw = watcher.get()] { dispatch(*raw); });
+        auto list = std::make_shared<WatcherList>(*loadWatchers());
+        list->push_back(watcher);
+        exchangeWatchers(std::move(list));
+        watcher_count++;
+        return watcher->id;
+    }
+
+    // Stop a watcher once the changes already queued for it are delivered.
+    // Returns false if there is no such watcher. Must not be called from
+    // that watcher's own callback.
+    bool unsubscribe(uint64_t id) {
+        std::shared_ptr<Watcher> found;
+        {
+            std::lock_guard<std::mutex> lock(changes);
+            auto list = std::make_shared<WatcherList>(*loadWatchers());
+            auto it = std::find_if(list->begin(), list->end(), [id](const auto& w) { return w->id == id; });
+            if (it == list->end()) {
+                return false;
+            }
+            if ((*it)->thread.get_id() == std::this_thread::get_id()) {
+                throw std::runtime_error("A watcher cannot unsubscribe itself from its callback!");
+            }
+            found = *it;
+            list->erase(it);
+            exchangeWatchers(std::move(list));
+            watcher_count--;
+        }
+        stopWatcher(*found);
+        return true;
+    }
+
+    // Stop every watcher, delivering what is queued first
+    void clear() {
+        std::shared_ptr<const WatcherList> list;
+        {
+            std::lock_guard<std::mutex> lock(changes);
+            list = exchangeWatchers(std::make_shared<const WatcherList>());
+            watcher_count = 0;
+        }
+        for (const auto& watcher : *list) {
+            stopWatcher(*watcher);
+        }
+    }
+
+    // Cheap enough to check on every write
+    bool empty() const { return watcher_count.load(std::memory_order_relaxed) == 0; }
+
+    // Queue changes, in order, for every watcher whose prefix they match,
+    // taking each watcher's lock once for all of them
+    void publish(const std::vector<Change>& batch) {
+        if (empty() || batch.empty()) {
+            return;
+        }
+        std::shared_ptr<const WatcherList> list = loadWatchers();
+        for (const auto& watcher : *list) {
+            bool first;
+            bool queued = false;
+            {
+                std::lock_guard<std::mutex> lock(watcher->mutex);
+                if (watcher->stop) {
+                    continue;
+                }
+                first = watcher->pending.empty();
+                for (const Change& change : batch) {
+                    if (!change.key.starts_with(watcher->prefix)) {
+                        continue;
+                    }
+                    if (watcher->pending.size() >= watcher->max_pending) {
+                        watcher->dropped++;
+                    } else {
+                        watcher->pending.push_back(change);
+                    }
+                    queued = true;
+                }
+            }
+            // A watcher with changes already queued has been woken for them
+            if (first && queued) {
+                watcher->wake.notify_one();
+            }
+        }
+    }
+};
+
+#endif // CHANGE_FEED_H
@@ -0,0 +1,164 @@
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdio>
+#include <cstdlib>
+
+#include "database_connection.h"
+
+// Measures dictionary-trained value compression on JSON-like user records,
+// the shape of data it is meant for. Part one runs the codec on its own:
+// bytes saved with and without a trained dictionary, and encode and decode
+// throughput. Part two loads the same records into DatabaseConnection with
+// and without compress_values and compares the value footprint, the whole
+// footprint per entry, and the cost of reading every record back.
+// Usage: compression_benchmark [records]
+
+std::string makeKey(size_t i) {
+    char key[32];
+    std::snprintf(key, sizeof(key), "user:%012zu", i);
+    return key;
+}
+
+std::string makeRecord(size_t i, std::mt19937_64& rng) {
+    static const char* cities[] = {"Berlin", "Lisbon", "Toronto", "Osaka", "Nairobi", "Austin", "Oslo", "Lima"};
+    static const char* plans[] = {"free", "pro", "team", "enterprise"};
+    char record[320];
+    std::snprintf(record, sizeof(record),
+                  "{\"id\":%zu,\"name\":\"user%zu\",\"email\":\"user%zu@example.com\",\"city\":\"%s\","
+                  "\"plan\":\"%s\",\"active\":%s,\"logins\":%u,\"created\":\"2024-%02u-%02uT%02u:%02u:00Z\"}",
+                  i, i, i, cities[rng() % 8], plans[rng() % 4], rng() % 5 ? "true" : "false",
+                  static_cast<unsigned>(rng() % 5000), static_cast<unsigned>(1 + rng() % 12),
+                  static_cast<unsigned>(1 + rng() % 28), static_cast<unsigned>(rng() % 24),
+                  static_cast<unsigned>(rng() % 60));
+    return record;
+}
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void codecRun(const std::string& label, const std::vector<std::string>& values, const ValueDictionary* dict) {
+    size_t raw = 0;
+    size_t stored = 0;
+    std::vector<std::string> encoded(values.size());
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < values.size(); i++) {
+        lzCompress(values[i], dict, encoded[i]);
+        raw += values[i].size();
+        stored += encoded[i].size();
+    }
+    double encode_seconds = secondsSince(start);
+    std::string decoded;
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < values.size(); i++) {
+        lzDecompress(encoded[i], dict, decoded);
+        if (decoded != values[i]) {
+            throw std::runtime_error("Round trip mismatch for record " + std::to_string(i));
+        }
+    }
+    double decode_seconds = secondsSince(start);
+    std::cout << std::fixed << std::setprecision(2) << std::left << std::setw(18) << label << std::right
+              << " ratio " << std::setw(5) << static_cast<double>(raw) / stored << "x, encode "
+              << std::setprecision(0) << std::setw(5) << raw / encode_seconds / 1e6 << " MB/s, decode "
+              << std::setw(5) << raw / decode_seconds / 1e6 << " MB/s\n";
+}
+
+struct StoreResult {
+    ShardTable::StorageStats storage;
+    double load_seconds;
+    double read_seconds;
+};
+
+StoreResult storeRun(const std::vector<std::pair<std::string, std::string>>& records, bool compress) {
+    DatabaseConnection& db = DatabaseConnection::getInstance();
+    ConnectionOptions options;
+    options.echo_inserts = false;
+    options.compress_values = compress;
+    db.connect("bench://compression", options);
+    StoreResult result;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < records.size(); i += 10000) {
+        db.insertBatch(std::span(records).subspan(i, std::min<size_t>(10000, records.size() - i)));
+    }
+    if (compress) {
+        db.trainCompression();
+    }
+    result.load_seconds = secondsSince(start);
+    size_t bytes = 0;
+    start = std::chrono::steady_clock::now();
+    for (const auto& [key, value] : records) {
+        bytes += db.lookup(key).value().size();
+    }
+    result.read_seconds = secondsSince(start);
+    if (bytes == 0) {
+        throw std::runtime_error("Nothing read back");
+    }
+    result.storage = db.storageStats();
+    db.disconnect();
+    return result;
+}
+
+int main(int argc, char* argv[]) {
+    char* end = nullptr;
+    const size_t record_count = argc > 1 ? std::strtoull(argv[1], &end, 10) : 1000000;
+    if (argc > 2 || record_count == 0 || (end && *end != '\0')) {
+        std::cerr << "Usage: compression_benchmark [records]" << std::endl;
+        return 1;
+    }
+
+    try {
+        std::mt19937_64 rng(42);
+        std::vector<std::pair<std::string, std::string>> records;
+        records.reserve(record_count);
+        for (size_t i = 0; i < record_count; i++) {
+            records.emplace_back(makeKey(i), makeRecord(i, rng));
+        }
+
+        std::vector<std::string> values;
+        for (size_t i = 0; i < std::min<size_t>(record_count, 200000); i++) {
+            values.push_back(records[i].second);
+        }
+        std::vector<std::string> sample;
+        for (size_t i = 0; i < values.size(); i += std::max<size_t>(1, values.size() / 2048)) {
+            sample.push_back(values[i]);
+        }
+        auto start = std::chrono::steady_clock::now();
+        ValueDictionary dictionary = ValueDictionary::train(sample, 16 << 10);
+        std::cout << "Trained a " << dictionary.size() << "-byte dictionary on " << sample.size() << " records in "
+                  << std::fixed << std::setprecision(1) << secondsSince(start) * 1000 << " ms\n";
+        codecRun("no dictionary", values, nullptr);
+        codecRun("with dictionary", values, &dictionary);
+
+        StoreResult plain = storeRun(records, false);
+        StoreResult packed = storeRun(records, true);
+        auto report = [record_count](const std::string& label, const StoreResult& r) {
+            const auto& s = r.storage;
+            size_t live_arena = s.arena_bytes - s.garbage_bytes;
+            std::cout << std::left << std::setw(12) << label << std::right << std::fixed << std::setprecision(1)
+                      << " values " << std::setw(6) << s.stored_value_bytes / 1e6 << " MB ("
+                      << s.compressed_values << " compressed), " << std::setw(5)
+                      << static_cast<double>(live_arena + s.table_bytes + s.dictionary_bytes) / record_count
+                      << " bytes/entry in total; load " << std::setprecision(2) << r.load_seconds
+                      << " s, read back " << std::setprecision(0) << record_count / r.read_seconds
+                      << " lookups/s\n";
+        };
+        std::cout << record_count << " records, " << std::fixed << std::setprecision(1)
+                  << static_cast<double>(plain.storage.value_bytes) / record_count << " value bytes each\n";
+        report("plain", plain);
+        report("compressed", packed);
+        std::cout << std::setprecision(2) << "Value footprint " << static_cast<double>(plain.storage.stored_value_bytes) /
+                                                 packed.storage.stored_value_bytes
+                  << "x smaller, " << packed.storage.trainings << " dictionaries trained\n";
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,2505 @@
+#ifndef DATABASE_CONNECTION_H
+#define DATABASE_CONNECTION_H
+
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <mutex>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+#include <optional>
+#include <span>
+#include <deque>
+#include <map>
+#include <set>
+#include <unordered_map>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <functional>
+#include <utility>
+#include <iterator>
+#include <thread>
+#include <condition_variable>
+#include <exception>
+#include <cstdint>
+#include <ctime>
+
+#include "shard_table.h"
+#include "write_ahead_log.h"
+#include "snapshot_file.h"
+#include "lsm_engine.h"
+#include "ordered_index.h"
+#include "cache_policy.h"
+#include "timer_wheel.h"
+#include "hot_keys.h"
+#include "delimited_file.h"
+#include "async_task.h"
+#include "replication_ring.h"
+#include "value_index.h"
+#include "change_feed.h"
+
+// Cache counters summed over all shards
+struct CacheStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    uint64_t resident_bytes = 0;
+    uint64_t entries = 0;
+
+    double hitRatio() const {
+        return hits + misses == 0 ? 0.0 : static_cast<double>(hits) / (hits + misses);
+    }
+};
+
+// Transaction counters; old versions are those kept for open snapshots
+struct TransactionStats {
+    uint64_t commits = 0;
+    uint64_t conflicts = 0;
+    uint64_t retained_versions = 0;
+    uint64_t collected_versions = 0;
+};
+
+// Expiry counters. scheduled is the number of keys that still have a TTL;
+// a slice is one stretch of reaping under a single shard lock. The
+// longest slice is measured twice: by the clock, which includes any time
+// the reaper thread was descheduled while holding the lock, and by the
+// CPU time the reaper itself spent in it. slow_slices counts those whose
+// CPU time reached a millisecond, which a virtual machine's host can
+// cause by interrupting the reaper mid-slice.
+struct TtlStats {
+    uint64_t scheduled = 0;
+    uint64_t expired_on_read = 0;
+    uint64_t expired_by_reaper = 0;
+    uint64_t reaper_slices = 0;
+    uint64_t longest_slice_us = 0;
+    uint64_t longest_slice_cpu_us = 0;
+    uint64_t slow_slices = 0;
+};
+
+// Hot-key counters. replicated is the number of keys the per-CPU replicas
+// currently serve; an invalidation is a replicated key dropped by a write.
+struct HotKeyStats {
+    uint64_t sampled_reads = 0;
+    uint64_t replicated = 0;
+    uint64_t replica_hits = 0;
+    uint64_t promotions = 0;
+    uint64_t invalidations = 0;
+};
+
+// One of the keys reported by DatabaseConnection::hotKeys; heat is its
+// decayed count of sampled reads
+struct HotKey {
+    std::string key;
+    uint64_t heat;
+    bool replicated;
+};
+
+// Settings for DatabaseConnection::bulkLoad
+struct BulkLoadOptions {
+    // Field separator; 0 picks a tab for .tsv files and a comma otherwise
+    char delimiter = 0;
+    // Skip the first line
+    bool header = false;
+    // Threads that parse and build; 0 means one per hardware thread
+    size_t threads = 0;
+};
+
+// What a bulk load read. malformed counts the non-empty lines without a
+// delimiter, which were skipped.
+struct BulkLoadStats {
+    uint64_t rows = 0;
+    uint64_t malformed = 0;
+    uint64_t bytes = 0;
+    double seconds = 0;
+};
+
+// Replication counters, from whichever side this process is
+struct ReplicationStats {
+    bool leader = false;
+    bool follower = false;
+    uint64_t shipped = 0;        // records written to the ring
+    uint64_t applied = 0;        // records applied from it
+    uint64_t full_syncs = 0;     // full copies sent or received
+    uint64_t overruns = 0;       // times the follower was dropped as dead
+    uint64_t in_flight_bytes = 0;
+    // Follower: how far behind the leader its data may be; UINT64_MAX
+    // until the first full copy has arrived
+    uint64_t staleness_ms = 0;
+    bool peer_alive = false;
+};
+
+// Outcome of DatabaseConnection::lookup
+enum class LookupStatus {
+    kFound,
+    kNotFound,
+    kNotConnected,
+    kStale,   // a follower further behind its leader than max_staleness
+};
+
+// Result of DatabaseConnection::lookup. A found value is a view of the
+// table's own bytes, kept in place by holding the lock of the key's shard
+// until the result is destroyed. Keep it short-lived and do not call back
+// into the database while holding one: other operations on that shard,
+// including from this thread, wait for it. A Session on the same thread
+// knows, and keeps buffering puts rather than flushing into a shard that
+// may be held (see Session::put). The LSM engine cannot lend its
+// bytes and compressed values must be decoded first, so for those the
+// result owns a copy and holds no lock. A hot key served from a read
+// replica is a view of the replica, which the result keeps alive.
+class LookupResult {
+private:
+    friend class DatabaseConnection;
+
+    LookupStatus state;
+    std::unique_lock<std::mutex> guard;
+    std::shared_ptr<const void> pin;
+    std::string_view borrowed;
+    std::string owned;
+    bool owning = false;
+
+    // Results on this thread holding a shard lock
+    static inline thread_local size_t locks_held_here = 0;
+
+    explicit LookupResult(LookupStatus status) : state(status) {}
+
+    LookupResult(std::unique_lock<std::mutex> lock, std::string_view value)
+        : state(LookupStatus::kFound), guard(std::move(lock)), borrowed(value) {
+        locks_held_here++;
+    }
+
+    LookupResult(std::shared_ptr<const void> keep, std::string_view value)
+        : state(LookupStatus::kFound), pin(std::move(keep)), borrowed(value) {}
+
+    explicit LookupResult(std::string value)
+        : state(LookupStatus::kFound), owned(std::move(value)), owning(true) {}
+
+public:
+    LookupResult(LookupResult&&) = default;
+
+    LookupResult& operator=(LookupResult&& other) {
+        if (guard.owns_lock()) {
+            locks_held_here--;
+        }
+        state = other.state;
+        guard = std::move(other.guard);
+        pin = std::move(other.pin);
+        borrowed = other.borrowed;
+        owned = std::move(other.owned);
+        owning = other.owning;
+        return *this;
+    }
+
+    ~LookupResult() {
+        if (guard.owns_lock()) {
+            locks_held_here--;
+        }
+    }
+
+    // Whether a result alive on the calling thread holds a shard lock
+    static bool lockHeldHere() { return locks_held_here > 0; }
+
+    LookupStatus status() const { return state; }
+    bool found() const { return state == LookupStatus::kFound; }
+    explicit operator bool() const { return found(); }
+
+    // Empty unless found()
+    std::string_view value() const { return owning ? std::string_view(owned) : borrowed; }
+    std::string_view operator*() const { return value(); }
+};
+
+// Settings chosen when connecting
+struct ConnectionOptions {
+    // Log every insert here and replay it on connect; empty keeps the
+    // database purely in memory
+    std::string wal_path;
+    // Serve reads from this memory-mapped checkpoint, with writes going to
+    // an in-memory overlay; checkpoint() rewrites it. Empty disables it.
+    std::string snapshot_path;
+    // Keep the data in an LSM tree under this directory instead of in
+    // memory, for datasets larger than RAM. The engine has its own log, so
+    // wal_path and snapshot_path must stay empty.
+    std::string lsm_directory;
+    LsmOptions lsm;
+    // Keep an ordered index of the keys to serve scan() and range(). Not
+    // available with the LSM engine; with a snapshot it is built on connect.
+    bool ordered_index = false;
+    // Keep an index from each value to the keys holding it, to serve
+    // keysWithValue(). Not available with the LSM engine or a snapshot,
+    // whose keys live outside the in-memory table.
+    bool value_index = false;
+    // Run as a cache: keep the table under this many bytes (keys, values and
+    // per-entry overhead) with W-TinyLFU eviction. 0 means unbounded. Not
+    // combinable with wal_path, snapshot_path or lsm_directory, since an
+    // evicted key must not come back from disk.
+    size_t memory_budget = 0;
+    // Receives entries the budget pushed out, e.g. to write them to a
+    // slower tier. Called on the inserting thread after the shard lock is
+    // released.
+    std::function<void(const std::string& key, const std::string& value)> on_evict;
+    // Store each distinct short value once per shard, for data where the
+    // same status strings or names repeat across many keys
+    bool intern_values = false;
+    // Store values compressed against a dictionary that a background pass
+    // trains on each shard's own values, for data whose values share most
+    // of their bytes, such as JSON records of one shape. Reads decompress.
+    // Not available with the LSM engine.
+    bool compress_values = false;
+    // Find the keys read most often from a sample of lookups and serve up
+    // to this many of them from per-CPU read replicas, for skewed traffic
+    // that would otherwise queue on a few shard locks. Writes invalidate a
+    // replicated key before they return. 0 disables it. Not available with
+    // the LSM engine or a memory budget, whose eviction would not see the
+    // reads the replicas serve.
+    size_t hot_keys = 0;
+    // Keep overwritten values while an open transaction may still read them,
+    // enabling begin(). Not combinable with lsm_directory, snapshot_path or
+    // memory_budget, which replace or drop values behind the versions' back.
+    bool transactions = false;
+    // Ship every write through a shared-memory ring of this name (see
+    // replication_ring.h, names look like "/name") to a follower process
+    // that connects with follow set to the same name. Writes wait while
+    // the ring is full, unless the follower has died. Not available with
+    // the LSM engine, a snapshot or a memory budget.
+    std::string replicate_to;
+    size_t replication_ring_bytes = 16 << 20;
+    // Connect as a read-only follower of the leader shipping to this ring.
+    // The follower gets a full copy first, then applies the leader's
+    // writes as they arrive; promote() makes it writable once the leader
+    // has died. With wal_path set it logs what it applies, so a promoted
+    // follower keeps the data across restarts.
+    std::string follow;
+    // On a follower, serve reads only from data that includes every write
+    // the leader had made this long ago, waiting up to that long for the
+    // follower to catch up; reads that still cannot are refused as stale.
+    // 0 accepts any staleness.
+    std::chrono::milliseconds max_staleness{0};
+    // Print a line for every insert
+    bool echo_inserts = true;
+};
+
+class DatabaseConnection {
+private:
+    static constexpr size_t kShardCount = 16;
+    // Lookups in a batch are processed in groups of this size: all slots of a
+    // group are prefetched, then all entries, then the keys are compared, so
+    // the cache misses of one group overlap instead of queueing up.
+    static constexpr size_t kPrefetchGroup = 16;
+
+    // Rough bookkeeping cost of one entry beyond its key and value bytes:
+    // the entry itself, its slots at 3/4 load and its policy node
+    static constexpr size_t kEntryOverhead = sizeof(ShardTable::Entry) + 16 + 32;
+
+    // Read timestamp meaning "the latest value", outside any transaction
+    static constexpr uint64_t kLatest = UINT64_MAX;
+
+    // The reaper wakes this often and holds a shard lock for about
+    // kReapSliceTime at a time, checking the clock every kReapStep units of
+    // wheel work (a key expired or a tick walked), so a backlog of expired
+    // keys is worked off in short slices between other operations however
+    // costly each removal turns out to be
+    static constexpr std::chrono::milliseconds kReapInterval{10};
+    static constexpr std::chrono::microseconds kReapSliceTime{100};
+    static constexpr size_t kReapStep = 8;
+
+    // Writes move a shard's entries to its grown slot array a few at a
+    // time; the compactor finishes what they leave, this many slots per
+    // shard lock it takes
+    static constexpr size_t kRehashSlice = 4096;
+
+    // Each shard's compression dictionary is trained on this many of its
+    // values and holds at most this many bytes
+    static constexpr size_t kTrainSample = 2048;
+    static constexpr size_t kDictionaryBytes = 16 << 10;
+
+    // One lookup in this many feeds the hot-key detector. A key needs this
+    // much heat, which halves every compactor pass, to be replicated.
+    static constexpr uint32_t kHeatSample = 16;
+    static constexpr uint32_t kMinHeat = 16;
+
+    // Bulk loads cut the file into chunks of about this size and parse a
+    // window of kLoadWindow chunks per thread before building the shards
+    // from it, so the parsed rows held at once stay a bounded amount
+    static constexpr size_t kLoadChunk = 4 << 20;
+    static constexpr size_t kLoadWindow = 4;
+
+    // Lets the string-keyed maps be searched with a string_view
+    struct KeyHash {
+        using is_transparent = void;
+        size_t operator()(std::string_view key) const { return std::hash<std::string_view>{}(key); }
+    };
+
+    // A value replaced at commit timestamp superseded; nullopt if the key
+    // did not exist before
+    struct OldVersion {
+        std::optional<std::string> value;
+        uint64_t superseded;
+    };
+
+    struct alignas(64) Shard {
+        std::mutex mutex;
+        ShardTable table;
+        std::unique_ptr<TinyLfuPolicy> cache;
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t evictions = 0;
+        // Per key, the values overwritten while a snapshot was open, oldest
+        // first. A snapshot at time t reads the first one superseded after t,
+        // or the table if there is none.
+        std::unordered_map<std::string, std::vector<OldVersion>, KeyHash, std::equal_to<>> versions;
+        uint64_t version_count = 0;
+        uint64_t collected_versions = 0;
+        // Deadlines of the keys inserted with a TTL, by entry index, in
+        // milliseconds of the steady clock
+        TimerWheel expiry;
+        uint64_t expired_on_read = 0;
+        uint64_t expired_by_reaper = 0;
+        // Sampled reads, and the hashes of the keys that may be replicated
+        // and so must be invalidated when written
+        std::unique_ptr<HeavyHitters> heat;
+        uint64_t sampled_reads = 0;
+        std::vector<uint64_t> hot;
+        // Entries by the hash of their value, if value_index is set
+        std::unique_ptr<ValueIndex> by_value;
+        // Changes queued for the watchers under the lock, in the order they
+        // were applied, and published once it is released. Publishing takes
+        // publish_mutex first, then this lock only to take the queue.
+        std::vector<Change> outbox;
+        std::atomic<bool> outbox_ready{false};
+        std::mutex publish_mutex;
+        // Held while a dictionary is trained for the shard, so the compactor
+        // and trainCompression() never both train one
+        std::mutex training_mutex;
+    };
+
+    using KeyValue = std::pair<std::string, std::string>;
+
+    // A row parsed by a bulk load; the views point into the mapped file
+    struct LoadRow {
+        std::string_view key;
+        std::string_view value;
+        uint64_t hash;
+    };
+    using LoadChunk = std::array<std::vector<LoadRow>, kShardCount>;
+
+    // Serializes connect() and disconnect(); never taken by reads or writes
+    static inline std::mutex mutex_;
+    std::array<Shard, kShardCount> shards;
+    std::atomic<bool> connected;
+    ConnectionOptions options;
+    std::unique_ptr<WriteAheadLog> wal;
+    std::unique_ptr<SnapshotFile> snapshot;
+    std::unique_ptr<LsmEngine> lsm;
+    std::unique_ptr<OrderedIndex> ordered;
+    // Background thread that compacts shard arenas once they are mostly garbage
+    std::thread compactor;
+    std::mutex compactor_mutex;
+    std::condition_variable compactor_wake;
+    bool compactor_stop = false;
+    // Background thread that removes expired keys
+    std::thread reaper;
+    std::mutex reaper_mutex;
+    std::condition_variable reaper_wake;
+    bool reaper_stop = false;
+    std::atomic<uint64_t> reaper_slices{0};
+    std::atomic<uint64_t> longest_slice_us{0};
+    std::atomic<uint64_t> longest_slice_cpu_us{0};
+    std::atomic<uint64_t> slow_slices{0};
+    // Commit timestamps. next_ts is drawn while holding the shard locks of
+    // the write, so timestamps order the writes to any one key. visible_ts
+    // trails it and advances strictly in order once each write is applied,
+    // so a snapshot never sees part of a commit.
+    std::atomic<uint64_t> next_ts{0};
+    std::atomic<uint64_t> visible_ts{0};
+    // Writers keep old versions only while this is nonzero; begin() raises
+    // it before choosing its read timestamp
+    std::atomic<size_t> open_snapshots{0};
+    std::mutex snapshots_mutex;
+    std::multiset<uint64_t> snapshot_times;
+    std::atomic<uint64_t> commits{0};
+    std::atomic<uint64_t> conflicts{0};
+    // Read replicas of the hot keys, refreshed by the compactor thread, and
+    // the ranking it last computed
+    std::unique_ptr<HotReplicas> replicas;
+    std::mutex hot_mutex;
+    std::vector<HotKey> hot_ranking;
+    // Replication. A leader ships writes only once a follower has asked
+    // for a full copy, and stops if the follower dies. A follower applies
+    // the ring from the applier thread; applied_through is the steady-clock
+    // millisecond by which everything the leader had written is applied.
+    std::unique_ptr<ReplicationRing> ring;
+    std::mutex ring_mutex;   // serializes pushes on the leader
+    std::atomic<bool> shipping{false};
+    std::atomic<bool> following{false};
+    std::thread applier;
+    std::atomic<bool> applier_stop{false};
+    std::atomic<bool> synced{false};
+    std::atomic<uint64_t> applied_through{0};
+    std::mutex applied_mutex;
+    std::condition_variable applied_wake;
+    std::atomic<uint64_t> shipped_records{0};
+    std::atomic<uint64_t> applied_records{0};
+    std::atomic<uint64_t> full_syncs{0};
+    std::atomic<uint64_t> replication_overruns{0};
+    // Subscribers of watch(); every change to the table is queued under its
+    // shard lock and published here by deliverChanges() once it is released
+    ChangeFeed feed;
+
+    // Private constructor
+    DatabaseConnection() : connected(false) {}
+
+    // Delete copy constructor and assignment operator
+    DatabaseConnection(const DatabaseConnection&) = delete;
+    DatabaseConnection& operator=(const DatabaseConnection&) = delete;
+
+    static uint64_t hashKey(std::string_view key) {
+        return std::hash<std::string_view>{}(key);
+    }
+
+    // The top bits pick the shard, the low bits pick the slot inside it
+    static size_t shardOf(uint64_t hash) {
+        return (hash >> 58) % kShardCount;
+    }
+
+    // Expiry deadlines are in milliseconds of the steady clock, which
+    // cannot jump; the log records them in wall-clock time instead
+    static uint64_t nowTick() {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    static uint64_t wallMillis() {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+                   std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    // Invalidate key's read replicas, if it may have any; every write or
+    // removal calls this before releasing the shard lock
+    void coolLocked(Shard& shard, std::string_view key, uint64_t hash) {
+        if (!shard.hot.empty() && std::find(shard.hot.begin(), shard.hot.end(), hash) != shard.hot.end()) {
+            replicas->invalidate(key, hash);
+        }
+    }
+
+    // Queue a change for the watchers, if there are any; deliverChanges()
+    // publishes it once the shard lock is released
+    void notifyLocked(Shard& shard, ChangeType type, std::string_view key, std::string_view value) {
+        if (feed.empty()) {
+            return;
+        }
+        shard.outbox.push_back(Change{type, std::string(key), std::string(value)});
+        shard.outbox_ready.store(true, std::memory_order_relaxed);
+    }
+
+    // Publish what notifyLocked() queued on shard. Called without the shard
+    // lock by whoever last wrote to the shard, so copying changes into the
+    // watchers' queues and waking them never holds up the shard's readers
+    // and writers. Deliveries for one shard take turns, each taking the
+    // whole queue, so changes reach the watchers in the order they were
+    // applied. The reaper also calls it for every shard on each pass, for
+    // removals made by reads that did not deliver them themselves.
+    void deliverChanges(Shard& shard) {
+        if (!shard.outbox_ready.load(std::memory_order_relaxed)) {
+            return;
+        }
+        std::lock_guard<std::mutex> publishing(shard.publish_mutex);
+        std::vector<Change> changes;
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            changes.swap(shard.outbox);
+            shard.outbox_ready.store(false, std::memory_order_relaxed);
+        }
+        feed.publish(changes);
+    }
+
+    // Drop an entry from a locked shard along with its timer, its key in
+    // the ordered and value indexes, its cache node and its read replicas,
+    // and queue the removal for the watchers
+    void removeLocked(Shard& shard, uint32_t index) {
+        const ShardTable::Entry& entry = shard.table.at(index);
+        coolLocked(shard, shard.table.keyOf(entry), entry.hash);
+        shard.expiry.cancel(index);
+        if (ordered) {
+            ordered->erase(shard.table.keyOf(entry));
+        }
+        if (shard.by_value) {
+            shard.by_value->remove(index);
+        }
+        notifyLocked(shard, ChangeType::kRemove, shard.table.keyOf(entry), {});
+        if (shard.cache && entry.node != ShardTable::kNoNode) {
+            shard.cache->remove(entry.node);
+        }
+        shard.table.eraseEntry(index);
+    }
+
+    // Overlay first, then the snapshot underneath it. The caller holds the
+    // shard lock, which also keeps checkpoint() from swapping the mapping.
+    // A key past its TTL is removed here rather than returned, so reads
+    // never depend on how far behind the reaper is. A compressed value is
+    // decoded into scratch, which stays empty otherwise.
+    std::optional<std::string_view> lookupLocked(Shard& shard, std::string_view key, uint64_t hash,
+                                                 std::string& scratch) {
+        ShardTable::Entry* entry = shard.table.find(key, hash);
+        if (entry && !shard.expiry.empty()) {
+            uint64_t deadline = shard.expiry.deadlineOf(entry->index);
+            if (deadline != 0 && deadline <= nowTick()) {
+                removeLocked(shard, entry->index);
+                shard.expired_on_read++;
+                entry = nullptr;
+            }
+        }
+        if (entry) {
+            if (shard.cache) {
+                shard.hits++;
+                shard.cache->recordHit(entry->node);
+            }
+            return shard.table.readValue(*entry, scratch);
+        }
+        if (shard.cache) {
+            shard.misses++;
+            shard.cache->recordMiss(hash);
+        }
+        if (snapshot) {
+            return snapshot->find(key);
+        }
+        return std::nullopt;
+    }
+
+    // Each pass takes one shard lock at a time, so a compaction stalls only
+    // the operations on that shard, for as long as copying it takes
+    void compactorLoop() {
+        std::unique_lock<std::mutex> lock(compactor_mutex);
+        while (!compactor_stop) {
+            compactor_wake.wait_for(lock, std::chrono::milliseconds(100));
+            lock.unlock();
+            uint64_t horizon = options.transactions ? versionHorizon() : 0;
+            for (Shard& shard : shards) {
+                for (bool rehashing = true; rehashing;) {
+                    std::lock_guard<std::mutex> shard_lock(shard.mutex);
+                    shard.table.advanceRehash(kRehashSlice);
+                    rehashing = shard.table.rehashing();
+                }
+                {
+                    std::lock_guard<std::mutex> shard_lock(shard.mutex);
+                    if (shard.table.needsCompaction()) {
+                        shard.table.compact();
+                    }
+                    collectVersionsLocked(shard, horizon);
+                    if (!shard.table.needsTraining()) {
+                        continue;
+                    }
+                }
+                trainDictionary(shard);
+            }
+            if (replicas) {
+                refreshHotKeys();
+            }
+            if (!options.replicate_to.empty()) {
+                serveFollower();
+            }
+            lock.lock();
+        }
+    }
+
+    // Sample the shard's values under its lock, train a dictionary on them
+    // without it, then re-encode the shard with the result. Re-encoding
+    // holds the lock for as long as a compaction, which it also performs.
+    // Does nothing unless the shard needs a dictionary, or, if untrained is
+    // set, has none yet.
+    void trainDictionary(Shard& shard, bool untrained = false) {
+        std::lock_guard<std::mutex> training(shard.training_mutex);
+        std::vector<std::string> samples;
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            if (!shard.table.needsTraining() && !(untrained && !shard.table.trained())) {
+                return;
+            }
+            samples = shard.table.sampleValues(kTrainSample);
+        }
+        if (samples.empty()) {
+            return;
+        }
+        auto dictionary = std::make_shared<const ValueDictionary>(ValueDictionary::train(samples, kDictionaryBytes));
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.table.setDictionary(std::move(dictionary));
+    }
+
+    // Rank the keys by their sampled reads plus the reads their replicas
+    // served, then publish the current values of the hottest to the
+    // replicas. A key is marked hot in its shard before its value is read,
+    // so a write racing with the publication invalidates it.
+    void refreshHotKeys() {
+        for (const HotReplicas::Hits& hits : replicas->takeHits()) {
+            if (hits.count >= kHeatSample) {
+                Shard& shard = shards[shardOf(hits.hash)];
+                std::lock_guard<std::mutex> lock(shard.mutex);
+                uint64_t weight = std::min<uint64_t>(hits.count / kHeatSample, UINT32_MAX);
+                shard.heat->record(hits.key, hits.hash, static_cast<uint32_t>(weight));
+            }
+        }
+        std::vector<HeavyHitters::Candidate> ranked;
+        for (Shard& shard : shards) {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            for (const HeavyHitters::Candidate& candidate : shard.heat->top()) {
+                if (candidate.count >= kMinHeat) {
+                    ranked.push_back(candidate);
+                }
+            }
+            shard.heat->decay();
+        }
+        std::sort(ranked.begin(), ranked.end(), [](const HeavyHitters::Candidate& a,
+                                                   const HeavyHitters::Candidate& b) { return a.count > b.count; });
+        ranked.resize(std::min(ranked.size(), options.hot_keys));
+
+        std::vector<HotReplicas::Source> sources;
+        std::string scratch;
+        replicas->beginRound();
+        for (const HeavyHitters::Candidate& candidate : ranked) {
+            Shard& shard = shards[shardOf(candidate.hash)];
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            // Keys with a TTL stay out, since only reads of the table check it
+            const ShardTable::Entry* entry = shard.table.find(candidate.key, candidate.hash);
+            if (!entry || shard.expiry.deadlineOf(entry->index) != 0) {
+                continue;
+            }
+            if (std::find(shard.hot.begin(), shard.hot.end(), candidate.hash) == shard.hot.end()) {
+                shard.hot.push_back(candidate.hash);
+            }
+            sources.push_back({candidate.key, candidate.hash, std::string(shard.table.readValue(*entry, scratch))});
+        }
+        std::vector<uint64_t> published = replicas->publish(std::move(sources));
+        auto isPublished = [&published](uint64_t hash) {
+            return std::find(published.begin(), published.end(), hash) != published.end();
+        };
+        for (Shard& shard : shards) {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            std::erase_if(shard.hot, [&](uint64_t hash) { return !isPublished(hash); });
+        }
+
+        std::vector<HotKey> ranking;
+        for (const HeavyHitters::Candidate& candidate : ranked) {
+            ranking.push_back({candidate.key, candidate.count, isPublished(candidate.hash)});
+        }
+        std::lock_guard<std::mutex> lock(hot_mutex);
+        hot_ranking = std::move(ranking);
+    }
+
+    static uint64_t threadCpuMicros() {
+        timespec now;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+        return uint64_t(now.tv_sec) * 1000000 + uint64_t(now.tv_nsec) / 1000;
+    }
+
+    // Each slice holds one shard lock until kReapSliceTime has passed; a
+    // shard with a backlog is revisited after its lock has been released,
+    // so writers and readers interleave with the reaping
+    void reaperLoop() {
+        std::unique_lock<std::mutex> lock(reaper_mutex);
+        std::vector<uint32_t> expired;
+        while (!reaper_stop) {
+            reaper_wake.wait_for(lock, kReapInterval);
+            lock.unlock();
+            for (Shard& shard : shards) {
+                bool done = false;
+                while (!done) {
+                    deliverChanges(shard);
+                    std::lock_guard<std::mutex> shard_lock(shard.mutex);
+                    if (shard.expiry.empty()) {
+                        break;
+                    }
+                    auto start = std::chrono::steady_clock::now();
+                    uint64_t cpu_start = threadCpuMicros();
+                    auto elapsed = std::chrono::steady_clock::duration::zero();
+                    uint64_t now = nowTick();
+                    while (!done && elapsed < kReapSliceTime) {
+                        expired.clear();
+                        done = shard.expiry.expire(now, kReapStep, expired);
+                        for (uint32_t index : expired) {
+                            removeLocked(shard, index);
+                        }
+                        shard.expired_by_reaper += expired.size();
+                        elapsed = std::chrono::steady_clock::now() - start;
+                    }
+                    uint64_t micros = std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+                    uint64_t cpu_micros = threadCpuMicros() - cpu_start;
+                    reaper_slices.fetch_add(1, std::memory_order_relaxed);
+                    if (micros > longest_slice_us.load(std::memory_order_relaxed)) {
+                        longest_slice_us.store(micros, std::memory_order_relaxed);
+                    }
+                    if (cpu_micros > longest_slice_cpu_us.load(std::memory_order_relaxed)) {
+                        longest_slice_cpu_us.store(cpu_micros, std::memory_order_relaxed);
+                    }
+                    if (cpu_micros >= 1000) {
+                        slow_slices.fetch_add(1, std::memory_order_relaxed);
+                    }
+                }
+                deliverChanges(shard);
+            }
+            lock.lock();
+        }
+    }
+
+    // Push one record to the follower; the caller holds ring_mutex. A
+    // follower that died while the ring was full is dropped: shipping stops
+    // and the ring is marked overrun, so if it comes back it asks for a
+    // new full copy.
+    bool pushLocked(ReplicationRing::RecordType type, std::string_view key, std::string_view value,
+                    uint64_t expires_at) {
+        if (ring->push(type, key, value, expires_at)) {
+            shipped_records++;
+            return true;
+        }
+        shipping = false;
+        ring->setState(ReplicationRing::kOverrun);
+        replication_overruns++;
+        std::cerr << "Replication follower stopped responding; shipping suspended" << std::endl;
+        return false;
+    }
+
+    // Ship a write to the follower, if one is being fed. Called under the
+    // shard lock of key before the write is logged or applied, so the
+    // follower sees the writes to any one key in the order they happen.
+    void shipLocked(std::string_view key, std::string_view value, uint64_t expires_at = 0) {
+        if (!ring || !shipping.load(std::memory_order_acquire)) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(ring_mutex);
+        if (ring->state() & ReplicationRing::kFenced) {
+            throw std::runtime_error("A follower has been promoted; this leader no longer accepts writes!");
+        }
+        if (shipping) {
+            pushLocked(ReplicationRing::RecordType::kPut, key, value, expires_at);
+        }
+    }
+
+    // Leader side of the compactor pass: beat, and send a full copy to a
+    // follower that asked for one
+    void serveFollower() {
+        ring->beatLeader();
+        if (ring->state() & ReplicationRing::kSyncRequested) {
+            syncFollower();
+        }
+    }
+
+    // Send every key to the follower between a SyncBegin and a SyncEnd
+    // record. Shipping starts right after SyncBegin, and each shard is
+    // copied under its lock, so a write lands either in the copy or after
+    // it in the ring, never in neither.
+    void syncFollower() {
+        using RecordType = ReplicationRing::RecordType;
+        {
+            std::lock_guard<std::mutex> lock(ring_mutex);
+            ring->clearState(ReplicationRing::kSyncRequested | ReplicationRing::kOverrun);
+            if (!pushLocked(RecordType::kSyncBegin, {}, {}, 0)) {
+                return;
+            }
+            shipping = true;
+        }
+        for (Shard& shard : shards) {
+            std::lock_guard<std::mutex> shard_lock(shard.mutex);
+            std::lock_guard<std::mutex> lock(ring_mutex);
+            if (!shipping) {
+                return;
+            }
+            ring->beatLeader();
+            uint64_t tick = nowTick();
+            uint64_t wall = wallMillis();
+            bool ok = true;
+            shard.table.forEach([&](std::string_view key, std::string_view value, const ShardTable::Entry& entry) {
+                uint64_t deadline = shard.expiry.empty() ? 0 : shard.expiry.deadlineOf(entry.index);
+                if (!ok || (deadline != 0 && deadline <= tick)) {
+                    return;
+                }
+                ok = pushLocked(RecordType::kPut, key, value, deadline ? wall + (deadline - tick) : 0);
+            });
+            if (!ok) {
+                return;
+            }
+        }
+        std::lock_guard<std::mutex> lock(ring_mutex);
+        if (shipping && pushLocked(RecordType::kSyncEnd, {}, {}, 0)) {
+            full_syncs++;
+        }
+    }
+
+    // Apply one record from the leader on a follower. Writes go through
+    // the ordinary write path, so they are logged if the follower has a
+    // log; lsn is raised to the position to wait for.
+    void applyReplicated(const ReplicationRing::Record& record, uint64_t& lsn) {
+        using RecordType = ReplicationRing::RecordType;
+        if (record.type == RecordType::kSyncBegin) {
+            synced = false;
+            for (Shard& shard : shards) {
+                std::lock_guard<std::mutex> lock(shard.mutex);
+                std::vector<uint32_t> indices;
+                shard.table.forEach([&indices](std::string_view, std::string_view, const ShardTable::Entry& entry) {
+                    indices.push_back(entry.index);
+                });
+                for (uint32_t index : indices) {
+                    removeLocked(shard, index);
+                }
+            }
+            for (Shard& shard : shards) {
+                deliverChanges(shard);
+            }
+            if (wal) {
+                wal->reset();
+            }
+            return;
+        }
+        if (record.type == RecordType::kSyncEnd) {
+            synced = true;
+            full_syncs++;
+            return;
+        }
+        uint64_t hash = hashKey(record.key);
+        Shard& shard = shards[shardOf(hash)];
+        std::unique_lock<std::mutex> lock(shard.mutex);
+        uint64_t now = wallMillis();
+        if (record.expires_at != 0 && record.expires_at <= now) {
+            // Expired in transit; logged so that replay drops the key too
+            if (wal) {
+                lsn = wal->appendExpiring(record.key, record.value, record.expires_at);
+            }
+            if (const ShardTable::Entry* entry = shard.table.find(record.key, hash)) {
+                removeLocked(shard, entry->index);
+            }
+            lock.unlock();
+            deliverChanges(shard);
+            return;
+        }
+        std::chrono::milliseconds ttl(record.expires_at ? record.expires_at - now : 0);
+        lsn = writeLocked(shard, std::move(lock), record.key, record.value, hash, ttl);
+    }
+
+    // Follower thread: apply whatever the leader has shipped, wait for it
+    // to be logged, then note the time at which the ring was read as the
+    // point the data is known to be current to
+    void applierLoop() {
+        try {
+            uint64_t lsn = 0;
+            while (!applier_stop) {
+                ring->beatFollower();
+                uint32_t state = ring->state();
+                if ((state & ReplicationRing::kOverrun) && !(state & ReplicationRing::kSyncRequested)) {
+                    // The leader gave up on us and dropped writes; start over
+                    synced = false;
+                    ring->setState(ReplicationRing::kSyncRequested);
+                }
+                uint64_t seen = nowTick();
+                size_t applied = ring->consume(ring->head(), [&](const ReplicationRing::Record& record) {
+                    applyReplicated(record, lsn);
+                });
+                if (wal && lsn) {
+                    wal->waitDurable(lsn);
+                }
+                applied_records += applied;
+                {
+                    std::lock_guard<std::mutex> lock(applied_mutex);
+                    applied_through = seen;
+                }
+                applied_wake.notify_all();
+                if (applied == 0) {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                }
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "Replication stopped: " << e.what() << std::endl;
+        }
+    }
+
+    void stopApplier() {
+        if (!applier.joinable()) {
+            return;
+        }
+        applier_stop = true;
+        applier.join();
+    }
+
+    // Whether a follower's data includes every write its leader made
+    // max_staleness ago, waiting up to that long for it to
+    bool freshEnough() {
+        if (freshNow()) {
+            return true;
+        }
+        std::unique_lock<std::mutex> lock(applied_mutex);
+        return applied_wake.wait_for(lock, options.max_staleness, [this] { return freshNow(); });
+    }
+
+    // The same without waiting
+    bool freshNow() {
+        return synced && nowTick() <= applied_through + static_cast<uint64_t>(options.max_staleness.count());
+    }
+
+    bool boundedFollower() {
+        return following.load(std::memory_order_relaxed) && options.max_staleness.count() > 0;
+    }
+
+    bool staleFollower() {
+        return boundedFollower() && !freshEnough();
+    }
+
+    // Old versions superseded at or before this time are invisible to every
+    // open snapshot and to any snapshot opened later
+    uint64_t versionHorizon() {
+        std::lock_guard<std::mutex> lock(snapshots_mutex);
+        return snapshot_times.empty() ? next_ts.load() : *snapshot_times.begin();
+    }
+
+    void collectVersionsLocked(Shard& shard, uint64_t horizon) {
+        for (auto it = shard.versions.begin(); it != shard.versions.end();) {
+            std::vector<OldVersion>& chain = it->second;
+            auto keep = std::find_if(chain.begin(), chain.end(), [horizon](const OldVersion& version) {
+                return version.superseded > horizon;
+            });
+            size_t dropped = keep - chain.begin();
+            chain.erase(chain.begin(), keep);
+            shard.version_count -= dropped;
+            shard.collected_versions += dropped;
+            it = chain.empty() ? shard.versions.erase(it) : std::next(it);
+        }
+    }
+
+    // Draw the commit timestamp of a write; the caller holds every shard
+    // lock the write needs and must publish() the timestamp afterwards
+    uint64_t stampLocked() {
+        return next_ts.fetch_add(1) + 1;
+    }
+
+    // Save the value key has before the write stamped ts replaces it, if a
+    // snapshot may need it
+    void keepVersionLocked(Shard& shard, std::string_view key, uint64_t hash, uint64_t ts) {
+        if (open_snapshots.load() == 0) {
+            return;
+        }
+        std::optional<std::string> previous;
+        if (const ShardTable::Entry* entry = shard.table.find(key, hash)) {
+            std::string scratch;
+            previous.emplace(shard.table.readValue(*entry, scratch));
+        }
+        shard.versions[std::string(key)].push_back({std::move(previous), ts});
+        shard.version_count++;
+    }
+
+    // Make the write stamped ts visible to new snapshots, after every
+    // earlier one. Must be called with no shard lock held: the writers of
+    // earlier timestamps may still be waiting for one.
+    void publish(uint64_t ts) {
+        uint64_t seen = visible_ts.load();
+        while (seen != ts - 1) {
+            visible_ts.wait(seen);
+            seen = visible_ts.load();
+        }
+        visible_ts.store(ts);
+        visible_ts.notify_all();
+    }
+
+    uint64_t openSnapshot() {
+        uint64_t read_ts;
+        {
+            std::lock_guard<std::mutex> lock(snapshots_mutex);
+            open_snapshots.fetch_add(1);
+            // Any write stamped later sees open_snapshots > 0 and keeps the
+            // value it replaces; writes stamped earlier are waited for below
+            read_ts = next_ts.load();
+            snapshot_times.insert(read_ts);
+        }
+        uint64_t seen = visible_ts.load();
+        while (seen < read_ts) {
+            visible_ts.wait(seen);
+            seen = visible_ts.load();
+        }
+        return read_ts;
+    }
+
+    void closeSnapshot(uint64_t read_ts) {
+        std::lock_guard<std::mutex> lock(snapshots_mutex);
+        snapshot_times.erase(snapshot_times.find(read_ts));
+        open_snapshots.fetch_sub(1);
+    }
+
+    // Apply a transaction's writes atomically unless one of its keys was
+    // written by a commit after read_ts (first committer wins)
+    bool commitWrites(uint64_t read_ts, const std::map<std::string, std::string>& writes) {
+        if (writes.empty()) {
+            return true;
+        }
+        std::vector<uint64_t> hashes;
+        std::array<bool, kShardCount> touched{};
+        for (const auto& [key, value] : writes) {
+            hashes.push_back(hashKey(key));
+            touched[shardOf(hashes.back())] = true;
+        }
+        // Always in shard order, so two commits cannot deadlock
+        std::vector<std::unique_lock<std::mutex>> locks;
+        for (size_t s = 0; s < kShardCount; s++) {
+            if (touched[s]) {
+                locks.emplace_back(shards[s].mutex);
+            }
+        }
+        size_t i = 0;
+        for (const auto& [key, value] : writes) {
+            Shard& shard = shards[shardOf(hashes[i++])];
+            auto it = shard.versions.find(key);
+            if (it != shard.versions.end() && it->second.back().superseded > read_ts) {
+                conflicts++;
+                return false;
+            }
+        }
+
+        uint64_t lsn = 0;
+        for (const auto& [key, value] : writes) {
+            shipLocked(key, value);
+        }
+        if (wal) {
+            std::vector<std::pair<std::string_view, std::string_view>> items(writes.begin(), writes.end());
+            lsn = wal->appendGroup(items);
+        }
+        uint64_t ts = stampLocked();
+        std::vector<KeyValue> evicted;
+        i = 0;
+        for (const auto& [key, value] : writes) {
+            uint64_t hash = hashes[i++];
+            Shard& shard = shards[shardOf(hash)];
+            keepVersionLocked(shard, key, hash, ts);
+            applyLocked(shard, key, value, hash, evicted);
+        }
+        locks.clear();
+        for (size_t s = 0; s < kShardCount; s++) {
+            if (touched[s]) {
+                deliverChanges(shards[s]);
+            }
+        }
+        publish(ts);
+        if (wal) {
+            wal->waitDurable(lsn);
+        }
+        commits++;
+        return true;
+    }
+
+    void stopCompactor() {
+        if (!compactor.joinable()) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(compactor_mutex);
+            compactor_stop = true;
+        }
+        compactor_wake.notify_one();
+        compactor.join();
+    }
+
+    void stopReaper() {
+        if (!reaper.joinable()) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(reaper_mutex);
+            reaper_stop = true;
+        }
+        reaper_wake.notify_one();
+        reaper.join();
+    }
+
+    // Apply one write to a locked shard: table, ordered and value indexes,
+    // cache policy and expiry, then queue it for the watchers. A write with no
+    // deadline clears any TTL the key had.
+    // Entries the memory budget pushes out are moved to evicted so the
+    // caller can hand them to on_evict once the lock is released. A key new
+    // to the table goes to added_keys instead of the ordered index if given,
+    // for callers that add many at once.
+    void applyLocked(Shard& shard, std::string_view key, std::string_view value, uint64_t hash,
+                     std::vector<KeyValue>& evicted, uint64_t deadline = 0,
+                     std::vector<std::string_view>* added_keys = nullptr) {
+        coolLocked(shard, key, hash);
+        auto [entry, added] = shard.table.upsert(key, value, hash);
+        if (deadline != 0) {
+            shard.expiry.schedule(entry->index, deadline, nowTick());
+        } else if (!added) {
+            shard.expiry.cancel(entry->index);
+        }
+        if (ordered && added) {
+            if (added_keys) {
+                added_keys->push_back(key);
+            } else {
+                ordered->insert(key);
+            }
+        }
+        if (shard.by_value) {
+            shard.by_value->set(entry->index, std::hash<std::string_view>{}(value));
+        }
+        notifyLocked(shard, added ? ChangeType::kInsert : ChangeType::kUpdate, key, value);
+        if (!shard.cache) {
+            return;
+        }
+        size_t bytes = key.size() + entry->value.length + kEntryOverhead;
+        if (added) {
+            entry->node = shard.cache->add(entry->index, hash, bytes);
+        } else {
+            shard.cache->resize(entry->node, bytes);
+        }
+        std::vector<uint32_t> victims;
+        shard.cache->evict(victims);
+        std::string scratch;
+        for (uint32_t index : victims) {
+            const ShardTable::Entry& victim = shard.table.at(index);
+            if (ordered) {
+                ordered->erase(shard.table.keyOf(victim));
+            }
+            if (options.on_evict) {
+                evicted.emplace_back(shard.table.keyOf(victim), shard.table.readValue(victim, scratch));
+            }
+            if (shard.by_value) {
+                shard.by_value->remove(index);
+            }
+            notifyLocked(shard, ChangeType::kRemove, shard.table.keyOf(victim), {});
+            shard.expiry.cancel(index);
+            shard.table.eraseEntry(index);
+            shard.evictions++;
+        }
+    }
+
+    void handOff(const std::vector<KeyValue>& evicted) {
+        for (const auto& [key, value] : evicted) {
+            options.on_evict(key, value);
+        }
+    }
+
+    // The LSM memtable has a single lock, so there is nothing to group by;
+    // the batch still waits for durability only once per log it touched
+    void insertBatchLsm(std::span<const std::pair<std::string, std::string>> items) {
+        std::vector<std::pair<std::shared_ptr<WriteAheadLog>, uint64_t>> waits;
+        for (const auto& [key, value] : items) {
+            auto pending = lsm->putAsync(key, value);
+            if (!waits.empty() && waits.back().first == pending.first) {
+                waits.back().second = pending.second;
+            } else {
+                waits.push_back(std::move(pending));
+            }
+        }
+        for (auto& [log, lsn] : waits) {
+            log->waitDurable(lsn);
+        }
+        if (options.echo_inserts) {
+            std::cout << "Inserted batch of " << items.size() << " keys" << std::endl;
+        }
+    }
+
+    // Apply a window of bulk-loaded chunks to shard s in file order, taking
+    // its lock once; keys new to the ordered index go in together at the
+    // end. lsn is raised to the last log record written.
+    void loadShard(size_t s, std::span<const LoadChunk> window, uint64_t& lsn) {
+        size_t count = 0;
+        for (const LoadChunk& chunk : window) {
+            count += chunk[s].size();
+        }
+        if (count == 0) {
+            return;
+        }
+        Shard& shard = shards[s];
+        std::vector<KeyValue> evicted;
+        std::vector<std::string_view> added;
+        std::vector<std::pair<std::string_view, std::string_view>> group;
+        uint64_t ts = 0;
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            shard.table.reserve(count);
+            // Ship and log everything before drawing the timestamp, which
+            // must be published once drawn
+            for (const LoadChunk& chunk : window) {
+                const std::vector<LoadRow>& rows = chunk[s];
+                for (const LoadRow& row : rows) {
+                    shipLocked(row.key, row.value);
+                }
+                if (wal && !rows.empty()) {
+                    group.clear();
+                    for (const LoadRow& row : rows) {
+                        group.emplace_back(row.key, row.value);
+                    }
+                    lsn = wal->appendGroup(group);
+                }
+            }
+            if (options.transactions) {
+                ts = stampLocked();
+            }
+            for (const LoadChunk& chunk : window) {
+                const std::vector<LoadRow>& rows = chunk[s];
+                for (size_t i = 0; i < rows.size(); i++) {
+                    if (i + kPrefetchGroup < rows.size()) {
+                        shard.table.prefetchSlot(rows[i + kPrefetchGroup].hash);
+                    }
+                    if (ts) {
+                        keepVersionLocked(shard, rows[i].key, rows[i].hash, ts);
+                    }
+                    applyLocked(shard, rows[i].key, rows[i].value, rows[i].hash, evicted, 0,
+                                ordered ? &added : nullptr);
+                }
+            }
+            if (!added.empty()) {
+                // Keys the memory budget has already pushed out stay out
+                if (shard.cache) {
+                    std::erase_if(added, [&shard](std::string_view key) {
+                        return !shard.table.find(key, hashKey(key));
+                    });
+                }
+                std::sort(added.begin(), added.end());
+                ordered->insertMany(added);
+            }
+        }
+        deliverChanges(shard);
+        if (ts) {
+            publish(ts);
+        }
+        handOff(evicted);
+    }
+
+    // Run task(i) for every i below count on up to threads threads,
+    // rethrowing the first exception once all of them have stopped
+    template<typename Task>
+    static void runParallel(size_t threads, size_t count, Task task) {
+        std::atomic<size_t> next{0};
+        std::mutex failure_mutex;
+        std::exception_ptr failure;
+        auto work = [&]() {
+            try {
+                for (size_t i = next++; i < count; i = next++) {
+                    task(i);
+                }
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(failure_mutex);
+                if (!failure) {
+                    failure = std::current_exception();
+                }
+                next = count;
+            }
+        };
+        std::vector<std::thread> workers;
+        for (size_t t = 1; t < std::min(threads, count); t++) {
+            workers.emplace_back(work);
+        }
+        work();
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+        if (failure) {
+            std::rethrow_exception(failure);
+        }
+    }
+
+    // The value as of read_ts, or the latest one for kLatest
+    std::optional<std::string> lookupCopy(std::string_view key, uint64_t read_ts = kLatest) {
+        uint64_t hash = hashKey(key);
+        Shard& shard = shards[shardOf(hash)];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        if (read_ts != kLatest && !shard.versions.empty()) {
+            auto it = shard.versions.find(key);
+            if (it != shard.versions.end()) {
+                for (const OldVersion& version : it->second) {
+                    if (version.superseded > read_ts) {
+                        return version.value;
+                    }
+                }
+            }
+        }
+        std::string scratch;
+        if (auto value = lookupLocked(shard, key, hash, scratch)) {
+            return std::string(*value);
+        }
+        return std::nullopt;
+    }
+
+    // lookup(), which with wait false gives up and sets busy instead of
+    // waiting when the key's shard lock is taken
+    // fresh_checked skips the follower's freshness wait, for callers that
+    // have already made it
+    LookupResult tryLookup(std::string_view key, bool wait, bool& busy, bool fresh_checked = false) {
+        if (!connected) {
+            return LookupResult(LookupStatus::kNotConnected);
+        }
+        if (!fresh_checked && staleFollower()) {
+            return LookupResult(LookupStatus::kStale);
+        }
+        if (lsm) {
+            if (auto value = lsm->get(key)) {
+                return LookupResult(std::move(*value));
+            }
+            return LookupResult(LookupStatus::kNotFound);
+        }
+        uint64_t hash = hashKey(key);
+        if (replicas) {
+            std::shared_ptr<const HotReplicas::Table> pin;
+            if (const HotReplicas::Item* item = replicas->find(key, hash, pin)) {
+                return LookupResult(std::move(pin), item->value);
+            }
+        }
+        Shard& shard = shards[shardOf(hash)];
+        std::unique_lock<std::mutex> lock(shard.mutex, std::defer_lock);
+        if (wait) {
+            lock.lock();
+        } else if (!lock.try_lock()) {
+            busy = true;
+            return LookupResult(LookupStatus::kNotFound);
+        }
+        std::string decoded;
+        if (auto value = lookupLocked(shard, key, hash, decoded)) {
+            if (shard.heat) {
+                thread_local uint32_t reads = 0;
+                if (++reads % kHeatSample == 0) {
+                    shard.heat->record(key, hash);
+                    shard.sampled_reads++;
+                }
+            }
+            if (!decoded.empty()) {
+                return LookupResult(std::move(decoded));
+            }
+            return LookupResult(std::move(lock), *value);
+        }
+        // The key may have just expired here
+        lock.unlock();
+        deliverChanges(shard);
+        return LookupResult(LookupStatus::kNotFound);
+    }
+
+    void requireOrderedIndex() const {
+        requireConnected();
+        if (!ordered) {
+            throw std::runtime_error("Ordered index not enabled!");
+        }
+    }
+
+    void requireConnected() const {
+        if (!connected) {
+            throw std::runtime_error("Database not connected!");
+        }
+    }
+
+    void requireWritable() const {
+        requireConnected();
+        if (following) {
+            throw std::runtime_error("A follower is read-only until promote()!");
+        }
+    }
+
+    void requireFresh() {
+        if (staleFollower()) {
+            throw std::runtime_error("Follower is too stale to serve reads!");
+        }
+    }
+
+    // Order item indices by shard (counting sort) so every shard is locked
+    // exactly once per batch. Returns the start offset of each shard's run.
+    static std::array<size_t, kShardCount + 1> groupByShard(const std::vector<uint64_t>& hashes,
+                                                            std::vector<uint32_t>& order) {
+        std::array<size_t, kShardCount + 1> starts{};
+        for (uint64_t hash : hashes) {
+            starts[shardOf(hash) + 1]++;
+        }
+        for (size_t s = 0; s < kShardCount; s++) {
+            starts[s + 1] += starts[s];
+        }
+        std::array<size_t, kShardCount> fill{};
+        order.resize(hashes.size());
+        for (uint32_t i = 0; i < hashes.size(); i++) {
+            size_t s = shardOf(hashes[i]);
+            order[starts[s] + fill[s]++] = i;
+        }
+        return starts;
+    }
+
+    // Reject option combinations that do not work together before connect()
+    // changes anything, so a refused connect leaves the instance unused
+    static void validateOptions(const ConnectionOptions& o) {
+        bool on_lsm = !o.lsm_directory.empty();
+        bool has_snapshot = !o.snapshot_path.empty();
+        if (on_lsm && (!o.wal_path.empty() || has_snapshot)) {
+            throw std::runtime_error("The LSM engine cannot be combined with wal_path or snapshot_path!");
+        }
+        if (on_lsm && o.compress_values) {
+            throw std::runtime_error("Value compression is not available with the LSM engine!");
+        }
+        if (o.memory_budget > 0 && (on_lsm || !o.wal_path.empty() || has_snapshot)) {
+            throw std::runtime_error("memory_budget cannot be combined with on-disk storage!");
+        }
+        if (o.hot_keys > 0 && (on_lsm || o.memory_budget > 0)) {
+            throw std::runtime_error("Hot-key replicas are not available with the LSM engine or a memory budget!");
+        }
+        if (o.transactions && (on_lsm || has_snapshot || o.memory_budget > 0)) {
+            throw std::runtime_error("Transactions cannot be combined with the LSM engine, a snapshot or a memory budget!");
+        }
+        if (o.ordered_index && on_lsm) {
+            throw std::runtime_error("The ordered index is not available with the LSM engine!");
+        }
+        if (o.value_index && (on_lsm || has_snapshot)) {
+            throw std::runtime_error("The value index is not available with the LSM engine or a snapshot!");
+        }
+        if (!o.replicate_to.empty() && !o.follow.empty()) {
+            throw std::runtime_error("A database cannot both replicate and follow!");
+        }
+        if ((!o.replicate_to.empty() || !o.follow.empty()) && (on_lsm || has_snapshot || o.memory_budget > 0)) {
+            throw std::runtime_error("Replication is not available with the LSM engine, a snapshot or a memory budget!");
+        }
+    }
+
+    // Build what options asks for: storage, replay, indexes, replication
+    // and the background threads. Called with mutex_ held.
+    void open() {
+        for (Shard& shard : shards) {
+            shard.table.setInterning(options.intern_values);
+            shard.table.setCompression(options.compress_values);
+        }
+        if (!options.lsm_directory.empty()) {
+            lsm = std::make_unique<LsmEngine>(options.lsm_directory, options.lsm);
+        }
+        if (!options.snapshot_path.empty()) {
+            auto start = std::chrono::steady_clock::now();
+            auto mapped = std::make_unique<SnapshotFile>();
+            if (mapped->open(options.snapshot_path)) {
+                std::cout << "Mapped snapshot with " << mapped->size() << " keys in "
+                          << std::chrono::duration_cast<std::chrono::microseconds>(
+                                 std::chrono::steady_clock::now() - start).count()
+                          << " us" << std::endl;
+                snapshot = std::move(mapped);
+            }
+        }
+        if (!options.wal_path.empty()) {
+            auto log = std::make_unique<WriteAheadLog>();
+            // Keys whose TTL ran out while the database was closed are
+            // dropped, together with any older value they had replaced
+            uint64_t replay_wall = wallMillis();
+            uint64_t replay_tick = nowTick();
+            std::vector<KeyValue> unused;
+            size_t replayed = log->open(options.wal_path, [&](std::string_view key, std::string_view value,
+                                                              uint64_t expires_at = 0) {
+                uint64_t hash = hashKey(key);
+                Shard& shard = shards[shardOf(hash)];
+                if (expires_at == 0) {
+                    applyLocked(shard, key, value, hash, unused);
+                } else if (expires_at > replay_wall) {
+                    applyLocked(shard, key, value, hash, unused, replay_tick + (expires_at - replay_wall));
+                } else if (const ShardTable::Entry* entry = shard.table.find(key, hash)) {
+                    removeLocked(shard, entry->index);
+                }
+            });
+            std::cout << "Replayed " << replayed << " records from " << options.wal_path << std::endl;
+            wal = std::move(log);
+        }
+        if (options.memory_budget > 0) {
+            size_t shard_budget = options.memory_budget / kShardCount;
+            for (Shard& shard : shards) {
+                shard.cache = std::make_unique<TinyLfuPolicy>(shard_budget, shard_budget / 128);
+                shard.hits = shard.misses = shard.evictions = 0;
+            }
+        }
+        if (options.hot_keys > 0) {
+            replicas = std::make_unique<HotReplicas>();
+            for (Shard& shard : shards) {
+                shard.heat = std::make_unique<HeavyHitters>(options.hot_keys);
+            }
+        }
+        if (options.ordered_index) {
+            ordered = std::make_unique<OrderedIndex>();
+            if (snapshot) {
+                snapshot->forEach([this](std::string_view key, std::string_view) {
+                    ordered->insert(key);
+                });
+            }
+            for (const Shard& shard : shards) {
+                shard.table.forEach([this](std::string_view key, std::string_view, const ShardTable::Entry&) {
+                    ordered->insert(key);
+                });
+            }
+        }
+        if (options.value_index) {
+            for (Shard& shard : shards) {
+                shard.by_value = std::make_unique<ValueIndex>();
+                shard.table.forEach([&shard](std::string_view, std::string_view value, const ShardTable::Entry& entry) {
+                    shard.by_value->set(entry.index, std::hash<std::string_view>{}(value));
+                });
+            }
+        }
+        if (!options.replicate_to.empty() || !options.follow.empty()) {
+            ring = std::make_unique<ReplicationRing>();
+            if (!options.replicate_to.empty()) {
+                ring->create(options.replicate_to, options.replication_ring_bytes);
+            } else {
+                ring->attach(options.follow);
+                following = true;
+                applier_stop = false;
+                applier = std::thread([this] { applierLoop(); });
+            }
+        }
+        if (!lsm) {
+            compactor_stop = false;
+            compactor = std::thread([this] { compactorLoop(); });
+            reaper_stop = false;
+            reaper = std::thread([this] { reaperLoop(); });
+        }
+    }
+
+    // Stop the background threads and drop everything connect() built,
+    // whether or not it got as far as connecting. Called with mutex_ held.
+    void resetLocked() {
+        // Watchers get what is queued for them while reads still work
+        for (Shard& shard : shards) {
+            deliverChanges(shard);
+        }
+        feed.clear();
+        connected = false;
+        stopApplier();
+        stopCompactor();
+        stopReaper();
+        if (ring && !following) {
+            ring->leave();
+        }
+        ring.reset();
+        following = false;
+        shipping = false;
+        synced = false;
+        applied_through = 0;
+        shipped_records = applied_records = full_syncs = replication_overruns = 0;
+        wal.reset();
+        snapshot.reset();
+        lsm.reset();
+        ordered.reset();
+        replicas.reset();
+        hot_ranking.clear();
+        for (Shard& shard : shards) {
+            std::lock_guard<std::mutex> shard_lock(shard.mutex);
+            shard.heat.reset();
+            shard.sampled_reads = 0;
+            shard.hot.clear();
+            shard.table.clear();
+            shard.by_value.reset();
+            shard.cache.reset();
+            shard.versions.clear();
+            shard.version_count = 0;
+            shard.collected_versions = 0;
+            shard.outbox.clear();
+            shard.outbox_ready = false;
+            shard.expiry.clear();
+            shard.expired_on_read = shard.expired_by_reaper = 0;
+        }
+        reaper_slices = 0;
+        longest_slice_us = 0;
+        longest_slice_cpu_us = 0;
+        slow_slices = 0;
+        commits = 0;
+        conflicts = 0;
+        next_ts = 0;
+        visible_ts = 0;
+    }
+
+public:
+    ~DatabaseConnection() {
+        stopCompactor();
+        stopReaper();
+    }
+
+    // Constructed once, thread-safely, on first use. Every later call is a
+    // load and a branch with no lock.
+    static DatabaseConnection& getInstance() {
+        static DatabaseConnection instance;
+        return instance;
+    }
+
+    // Per-thread handle returned by session(). It holds the instance and
+    // this thread's own state, so its hot path touches nothing shared but
+    // the shard a key lands on. Puts are buffered and applied with one
+    // insertBatch once kBatch of them are waiting, before the next lookup
+    // through the session, on flush(), or when the thread exits.
+    class Session {
+    public:
+        static constexpr size_t kBatch = 64;
+
+        struct Stats {
+            uint64_t reads = 0;
+            uint64_t hits = 0;
+            uint64_t writes = 0;
+            uint64_t flushes = 0;
+        };
+
+    private:
+        DatabaseConnection& db;
+        std::vector<KeyValue> pending;
+        Stats counters;
+
+    public:
+        explicit Session(DatabaseConnection& owner) : db(owner) {}
+
+        Session(const Session&) = delete;
+        Session& operator=(const Session&) = delete;
+
+        ~Session() {
+            try {
+                flush();
+            } catch (const std::exception& e) {
+                std::cerr << "Session: dropped " << pending.size() << " buffered writes: " << e.what() << std::endl;
+            }
+        }
+
+        DatabaseConnection& database() { return db; }
+        const Stats& stats() const { return counters; }
+
+        // Sees this session's own puts, which are flushed first; throws
+        // like flush() if that is not possible
+        LookupResult lookup(std::string_view key) {
+            flush();
+            counters.reads++;
+            LookupResult result = db.lookup(key);
+            counters.hits += result.found();
+            return result;
+        }
+
+        // Flushes every kBatch puts, except while a LookupResult on this
+        // thread holds a shard lock, which the flush could need: then the
+        // puts stay buffered until the first put after it is gone
+        void put(std::string_view key, std::string_view value) {
+            pending.emplace_back(key, value);
+            counters.writes++;
+            if (pending.size() >= kBatch && !LookupResult::lockHeldHere()) {
+                flush();
+            }
+        }
+
+        // Throws std::runtime_error instead of deadlocking if a LookupResult
+        // on this thread holds a shard lock
+        void flush() {
+            if (pending.empty()) {
+                return;
+            }
+            if (LookupResult::lockHeldHere()) {
+                throw std::runtime_error("Session cannot flush while this thread holds a borrowed lookup result");
+            }
+            db.insertBatch(pending);
+            pending.clear();
+            counters.flushes++;
+        }
+    };
+
+    // The calling thread's session, created on its first call
+    static Session& session() {
+        thread_local Session current(getInstance());
+        return current;
+    }
+
+    void connect(const std::string& connectionString, const ConnectionOptions& connectOptions = {}) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (connected) {
+            throw std::runtime_error("Database already connected!");
+        }
+        validateOptions(connectOptions);
+        std::cout << "Connecting to database: " << connectionString << std::endl;
+        options = connectOptions;
+        try {
+            open();
+        } catch (...) {
+            // Whatever was opened or loaded before the failure goes again,
+            // so the next connect() starts from an empty instance
+            resetLocked();
+            throw;
+        }
+        connected = true;
+    }
+
+    // Close the log and drop the in-memory table. Must not race with
+    // operations still in flight on other threads.
+    void disconnect() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!connected) {
+            throw std::runtime_error("Database not connected!");
+        }
+        resetLocked();
+    }
+
+    // Number of fsyncs issued by the log; with group commit this grows much
+    // more slowly than the number of inserts
+    uint64_t walSyncs() {
+        return wal ? wal->syncs() : 0;
+    }
+
+    // Arena, interning, compression and table footprint summed over all shards
+    ShardTable::StorageStats storageStats() {
+        ShardTable::StorageStats total;
+        for (Shard& shard : shards) {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            ShardTable::StorageStats stats = shard.table.storageStats();
+            total.entries += stats.entries;
+            total.arena_bytes += stats.arena_bytes;
+            total.garbage_bytes += stats.garbage_bytes;
+            total.arena_blocks += stats.arena_blocks;
+            total.interned_values += stats.interned_values;
+            total.intern_hits += stats.intern_hits;
+            total.compactions += stats.compactions;
+            total.table_bytes += stats.table_bytes;
+            total.value_bytes += stats.value_bytes;
+            total.stored_value_bytes += stats.stored_value_bytes;
+            total.compressed_values += stats.compressed_values;
+            total.dictionary_bytes += stats.dictionary_bytes;
+            total.trainings += stats.trainings;
+        }
+        return total;
+    }
+
+    // Hit ratio, evictions and footprint; all zero without a memory budget
+    CacheStats cacheStats() {
+        CacheStats stats;
+        for (Shard& shard : shards) {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            if (!shard.cache) {
+                continue;
+            }
+            stats.hits += shard.hits;
+            stats.misses += shard.misses;
+            stats.evictions += shard.evictions;
+            stats.resident_bytes += shard.cache->residentBytes();
+            stats.entries += shard.table.size();
+        }
+        return stats;
+    }
+
+    TransactionStats transactionStats() {
+        TransactionStats stats;
+        stats.commits = commits;
+        stats.conflicts = conflicts;
+        for (Shard& shard : shards) {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            stats.retained_versions += shard.version_count;
+            stats.collected_versions += shard.collected_versions;
+        }
+        return stats;
+    }
+
+    TtlStats ttlStats() {
+        TtlStats stats;
+        for (Shard& shard : shards) {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            stats.scheduled += shard.expiry.size();
+            stats.expired_on_read += shard.expired_on_read;
+            stats.expired_by_reaper += shard.expired_by_reaper;
+        }
+        stats.reaper_slices = reaper_slices;
+        stats.longest_slice_us = longest_slice_us;
+        stats.longest_slice_cpu_us = longest_slice_cpu_us;
+        stats.slow_slices = slow_slices;
+        return stats;
+    }
+
+    // The keys that were hottest at the last compactor pass, hottest first,
+    // and whether each is replicated. Empty unless hot_keys is set.
+    std::vector<HotKey> hotKeys() {
+        std::lock_guard<std::mutex> lock(hot_mutex);
+        return hot_ranking;
+    }
+
+    // All zero unless hot_keys is set
+    HotKeyStats hotKeyStats() {
+        HotKeyStats stats;
+        if (!replicas) {
+            return stats;
+        }
+        for (Shard& shard : shards) {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            stats.sampled_reads += shard.sampled_reads;
+        }
+        HotReplicas::Stats replica_stats = replicas->stats();
+        stats.replicated = replica_stats.replicated;
+        stats.replica_hits = replica_stats.hits;
+        stats.promotions = replica_stats.promotions;
+        stats.invalidations = replica_stats.invalidations;
+        return stats;
+    }
+
+    ReplicationStats replicationStats() {
+        ReplicationStats stats;
+        if (!ring) {
+            return stats;
+        }
+        stats.leader = !following;
+        stats.follower = following;
+        stats.shipped = shipped_records;
+        stats.applied = applied_records;
+        stats.full_syncs = full_syncs;
+        stats.overruns = replication_overruns;
+        stats.in_flight_bytes = ring->inFlight();
+        if (following) {
+            uint64_t now = nowTick();
+            stats.staleness_ms = synced ? now - std::min<uint64_t>(now, applied_through) : UINT64_MAX;
+            stats.peer_alive = ring->leaderAlive();
+        } else {
+            stats.peer_alive = ring->followerAlive();
+        }
+        return stats;
+    }
+
+    // Turn a follower whose leader has died into a writable database
+    // holding everything the leader shipped. The ring is fenced first, so
+    // a leader that had only stalled fails its next write instead of
+    // diverging. Must not race with other operations on the connection.
+    void promote() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        requireConnected();
+        if (!following) {
+            throw std::runtime_error("Only a follower can be promoted!");
+        }
+        if (ring->leaderAlive()) {
+            throw std::runtime_error("The leader is still running!");
+        }
+        if (!synced) {
+            throw std::runtime_error("The follower has not received a full copy yet!");
+        }
+        stopApplier();
+        ring->setState(ReplicationRing::kFenced);
+        uint64_t lsn = 0;
+        applied_records += ring->consume(ring->head(), [&](const ReplicationRing::Record& record) {
+            applyReplicated(record, lsn);
+        });
+        if (wal && lsn) {
+            wal->waitDurable(lsn);
+        }
+        ring->unlink();
+        ring.reset();
+        following = false;
+        std::cout << "Promoted follower of " << options.follow << " after applying " << applied_records
+                  << " records" << std::endl;
+    }
+
+    // Train the dictionary of every shard that has none yet, or whose
+    // dictionary the background pass would replace, now instead of waiting
+    // for it, e.g. right after a bulk load. Shards it already trained keep
+    // their dictionary, so each is re-encoded once.
+    void trainCompression() {
+        requireConnected();
+        if (!options.compress_values) {
+            throw std::runtime_error("Value compression not enabled!");
+        }
+        for (Shard& shard : shards) {
+            trainDictionary(shard, true);
+        }
+    }
+
+    // LSM engine counters; all zero for the in-memory engine
+    LsmStats lsmStats() {
+        return lsm ? lsm->statistics() : LsmStats{};
+    }
+
+    // Write the merged snapshot and overlay as a new snapshot, map it, and
+    // empty the overlay and the log. Writers are blocked while it runs. With
+    // the LSM engine this flushes the memtable and waits for compaction.
+    void checkpoint() {
+        requireConnected();
+        if (lsm) {
+            lsm->flushAndSettle();
+            return;
+        }
+        if (options.snapshot_path.empty()) {
+            throw std::runtime_error("No snapshot path configured!");
+        }
+        std::vector<std::unique_lock<std::mutex>> locks;
+        for (Shard& shard : shards) {
+            locks.emplace_back(shard.mutex);
+        }
+
+        // The snapshot stores values as written; decompressed ones are kept
+        // here until it has been written
+        std::vector<SnapshotFile::Record> records;
+        std::deque<std::string> decoded;
+        for (const Shard& shard : shards) {
+            shard.table.forEach([&records, &decoded](std::string_view key, std::string_view value,
+                                                     const ShardTable::Entry& entry) {
+                if (entry.compressed) {
+                    value = decoded.emplace_back(value);
+                }
+                records.push_back({key, value});
+            });
+        }
+        if (snapshot) {
+            snapshot->forEach([this, &records](std::string_view key, std::string_view value) {
+                uint64_t hash = hashKey(key);
+                if (!shards[shardOf(hash)].table.find(key, hash)) {
+                    records.push_back({key, value});
+                }
+            });
+        }
+        SnapshotFile::write(options.snapshot_path, records);
+
+        auto mapped = std::make_unique<SnapshotFile>();
+        mapped->open(options.snapshot_path);
+        snapshot = std::move(mapped);
+        for (Shard& shard : shards) {
+            shard.table.clear();
+        }
+        if (wal) {
+            wal->reset();
+        }
+        std::cout << "Checkpointed " << records.size() << " keys to " << options.snapshot_path << std::endl;
+    }
+
+    void insert(const std::string& key, const std::string& value) {
+        write(key, value, std::chrono::milliseconds::zero());
+    }
+
+    // Insert a key that disappears once ttl has passed. Reads check the
+    // deadline themselves, so an expired key is never returned even before
+    // the background reaper removes it. A later insert without a TTL makes
+    // the key permanent again. Not available with the LSM engine, a
+    // snapshot or transactions.
+    void insert(const std::string& key, const std::string& value, std::chrono::milliseconds ttl) {
+        requireConnected();
+        if (ttl <= std::chrono::milliseconds::zero()) {
+            throw std::runtime_error("TTL must be positive!");
+        }
+        if (lsm || snapshot || !options.snapshot_path.empty() || options.transactions) {
+            throw std::runtime_error("TTL is not available with the LSM engine, a snapshot or transactions!");
+        }
+        write(key, value, ttl);
+    }
+
+    std::string query(const std::string& key) {
+        requireConnected();
+        LookupResult result = lookup(key);
+        if (result) {
+            return std::string(*result);
+        }
+        if (result.status() == LookupStatus::kStale) {
+            throw std::runtime_error("Follower is too stale to serve reads!");
+        }
+        throw std::runtime_error("Key not found: " + key);
+    }
+
+    // insert() as a coroutine on executor, for callers that keep many
+    // requests in flight on one thread. Where insert() would block, this
+    // suspends: while the key's shard lock is taken it lets the executor's
+    // other coroutines run and tries again, and once logged it waits for
+    // the executor to run out of ready work before making the write
+    // durable, so one log flush covers every write issued meanwhile. LSM
+    // writes wait for their engine's log the same way.
+    Task<void> insertAsync(Executor& executor, std::string key, std::string value) {
+        requireWritable();
+        if (lsm) {
+            auto [log, lsn] = lsm->putAsync(key, value);
+            if (!log->isDurable(lsn)) {
+                co_await executor.drained();
+                log->waitDurable(lsn);
+            }
+        } else {
+            uint64_t hash = hashKey(key);
+            Shard& shard = shards[shardOf(hash)];
+            std::unique_lock<std::mutex> lock(shard.mutex, std::try_to_lock);
+            while (!lock.owns_lock()) {
+                co_await executor.yield();
+                lock.try_lock();
+            }
+            uint64_t lsn = writeLocked(shard, std::move(lock), key, value, hash, std::chrono::milliseconds::zero());
+            if (wal && !wal->isDurable(lsn)) {
+                co_await executor.drained();
+                wal->waitDurable(lsn);
+            }
+        }
+        if (options.echo_inserts) {
+            std::cout << "Inserted: " << key << " = " << value << std::endl;
+        }
+    }
+
+    // query() as a coroutine on executor, suspending instead of waiting
+    // while the key's shard lock is taken. Returns a copy, since a
+    // borrowed value would hold the lock across suspensions. A follower
+    // waiting to catch up and LSM reads, which may go to disk, wait on one
+    // of the executor's helper threads instead of its own.
+    Task<std::string> queryAsync(Executor& executor, std::string key) {
+        requireConnected();
+        if (boundedFollower() && !freshNow()) {
+            if (!co_await executor.offload([this] { return freshEnough(); })) {
+                throw std::runtime_error("Follower is too stale to serve reads!");
+            }
+        }
+        if (lsm) {
+            std::optional<std::string> value = co_await executor.offload([this, &key] { return lsm->get(key); });
+            if (!value) {
+                throw std::runtime_error("Key not found: " + key);
+            }
+            co_return std::move(*value);
+        }
+        for (;;) {
+            bool busy = false;
+            LookupResult result = tryLookup(key, false, busy, true);
+            if (result) {
+                co_return std::string(*result);
+            }
+            if (result.status() == LookupStatus::kStale) {
+                throw std::runtime_error("Follower is too stale to serve reads!");
+            }
+            if (!busy) {
+                throw std::runtime_error("Key not found: " + key);
+            }
+            co_await executor.yield();
+        }
+    }
+
+    // Like query(), for callers where misses are common: takes any string
+    // view without building a std::string, reports misses and a missing
+    // connection as a status instead of throwing, and borrows the value
+    // instead of copying it (see LookupResult).
+    LookupResult lookup(std::string_view key) {
+        bool busy = false;
+        return tryLookup(key, true, busy);
+    }
+
+    // Insert many pairs, taking each shard lock once for the whole batch
+    void insertBatch(std::span<const std::pair<std::string, std::string>> items) {
+        requireWritable();
+        if (lsm) {
+            insertBatchLsm(items);
+            return;
+        }
+        std::vector<uint64_t> hashes(items.size());
+        for (size_t i = 0; i < items.size(); i++) {
+            hashes[i] = hashKey(items[i].first);
+        }
+        std::vector<uint32_t> order;
+        auto starts = groupByShard(hashes, order);
+
+        uint64_t lsn = 0;
+        std::vector<KeyValue> evicted;
+        for (size_t s = 0; s < kShardCount; s++) {
+            if (starts[s] == starts[s + 1]) {
+                continue;
+            }
+            Shard& shard = shards[s];
+            uint64_t ts = 0;
+            {
+                // Each shard's part of the batch is one write with its own
+                // timestamp; the batch as a whole is not atomic. The
+                // timestamp is drawn once shipping and logging, which can
+                // throw, are done, since one drawn must be published.
+                std::lock_guard<std::mutex> lock(shard.mutex);
+                for (size_t k = starts[s]; k < starts[s + 1]; k++) {
+                    const auto& [key, value] = items[order[k]];
+                    shipLocked(key, value);
+                    if (wal) {
+                        lsn = wal->append(key, value);
+                    }
+                }
+                if (options.transactions) {
+                    ts = stampLocked();
+                }
+                for (size_t k = starts[s]; k < starts[s + 1]; k++) {
+                    if (k + kPrefetchGroup < starts[s + 1]) {
+                        shard.table.prefetchSlot(hashes[order[k + kPrefetchGroup]]);
+                    }
+                    const auto& [key, value] = items[order[k]];
+                    if (ts) {
+                        keepVersionLocked(shard, key, hashes[order[k]], ts);
+                    }
+                    applyLocked(shard, key, value, hashes[order[k]], evicted);
+                }
+            }
+            deliverChanges(shard);
+            if (ts) {
+                publish(ts);
+            }
+        }
+        handOff(evicted);
+        // The whole batch shares one durability wait
+        if (wal) {
+            wal->waitDurable(lsn);
+        }
+        if (options.echo_inserts) {
+            std::cout << "Inserted batch of " << items.size() << " keys" << std::endl;
+        }
+    }
+
+    // Load every "key<delimiter>value" line of a CSV or TSV file (see
+    // parseRows), a later line winning over an earlier one with the same
+    // key. The file is mapped and cut into newline-aligned chunks that
+    // threads parse in parallel, sorting the rows by shard; then each shard
+    // is built by one thread, locked once per window of chunks, with
+    // nothing printed per row. With a log, each chunk's rows for a shard
+    // are one group record. Not available with the LSM engine.
+    BulkLoadStats bulkLoad(const std::string& path, const BulkLoadOptions& load = {}) {
+        requireWritable();
+        if (lsm) {
+            throw std::runtime_error("Bulk loading is not available with the LSM engine!");
+        }
+        auto start = std::chrono::steady_clock::now();
+        MappedFile file(path);
+        std::string_view text = file.bytes();
+        if (load.header) {
+            size_t newline = text.find('\n');
+            text.remove_prefix(newline == std::string_view::npos ? text.size() : newline + 1);
+        }
+        char delimiter = load.delimiter ? load.delimiter : delimiterFor(path);
+        size_t threads = load.threads ? load.threads : std::max(1u, std::thread::hardware_concurrency());
+        std::vector<std::string_view> chunks = splitLines(text, kLoadChunk);
+
+        BulkLoadStats stats;
+        stats.bytes = file.bytes().size();
+        std::vector<LoadChunk> parsed(std::min(chunks.size(), threads * kLoadWindow));
+        std::vector<size_t> malformed(parsed.size(), 0);
+        std::array<uint64_t, kShardCount> lsns{};
+        for (size_t first = 0; first < chunks.size(); first += parsed.size()) {
+            size_t window = std::min(parsed.size(), chunks.size() - first);
+            runParallel(threads, window, [&](size_t c) {
+                for (std::vector<LoadRow>& rows : parsed[c]) {
+                    rows.clear();
+                }
+                malformed[c] += parseRows(chunks[first + c], delimiter, [&](std::string_view key,
+                                                                            std::string_view value) {
+                    uint64_t hash = hashKey(key);
+                    parsed[c][shardOf(hash)].push_back({key, value, hash});
+                });
+            });
+            runParallel(threads, kShardCount, [&](size_t s) {
+                loadShard(s, std::span<const LoadChunk>(parsed).first(window), lsns[s]);
+            });
+            for (size_t c = 0; c < window; c++) {
+                for (const std::vector<LoadRow>& rows : parsed[c]) {
+                    stats.rows += rows.size();
+                }
+            }
+        }
+        for (size_t count : malformed) {
+            stats.malformed += count;
+        }
+        if (wal) {
+            wal->waitDurable(*std::max_element(lsns.begin(), lsns.end()));
+        }
+        stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (options.echo_inserts) {
+            std::cout << "Bulk loaded " << stats.rows << " rows from " << path << std::endl;
+        }
+        return stats;
+    }
+
+    // Look up many keys at once. Misses come back as std::nullopt instead of
+    // throwing, since a partial hit is the normal case for a fan-out request.
+    std::vector<std::optional<std::string>> queryMany(std::span<const std::string> keys) {
+        requireConnected();
+        requireFresh();
+        if (lsm) {
+            std::vector<std::optional<std::string>> results;
+            results.reserve(keys.size());
+            for (const auto& key : keys) {
+                results.push_back(lsm->get(key));
+            }
+            return results;
+        }
+        std::vector<uint64_t> hashes(keys.size());
+        for (size_t i = 0; i < keys.size(); i++) {
+            hashes[i] = hashKey(keys[i]);
+        }
+        std::vector<uint32_t> order;
+        auto starts = groupByShard(hashes, order);
+
+        std::vector<std::optional<std::string>> results(keys.size());
+        for (size_t s = 0; s < kShardCount; s++) {
+            if (starts[s] == starts[s + 1]) {
+                continue;
+            }
+            Shard& shard = shards[s];
+            {
+                std::lock_guard<std::mutex> lock(shard.mutex);
+                std::string scratch;
+                for (size_t group = starts[s]; group < starts[s + 1]; group += kPrefetchGroup) {
+                    size_t group_end = std::min(group + kPrefetchGroup, starts[s + 1]);
+                    for (size_t k = group; k < group_end; k++) {
+                        shard.table.prefetchSlot(hashes[order[k]]);
+                    }
+                    for (size_t k = group; k < group_end; k++) {
+                        shard.table.prefetchEntry(hashes[order[k]]);
+                    }
+                    for (size_t k = group; k < group_end; k++) {
+                        uint32_t i = order[k];
+                        if (auto value = lookupLocked(shard, keys[i], hashes[i], scratch)) {
+                            results[i] = std::string(*value);
+                        }
+                    }
+                }
+            }
+            deliverChanges(shard);
+        }
+        return results;
+    }
+
+    // Every key whose value is value, in order. Needs value_index.
+    std::vector<std::string> keysWithValue(std::string_view value) {
+        requireConnected();
+        if (!options.value_index) {
+            throw std::runtime_error("Value index not enabled!");
+        }
+        requireFresh();
+        uint64_t value_hash = std::hash<std::string_view>{}(value);
+        uint64_t now = nowTick();
+        std::vector<std::string> keys;
+        std::string scratch;
+        for (Shard& shard : shards) {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            const std::vector<uint32_t>* candidates = shard.by_value->find(value_hash);
+            if (!candidates) {
+                continue;
+            }
+            for (uint32_t index : *candidates) {
+                const ShardTable::Entry& entry = shard.table.at(index);
+                uint64_t deadline = shard.expiry.empty() ? 0 : shard.expiry.deadlineOf(index);
+                if ((deadline == 0 || deadline > now) && shard.table.readValue(entry, scratch) == value) {
+                    keys.emplace_back(shard.table.keyOf(entry));
+                }
+            }
+        }
+        std::sort(keys.begin(), keys.end());
+        return keys;
+    }
+
+    // Call callback from a thread of its own with each batch of changes to
+    // keys starting with prefix: inserts, updates, and keys removed by
+    // expiry or eviction. Changes to one key arrive in the order they were
+    // applied. Writers never wait for a watcher; once max_pending changes
+    // are queued for it, further ones are dropped and the next batch says
+    // how many. Returns the id to pass to unwatch(). disconnect() ends
+    // every watch. Not available with the LSM engine.
+    uint64_t watch(std::string prefix, std::function<void(const WatchBatch&)> callback,
+                   size_t max_pending = 1 << 16) {
+        requireConnected();
+        if (lsm) {
+            throw std::runtime_error("Watching is not available with the LSM engine!");
+        }
+        return feed.subscribe(std::move(prefix), std::move(callback), max_pending);
+    }
+
+    // End a watch once the changes already queued for it are delivered.
+    // Must not be called from that watch's own callback.
+    void unwatch(uint64_t id) {
+        if (!feed.unsubscribe(id)) {
+            throw std::runtime_error("No such watch!");
+        }
+    }
+
+    // Forward cursor over keys in order, produced by scan() and range().
+    // Keys are pulled from the ordered index one leaf at a time and values
+    // are looked up as the cursor reaches them, so the work done is
+    // proportional to what is read, not to the size of the table. Keys
+    // inserted while a cursor is open may or may not be seen.
+    class Cursor {
+    private:
+        static constexpr size_t kRefill = 64;
+
+        DatabaseConnection* db;
+        uint64_t read_ts;
+        std::string resume;
+        bool inclusive;
+        std::string hi;
+        bool bounded;
+        size_t remaining;
+        std::vector<std::string> keys;
+        size_t pos;
+        bool more;
+        std::string current_value;
+
+        // Advance to the next key that still has a value
+        void settle() {
+            while (remaining > 0) {
+                if (pos == keys.size()) {
+                    if (!more) {
+                        break;
+                    }
+                    keys.clear();
+                    pos = 0;
+                    more = db->ordered->collect(resume, inclusive, bounded ? &hi : nullptr, kRefill, keys);
+                    if (keys.empty()) {
+                        break;
+                    }
+                    resume = keys.back();
+                    inclusive = false;
+                }
+                if (auto value = db->lookupCopy(keys[pos], read_ts)) {
+                    current_value = std::move(*value);
+                    return;
+                }
+                pos++;
+            }
+            keys.clear();
+            pos = 0;
+            remaining = 0;
+        }
+
+    public:
+        Cursor(DatabaseConnection* owner, std::string lo, std::optional<std::string> upper, size_t limit,
+               uint64_t snapshot = kLatest)
+            : db(owner), read_ts(snapshot), resume(std::move(lo)), inclusive(true), hi(upper.value_or("")),
+              bounded(upper.has_value()), remaining(limit), pos(0), more(true) {
+            settle();
+        }
+
+        bool valid() const { return pos < keys.size(); }
+        const std::string& key() const { return keys[pos]; }
+        const std::string& value() const { return current_value; }
+
+        void next() {
+            pos++;
+            remaining--;
+            settle();
+        }
+    };
+
+    // All keys starting with prefix, in order
+    Cursor scan(const std::string& prefix) {
+        return scanAt(prefix, kLatest);
+    }
+
+    // Keys in [lo, hi), at most limit of them
+    Cursor range(const std::string& lo, const std::string& hi, size_t limit = SIZE_MAX) {
+        requireOrderedIndex();
+        requireFresh();
+        return Cursor(this, lo, hi, limit);
+    }
+
+    // Snapshot transaction from begin(). Reads see the database as of
+    // begin() plus the transaction's own puts; puts stay private until
+    // commit(), which applies all of them atomically or, if another write
+    // to one of the keys committed since begin(), none of them. Readers
+    // never block writers: overwritten values are kept for as long as an
+    // open transaction may read them. A transaction is used by one thread.
+    class Transaction {
+    private:
+        DatabaseConnection* db;
+        uint64_t read_ts;
+        std::map<std::string, std::string> writes;
+
+        void requireOpen() const {
+            if (!db) {
+                throw std::runtime_error("Transaction already finished!");
+            }
+        }
+
+        void finish() {
+            db->closeSnapshot(read_ts);
+            db = nullptr;
+        }
+
+    public:
+        Transaction(DatabaseConnection* owner, uint64_t snapshot) : db(owner), read_ts(snapshot) {}
+
+        Transaction(Transaction&& other) noexcept
+            : db(std::exchange(other.db, nullptr)), read_ts(other.read_ts), writes(std::move(other.writes)) {}
+
+        Transaction(const Transaction&) = delete;
+        Transaction& operator=(const Transaction&) = delete;
+        Transaction& operator=(Transaction&&) = delete;
+
+        ~Transaction() {
+            if (db) {
+                finish();
+            }
+        }
+
+        std::optional<std::string> get(const std::string& key) const {
+            requireOpen();
+            auto it = writes.find(key);
+            if (it != writes.end()) {
+                return it->second;
+            }
+            return db->lookupCopy(key, read_ts);
+        }
+
+        void put(const std::string& key, const std::string& value) {
+            requireOpen();
+            writes[key] = value;
+        }
+
+        // Keys starting with prefix as of begin(); the transaction's own
+        // puts are not included. Needs the ordered index.
+        Cursor scan(const std::string& prefix) const {
+            requireOpen();
+            return db->scanAt(prefix, read_ts);
+        }
+
+        // Returns false, discarding the puts, if the transaction lost a
+        // write conflict; the caller may retry with a new transaction
+        bool commit() {
+            requireOpen();
+            bool committed = db->commitWrites(read_ts, writes);
+            finish();
+            return committed;
+        }
+
+        void rollback() {
+            requireOpen();
+            finish();
+        }
+    };
+
+    Transaction begin() {
+        requireWritable();
+        if (!options.transactions) {
+            throw std::runtime_error("Transactions not enabled!");
+        }
+        return Transaction(this, openSnapshot());
+    }
+
+private:
+    // insert() with an optional TTL; zero means none
+    void write(const std::string& key, const std::string& value, std::chrono::milliseconds ttl) {
+        requireWritable();
+        if (lsm) {
+            lsm->put(key, value);
+        } else {
+            uint64_t hash = hashKey(key);
+            Shard& shard = shards[shardOf(hash)];
+            std::unique_lock<std::mutex> lock(shard.mutex);
+            uint64_t lsn = writeLocked(shard, std::move(lock), key, value, hash, ttl);
+            if (wal) {
+                wal->waitDurable(lsn);
+            }
+        }
+        if (options.echo_inserts) {
+            std::cout << "Inserted: " << key << " = " << value << std::endl;
+        }
+    }
+
+    // The part of write() done under the shard lock, which it releases
+    // before handing off evictions. Returns the log position to wait for.
+    uint64_t writeLocked(Shard& shard, std::unique_lock<std::mutex> lock, std::string_view key,
+                         std::string_view value, uint64_t hash, std::chrono::milliseconds ttl) {
+        uint64_t lsn = 0;
+        uint64_t ts = 0;
+        uint64_t deadline = ttl.count() > 0 ? nowTick() + ttl.count() : 0;
+        std::vector<KeyValue> evicted;
+        // Logging and shipping under the shard lock keeps log order equal
+        // to apply order for any single key
+        shipLocked(key, value, deadline ? wallMillis() + ttl.count() : 0);
+        if (wal) {
+            lsn = deadline ? wal->appendExpiring(key, value, wallMillis() + ttl.count()) : wal->append(key, value);
+        }
+        if (options.transactions) {
+            ts = stampLocked();
+            keepVersionLocked(shard, key, hash, ts);
+        }
+        applyLocked(shard, key, value, hash, evicted, deadline);
+        lock.unlock();
+        deliverChanges(shard);
+        if (ts) {
+            publish(ts);
+        }
+        handOff(evicted);
+        return lsn;
+    }
+
+    Cursor scanAt(const std::string& prefix, uint64_t read_ts) {
+        requireOrderedIndex();
+        requireFresh();
+        // The first string greater than every key with this prefix
+        std::string upper = prefix;
+        while (!upper.empty() && static_cast<unsigned char>(upper.back()) == 0xFF) {
+            upper.pop_back();
+        }
+        if (upper.empty()) {
+            return Cursor(this, prefix, std::nullopt, SIZE_MAX, read_ts);
+        }
+        upper.back() = static_cast<char>(upper.back() + 1);
+        return Cursor(this, prefix, upper, SIZE_MAX, read_ts);
+    }
+};
+
+#endif // DATABASE_CONNECTION_H
@@ -1,68 +1,14 @@
 #include <iostream>
-#include <unordered_map>
 #include <string>
-#include <mutex>
-#include <memory>
-#include <stdexcept>
-
-class DatabaseConnection {
-private:
-    static std::unique_ptr<DatabaseConnection> instance;
-    static std::mutex mutex_;
-    std::unordered_map<std::string, std::string> data;
-    bool connected;
-
-    // Private constructor
-    DatabaseConnection() : connected(false) {}
-
-    // Delete copy constructor and assignment operator
-    DatabaseConnection(const DatabaseConnection&) = delete;
-    DatabaseConnection& operator=(const DatabaseConnection&) = delete;
-
-public:
-    static DatabaseConnection& getInstance() {
-        std::lock_guard<std::mutex> lock(mutex_);
-        if (!instance) {
-            instance.reset(new DatabaseConnection());
-        }
-        return *instance;
-    }
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <cstdio>
+#include <cmath>
+#include <random>
+#include <atomic>
 
-    void connect(const std::string& connectionString) {
-        std::lock_guard<std::mutex> lock(mutex_);
-        if (connected) {
-            throw std::runtime_error("Database already connected!");
-        }
-        // Simulate database connection
-        std::cout << "Connecting to database: " << connectionString << std::endl;
-        connected = true;
-    }
-
-    void insert(const std::string& key, const std::string& value) {
-        std::lock_guard<std::mutex> lock(mutex_);
-        if (!connected) {
-            throw std::runtime_error("Database not connected!");
-        }
-        data[key] = value;
-        std::cout << "Inserted: " << key << " = " << value << std::endl;
-    }
-
-    std::string query(const std::string& key) {
-        std::lock_guard<std::mutex> lock(mutex_);
-        if (!connected) {
-            throw std::runtime_error("Database not connected!");
-        }
-        auto it = data.find(key);
-        if (it != data.end()) {
-            return it->second;
-        }
-        throw std::runtime_error("Key not found: " + key);
-    }
-};
-
-// Initialize static members
-std::unique_ptr<DatabaseConnection> DatabaseConnection::instance;
-std::mutex DatabaseConnection::mutex_;
+#include "database_connection.h"
 
 int main() {
     try {
@@ -83,7 +29,7 @@ int main() {
 
         // Get another instance (will be the same instance)
         DatabaseConnection& db2 = DatabaseConnection::getInstance();
-        
+
         // Query data using second instance
         std::cout << "Query result: " << db2.query("user1") << std::endl;
 
@@ -92,8 +38,397 @@ int main() {
             std::cout << "Both database connections are the same instance!" << std::endl;
         }
 
+        // Batched insert and lookup: one lock per shard, misses as nullopt
+        std::vector<std::pair<std::string, std::string>> batch;
+        for (int i = 0; i < 200000; i++) {
+            batch.emplace_back("item" + std::to_string(i), "value" + std::to_string(i));
+        }
+        db1.insertBatch(batch);
+
+        std::vector<std::string> keys = {"user2", "item42", "missing", "item199999"};
+        auto results = db2.queryMany(keys);
+        for (size_t i = 0; i < keys.size(); i++) {
+            std::cout << "queryMany " << keys[i] << ": "
+                      << (results[i] ? *results[i] : "<not found>") << std::endl;
+        }
+
+        // Compare a fan-out of single lookups against one batched lookup
+        std::vector<std::string> fanout;
+        for (int i = 0; i < 200000; i += 2) {
+            fanout.push_back("item" + std::to_string((i * 7919) % 200000));
+        }
+        auto start = std::chrono::steady_clock::now();
+        size_t single_hits = 0;
+        for (const auto& key : fanout) {
+            single_hits += db1.query(key).size() > 0;
+        }
+        auto mid = std::chrono::steady_clock::now();
+        size_t batch_hits = 0;
+        for (const auto& value : db1.queryMany(fanout)) {
+            batch_hits += value.has_value();
+        }
+        auto end = std::chrono::steady_clock::now();
+        std::cout << "Single lookups: " << single_hits << " hits in "
+                  << std::chrono::duration_cast<std::chrono::microseconds>(mid - start).count() << " us\n";
+        std::cout << "Batched lookup: " << batch_hits << " hits in "
+                  << std::chrono::duration_cast<std::chrono::microseconds>(end - mid).count() << " us\n";
+
+        // Durable inserts: every insert is logged and acknowledged only after
+        // an fsync, but concurrent inserts share that fsync
+        db1.disconnect();
+        const std::string wal_path = "database_demo.wal";
+        std::remove(wal_path.c_str());
+        ConnectionOptions durable;
+        durable.wal_path = wal_path;
+        db1.connect("mysql://localhost:3306/mydb", durable);
+        db1.insert("user1", "John Doe");
+        db1.insert("user3", "Max Mustermann");
+        db1.disconnect();
+        db1.connect("mysql://localhost:3306/mydb", durable);
+        std::cout << "After replay: user3 = " << db1.query("user3") << std::endl;
+        db1.disconnect();
+
+        auto insertRate = [&db1](const ConnectionOptions& connectOptions) {
+            const int threads = 32;
+            const int per_thread = 500;
+            db1.connect("mysql://localhost:3306/mydb", connectOptions);
+            auto begin = std::chrono::steady_clock::now();
+            std::vector<std::thread> writers;
+            for (int t = 0; t < threads; t++) {
+                writers.emplace_back([&db1, t]() {
+                    for (int i = 0; i < per_thread; i++) {
+                        db1.insert("bench" + std::to_string(t) + ":" + std::to_string(i), "payload");
+                    }
+                });
+            }
+            for (auto& writer : writers) {
+                writer.join();
+            }
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+            uint64_t syncs = db1.walSyncs();
+            std::cout << "  " << threads * per_thread / seconds << " inserts/sec, " << syncs << " fsyncs";
+            if (syncs > 0) {
+                std::cout << ", " << double(threads * per_thread) / syncs << " inserts per fsync";
+            }
+            std::cout << std::endl;
+            db1.disconnect();
+        };
+        std::remove(wal_path.c_str());
+        ConnectionOptions quiet_memory;
+        quiet_memory.echo_inserts = false;
+        ConnectionOptions quiet_durable = durable;
+        quiet_durable.echo_inserts = false;
+        std::cout << "In-memory inserts:" << std::endl;
+        insertRate(quiet_memory);
+        // Each durable insert blocks its thread until the fsync, so with 32
+        // writers a group holds at most 32 inserts and every insert costs a
+        // sleep and a wakeup; that, more than the fsyncs, is what the rate
+        // gives up against memory. insertBatch() and insertAsync() share an
+        // fsync among many more writes.
+        std::cout << "Durable inserts with group commit:" << std::endl;
+        insertRate(quiet_durable);
+        std::remove(wal_path.c_str());
+
+        // Checkpoint to a memory-mapped snapshot; reconnecting maps it
+        // instead of rebuilding the table
+        const std::string snapshot_path = "database_demo.snap";
+        ConnectionOptions mapped;
+        mapped.wal_path = wal_path;
+        mapped.snapshot_path = snapshot_path;
+        mapped.echo_inserts = false;
+        db1.connect("mysql://localhost:3306/mydb", mapped);
+        db1.insertBatch(batch);
+        db1.checkpoint();
+        db1.insert("item42", "overwritten after checkpoint");
+        db1.disconnect();
+        db1.connect("mysql://localhost:3306/mydb", mapped);
+        std::cout << "From snapshot: item7 = " << db1.query("item7") << std::endl;
+        std::cout << "From overlay: item42 = " << db1.query("item42") << std::endl;
+        db1.disconnect();
+        std::remove(wal_path.c_str());
+        std::remove(snapshot_path.c_str());
+
+        // Ordered index: prefix and range scans walk only the matching keys
+        ConnectionOptions indexed;
+        indexed.ordered_index = true;
+        indexed.echo_inserts = false;
+        db1.connect("mysql://localhost:3306/mydb", indexed);
+        db1.insertBatch(batch);
+        db1.insert("user:1001", "John Doe");
+        db1.insert("user:1002", "Jane Smith");
+        db1.insert("user:1003", "Max Mustermann");
+        db1.insert("userz", "not a user: key");
+        for (auto cursor = db1.scan("user:"); cursor.valid(); cursor.next()) {
+            std::cout << "scan user: " << cursor.key() << " = " << cursor.value() << std::endl;
+        }
+        for (auto cursor = db1.range("item100", "item101", 3); cursor.valid(); cursor.next()) {
+            std::cout << "range: " << cursor.key() << " = " << cursor.value() << std::endl;
+        }
+        auto scan_start = std::chrono::steady_clock::now();
+        size_t scanned = 0;
+        for (auto cursor = db1.scan("item19999"); cursor.valid(); cursor.next()) {
+            scanned++;
+        }
+        std::cout << "Prefix scan found " << scanned << " of " << batch.size() << " keys in "
+                  << std::chrono::duration_cast<std::chrono::microseconds>(
+                         std::chrono::steady_clock::now() - scan_start).count()
+                  << " us" << std::endl;
+        db1.disconnect();
+
+        // Cache mode: a byte budget with W-TinyLFU eviction. A skewed read
+        // stream keeps its hot keys resident even while a one-off scan of
+        // cold keys streams through.
+        ConnectionOptions cache;
+        cache.memory_budget = 4 << 20;
+        cache.echo_inserts = false;
+        size_t cold_tier = 0;
+        cache.on_evict = [&cold_tier](const std::string&, const std::string&) { cold_tier++; };
+        db1.connect("mysql://localhost:3306/mydb", cache);
+        std::mt19937 rng(7);
+        std::vector<std::string> one_key(1);
+        for (int i = 0; i < 300000; i++) {
+            // Roughly Zipfian: low ids are far more popular
+            double u = std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+            one_key[0] = "hot" + std::to_string(static_cast<int>(std::pow(100000.0, u)));
+            if (!db1.queryMany(one_key)[0]) {
+                db1.insert(one_key[0], std::string(100, 'h'));
+            }
+            if (i % 3 == 0) {
+                db1.insert("scan" + std::to_string(i), std::string(100, 's'));
+            }
+        }
+        CacheStats stats = db1.cacheStats();
+        std::cout << "Cache: hit ratio " << stats.hitRatio() << ", " << stats.evictions << " evictions ("
+                  << cold_tier << " handed to cold tier), " << stats.entries << " entries in "
+                  << stats.resident_bytes << " of " << cache.memory_budget << " bytes" << std::endl;
+        db1.disconnect();
+
+        // Arena storage with interning: many small records whose values
+        // repeat. Rewriting every record turns the old bytes into garbage,
+        // which the background compactor reclaims.
+        ConnectionOptions arena;
+        arena.intern_values = true;
+        arena.echo_inserts = false;
+        db1.connect("mysql://localhost:3306/mydb", arena);
+        const char* statuses[] = {"active", "suspended", "pending-verification", "closed"};
+        std::vector<std::pair<std::string, std::string>> records;
+        for (int i = 0; i < 500000; i++) {
+            records.emplace_back("account:" + std::to_string(i), statuses[i % 4]);
+        }
+        db1.insertBatch(records);
+        auto storage = db1.storageStats();
+        std::cout << "Arena: " << storage.entries << " entries, "
+                  << (storage.arena_bytes + storage.table_bytes) / storage.entries << " bytes/entry, "
+                  << storage.interned_values << " distinct values shared " << storage.intern_hits
+                  << " times, " << storage.arena_blocks << " arena blocks" << std::endl;
+        for (int version = 1; version <= 3; version++) {
+            for (auto& record : records) {
+                record.second = "migrated-v" + std::to_string(version) + ":" + record.first;
+            }
+            db1.insertBatch(records);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(300));
+        storage = db1.storageStats();
+        std::cout << "After rewrites: " << storage.compactions << " compactions, "
+                  << storage.garbage_bytes << " garbage bytes left of " << storage.arena_bytes
+                  << "; " << db1.query("account:42") << std::endl;
+        db1.disconnect();
+
+        // Snapshot transactions: writers move money between accounts while
+        // an analytics thread sums every balance from a snapshot. The total
+        // never changes, and the scans do not hold up the transfers.
+        ConnectionOptions mvcc;
+        mvcc.transactions = true;
+        mvcc.ordered_index = true;
+        mvcc.echo_inserts = false;
+        db1.connect("mysql://localhost:3306/mydb", mvcc);
+        const int accounts = 100;
+        auto accountKey = [](int i) {
+            char key[16];
+            std::snprintf(key, sizeof(key), "acct:%03d", i);
+            return std::string(key);
+        };
+        for (int i = 0; i < accounts; i++) {
+            db1.insert(accountKey(i), "1000");
+        }
+        std::atomic<bool> transfers_done{false};
+        std::vector<std::thread> tellers;
+        for (int t = 0; t < 4; t++) {
+            tellers.emplace_back([&db1, &accountKey, t]() {
+                std::mt19937 pick(t);
+                for (int n = 0; n < 5000; n++) {
+                    std::string from = accountKey(pick() % accounts);
+                    std::string to = accountKey(pick() % accounts);
+                    if (from == to) {
+                        continue;
+                    }
+                    // Retry until no other transfer touched either account
+                    for (;;) {
+                        auto tx = db1.begin();
+                        int amount = static_cast<int>(pick() % 50);
+                        tx.put(from, std::to_string(std::stoi(*tx.get(from)) - amount));
+                        tx.put(to, std::to_string(std::stoi(*tx.get(to)) + amount));
+                        if (tx.commit()) {
+                            break;
+                        }
+                    }
+                }
+            });
+        }
+        size_t audits = 0;
+        size_t inconsistent = 0;
+        std::thread auditor([&]() {
+            while (!transfers_done) {
+                auto tx = db1.begin();
+                long total = 0;
+                for (auto cursor = tx.scan("acct:"); cursor.valid(); cursor.next()) {
+                    total += std::stol(cursor.value());
+                }
+                tx.rollback();
+                audits++;
+                inconsistent += total != accounts * 1000;
+            }
+        });
+        for (auto& teller : tellers) {
+            teller.join();
+        }
+        transfers_done = true;
+        auditor.join();
+        std::this_thread::sleep_for(std::chrono::milliseconds(300));
+        TransactionStats tx_stats = db1.transactionStats();
+        std::cout << "Transactions: " << tx_stats.commits << " commits, " << tx_stats.conflicts
+                  << " conflicts retried; " << audits << " snapshot audits, " << inconsistent
+                  << " inconsistent; " << tx_stats.collected_versions << " old versions collected, "
+                  << tx_stats.retained_versions << " retained" << std::endl;
+        db1.disconnect();
+
+        // Per-thread sessions: each worker reaches the instance through its
+        // own session, which batches its puts and counts its own traffic
+        // without touching any shared lock or counter
+        ConnectionOptions quiet;
+        quiet.echo_inserts = false;
+        db1.connect("mysql://localhost:3306/mydb", quiet);
+        std::vector<std::thread> workers;
+        std::vector<DatabaseConnection::Session::Stats> session_stats(4);
+        for (int t = 0; t < 4; t++) {
+            workers.emplace_back([&session_stats, t]() {
+                DatabaseConnection::Session& session = DatabaseConnection::session();
+                for (int i = 0; i < 10000; i++) {
+                    session.put("session:" + std::to_string(t) + ":" + std::to_string(i), std::to_string(i));
+                    if (i % 500 == 0) {
+                        session.lookup("session:" + std::to_string((t + 1) % 4) + ":" + std::to_string(i));
+                    }
+                }
+                session.flush();
+                session_stats[t] = session.stats();
+            });
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        for (int t = 0; t < 4; t++) {
+            const auto& s = session_stats[t];
+            std::cout << "Session " << t << ": " << s.writes << " writes in " << s.flushes << " batches, "
+                      << s.hits << "/" << s.reads << " reads hit" << std::endl;
+        }
+        std::cout << "Same instance from sessions: " << std::boolalpha
+                  << (&DatabaseConnection::session().database() == &db1) << std::endl;
+
+        // A borrowed result holds its shard's lock, so the session keeps
+        // buffering past its batch size instead of flushing into that shard,
+        // and refuses an explicit flush until the result is gone
+        DatabaseConnection::Session& session = DatabaseConnection::session();
+        size_t flushes_before = session.stats().flushes;
+        {
+            LookupResult borrowed = session.lookup("session:0:0");
+            for (size_t i = 0; i < 2 * DatabaseConnection::Session::kBatch; i++) {
+                session.put("borrowed:" + std::to_string(i), std::string(borrowed.value()));
+            }
+            bool refused = false;
+            try {
+                session.flush();
+            } catch (const std::runtime_error&) {
+                refused = true;
+            }
+            if (!borrowed || session.stats().flushes != flushes_before || !refused) {
+                throw std::logic_error("Session flushed while a borrowed result was alive");
+            }
+        }
+        session.put("borrowed:last", "0");
+        if (session.stats().flushes != flushes_before + 1 || !db1.lookup("borrowed:0")) {
+            throw std::logic_error("Session did not flush once the borrowed result was gone");
+        }
+        std::cout << "Session buffered " << 2 * DatabaseConnection::Session::kBatch
+                  << " puts while a borrowed result was alive, then flushed" << std::endl;
+        db1.disconnect();
+
+        // Expiring keys: a million sessions with TTLs spread over half a
+        // second. Reads never see an expired key, and the reaper removes
+        // them in short slices instead of one long sweep.
+        db1.connect("mysql://localhost:3306/mydb", quiet);
+        auto loaded = std::chrono::steady_clock::now();
+        for (int i = 0; i < 1000000; i++) {
+            db1.insert("token:" + std::to_string(i), "session-data", std::chrono::milliseconds(2000 + i % 500));
+        }
+        db1.insert("token:permanent", "kept");
+        auto last_insert = std::chrono::steady_clock::now();
+        TtlStats ttl = db1.ttlStats();
+        std::cout << "TTL: " << ttl.scheduled << " keys scheduled to expire" << std::endl;
+        std::this_thread::sleep_until(loaded + std::chrono::milliseconds(2250));
+        std::cout << "After 2.25 s: token:0 is " << (db1.lookup("token:0") ? "present" : "gone")
+                  << ", token:499 is " << (db1.lookup("token:499") ? "present" : "gone") << std::endl;
+        std::this_thread::sleep_until(last_insert + std::chrono::milliseconds(2600));
+        ttl = db1.ttlStats();
+        std::cout << "Once every TTL has run out: " << ttl.scheduled << " scheduled, " << ttl.expired_by_reaper
+                  << " expired by the reaper in " << ttl.reaper_slices << " slices (longest "
+                  << ttl.longest_slice_cpu_us << " us of reaping, " << ttl.longest_slice_us
+                  << " us by the clock; " << ttl.slow_slices << " over 1 ms), " << ttl.expired_on_read
+                  << " on read; "
+                  << db1.storageStats().entries << " keys left, token:permanent = "
+                  << db1.query("token:permanent") << std::endl;
+        // The clock also counts time the reaper was descheduled mid-slice,
+        // which on a busy or single-CPU machine can take milliseconds. The
+        // reaping itself stays well under one; on a virtual machine the
+        // host may still stall a rare slice past it, but never more than
+        // one in a thousand.
+        if (ttl.slow_slices * 1000 > ttl.reaper_slices) {
+            throw std::logic_error("Reaper slices ran for a millisecond or more");
+        }
+        db1.disconnect();
+
+        // A refused connect leaves nothing behind: neither one rejected for
+        // its options nor one that fails halfway, after replaying the log,
+        // keeps the instance from connecting again
+        std::remove(wal_path.c_str());
+        db1.connect("mysql://localhost:3306/mydb", quiet_durable);
+        db1.insert("left:behind", "replayed");
+        db1.disconnect();
+        ConnectionOptions conflicting;
+        conflicting.lsm_directory = "database_demo.lsm";
+        conflicting.ordered_index = true;
+        ConnectionOptions failing = quiet_durable;
+        failing.follow = "/database_demo_no_such_ring";
+        for (const ConnectionOptions* refused : {&conflicting, &failing}) {
+            try {
+                db1.connect("mysql://localhost:3306/mydb", *refused);
+                throw std::logic_error("connect() accepted options it should refuse");
+            } catch (const std::runtime_error& e) {
+                std::cout << "Expected error: " << e.what() << std::endl;
+            }
+        }
+        ConnectionOptions plain_indexed = indexed;
+        db1.connect("mysql://localhost:3306/mydb", plain_indexed);
+        if (db1.lookup("left:behind") || db1.scan("left:").valid()) {
+            throw std::logic_error("A refused connect left keys behind");
+        }
+        std::cout << "Connected again after refused connects, with nothing left behind" << std::endl;
+        db1.disconnect();
+        std::remove(wal_path.c_str());
+
     } catch (const std::exception& e) {
+        // Includes the self-checks above, which must fail the run
         std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
     }
 
     return 0;
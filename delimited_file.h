@@ -0,0 +1,115 @@
+#ifndef DELIMITED_FILE_H
+#define DELIMITED_FILE_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Read-only memory mapping of a whole file
+class MappedFile {
+private:
+    int fd;
+    const char* base;
+    size_t length;
+
+public:
+    explicit MappedFile(const std::string& path) : fd(-1), base(nullptr), length(0) {
+        fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("Cannot open " + path + ": " + std::strerror(errno));
+        }
+        struct stat info;
+        if (::fstat(fd, &info) != 0) {
+            ::close(fd);
+            throw std::runtime_error("Cannot stat " + path + ": " + std::strerror(errno));
+        }
+        length = static_cast<size_t>(info.st_size);
+        if (length == 0) {
+            return;
+        }
+        void* mapping = ::mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+        if (mapping == MAP_FAILED) {
+            ::close(fd);
+            throw std::runtime_error("Cannot map " + path + ": " + std::strerror(errno));
+        }
+        base = static_cast<const char*>(mapping);
+        // Read ahead aggressively and drop pages behind the reader
+        ::madvise(mapping, length, MADV_SEQUENTIAL);
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+        if (base) {
+            ::munmap(const_cast<char*>(base), length);
+        }
+        ::close(fd);
+    }
+
+    std::string_view bytes() const { return std::string_view(base, length); }
+};
+
+// Field separator for a file: a tab for .tsv, a comma for anything else
+inline char delimiterFor(const std::string& path) {
+    return path.size() >= 4 && path.compare(path.size() - 4, 4, ".tsv") == 0 ? '\t' : ',';
+}
+
+// Cut text into pieces of about chunk_bytes that each end just after a
+// newline (or at the end of the text), so no line spans two pieces and
+// each can be parsed on its own
+inline std::vector<std::string_view> splitLines(std::string_view text, size_t chunk_bytes) {
+    std::vector<std::string_view> chunks;
+    size_t start = 0;
+    while (start < text.size()) {
+        size_t end = std::min(text.size(), start + chunk_bytes);
+        if (end < text.size()) {
+            const void* newline = std::memchr(text.data() + end, '\n', text.size() - end);
+            end = newline ? static_cast<const char*>(newline) - text.data() + 1 : text.size();
+        }
+        chunks.push_back(text.substr(start, end - start));
+        start = end;
+    }
+    return chunks;
+}
+
+// Call visit(key, value) for every line "key<delimiter>value" of chunk. The
+// value is the rest of the line, delimiters included, without a trailing
+// \r. Fields are not unquoted. Empty lines are skipped; returns the number
+// of other lines that had no delimiter, which are skipped too.
+template<typename Visit>
+size_t parseRows(std::string_view chunk, char delimiter, Visit visit) {
+    size_t malformed = 0;
+    const char* p = chunk.data();
+    const char* end = p + chunk.size();
+    while (p < end) {
+        const char* line_end = static_cast<const char*>(std::memchr(p, '\n', end - p));
+        if (!line_end) {
+            line_end = end;
+        }
+        const char* content_end = line_end;
+        if (content_end > p && content_end[-1] == '\r') {
+            content_end--;
+        }
+        if (content_end > p) {
+            const char* split = static_cast<const char*>(std::memchr(p, delimiter, content_end - p));
+            if (split) {
+                visit(std::string_view(p, split - p), std::string_view(split + 1, content_end - split - 1));
+            } else {
+                malformed++;
+            }
+        }
+        p = line_end + 1;
+    }
+    return malformed;
+}
+
+#endif // DELIMITED_FILE_H
@@ -0,0 +1,102 @@
+#ifndef FILE_IO_H
+#define FILE_IO_H
+
+#include <array>
+#include <string>
+#include <string_view>
+#include <stdexcept>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Bitwise-reflected CRC-32 (IEEE polynomial), used to detect torn or
+// corrupted log records
+inline uint32_t crc32(std::string_view bytes) {
+    static const std::array<uint32_t, 256> table = [] {
+        std::array<uint32_t, 256> t{};
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int bit = 0; bit < 8; bit++) {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            t[i] = c;
+        }
+        return t;
+    }();
+    uint32_t crc = 0xFFFFFFFFu;
+    for (unsigned char byte : bytes) {
+        crc = table[(crc ^ byte) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFu;
+}
+
+// Fixed-width integers in files are little-endian whatever the host is
+inline void putLittleEndian32(char* out, uint32_t v) {
+    for (int i = 0; i < 4; i++) {
+        out[i] = static_cast<char>(v >> (8 * i));
+    }
+}
+
+inline void putLittleEndian64(char* out, uint64_t v) {
+    for (int i = 0; i < 8; i++) {
+        out[i] = static_cast<char>(v >> (8 * i));
+    }
+}
+
+inline uint32_t getLittleEndian32(const char* p) {
+    const unsigned char* u = reinterpret_cast<const unsigned char*>(p);
+    return u[0] | (u[1] << 8) | (u[2] << 16) | (static_cast<uint32_t>(u[3]) << 24);
+}
+
+inline uint64_t getLittleEndian64(const char* p) {
+    return getLittleEndian32(p) | (static_cast<uint64_t>(getLittleEndian32(p + 4)) << 32);
+}
+
+// Flush file data to stable storage
+inline void syncFile(int fd) {
+#ifdef __APPLE__
+    // fsync on macOS does not flush the drive cache
+    if (fcntl(fd, F_FULLFSYNC) == 0) {
+        return;
+    }
+    if (fsync(fd) != 0) {
+#else
+    if (fdatasync(fd) != 0) {
+#endif
+        throw std::runtime_error(std::string("WAL sync failed: ") + std::strerror(errno));
+    }
+}
+
+// Make a rename or file creation inside directory durable: the new
+// directory entry is only on disk once the directory itself is synced
+inline void syncDirectory(const std::string& directory) {
+    int fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY);
+    if (fd < 0) {
+        throw std::runtime_error("Cannot open directory " + directory + ": " + std::strerror(errno));
+    }
+    int result = fsync(fd);
+    int error = errno;
+    ::close(fd);
+    if (result != 0) {
+        throw std::runtime_error("Directory sync of " + directory + " failed: " + std::strerror(error));
+    }
+}
+
+// Write every byte, retrying short writes and interrupted calls
+inline void writeFully(int fd, std::string_view bytes, const char* what) {
+    size_t done = 0;
+    while (done < bytes.size()) {
+        ssize_t n = ::write(fd, bytes.data() + done, bytes.size() - done);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::runtime_error(std::string(what) + " failed: " + std::strerror(errno));
+        }
+        done += static_cast<size_t>(n);
+    }
+}
+
+#endif // FILE_IO_H
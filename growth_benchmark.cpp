@@ -0,0 +1,141 @@
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <stdexcept>
+#include <exception>
+#include <cstdio>
+#include <cstdlib>
+#include <sys/resource.h>
+
+#include "database_connection.h"
+
+// Inserts keys into an empty DatabaseConnection, so every shard's table
+// grows through many doublings, optionally while a second thread queries
+// keys already inserted. Reports latency percentiles for both; the
+// slowest operations are the ones that hit a table while it grew. On a
+// machine with fewer cores than threads, scheduling delays show up too:
+// an operation the kernel preempts mid-way waits out the other thread's
+// time slice, a few milliseconds. To tell the two apart, each thread's
+// count of operations over a millisecond is printed next to the number of
+// times the kernel preempted it.
+// Usage: growth_benchmark [keys] [with_reader]
+
+std::string makeKey(size_t i) {
+    char key[32];
+    std::snprintf(key, sizeof(key), "key:%012zu", i);
+    return key;
+}
+
+// Times the calling thread was preempted so far
+long preemptions() {
+    rusage usage;
+    getrusage(RUSAGE_THREAD, &usage);
+    return usage.ru_nivcsw;
+}
+
+void report(const std::string& label, std::vector<uint32_t>& nanos, long preempted) {
+    size_t over_ms = std::count_if(nanos.begin(), nanos.end(), [](uint32_t n) { return n >= 1000000; });
+    std::sort(nanos.begin(), nanos.end());
+    auto at = [&nanos](double q) {
+        return nanos[std::min(nanos.size() - 1, static_cast<size_t>(q * nanos.size()))] / 1000.0;
+    };
+    std::cout << std::left << std::setw(8) << label << std::right << std::fixed << std::setprecision(1)
+              << " p50 " << std::setw(7) << at(0.5) << " us  p99 " << std::setw(7) << at(0.99)
+              << " us  p99.99 " << std::setw(8) << at(0.9999) << " us  max " << std::setw(9)
+              << nanos.back() / 1000.0 << " us" << std::endl;
+    std::cout << std::setw(8) << "" << " " << over_ms << " over 1 ms; thread preempted " << preempted
+              << " times" << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    size_t keys = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 4000000;
+    bool with_reader = argc > 2 ? std::atoi(argv[2]) != 0 : true;
+    if (keys == 0) {
+        std::cerr << "Usage: growth_benchmark [keys] [with_reader]" << std::endl;
+        return 1;
+    }
+
+    try {
+        DatabaseConnection& db = DatabaseConnection::getInstance();
+        ConnectionOptions options;
+        options.echo_inserts = false;
+        db.connect("growth://benchmark", options);
+
+        std::vector<std::string> names(keys);
+        for (size_t i = 0; i < keys; i++) {
+            names[i] = makeKey(i);
+        }
+        std::vector<uint32_t> insert_nanos(keys);
+        std::vector<uint32_t> query_nanos;
+        query_nanos.reserve(keys);
+        std::atomic<size_t> inserted{0};
+        std::atomic<bool> done{false};
+        // The reader's failure, rethrown here once it has been joined
+        std::exception_ptr reader_error;
+        long reader_preempted = 0;
+
+        std::thread reader([&] {
+            if (!with_reader) {
+                return;
+            }
+            long preempted_before = preemptions();
+            uint64_t state = 1;
+            while (!done) {
+                size_t limit = inserted.load();
+                if (limit == 0) {
+                    std::this_thread::yield();
+                    continue;
+                }
+                state = state * 6364136223846793005ull + 1442695040888963407ull;
+                const std::string& key = names[(state >> 33) % limit];
+                auto start = std::chrono::steady_clock::now();
+                bool found = static_cast<bool>(db.lookup(key));
+                auto nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                 std::chrono::steady_clock::now() - start).count();
+                if (!found) {
+                    reader_error = std::make_exception_ptr(
+                        std::runtime_error("Lost " + key + " while the table grew"));
+                    break;
+                }
+                query_nanos.push_back(static_cast<uint32_t>(std::min<int64_t>(nanos, UINT32_MAX)));
+            }
+            reader_preempted = preemptions() - preempted_before;
+        });
+
+        long preempted_before = preemptions();
+        auto begin = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < keys; i++) {
+            auto start = std::chrono::steady_clock::now();
+            db.insert(names[i], "value");
+            auto nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                             std::chrono::steady_clock::now() - start).count();
+            insert_nanos[i] = static_cast<uint32_t>(std::min<int64_t>(nanos, UINT32_MAX));
+            inserted.store(i + 1, std::memory_order_release);
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        long insert_preempted = preemptions() - preempted_before;
+        done = true;
+        reader.join();
+        if (reader_error) {
+            std::rethrow_exception(reader_error);
+        }
+
+        std::cout << keys << " inserts in " << std::fixed << std::setprecision(2) << seconds << " s, "
+                  << query_nanos.size() << " concurrent queries, " << std::thread::hardware_concurrency()
+                  << " hardware threads" << std::endl;
+        report("insert", insert_nanos, insert_preempted);
+        if (!query_nanos.empty()) {
+            report("query", query_nanos, reader_preempted);
+        }
+        db.disconnect();
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
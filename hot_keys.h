@@ -0,0 +1,343 @@
+#ifndef HOT_KEYS_H
+#define HOT_KEYS_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <array>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+#include <sched.h>
+
+// The keys read most often lately, estimated from a sample of reads. A
+// count-min sketch with conservative updates estimates every key's count,
+// and the keys with the highest estimates are kept along with their bytes,
+// so the top keys can be named without remembering every key seen. decay()
+// halves all counts, so keys that cool down drop out. Not thread-safe.
+class HeavyHitters {
+public:
+    struct Candidate {
+        std::string key;
+        uint64_t hash;
+        uint32_t count;
+    };
+
+private:
+    static constexpr size_t kRows = 4;
+    static constexpr size_t kWidth = 1024;
+
+    std::vector<uint32_t> counters;   // row-major
+    std::vector<Candidate> candidates;
+    size_t capacity;
+
+    static size_t counterIndex(uint64_t hash, size_t row) {
+        static constexpr std::array<uint64_t, kRows> seeds = {
+            0x9E3779B97F4A7C15ull, 0xC2B2AE3D27D4EB4Full, 0x165667B19E3779F9ull, 0xD6E8FEB86659FD93ull};
+        uint64_t h = (hash + seeds[row]) * seeds[(row + 1) % kRows];
+        return row * kWidth + ((h >> 32) & (kWidth - 1));
+    }
+
+public:
+    explicit HeavyHitters(size_t top) : counters(kRows * kWidth, 0), capacity(top) {}
+
+    // Count weight reads of key. Only the rows holding the current minimum
+    // are raised, which keeps collisions from inflating the estimate.
+    void record(std::string_view key, uint64_t hash, uint32_t weight = 1) {
+        uint32_t estimate = UINT32_MAX;
+        for (size_t row = 0; row < kRows; row++) {
+            estimate = std::min(estimate, counters[counterIndex(hash, row)]);
+        }
+        estimate = estimate > UINT32_MAX - weight ? UINT32_MAX : estimate + weight;
+        for (size_t row = 0; row < kRows; row++) {
+            uint32_t& counter = counters[counterIndex(hash, row)];
+            counter = std::max(counter, estimate);
+        }
+        auto it = std::find_if(candidates.begin(), candidates.end(), [&](const Candidate& candidate) {
+            return candidate.hash == hash && candidate.key == key;
+        });
+        if (it != candidates.end()) {
+            it->count = estimate;
+            return;
+        }
+        if (candidates.size() < capacity) {
+            candidates.push_back({std::string(key), hash, estimate});
+            return;
+        }
+        auto coldest = std::min_element(candidates.begin(), candidates.end(),
+                                        [](const Candidate& a, const Candidate& b) { return a.count < b.count; });
+        if (coldest != candidates.end() && coldest->count < estimate) {
+            *coldest = {std::string(key), hash, estimate};
+        }
+    }
+
+    void decay() {
+        for (uint32_t& counter : counters) {
+            counter >>= 1;
+        }
+        for (Candidate& candidate : candidates) {
+            candidate.count >>= 1;
+        }
+        std::erase_if(candidates, [](const Candidate& candidate) { return candidate.count == 0; });
+    }
+
+    // In no particular order
+    const std::vector<Candidate>& top() const { return candidates; }
+};
+
+// Copies of the hot keys' values, one per CPU, so that a read of a hot key
+// touches memory of the reader's own core instead of the lock and cache
+// lines of the key's shard. A published copy never changes except for the
+// stale flags and hit counters of its items: a write to a replicated key
+// marks the key stale in every copy before the write returns, and readers
+// skip stale items. The set of keys changes only by publishing new copies,
+// which the owner does from a background pass.
+class HotReplicas {
+public:
+    struct Item {
+        std::string key;
+        uint64_t hash = 0;
+        std::string value;
+        mutable std::atomic<bool> stale{false};
+        mutable std::atomic<uint64_t> hits{0};
+    };
+
+    // One CPU's copy, sorted by hash
+    struct Table {
+        std::vector<Item> items;
+
+        explicit Table(size_t count) : items(count) {}
+
+        const Item* find(std::string_view key, uint64_t hash) const {
+            auto it = std::lower_bound(items.begin(), items.end(), hash,
+                                       [](const Item& item, uint64_t h) { return item.hash < h; });
+            for (; it != items.end() && it->hash == hash; ++it) {
+                if (it->key == key) {
+                    return &*it;
+                }
+            }
+            return nullptr;
+        }
+    };
+
+    // A value to publish
+    struct Source {
+        std::string key;
+        uint64_t hash;
+        std::string value;
+    };
+
+    struct Hits {
+        std::string key;
+        uint64_t hash;
+        uint64_t count;
+    };
+
+private:
+    // Bits of hash that might be replicated, checked before any copy is
+    // loaded so reads of other keys pay one load of a read-mostly line
+    static constexpr size_t kFilterWords = 16;
+
+    // A CPU's copy behind a lock of its own, taken only long enough to copy
+    // the pointer; threads on other CPUs never touch it
+    struct alignas(64) Slot {
+        mutable std::mutex mutex;
+        std::shared_ptr<const Table> table;
+
+        std::shared_ptr<const Table> load() const {
+            std::lock_guard<std::mutex> lock(mutex);
+            return table;
+        }
+
+        std::shared_ptr<const Table> exchange(std::shared_ptr<const Table> next) {
+            std::lock_guard<std::mutex> lock(mutex);
+            table.swap(next);
+            return next;
+        }
+    };
+
+    std::vector<Slot> slots;
+    std::array<std::atomic<uint64_t>, kFilterWords> filter{};
+    // Serializes publish() and invalidate(), so a key written between being
+    // collected and being published is never published with its old value
+    std::mutex mutex;
+    std::vector<uint64_t> invalidated;   // hashes written since beginRound()
+    uint64_t promotions = 0;
+    uint64_t invalidations = 0;
+    uint64_t retired_hits = 0;
+
+    static size_t filterBit(uint64_t hash) {
+        return (hash >> 20) % (kFilterWords * 64);
+    }
+
+    const Slot& localSlot() const {
+        int cpu = sched_getcpu();
+        return slots[cpu < 0 ? 0 : static_cast<size_t>(cpu) % slots.size()];
+    }
+
+    static uint64_t countHits(const std::shared_ptr<const Table>& table) {
+        uint64_t total = 0;
+        if (table) {
+            for (const Item& item : table->items) {
+                total += item.hits.load(std::memory_order_relaxed);
+            }
+        }
+        return total;
+    }
+
+public:
+    struct Stats {
+        uint64_t replicated = 0;
+        uint64_t hits = 0;
+        uint64_t promotions = 0;
+        uint64_t invalidations = 0;
+    };
+
+    HotReplicas() : slots(std::max(1u, std::thread::hardware_concurrency())) {}
+
+    // The calling CPU's fresh copy of key, or nullptr; pin keeps it alive
+    const Item* find(std::string_view key, uint64_t hash, std::shared_ptr<const Table>& pin) const {
+        size_t bit = filterBit(hash);
+        if ((filter[bit / 64].load(std::memory_order_relaxed) & (uint64_t(1) << (bit % 64))) == 0) {
+            return nullptr;
+        }
+        pin = localSlot().load();
+        if (!pin) {
+            return nullptr;
+        }
+        const Item* item = pin->find(key, hash);
+        if (!item || item->stale.load()) {
+            return nullptr;
+        }
+        item->hits.fetch_add(1, std::memory_order_relaxed);
+        return item;
+    }
+
+    // Called by every write to a key that may be replicated, before the
+    // write returns
+    void invalidate(std::string_view key, uint64_t hash) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (std::find(invalidated.begin(), invalidated.end(), hash) == invalidated.end()) {
+            invalidated.push_back(hash);
+        }
+        for (const Slot& slot : slots) {
+            std::shared_ptr<const Table> table = slot.load();
+            if (const Item* item = table ? table->find(key, hash) : nullptr) {
+                if (!item->stale.exchange(true)) {
+                    invalidations++;
+                }
+            }
+        }
+    }
+
+    // Hits per replicated key since the last call, summed over the copies,
+    // for the owner to feed back into its detector
+    std::vector<Hits> takeHits() {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::vector<Hits> hits;
+        std::vector<std::shared_ptr<const Table>> tables;
+        for (const Slot& slot : slots) {
+            tables.push_back(slot.load());
+        }
+        if (!tables.front()) {
+            return hits;
+        }
+        for (size_t i = 0; i < tables.front()->items.size(); i++) {
+            const Item& item = tables.front()->items[i];
+            uint64_t total = 0;
+            for (const auto& table : tables) {
+                total += table->items[i].hits.exchange(0, std::memory_order_relaxed);
+            }
+            retired_hits += total;
+            hits.push_back({item.key, item.hash, total});
+        }
+        return hits;
+    }
+
+    // Call before collecting the values of the next publish()
+    void beginRound() {
+        std::lock_guard<std::mutex> lock(mutex);
+        invalidated.clear();
+    }
+
+    // Replace the replicated set with sources, except keys written since
+    // beginRound(), whose collected value may already be old; a key that
+    // stays hot is collected again with its new value next time. Returns
+    // the hashes published. Nothing is rebuilt if the set and its values
+    // are unchanged.
+    std::vector<uint64_t> publish(std::vector<Source> sources) {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::erase_if(sources, [this](const Source& source) {
+            return std::find(invalidated.begin(), invalidated.end(), source.hash) != invalidated.end();
+        });
+        std::sort(sources.begin(), sources.end(), [](const Source& a, const Source& b) { return a.hash < b.hash; });
+
+        std::shared_ptr<const Table> current = slots.front().load();
+        std::vector<uint64_t> hashes;
+        for (const Source& source : sources) {
+            hashes.push_back(source.hash);
+        }
+        bool unchanged = current && current->items.size() == sources.size();
+        for (size_t i = 0; unchanged && i < sources.size(); i++) {
+            const Item& item = current->items[i];
+            unchanged = item.hash == sources[i].hash && item.key == sources[i].key && !item.stale.load();
+        }
+        if (unchanged) {
+            return hashes;
+        }
+
+        for (const Source& source : sources) {
+            if (!current || !current->find(source.key, source.hash)) {
+                promotions++;
+            }
+        }
+        std::array<uint64_t, kFilterWords> bits{};
+        for (const Source& source : sources) {
+            bits[filterBit(source.hash) / 64] |= uint64_t(1) << (filterBit(source.hash) % 64);
+        }
+        // New bits go up before the copies and old ones come down after, so
+        // the filter never hides a published key
+        for (size_t w = 0; w < kFilterWords; w++) {
+            filter[w].fetch_or(bits[w], std::memory_order_relaxed);
+        }
+        for (Slot& slot : slots) {
+            std::shared_ptr<Table> table;
+            if (!sources.empty()) {
+                table = std::make_shared<Table>(sources.size());
+                for (size_t i = 0; i < sources.size(); i++) {
+                    table->items[i].key = sources[i].key;
+                    table->items[i].hash = sources[i].hash;
+                    table->items[i].value = sources[i].value;
+                }
+            }
+            retired_hits += countHits(slot.exchange(std::move(table)));
+        }
+        for (size_t w = 0; w < kFilterWords; w++) {
+            filter[w].store(bits[w], std::memory_order_relaxed);
+        }
+        return hashes;
+    }
+
+    Stats stats() {
+        std::lock_guard<std::mutex> lock(mutex);
+        Stats result;
+        result.hits = retired_hits;
+        for (const Slot& slot : slots) {
+            result.hits += countHits(slot.load());
+        }
+        if (auto table = slots.front().load()) {
+            for (const Item& item : table->items) {
+                result.replicated += !item.stale.load();
+            }
+        }
+        result.promotions = promotions;
+        result.invalidations = invalidations;
+        return result;
+    }
+};
+
+#endif // HOT_KEYS_H
@@ -1,40 +1,223 @@
 #include <iostream>
 #include <map>
 #include <string>
+#include <string_view>
+#include <vector>
+#include <array>
+#include <unordered_map>
+#include <optional>
+#include <span>
+#include <utility>
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+#include <cstdint>
+#include <cstdlib>
 #include <type_traits>
 
-// Class representing a user database
+// Class representing a user database. User IDs are mostly dense integers,
+// so names are found by indexing an array with id - base rather than by
+// searching: one access for the name's position and one for its bytes.
+// IDs far outside the dense range go to a hash map instead, so one stray
+// large ID does not size the array. Names live back to back in a single
+// string, not in a heap block each.
 class UserDatabase {
-    std::map<int, std::string> users;
+    // Where a name sits in the name heap; kAbsent marks an unused ID
+    struct NameRef {
+        uint32_t offset;
+        uint32_t length;
+    };
+    static constexpr uint32_t kAbsent = UINT32_MAX;
+    // The dense array may have at most this many unused IDs per user
+    static constexpr size_t kMaxGapsPerUser = 3;
+    // Batch lookups go through the IDs in groups of this size: all array
+    // slots of a group are prefetched, then all names, then the views are
+    // made, so the cache misses of one group overlap instead of queueing
+    static constexpr size_t kPrefetchGroup = 16;
+
+    int64_t base = 0;
+    std::vector<NameRef> dense;
+    std::unordered_map<int, NameRef> sparse;
+    std::string names;
+    size_t count = 0;
+
+    NameRef store(std::string_view name) {
+        if (names.size() + name.size() > UINT32_MAX) {
+            throw std::length_error("UserDatabase name heap is full");
+        }
+        NameRef ref{static_cast<uint32_t>(names.size()), static_cast<uint32_t>(name.size())};
+        names.append(name);
+        return ref;
+    }
+
+    std::string_view view(NameRef ref) const {
+        return std::string_view(names.data() + ref.offset, ref.length);
+    }
+
+    // Position of id in the dense array, or SIZE_MAX if it is outside it
+    size_t slotOf(int id) const {
+        uint64_t slot = static_cast<uint64_t>(int64_t(id) - base);
+        return slot < dense.size() ? slot : SIZE_MAX;
+    }
+
+    // Extend the dense array to at least slot_count IDs, doubling so that
+    // appending IDs in order resizes it rarely, and move the sparse
+    // entries it now covers into it
+    void growDense(size_t slot_count) {
+        size_t limit = (count + 1) * (kMaxGapsPerUser + 1);
+        dense.resize(std::max(slot_count, std::min(dense.size() * 2, limit)), NameRef{0, kAbsent});
+        for (auto iter = sparse.begin(); iter != sparse.end();) {
+            if (size_t slot = slotOf(iter->first); slot != SIZE_MAX) {
+                dense[slot] = iter->second;
+                iter = sparse.erase(iter);
+            } else {
+                ++iter;
+            }
+        }
+    }
 
 public:
     UserDatabase() {
-        users[1] = "John";
-        users[2] = "Alice";
-        users[3] = "Bob";
+        addUser(1, "John");
+        addUser(2, "Alice");
+        addUser(3, "Bob");
     }
 
+    // Bulk load: sort the IDs once, cover the largest run of them that is
+    // dense enough with the array, and copy all names into one heap. A
+    // later duplicate ID replaces an earlier one.
+    explicit UserDatabase(std::vector<std::pair<int, std::string>> users) {
+        std::stable_sort(users.begin(), users.end(),
+                         [](const auto& a, const auto& b) { return a.first < b.first; });
+        size_t bytes = 0;
+        for (const auto& user : users) {
+            bytes += user.second.size();
+        }
+        names.reserve(bytes);
+        // Slide a window over the sorted IDs, narrowing it from the left
+        // whenever it has too many gaps, and keep the widest one
+        size_t best_first = 0;
+        size_t best_last = 0;
+        for (size_t first = 0, last = 0; last < users.size(); last++) {
+            auto span = [&] { return static_cast<uint64_t>(int64_t(users[last].first) - users[first].first) + 1; };
+            while (span() > (last - first + 1) * (kMaxGapsPerUser + 1)) {
+                first++;
+            }
+            if (last - first > best_last - best_first) {
+                best_first = first;
+                best_last = last;
+            }
+        }
+        if (!users.empty()) {
+            base = users[best_first].first;
+            dense.assign(static_cast<size_t>(int64_t(users[best_last].first) - base) + 1, NameRef{0, kAbsent});
+        }
+        for (const auto& [id, name] : users) {
+            addUser(id, name);
+        }
+    }
+
+    // Add or rename a user. An ID just past the dense array extends it;
+    // others outside it go to the sparse map.
+    void addUser(int id, std::string_view name) {
+        if (dense.empty() && sparse.empty()) {
+            base = id;
+        }
+        size_t slot = slotOf(id);
+        if (slot == SIZE_MAX && id >= base) {
+            uint64_t wanted = static_cast<uint64_t>(int64_t(id) - base) + 1;
+            if (wanted <= (count + 1) * (kMaxGapsPerUser + 1)) {
+                growDense(wanted);
+                slot = wanted - 1;
+            }
+        }
+        NameRef ref = store(name);
+        if (slot != SIZE_MAX) {
+            count += dense[slot].length == kAbsent;
+            dense[slot] = ref;
+        } else {
+            count += sparse.insert_or_assign(id, ref).second;
+        }
+    }
+
+    // The user's name, valid until the next addUser
+    std::optional<std::string_view> find(int id) const {
+        if (size_t slot = slotOf(id); slot != SIZE_MAX) {
+            if (NameRef ref = dense[slot]; ref.length != kAbsent) {
+                return view(ref);
+            }
+            return std::nullopt;
+        }
+        if (auto iter = sparse.find(id); iter != sparse.end()) {
+            return view(iter->second);
+        }
+        return std::nullopt;
+    }
+
+    // Look up many users at once; names_out[i] receives the name of
+    // ids[i], or nullopt. The views are valid until the next addUser. On a
+    // table larger than the cache, a caller that does real work with each
+    // name between find() calls waits out one miss after another; here
+    // the misses of a whole group are in flight together.
+    void findUsers(std::span<const int> ids, std::span<std::optional<std::string_view>> names_out) const {
+        if (names_out.size() < ids.size()) {
+            throw std::invalid_argument("findUsers needs an output slot per ID");
+        }
+        std::array<size_t, kPrefetchGroup> slots;
+        for (size_t group = 0; group < ids.size(); group += kPrefetchGroup) {
+            size_t group_size = std::min(kPrefetchGroup, ids.size() - group);
+            for (size_t k = 0; k < group_size; k++) {
+                slots[k] = slotOf(ids[group + k]);
+                if (slots[k] != SIZE_MAX) {
+                    __builtin_prefetch(&dense[slots[k]]);
+                }
+            }
+            for (size_t k = 0; k < group_size; k++) {
+                if (slots[k] != SIZE_MAX && dense[slots[k]].length != kAbsent) {
+                    __builtin_prefetch(names.data() + dense[slots[k]].offset);
+                }
+            }
+            for (size_t k = 0; k < group_size; k++) {
+                if (slots[k] == SIZE_MAX) {
+                    names_out[group + k] = find(ids[group + k]);
+                } else if (NameRef ref = dense[slots[k]]; ref.length != kAbsent) {
+                    names_out[group + k] = view(ref);
+                } else {
+                    names_out[group + k] = std::nullopt;
+                }
+            }
+        }
+    }
+
+    std::vector<std::optional<std::string_view>> findUsers(std::span<const int> ids) const {
+        std::vector<std::optional<std::string_view>> names_out(ids.size());
+        findUsers(ids, names_out);
+        return names_out;
+    }
+
+    size_t size() const { return count; }
+
     // C++17 style with if initialization
     void findUserModern(int id) {
         std::cout << "\nC++17 approach:" << std::endl;
-        if (auto iter = users.find(id); iter != users.end()) {
-            std::cout << "User found: " << iter->second << std::endl;
+        if (auto name = find(id); name) {
+            std::cout << "User found: " << *name << std::endl;
         } else {
             std::cout << "User not found!" << std::endl;
         }
-        // iter is not accessible here - better scope control
+        // name is not accessible here - better scope control
     }
 
     // C++11/14 style
     void findUserLegacy(int id) {
         std::cout << "\nC++11/14 approach:" << std::endl;
-        auto iter = users.find(id);  // Variable declared outside if
-        if (iter != users.end()) {
-            std::cout << "User found: " << iter->second << std::endl;
+        auto name = find(id);  // Variable declared outside if
+        if (name) {
+            std::cout << "User found: " << *name << std::endl;
         } else {
             std::cout << "User not found!" << std::endl;
         }
-        // iter is still accessible here - potential scope pollution
+        // name is still accessible here - potential scope pollution
     }
 };
 
@@ -59,7 +242,115 @@ public:
     }
 };
 
-int main() {
+// Looks up random IDs, most of them present, in a bulk-loaded
+// UserDatabase and in the std::map it replaced
+void compareWithMap(size_t user_count) {
+    std::vector<std::pair<int, std::string>> users;
+    users.reserve(user_count);
+    std::map<int, std::string> map;
+    // Every tenth ID is unused, and a few IDs are far out of range
+    for (size_t i = 0; i < user_count; i++) {
+        int id = static_cast<int>(i + i / 9);
+        users.emplace_back(id, "user" + std::to_string(id));
+        map.emplace(id, users.back().second);
+    }
+    users.emplace_back(2000000000, "outlier");
+    map.emplace(2000000000, "outlier");
+
+    auto start = std::chrono::steady_clock::now();
+    UserDatabase db(std::move(users));
+    double load_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    const size_t lookups = 2000000;
+    std::vector<int> ids(lookups);
+    uint64_t state = 42;
+    for (int& id : ids) {
+        state = state * 6364136223846793005ull + 1442695040888963407ull;
+        id = static_cast<int>((state >> 33) % (user_count + user_count / 9));
+    }
+    size_t found_db = 0;
+    size_t found_map = 0;
+    start = std::chrono::steady_clock::now();
+    for (int id : ids) {
+        if (auto name = db.find(id); name) {
+            found_db += name->size();
+        }
+    }
+    double db_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / lookups;
+    start = std::chrono::steady_clock::now();
+    for (int id : ids) {
+        if (auto iter = map.find(id); iter != map.end()) {
+            found_map += iter->second.size();
+        }
+    }
+    double map_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / lookups;
+    if (found_db != found_map || db.find(2000000000) != std::optional<std::string_view>("outlier")) {
+        throw std::runtime_error("UserDatabase and std::map disagree");
+    }
+    std::cout << "\n" << db.size() << " users bulk-loaded in " << load_ms << " ms; lookup "
+              << db_ns << " ns with the dense store, " << map_ns << " ns with std::map" << std::endl;
+}
+
+// Answers requests of a thousand random IDs, each with a response listing
+// the names, against a table bigger than the last-level cache: resolving
+// one ID at a time with find(), and the whole request with findUsers()
+void compareBatches(size_t user_count) {
+    std::vector<std::pair<int, std::string>> users;
+    users.reserve(user_count);
+    for (size_t i = 0; i < user_count; i++) {
+        users.emplace_back(static_cast<int>(i), "user" + std::to_string(i));
+    }
+    UserDatabase db(std::move(users));
+
+    const size_t lookups = 4000000;
+    const size_t request = 1000;
+    std::vector<int> ids(lookups);
+    uint64_t state = 7;
+    for (int& id : ids) {
+        state = state * 6364136223846793005ull + 1442695040888963407ull;
+        id = static_cast<int>((state >> 33) % user_count);
+    }
+    auto respond = [](std::string& response, std::optional<std::string_view> name) {
+        if (name) {
+            response.append(*name);
+        } else {
+            response.append("(unknown)");
+        }
+        response.push_back('\n');
+    };
+    std::string response;
+    size_t bytes_single = 0;
+    size_t bytes_batch = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t first = 0; first < lookups; first += request) {
+        response.clear();
+        for (size_t i = first; i < std::min(first + request, lookups); i++) {
+            respond(response, db.find(ids[i]));
+        }
+        bytes_single += response.size();
+    }
+    double single_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::vector<std::optional<std::string_view>> names(request);
+    start = std::chrono::steady_clock::now();
+    for (size_t first = 0; first < lookups; first += request) {
+        response.clear();
+        std::span<const int> batch(ids.data() + first, std::min(request, lookups - first));
+        db.findUsers(batch, names);
+        for (size_t i = 0; i < batch.size(); i++) {
+            respond(response, names[i]);
+        }
+        bytes_batch += response.size();
+    }
+    double batch_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (bytes_single != bytes_batch) {
+        throw std::runtime_error("findUsers and find disagree");
+    }
+    std::cout << user_count << " users: " << lookups / single_s / 1e6 << " M lookups/s one at a time, "
+              << lookups / batch_s / 1e6 << " M lookups/s in batches of " << request << std::endl;
+}
+
+// Usage: if_init_example [users_to_compare] [users_for_batches]
+int main(int argc, char* argv[]) {
     UserDatabase db;
     
     // Test with existing user
@@ -78,5 +369,7 @@ int main() {
     doublePrinter.print(3.14159);
     stringPrinter.print("Hello, constexpr if!");
 
+    compareWithMap(argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1000000);
+    compareBatches(argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 10000000);
     return 0;
 }
@@ -0,0 +1,173 @@
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+
+#include "kv_protocol.h"
+#include "kv_server.h"
+
+// Load generator for kv_server. Each connection runs on its own thread and
+// keeps up to [pipeline] requests in flight: it tops the window up, sends
+// the new requests in one write, and reads until half the window has been
+// answered. Latency is measured per request from its send to its answer.
+// With "self" as the address the server runs inside this process on a
+// temporary Unix socket, so a single command exercises the whole path.
+// Usage: kv_loadgen [self | unix:<path> | tcp:<port>] [connections] [pipeline]
+//                   [seconds] [read_percent] [keys] [value_size]
+
+std::string makeKey(size_t i) {
+    char key[32];
+    std::snprintf(key, sizeof(key), "key%012zu", i);
+    return key;
+}
+
+struct WorkerResult {
+    uint64_t operations = 0;
+    uint64_t reads = 0;
+    uint64_t hits = 0;
+    std::vector<double> micros;
+    std::string error;
+};
+
+int main(int argc, char* argv[]) {
+    const std::string target = argc > 1 ? argv[1] : "self";
+    const size_t connections = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 4;
+    const size_t pipeline = std::max<size_t>(1, argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 32);
+    const double seconds = argc > 4 ? std::strtod(argv[4], nullptr) : 3.0;
+    const unsigned read_percent = argc > 5 ? static_cast<unsigned>(std::strtoul(argv[5], nullptr, 10)) : 90;
+    const size_t key_count = argc > 6 ? std::strtoull(argv[6], nullptr, 10) : 100000;
+    const size_t value_size = argc > 7 ? std::strtoull(argv[7], nullptr, 10) : 100;
+
+    try {
+        std::unique_ptr<KvServer> embedded;
+        KvAddress address;
+        if (target == "self") {
+            address.unix_path = "/tmp/kv_loadgen_" + std::to_string(::getpid()) + ".sock";
+            ConnectionOptions options;
+            options.echo_inserts = false;
+            DatabaseConnection& db = DatabaseConnection::getInstance();
+            db.connect("kv://" + address.toString(), options);
+            KvServer::Options server_options;
+            server_options.address = address;
+            embedded = std::make_unique<KvServer>(db, server_options);
+            embedded->start();
+        } else {
+            address = KvAddress::parse(target);
+        }
+
+        // Load every key once so reads hit, pipelining the whole load
+        {
+            KvClient loader(address);
+            const std::string value(value_size, 'v');
+            for (size_t i = 0; i < key_count; i += 1000) {
+                size_t end = std::min(key_count, i + 1000);
+                for (size_t k = i; k < end; k++) {
+                    loader.put(makeKey(k), value);
+                }
+                loader.flush();
+                for (size_t k = i; k < end; k++) {
+                    if (loader.read().status != KvStatus::kOk) {
+                        throw std::runtime_error("Load failed at " + makeKey(k));
+                    }
+                }
+            }
+            if (!loader.getNow(makeKey(key_count - 1))) {
+                throw std::runtime_error("Loaded key not found");
+            }
+        }
+
+        using Clock = std::chrono::steady_clock;
+        std::vector<WorkerResult> results(connections);
+        std::vector<std::thread> workers;
+        auto start = Clock::now();
+        auto deadline = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds));
+        for (size_t c = 0; c < connections; c++) {
+            workers.emplace_back([&, c]() {
+                WorkerResult& result = results[c];
+                try {
+                    KvClient client(address);
+                    std::mt19937_64 rng(c + 1);
+                    const std::string value(value_size, static_cast<char>('a' + c % 26));
+                    std::deque<std::pair<Clock::time_point, bool>> in_flight;   // send time, is a read
+                    for (;;) {
+                        // Past the deadline only the requests in flight are read
+                        if (Clock::now() < deadline && in_flight.size() <= pipeline / 2) {
+                            auto now = Clock::now();
+                            while (in_flight.size() < pipeline) {
+                                bool read = rng() % 100 < read_percent;
+                                std::string key = makeKey(rng() % key_count);
+                                if (read) {
+                                    client.get(key);
+                                } else {
+                                    client.put(key, value);
+                                }
+                                in_flight.emplace_back(now, read);
+                            }
+                            client.flush();
+                        }
+                        if (in_flight.empty()) {
+                            break;
+                        }
+                        KvResponse response = client.read();
+                        auto [sent, read] = in_flight.front();
+                        in_flight.pop_front();
+                        if (response.status == KvStatus::kError) {
+                            throw std::runtime_error("Server error: " + std::string(response.value));
+                        }
+                        result.micros.push_back(std::chrono::duration<double, std::micro>(Clock::now() - sent).count());
+                        result.operations++;
+                        result.reads += read;
+                        result.hits += read && response.status == KvStatus::kOk;
+                    }
+                } catch (const std::exception& e) {
+                    result.error = e.what();
+                }
+            });
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+        WorkerResult total;
+        for (auto& result : results) {
+            if (!result.error.empty()) {
+                throw std::runtime_error(result.error);
+            }
+            total.operations += result.operations;
+            total.reads += result.reads;
+            total.hits += result.hits;
+            total.micros.insert(total.micros.end(), result.micros.begin(), result.micros.end());
+        }
+        std::sort(total.micros.begin(), total.micros.end());
+        auto at = [&total](double p) {
+            return total.micros[std::min(total.micros.size() - 1, static_cast<size_t>(p * total.micros.size()))];
+        };
+        std::cout << address.toString() << ": " << connections << " connections, pipeline " << pipeline << ", "
+                  << read_percent << "% reads, " << key_count << " keys, " << value_size << "-byte values\n";
+        std::cout << std::fixed << std::setprecision(0) << total.operations / elapsed << " ops/sec ("
+                  << total.operations << " in " << std::setprecision(2) << elapsed << " s), "
+                  << total.hits << "/" << total.reads << " reads hit\n";
+        std::cout << "Latency (us): p50 " << at(0.50) << ", p90 " << at(0.90) << ", p99 " << at(0.99)
+                  << ", p99.9 " << at(0.999) << ", max " << total.micros.back() << "\n";
+
+        if (embedded) {
+            embedded->stop();
+            DatabaseConnection::getInstance().disconnect();
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
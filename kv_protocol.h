@@ -0,0 +1,258 @@
+#ifndef KV_PROTOCOL_H
+#define KV_PROTOCOL_H
+
+#include <string>
+#include <string_view>
+#include <optional>
+#include <stdexcept>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "file_io.h"
+
+// Binary protocol spoken between kv_server and its clients. Every message
+// is a frame
+//   [u32 payload length][payload]
+// in little-endian order. A request payload is
+//   [u8 op][u32 key length][key][value]
+// and a response payload is
+//   [u8 status][value or error message]
+// Requests are answered strictly in order, so a client may pipeline: send
+// many requests before reading any response, matching each response to the
+// oldest request still outstanding.
+enum class KvOp : uint8_t {
+    kGet = 1,
+    kPut = 2,
+};
+
+enum class KvStatus : uint8_t {
+    kOk = 0,
+    kNotFound = 1,
+    kError = 2,
+};
+
+constexpr size_t kKvFrameHeader = 4;
+// Larger frames are treated as a corrupt stream
+constexpr size_t kKvMaxFrame = 64 << 20;
+
+inline void kvPutU32(char* out, uint32_t v) {
+    out[0] = static_cast<char>(v);
+    out[1] = static_cast<char>(v >> 8);
+    out[2] = static_cast<char>(v >> 16);
+    out[3] = static_cast<char>(v >> 24);
+}
+
+inline uint32_t kvGetU32(const char* p) {
+    const unsigned char* u = reinterpret_cast<const unsigned char*>(p);
+    return u[0] | (u[1] << 8) | (u[2] << 16) | (static_cast<uint32_t>(u[3]) << 24);
+}
+
+inline void kvAppendRequest(std::string& out, KvOp op, std::string_view key, std::string_view value = {}) {
+    size_t start = out.size();
+    out.resize(start + kKvFrameHeader + 5);
+    kvPutU32(&out[start], static_cast<uint32_t>(5 + key.size() + value.size()));
+    out[start + kKvFrameHeader] = static_cast<char>(op);
+    kvPutU32(&out[start + kKvFrameHeader + 1], static_cast<uint32_t>(key.size()));
+    out.append(key);
+    out.append(value);
+}
+
+inline void kvAppendResponse(std::string& out, KvStatus status, std::string_view value = {}) {
+    size_t start = out.size();
+    out.resize(start + kKvFrameHeader + 1);
+    kvPutU32(&out[start], static_cast<uint32_t>(1 + value.size()));
+    out[start + kKvFrameHeader] = static_cast<char>(status);
+    out.append(value);
+}
+
+// Length of the complete frame at the start of bytes, or 0 if more bytes
+// are needed. Throws on a frame no peer would send.
+inline size_t kvFrameLength(std::string_view bytes) {
+    if (bytes.size() < kKvFrameHeader) {
+        return 0;
+    }
+    size_t payload = kvGetU32(bytes.data());
+    if (payload == 0 || payload > kKvMaxFrame) {
+        throw std::runtime_error("Malformed frame of " + std::to_string(payload) + " bytes");
+    }
+    return bytes.size() - kKvFrameHeader >= payload ? kKvFrameHeader + payload : 0;
+}
+
+struct KvRequest {
+    KvOp op;
+    std::string_view key;
+    std::string_view value;
+};
+
+// Decode a complete request frame; views point into frame
+inline KvRequest kvParseRequest(std::string_view frame) {
+    std::string_view payload = frame.substr(kKvFrameHeader);
+    if (payload.size() < 5) {
+        throw std::runtime_error("Truncated request");
+    }
+    uint32_t key_length = kvGetU32(payload.data() + 1);
+    if (key_length > payload.size() - 5) {
+        throw std::runtime_error("Key length exceeds request");
+    }
+    KvOp op = static_cast<KvOp>(payload[0]);
+    if (op != KvOp::kGet && op != KvOp::kPut) {
+        throw std::runtime_error("Unknown op " + std::to_string(static_cast<int>(payload[0])));
+    }
+    return KvRequest{op, payload.substr(5, key_length), payload.substr(5 + key_length)};
+}
+
+struct KvResponse {
+    KvStatus status;
+    std::string_view value;
+};
+
+inline KvResponse kvParseResponse(std::string_view frame) {
+    std::string_view payload = frame.substr(kKvFrameHeader);
+    return KvResponse{static_cast<KvStatus>(payload[0]), payload.substr(1)};
+}
+
+// "unix:<path>" or "tcp:<port>" (loopback only)
+struct KvAddress {
+    std::string unix_path;
+    uint16_t tcp_port = 0;
+
+    static KvAddress parse(const std::string& text) {
+        KvAddress address;
+        if (text.rfind("unix:", 0) == 0) {
+            address.unix_path = text.substr(5);
+        } else if (text.rfind("tcp:", 0) == 0) {
+            address.tcp_port = static_cast<uint16_t>(std::stoi(text.substr(4)));
+        } else {
+            throw std::runtime_error("Address must be unix:<path> or tcp:<port>, got " + text);
+        }
+        return address;
+    }
+
+    std::string toString() const {
+        return unix_path.empty() ? "tcp:127.0.0.1:" + std::to_string(tcp_port) : "unix:" + unix_path;
+    }
+};
+
+inline int kvOpenSocket(const KvAddress& address) {
+    int fd = ::socket(address.unix_path.empty() ? AF_INET : AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        throw std::runtime_error(std::string("socket failed: ") + std::strerror(errno));
+    }
+    return fd;
+}
+
+// Fill in the sockaddr for address; returns its length
+inline socklen_t kvSocketAddress(const KvAddress& address, sockaddr_storage& storage) {
+    std::memset(&storage, 0, sizeof(storage));
+    if (!address.unix_path.empty()) {
+        sockaddr_un* un = reinterpret_cast<sockaddr_un*>(&storage);
+        if (address.unix_path.size() >= sizeof(un->sun_path)) {
+            throw std::runtime_error("Unix socket path too long: " + address.unix_path);
+        }
+        un->sun_family = AF_UNIX;
+        std::memcpy(un->sun_path, address.unix_path.c_str(), address.unix_path.size() + 1);
+        return sizeof(sockaddr_un);
+    }
+    sockaddr_in* in = reinterpret_cast<sockaddr_in*>(&storage);
+    in->sin_family = AF_INET;
+    in->sin_port = htons(address.tcp_port);
+    in->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    return sizeof(sockaddr_in);
+}
+
+// Blocking client for one connection. Requests are buffered by get() and
+// put() and sent by flush(), so a caller pipelines simply by queueing
+// several before flushing; read() then returns the responses in order.
+class KvClient {
+private:
+    int fd;
+    std::string out;
+    std::string in;
+    size_t consumed;     // bytes at the front of in already returned by read()
+
+public:
+    explicit KvClient(const KvAddress& address) : fd(kvOpenSocket(address)), consumed(0) {
+        sockaddr_storage storage;
+        socklen_t length = kvSocketAddress(address, storage);
+        if (::connect(fd, reinterpret_cast<sockaddr*>(&storage), length) != 0) {
+            int error = errno;
+            ::close(fd);
+            throw std::runtime_error("Cannot connect to " + address.toString() + ": " + std::strerror(error));
+        }
+        if (address.unix_path.empty()) {
+            int one = 1;
+            ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        }
+    }
+
+    KvClient(const KvClient&) = delete;
+    KvClient& operator=(const KvClient&) = delete;
+
+    ~KvClient() {
+        ::close(fd);
+    }
+
+    void get(std::string_view key) { kvAppendRequest(out, KvOp::kGet, key); }
+    void put(std::string_view key, std::string_view value) { kvAppendRequest(out, KvOp::kPut, key, value); }
+
+    void flush() {
+        writeFully(fd, out, "Client send");
+        out.clear();
+    }
+
+    // Next response, blocking until it has arrived. The value view stays
+    // valid until the following call to read().
+    KvResponse read() {
+        size_t frame;
+        while ((frame = kvFrameLength(std::string_view(in).substr(consumed))) == 0) {
+            // Drop returned responses only when more bytes are needed, so a
+            // pipelined burst is not shifted once per response
+            in.erase(0, consumed);
+            consumed = 0;
+            char buffer[64 << 10];
+            ssize_t n = ::read(fd, buffer, sizeof(buffer));
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                throw std::runtime_error("Connection closed by server");
+            }
+            in.append(buffer, static_cast<size_t>(n));
+        }
+        std::string_view bytes = std::string_view(in).substr(consumed, frame);
+        consumed += frame;
+        return kvParseResponse(bytes);
+    }
+
+    // Convenience wrappers that send one request and wait for its answer
+    std::optional<std::string> getNow(std::string_view key) {
+        get(key);
+        flush();
+        KvResponse response = read();
+        if (response.status == KvStatus::kError) {
+            throw std::runtime_error("Server error: " + std::string(response.value));
+        }
+        if (response.status == KvStatus::kNotFound) {
+            return std::nullopt;
+        }
+        return std::string(response.value);
+    }
+
+    void putNow(std::string_view key, std::string_view value) {
+        put(key, value);
+        flush();
+        KvResponse response = read();
+        if (response.status != KvStatus::kOk) {
+            throw std::runtime_error("Server error: " + std::string(response.value));
+        }
+    }
+};
+
+#endif // KV_PROTOCOL_H
@@ -0,0 +1,47 @@
+#include <iostream>
+#include <string>
+#include <csignal>
+#include <cstdlib>
+#include <pthread.h>
+
+#include "kv_server.h"
+
+// Runs DatabaseConnection as a local server until SIGINT or SIGTERM.
+// Usage: kv_server [unix:<path> | tcp:<port>] [loops] [wal_path]
+// Defaults to unix:/tmp/kv_server.sock with one event loop per core and
+// no write-ahead log.
+
+int main(int argc, char* argv[]) {
+    KvServer::Options server_options;
+    ConnectionOptions connect_options;
+    connect_options.echo_inserts = false;
+    try {
+        server_options.address = KvAddress::parse(argc > 1 ? argv[1] : "unix:/tmp/kv_server.sock");
+        server_options.loops = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 0;
+        if (argc > 3) {
+            connect_options.wal_path = argv[3];
+        }
+
+        // Block the shutdown signals in every thread; main waits for them
+        sigset_t signals;
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGINT);
+        sigaddset(&signals, SIGTERM);
+        pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+        DatabaseConnection& db = DatabaseConnection::getInstance();
+        db.connect("kv://" + server_options.address.toString(), connect_options);
+        KvServer server(db, server_options);
+        server.start();
+
+        int received = 0;
+        sigwait(&signals, &received);
+        std::cout << "Shutting down after " << server.requestsServed() << " requests" << std::endl;
+        server.stop();
+        db.disconnect();
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,360 @@
+#ifndef KV_SERVER_H
+#define KV_SERVER_H
+
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <utility>
+#include <stdexcept>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+
+#include "kv_protocol.h"
+#include "database_connection.h"
+
+// Serves a DatabaseConnection to local processes over a Unix socket or TCP
+// on the loopback interface, speaking the protocol in kv_protocol.h.
+// There is one epoll loop per core, each on its own thread and pinned to
+// its core. All loops watch the listening socket with EPOLLEXCLUSIVE, so
+// only one wakes per new connection, and a connection stays on the loop
+// that accepted it. A loop reads everything a client has sent, answers
+// every complete request in it, and writes all the answers back with one
+// send, so a client that pipelines gets batched responses.
+class KvServer {
+public:
+    struct Options {
+        KvAddress address;
+        // Event loops; 0 means one per core
+        size_t loops = 0;
+        // Stop reading from a client once this many response bytes are
+        // waiting for it to read them
+        size_t max_pending_output = 4 << 20;
+    };
+
+private:
+    struct Connection {
+        int fd;
+        std::string in;
+        std::string out;
+        size_t out_sent = 0;
+        uint32_t events = EPOLLIN | EPOLLRDHUP;   // what epoll watches for
+    };
+
+    struct Loop {
+        int epoll_fd = -1;
+        int wake_fd = -1;
+        std::thread thread;
+        std::atomic<uint64_t> requests{0};
+        std::unordered_map<int, std::unique_ptr<Connection>> connections;
+    };
+
+    DatabaseConnection& db;
+    Options options;
+    int listen_fd;
+    std::vector<std::unique_ptr<Loop>> loops;
+    std::atomic<bool> stopping;
+
+    static void watch(int epoll_fd, int op, int fd, uint32_t events) {
+        epoll_event event{};
+        event.events = events;
+        event.data.fd = fd;
+        if (::epoll_ctl(epoll_fd, op, fd, &event) != 0) {
+            throw std::runtime_error(std::string("epoll_ctl failed: ") + std::strerror(errno));
+        }
+    }
+
+    void listen() {
+        listen_fd = kvOpenSocket(options.address);
+        if (options.address.unix_path.empty()) {
+            int one = 1;
+            ::setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        } else {
+            ::unlink(options.address.unix_path.c_str());
+        }
+        sockaddr_storage storage;
+        socklen_t length = kvSocketAddress(options.address, storage);
+        if (::bind(listen_fd, reinterpret_cast<sockaddr*>(&storage), length) != 0 ||
+            ::listen(listen_fd, SOMAXCONN) != 0) {
+            int error = errno;
+            ::close(listen_fd);
+            listen_fd = -1;
+            throw std::runtime_error("Cannot listen on " + options.address.toString() + ": " + std::strerror(error));
+        }
+        ::fcntl(listen_fd, F_SETFL, ::fcntl(listen_fd, F_GETFL) | O_NONBLOCK);
+    }
+
+    // Take one pending connection; with EPOLLEXCLUSIVE another loop is
+    // woken for the next, which spreads connections over the loops
+    void accept(Loop& loop) {
+        int fd = ::accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            return;   // another loop took it, or the client gave up
+        }
+        if (options.address.unix_path.empty()) {
+            int one = 1;
+            ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        }
+        auto connection = std::make_unique<Connection>();
+        connection->fd = fd;
+        watch(loop.epoll_fd, EPOLL_CTL_ADD, fd, EPOLLIN | EPOLLRDHUP);
+        loop.connections.emplace(fd, std::move(connection));
+    }
+
+    void close(Loop& loop, int fd) {
+        ::epoll_ctl(loop.epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+        ::close(fd);
+        loop.connections.erase(fd);
+    }
+
+    // Answer every complete request in the input buffer. Consecutive puts
+    // are applied with one insertBatch; a get first applies the puts before
+    // it, so each request sees the effect of the ones sent earlier.
+    void process(Loop& loop, Connection& connection) {
+        std::string_view input = connection.in;
+        std::vector<std::pair<std::string, std::string>> puts;
+        auto applyPuts = [this, &connection, &puts]() {
+            if (puts.empty()) {
+                return;
+            }
+            try {
+                db.insertBatch(puts);
+                for (size_t i = 0; i < puts.size(); i++) {
+                    kvAppendResponse(connection.out, KvStatus::kOk);
+                }
+            } catch (const std::exception& e) {
+                for (size_t i = 0; i < puts.size(); i++) {
+                    kvAppendResponse(connection.out, KvStatus::kError, e.what());
+                }
+            }
+            puts.clear();
+        };
+
+        size_t offset = 0;
+        uint64_t answered = 0;
+        size_t frame;
+        while ((frame = kvFrameLength(input.substr(offset))) > 0) {
+            KvRequest request = kvParseRequest(input.substr(offset, frame));
+            offset += frame;
+            answered++;
+            if (request.op == KvOp::kPut) {
+                puts.emplace_back(request.key, request.value);
+                continue;
+            }
+            applyPuts();
+            // The value is copied straight from the table into the output
+            LookupResult result = db.lookup(request.key);
+            switch (result.status()) {
+            case LookupStatus::kFound:
+                kvAppendResponse(connection.out, KvStatus::kOk, result.value());
+                break;
+            case LookupStatus::kNotFound:
+                kvAppendResponse(connection.out, KvStatus::kNotFound);
+                break;
+            case LookupStatus::kNotConnected:
+                kvAppendResponse(connection.out, KvStatus::kError, "Database not connected!");
+                break;
+            case LookupStatus::kStale:
+                kvAppendResponse(connection.out, KvStatus::kError, "Follower is too stale to serve reads!");
+                break;
+            }
+        }
+        applyPuts();
+        connection.in.erase(0, offset);
+        loop.requests.fetch_add(answered, std::memory_order_relaxed);
+    }
+
+    // Send as much pending output as the socket takes, then watch for
+    // whatever the connection needs next. Returns false if it is gone.
+    bool flush(Loop& loop, Connection& connection) {
+        while (connection.out_sent < connection.out.size()) {
+            ssize_t n = ::send(connection.fd, connection.out.data() + connection.out_sent,
+                               connection.out.size() - connection.out_sent, MSG_NOSIGNAL);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    break;
+                }
+                return false;
+            }
+            connection.out_sent += static_cast<size_t>(n);
+        }
+        if (connection.out_sent == connection.out.size()) {
+            connection.out.clear();
+            connection.out_sent = 0;
+        }
+        // Wait for room in the socket while output is left over, and stop
+        // taking requests once too much is, until the client reads
+        size_t pending = connection.out.size() - connection.out_sent;
+        uint32_t events = EPOLLRDHUP;
+        if (pending > 0) {
+            events |= EPOLLOUT;
+        }
+        if (pending <= options.max_pending_output) {
+            events |= EPOLLIN;
+        }
+        if (events != connection.events) {
+            watch(loop.epoll_fd, EPOLL_CTL_MOD, connection.fd, events);
+            connection.events = events;
+        }
+        return true;
+    }
+
+    // Read until the socket is drained. Returns false once the client has
+    // closed its end or the connection failed.
+    bool receive(Connection& connection) {
+        char buffer[64 << 10];
+        for (;;) {
+            ssize_t n = ::recv(connection.fd, buffer, sizeof(buffer), 0);
+            if (n > 0) {
+                connection.in.append(buffer, static_cast<size_t>(n));
+                continue;
+            }
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+        }
+    }
+
+    void run(Loop& loop, size_t core) {
+#ifdef __linux__
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(core % std::max(1u, std::thread::hardware_concurrency()), &cpus);
+        pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+#endif
+        epoll_event events[64];
+        while (!stopping.load(std::memory_order_relaxed)) {
+            int ready = ::epoll_wait(loop.epoll_fd, events, 64, -1);
+            if (ready < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                std::cerr << "epoll_wait failed: " << std::strerror(errno) << std::endl;
+                break;
+            }
+            for (int i = 0; i < ready; i++) {
+                int fd = events[i].data.fd;
+                if (fd == loop.wake_fd) {
+                    continue;
+                }
+                if (fd == listen_fd) {
+                    accept(loop);
+                    continue;
+                }
+                auto it = loop.connections.find(fd);
+                if (it == loop.connections.end()) {
+                    continue;
+                }
+                Connection& connection = *it->second;
+                bool open = true;
+                try {
+                    if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                        // Answer what arrived even if the client then hung up
+                        open = receive(connection);
+                        process(loop, connection);
+                    }
+                    open = flush(loop, connection) && open;
+                } catch (const std::exception& e) {
+                    std::cerr << "Dropping client: " << e.what() << std::endl;
+                    open = false;
+                }
+                if (!open) {
+                    close(loop, fd);
+                }
+            }
+        }
+        for (auto& [fd, connection] : loop.connections) {
+            ::close(fd);
+        }
+        loop.connections.clear();
+    }
+
+public:
+    KvServer(DatabaseConnection& database, Options serverOptions)
+        : db(database), options(std::move(serverOptions)), listen_fd(-1), stopping(false) {}
+
+    KvServer(const KvServer&) = delete;
+    KvServer& operator=(const KvServer&) = delete;
+
+    ~KvServer() {
+        stop();
+    }
+
+    void start() {
+        if (listen_fd >= 0) {
+            throw std::runtime_error("Server already started!");
+        }
+        listen();
+        size_t count = options.loops > 0 ? options.loops : std::max(1u, std::thread::hardware_concurrency());
+        stopping = false;
+        for (size_t i = 0; i < count; i++) {
+            auto loop = std::make_unique<Loop>();
+            loop->epoll_fd = ::epoll_create1(EPOLL_CLOEXEC);
+            loop->wake_fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            if (loop->epoll_fd < 0 || loop->wake_fd < 0) {
+                throw std::runtime_error(std::string("Cannot create event loop: ") + std::strerror(errno));
+            }
+            watch(loop->epoll_fd, EPOLL_CTL_ADD, loop->wake_fd, EPOLLIN);
+            watch(loop->epoll_fd, EPOLL_CTL_ADD, listen_fd, EPOLLIN | EPOLLEXCLUSIVE);
+            loops.push_back(std::move(loop));
+        }
+        for (size_t i = 0; i < loops.size(); i++) {
+            Loop* loop = loops[i].get();
+            loop->thread = std::thread([this, loop, i] { run(*loop, i); });
+        }
+        std::cout << "Serving on " << options.address.toString() << " with " << loops.size()
+                  << " event loops" << std::endl;
+    }
+
+    // Close every connection and the listening socket; requests not yet
+    // answered are dropped
+    void stop() {
+        if (listen_fd < 0) {
+            return;
+        }
+        stopping = true;
+        for (auto& loop : loops) {
+            uint64_t one = 1;
+            (void)!::write(loop->wake_fd, &one, sizeof(one));
+        }
+        for (auto& loop : loops) {
+            if (loop->thread.joinable()) {
+                loop->thread.join();
+            }
+            ::close(loop->epoll_fd);
+            ::close(loop->wake_fd);
+        }
+        loops.clear();
+        ::close(listen_fd);
+        listen_fd = -1;
+        if (!options.address.unix_path.empty()) {
+            ::unlink(options.address.unix_path.c_str());
+        }
+    }
+
+    uint64_t requestsServed() const {
+        uint64_t total = 0;
+        for (const auto& loop : loops) {
+            total += loop->requests.load(std::memory_order_relaxed);
+        }
+        return total;
+    }
+};
+
+#endif // KV_SERVER_H
@@ -4,28 +4,109 @@
 #include <mutex>
 #include <stdexcept>
 #include <chrono>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <ctime>
 
 class Logger {
 private:
-    static Logger* instance;
+    // Guards the file; taken once per line by log() and once per buffer
+    // by a Session, never just to find the instance
     static std::mutex mutex_;
     std::ofstream log_file;
-    bool initialized;
+    std::atomic<bool> initialized;
 
     // Private constructor to prevent direct instantiation
     Logger() : initialized(false) {}
 
+    // Same layout as std::ctime, but into the caller's buffer, since
+    // ctime's shared buffer is not safe to use from several threads
+    static void appendTimestamp(std::string& out) {
+        std::time_t time = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+        std::tm local;
+        localtime_r(&time, &local);
+        char stamp[32];
+        out.append(stamp, std::strftime(stamp, sizeof(stamp), "%a %b %e %H:%M:%S %Y\n", &local));
+    }
+
+    void write(const std::string& lines) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        log_file << lines;
+        log_file.flush();
+    }
+
+    void requireInitialized() const {
+        if (!initialized) {
+            throw std::runtime_error("Logger not initialized!");
+        }
+    }
+
     // Delete copy constructor and assignment operator
     Logger(const Logger&) = delete;
     Logger& operator=(const Logger&) = delete;
 
 public:
+    // Constructed once, thread-safely, on first use; later calls take no
+    // lock
     static Logger* getInstance() {
-        std::lock_guard<std::mutex> lock(mutex_);
-        if (instance == nullptr) {
-            instance = new Logger();
+        static Logger instance;
+        return &instance;
+    }
+
+    // Per-thread handle returned by session(): formats lines into its own
+    // buffer and hands the buffer to the file in one locked write once it
+    // holds kFlushBytes, on flush(), or when the thread exits. Lines from
+    // one thread stay in order; lines from different threads interleave
+    // by buffer rather than by line.
+    class Session {
+    public:
+        static constexpr size_t kFlushBytes = 4096;
+
+    private:
+        Logger& logger;
+        std::string buffer;
+        uint64_t lines;
+        uint64_t flushes;
+
+    public:
+        explicit Session(Logger& owner) : logger(owner), lines(0), flushes(0) {}
+
+        Session(const Session&) = delete;
+        Session& operator=(const Session&) = delete;
+
+        ~Session() {
+            flush();
+        }
+
+        void log(const std::string& message) {
+            logger.requireInitialized();
+            appendTimestamp(buffer);
+            buffer += message;
+            buffer += '\n';
+            lines++;
+            if (buffer.size() >= kFlushBytes) {
+                flush();
+            }
+        }
+
+        void flush() {
+            if (buffer.empty()) {
+                return;
+            }
+            logger.write(buffer);
+            buffer.clear();
+            flushes++;
         }
-        return instance;
+
+        uint64_t linesLogged() const { return lines; }
+        uint64_t flushCount() const { return flushes; }
+    };
+
+    // The calling thread's session, created on its first call
+    static Session& session() {
+        thread_local Session current(*getInstance());
+        return current;
     }
 
     void init(const std::string& filename) {
@@ -38,13 +119,12 @@ public:
     }
 
     void log(const std::string& message) {
-        std::lock_guard<std::mutex> lock(mutex_);
-        if (!initialized) {
-            throw std::runtime_error("Logger not initialized!");
-        }
-        auto now = std::chrono::system_clock::now();
-        auto time = std::chrono::system_clock::to_time_t(now);
-        log_file << std::ctime(&time) << message << std::endl;
+        requireInitialized();
+        std::string line;
+        appendTimestamp(line);
+        line += message;
+        line += '\n';
+        write(line);
     }
 
     ~Logger() {
@@ -55,7 +135,6 @@ public:
 };
 
 // Initialize static members
-Logger* Logger::instance = nullptr;
 std::mutex Logger::mutex_;
 
 int main() {
@@ -83,6 +162,35 @@ int main() {
             std::cout << "Both loggers are the same instance!" << std::endl;
         }
 
+        // Busy threads: every log() call takes the file lock, while a
+        // session buffers its thread's lines and takes it once per 4 KB
+        const int threads = 4;
+        const int messages = 2000;
+        auto timeThreads = [&](auto logOne) {
+            auto start = std::chrono::steady_clock::now();
+            std::vector<std::thread> workers;
+            for (int t = 0; t < threads; t++) {
+                workers.emplace_back([&logOne, t]() {
+                    for (int i = 0; i < messages; i++) {
+                        logOne("worker " + std::to_string(t) + " handled request " + std::to_string(i));
+                    }
+                    Logger::session().flush();
+                });
+            }
+            for (auto& worker : workers) {
+                worker.join();
+            }
+            return std::chrono::duration_cast<std::chrono::microseconds>(
+                       std::chrono::steady_clock::now() - start).count();
+        };
+        auto direct = timeThreads([](const std::string& message) { Logger::getInstance()->log(message); });
+        auto buffered = timeThreads([](const std::string& message) { Logger::session().log(message); });
+        std::cout << threads * messages << " lines per run: log() " << direct << " us, sessions "
+                  << buffered << " us" << std::endl;
+        Logger::session().log("Application finished");
+        std::cout << "Main thread session: " << Logger::session().linesLogged() << " lines in "
+                  << Logger::session().flushCount() << " writes (rest flushed at exit)" << std::endl;
+
     } catch (const std::exception& e) {
         std::cerr << "Error: " << e.what() << std::endl;
     }
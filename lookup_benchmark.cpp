@@ -0,0 +1,126 @@
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdio>
+#include <cstdlib>
+
+#include "database_connection.h"
+
+// Compares the two point-lookup paths of DatabaseConnection:
+//   query()   copies the value out and throws on a miss
+//   lookup()  borrows the value and reports a miss as a status
+// for keys that are present and keys that are not. Latencies are per call
+// and include the cost of reading the clock, which is the same for both.
+// Usage: lookup_benchmark [keys] [value_size]
+
+std::string makeKey(size_t i) {
+    char key[32];
+    std::snprintf(key, sizeof(key), "user:%012zu", i);
+    return key;
+}
+
+void printPercentiles(const std::string& label, std::vector<double>& nanos) {
+    std::sort(nanos.begin(), nanos.end());
+    auto at = [&nanos](double p) {
+        return nanos[std::min(nanos.size() - 1, static_cast<size_t>(p * nanos.size()))];
+    };
+    double total = 0;
+    for (double n : nanos) {
+        total += n;
+    }
+    std::cout << std::fixed << std::setprecision(0) << std::left << std::setw(14) << label << std::right
+              << " latency (ns): mean " << std::setw(6) << total / nanos.size() << ", p50 " << std::setw(6)
+              << at(0.50) << ", p99 " << std::setw(6) << at(0.99) << ", p99.9 " << std::setw(6) << at(0.999)
+              << "\n";
+}
+
+// Time fn(key) for every key, one measurement per call
+template<typename Fn>
+std::vector<double> timeEach(const std::vector<std::string>& keys, Fn fn, size_t& found) {
+    std::vector<double> nanos;
+    nanos.reserve(keys.size());
+    for (const auto& key : keys) {
+        auto begin = std::chrono::steady_clock::now();
+        found += fn(key);
+        nanos.push_back(std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - begin).count());
+    }
+    return nanos;
+}
+
+int main(int argc, char* argv[]) {
+    const size_t key_count = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1000000;
+    const size_t value_size = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 64;
+
+    ConnectionOptions options;
+    options.echo_inserts = false;
+
+    try {
+        DatabaseConnection& db = DatabaseConnection::getInstance();
+        if (db.lookup("anything").status() != LookupStatus::kNotConnected) {
+            throw std::runtime_error("lookup() before connect() should report kNotConnected");
+        }
+        db.connect("mysql://localhost:3306/benchmark", options);
+
+        std::vector<std::pair<std::string, std::string>> batch;
+        for (size_t i = 0; i < key_count; i++) {
+            batch.emplace_back(makeKey(i), std::string(value_size, static_cast<char>('a' + i % 26)));
+            if (batch.size() == 10000 || i + 1 == key_count) {
+                db.insertBatch(batch);
+                batch.clear();
+            }
+        }
+
+        // Same keys for both paths; misses sit between present keys
+        std::mt19937_64 rng(42);
+        const size_t reads = std::min<size_t>(key_count, 200000);
+        std::vector<std::string> hits;
+        std::vector<std::string> misses;
+        for (size_t i = 0; i < reads; i++) {
+            hits.push_back(makeKey(rng() % key_count));
+            misses.push_back(makeKey(rng() % key_count) + "~");
+        }
+
+        size_t bytes = 0;
+        auto query = [&db, &bytes](const std::string& key) -> size_t {
+            try {
+                bytes += db.query(key).size();
+                return 1;
+            } catch (const std::runtime_error&) {
+                return 0;
+            }
+        };
+        auto lookup = [&db, &bytes](const std::string& key) -> size_t {
+            LookupResult result = db.lookup(key);
+            bytes += result.value().size();
+            return result.found();
+        };
+
+        size_t query_hits = 0;
+        size_t lookup_hits = 0;
+        size_t query_misses = 0;
+        size_t lookup_misses = 0;
+        auto query_hit = timeEach(hits, query, query_hits);
+        auto lookup_hit = timeEach(hits, lookup, lookup_hits);
+        auto query_miss = timeEach(misses, query, query_misses);
+        auto lookup_miss = timeEach(misses, lookup, lookup_misses);
+
+        std::cout << key_count << " keys, " << value_size << "-byte values, " << reads << " reads per case\n";
+        std::cout << "Found: query " << query_hits << "/" << reads << ", lookup " << lookup_hits << "/" << reads
+                  << " (hits); query " << query_misses << ", lookup " << lookup_misses << " (misses)\n";
+        printPercentiles("query() hit", query_hit);
+        printPercentiles("lookup() hit", lookup_hit);
+        printPercentiles("query() miss", query_miss);
+        printPercentiles("lookup() miss", lookup_miss);
+        db.disconnect();
+        return bytes > 0 ? 0 : 1;
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+}
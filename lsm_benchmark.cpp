@@ -0,0 +1,133 @@
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <filesystem>
+#include <cstdlib>
+
+#include "database_connection.h"
+
+// Measures the LSM engine behind DatabaseConnection:
+//   write amplification  bytes written to disk / bytes handed to insert
+//   space amplification  bytes of live SSTables / bytes of live data
+//   read latency         percentiles for hits and for misses
+// Usage: lsm_benchmark [keys] [value_size]
+
+std::string makeKey(size_t i) {
+    char key[24];
+    std::snprintf(key, sizeof(key), "key%012zu", i);
+    return key;
+}
+
+void printPercentiles(const std::string& label, std::vector<double>& micros) {
+    std::sort(micros.begin(), micros.end());
+    auto at = [&micros](double p) {
+        return micros[std::min(micros.size() - 1, static_cast<size_t>(p * micros.size()))];
+    };
+    std::cout << std::fixed << std::setprecision(2)
+              << label << " latency (us): p50 " << at(0.50) << ", p90 " << at(0.90)
+              << ", p99 " << at(0.99) << ", p99.9 " << at(0.999) << ", max " << micros.back() << "\n";
+}
+
+int main(int argc, char* argv[]) {
+    const size_t key_count = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 300000;
+    const size_t value_size = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 100;
+    const std::string directory = "lsm_benchmark_data";
+    std::filesystem::remove_all(directory);
+
+    ConnectionOptions options;
+    options.lsm_directory = directory;
+    options.echo_inserts = false;
+    // Small sizes so a few hundred thousand keys exercise several levels
+    options.lsm.memtable_bytes = 1 << 20;
+    options.lsm.table_file_bytes = 1 << 20;
+    options.lsm.level1_bytes = 4 << 20;
+
+    try {
+        DatabaseConnection& db = DatabaseConnection::getInstance();
+        db.connect("lsm://" + directory, options);
+
+        // Load every key once in random order, then overwrite half of them
+        std::mt19937_64 rng(42);
+        std::vector<size_t> order(key_count);
+        for (size_t i = 0; i < key_count; i++) {
+            order[i] = i;
+        }
+        std::shuffle(order.begin(), order.end(), rng);
+        for (size_t i = 0; i < key_count / 2; i++) {
+            order.push_back(rng() % key_count);
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::pair<std::string, std::string>> batch;
+        for (size_t n = 0; n < order.size(); n++) {
+            std::string value = std::to_string(n) + ":";
+            value.resize(value_size, static_cast<char>('a' + n % 26));
+            batch.emplace_back(makeKey(order[n]), std::move(value));
+            if (batch.size() == 1000 || n + 1 == order.size()) {
+                db.insertBatch(batch);
+                batch.clear();
+            }
+        }
+        double load_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        db.checkpoint();
+        double settle_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        LsmStats stats = db.lsmStats();
+        double live_bytes = static_cast<double>(key_count * (makeKey(0).size() + value_size));
+        std::cout << "Loaded " << order.size() << " inserts (" << key_count << " distinct keys) in "
+                  << std::setprecision(2) << std::fixed << load_seconds << " s, "
+                  << order.size() / load_seconds << " inserts/sec; settled after " << settle_seconds << " s\n";
+        std::cout << "Files per level:";
+        for (size_t files : stats.files_per_level) {
+            std::cout << " " << files;
+        }
+        std::cout << "\nCompactions: " << stats.compactions << "\n";
+        std::cout << "Write amplification: "
+                  << static_cast<double>(stats.flush_bytes + stats.compaction_bytes) / stats.user_bytes
+                  << " (SSTables only), "
+                  << static_cast<double>(stats.wal_bytes + stats.flush_bytes + stats.compaction_bytes) / stats.user_bytes
+                  << " (including WAL)\n";
+        std::cout << "Space amplification: " << stats.table_bytes / live_bytes << "\n";
+
+        // Point reads of present keys, then of absent keys (Bloom filters)
+        const size_t reads = std::min<size_t>(key_count, 100000);
+        std::vector<double> hit_micros;
+        std::vector<double> miss_micros;
+        size_t found = 0;
+        for (size_t i = 0; i < reads; i++) {
+            std::string key = makeKey(rng() % key_count);
+            auto begin = std::chrono::steady_clock::now();
+            auto value = db.queryMany(std::span<const std::string>(&key, 1));
+            hit_micros.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - begin).count());
+            found += value[0].has_value();
+        }
+        uint64_t skips_before = db.lsmStats().bloom_skips;
+        for (size_t i = 0; i < reads; i++) {
+            // Inside the key range, so only the Bloom filter can rule it out
+            std::string key = makeKey(rng() % key_count) + "~";
+            auto begin = std::chrono::steady_clock::now();
+            auto value = db.queryMany(std::span<const std::string>(&key, 1));
+            miss_micros.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - begin).count());
+            found += value[0].has_value();
+        }
+        std::cout << "Reads: " << reads << " hits expected, " << found << " found\n";
+        printPercentiles("Hit", hit_micros);
+        printPercentiles("Miss", miss_micros);
+        std::cout << "Bloom filter skips during misses: " << db.lsmStats().bloom_skips - skips_before << "\n";
+
+        // Reopen and check the data survived
+        db.disconnect();
+        db.connect("lsm://" + directory, options);
+        std::cout << "After reopen: " << makeKey(7) << " = " << db.query(makeKey(7)).substr(0, 16) << "...\n";
+        db.disconnect();
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    std::filesystem::remove_all(directory);
+    return 0;
+}
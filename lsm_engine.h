@@ -0,0 +1,885 @@
+#ifndef LSM_ENGINE_H
+#define LSM_ENGINE_H
+
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <memory>
+#include <optional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "file_io.h"
+#include "shard_table.h"
+#include "write_ahead_log.h"
+
+// Tuning knobs for LsmEngine. The defaults suit a demo; real deployments
+// would scale all the byte sizes up together.
+struct LsmOptions {
+    size_t memtable_bytes = 4 << 20;      // rotate the memtable past this size
+    size_t block_bytes = 4096;            // target size of an SSTable data block
+    size_t table_file_bytes = 2 << 20;    // compaction output file size
+    size_t level0_file_trigger = 4;       // compact L0 into L1 at this many files
+    size_t level1_bytes = 8 << 20;        // L1 target; each level below is 10x larger
+    size_t bloom_bits_per_key = 10;
+    size_t max_levels = 7;
+};
+
+// Counters for judging the engine. Amplification is the ratio of bytes the
+// engine wrote (or keeps) to the bytes the user handed it.
+struct LsmStats {
+    uint64_t user_bytes = 0;        // key + value bytes passed to put
+    uint64_t wal_bytes = 0;         // bytes appended to write-ahead logs
+    uint64_t flush_bytes = 0;       // SSTable bytes written by memtable flushes
+    uint64_t compaction_bytes = 0;  // SSTable bytes written by compactions
+    uint64_t compactions = 0;
+    uint64_t bloom_skips = 0;       // table probes avoided by a Bloom filter
+    uint64_t table_bytes = 0;       // current size of all live SSTables
+    std::vector<size_t> files_per_level;
+};
+
+// Immutable sorted string table. File layout:
+//   data blocks   [u32 klen][u32 vlen][key][value]... sorted by key
+//   index block   [u32 klen][smallest key] then per data block
+//                 [u32 klen][last key][u64 offset][u32 size]
+//   bloom block   bit array over hashBytes of every key
+//   footer        u64 index offset, u64 index size, u64 bloom offset,
+//                 u64 bloom size, u32 bloom probes, u64 entries, u64 magic
+// Integers are little-endian, like the WAL's, whatever the host is.
+// The index and Bloom filter are loaded when the table is opened; data blocks
+// are read with pread on demand and left to the page cache.
+class SSTable {
+public:
+    struct BlockHandle {
+        std::string last_key;
+        uint64_t offset;
+        uint32_t size;
+    };
+
+    static constexpr uint64_t kMagic = 0x4C534D5353543031ull;  // "LSMSST01"
+    static constexpr size_t kFooterSize = 8 * 6 + 4;
+
+private:
+    int fd;
+    uint64_t number;
+    uint64_t file_size;
+    uint64_t entries;
+    std::string smallest;
+    std::vector<BlockHandle> index;
+    std::vector<uint8_t> bloom;
+    uint32_t bloom_probes;
+
+    static uint32_t loadU32(const char* p) { return getLittleEndian32(p); }
+    static uint64_t loadU64(const char* p) { return getLittleEndian64(p); }
+
+    std::string readAt(uint64_t offset, size_t size) const {
+        std::string out(size, '\0');
+        size_t done = 0;
+        while (done < size) {
+            ssize_t n = ::pread(fd, &out[done], size - done, static_cast<off_t>(offset + done));
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                throw std::runtime_error("SSTable read failed: " + std::string(std::strerror(errno)));
+            }
+            done += static_cast<size_t>(n);
+        }
+        return out;
+    }
+
+public:
+    SSTable(const std::string& path, uint64_t fileNumber) : fd(-1), number(fileNumber), bloom_probes(0) {
+        fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("Cannot open SSTable " + path + ": " + std::strerror(errno));
+        }
+        struct stat info;
+        if (::fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < kFooterSize) {
+            ::close(fd);
+            throw std::runtime_error("SSTable " + path + " is truncated");
+        }
+        file_size = static_cast<uint64_t>(info.st_size);
+        std::string footer = readAt(file_size - kFooterSize, kFooterSize);
+        uint64_t index_offset = loadU64(&footer[0]);
+        uint64_t index_size = loadU64(&footer[8]);
+        uint64_t bloom_offset = loadU64(&footer[16]);
+        uint64_t bloom_size = loadU64(&footer[24]);
+        bloom_probes = loadU32(&footer[32]);
+        entries = loadU64(&footer[36]);
+        if (loadU64(&footer[44]) != kMagic) {
+            ::close(fd);
+            throw std::runtime_error("SSTable " + path + " is corrupt");
+        }
+
+        std::string raw = readAt(index_offset, index_size);
+        size_t pos = 4 + loadU32(&raw[0]);
+        smallest = raw.substr(4, pos - 4);
+        while (pos < raw.size()) {
+            uint32_t key_length = loadU32(&raw[pos]);
+            BlockHandle handle;
+            handle.last_key = raw.substr(pos + 4, key_length);
+            handle.offset = loadU64(&raw[pos + 4 + key_length]);
+            handle.size = loadU32(&raw[pos + 12 + key_length]);
+            index.push_back(std::move(handle));
+            pos += 16 + key_length;
+        }
+        std::string bits = readAt(bloom_offset, bloom_size);
+        bloom.assign(bits.begin(), bits.end());
+    }
+
+    SSTable(const SSTable&) = delete;
+    SSTable& operator=(const SSTable&) = delete;
+
+    ~SSTable() {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    }
+
+    uint64_t fileNumber() const { return number; }
+    uint64_t fileSize() const { return file_size; }
+    uint64_t entryCount() const { return entries; }
+    const std::string& smallestKey() const { return smallest; }
+    const std::string& largestKey() const { return index.back().last_key; }
+    const std::vector<BlockHandle>& blocks() const { return index; }
+
+    bool overlaps(std::string_view lo, std::string_view hi) const {
+        return !(hi < std::string_view(smallest) || std::string_view(largestKey()) < lo);
+    }
+
+    static bool bloomTest(const std::vector<uint8_t>& bits, uint32_t probes, uint64_t hash) {
+        uint64_t bit_count = bits.size() * 8;
+        uint64_t delta = (hash >> 33) | (hash << 31);
+        for (uint32_t i = 0; i < probes; i++) {
+            uint64_t bit = hash % bit_count;
+            if (!(bits[bit / 8] & (1u << (bit % 8)))) {
+                return false;
+            }
+            hash += delta;
+        }
+        return true;
+    }
+
+    bool mayContain(uint64_t hash) const {
+        return bloomTest(bloom, bloom_probes, hash);
+    }
+
+    std::string readBlock(size_t i) const {
+        return readAt(index[i].offset, index[i].size);
+    }
+
+    // Point lookup; the caller checks the Bloom filter first
+    std::optional<std::string> get(std::string_view key) const {
+        auto it = std::lower_bound(index.begin(), index.end(), key,
+                                   [](const BlockHandle& handle, std::string_view k) {
+                                       return std::string_view(handle.last_key) < k;
+                                   });
+        if (it == index.end()) {
+            return std::nullopt;
+        }
+        std::string block = readBlock(static_cast<size_t>(it - index.begin()));
+        for (size_t pos = 0; pos < block.size();) {
+            uint32_t key_length = loadU32(&block[pos]);
+            uint32_t value_length = loadU32(&block[pos + 4]);
+            std::string_view candidate(&block[pos + 8], key_length);
+            if (candidate == key) {
+                return block.substr(pos + 8 + key_length, value_length);
+            }
+            if (key < candidate) {
+                break;
+            }
+            pos += 8 + key_length + value_length;
+        }
+        return std::nullopt;
+    }
+
+    // Forward iterator over every entry, one block in memory at a time
+    class Iterator {
+    private:
+        const SSTable* table;
+        size_t block_index;
+        std::string block;
+        size_t pos;
+
+        void loadBlock() {
+            block.clear();
+            pos = 0;
+            while (block.empty() && block_index < table->index.size()) {
+                block = table->readBlock(block_index);
+                if (block.empty()) {
+                    block_index++;
+                }
+            }
+        }
+
+    public:
+        explicit Iterator(const SSTable* t) : table(t), block_index(0), pos(0) { loadBlock(); }
+
+        bool valid() const { return pos < block.size(); }
+        std::string_view key() const {
+            return std::string_view(&block[pos + 8], loadU32(&block[pos]));
+        }
+        std::string_view value() const {
+            return std::string_view(&block[pos + 8 + loadU32(&block[pos])], loadU32(&block[pos + 4]));
+        }
+        void next() {
+            pos += 8 + loadU32(&block[pos]) + loadU32(&block[pos + 4]);
+            if (pos >= block.size()) {
+                block_index++;
+                loadBlock();
+            }
+        }
+    };
+};
+
+// Streams sorted entries into a new SSTable file
+class SSTableWriter {
+private:
+    int fd;
+    std::string path;
+    const LsmOptions& options;
+    std::string block;
+    std::string index;
+    std::string smallest;
+    std::string last_key;
+    std::vector<uint64_t> hashes;
+    uint64_t offset;
+
+    static void putU32(std::string& out, uint32_t v) {
+        char bytes[4];
+        putLittleEndian32(bytes, v);
+        out.append(bytes, 4);
+    }
+
+    static void putU64(std::string& out, uint64_t v) {
+        char bytes[8];
+        putLittleEndian64(bytes, v);
+        out.append(bytes, 8);
+    }
+
+    void flushBlock() {
+        if (block.empty()) {
+            return;
+        }
+        writeFully(fd, block, "SSTable write");
+        putU32(index, static_cast<uint32_t>(last_key.size()));
+        index += last_key;
+        putU64(index, offset);
+        putU32(index, static_cast<uint32_t>(block.size()));
+        offset += block.size();
+        block.clear();
+    }
+
+public:
+    SSTableWriter(const std::string& filePath, const LsmOptions& lsmOptions)
+        : fd(-1), path(filePath), options(lsmOptions), offset(0) {
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            throw std::runtime_error("Cannot create SSTable " + path + ": " + std::strerror(errno));
+        }
+    }
+
+    SSTableWriter(const SSTableWriter&) = delete;
+    SSTableWriter& operator=(const SSTableWriter&) = delete;
+
+    ~SSTableWriter() {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    }
+
+    size_t entries() const { return hashes.size(); }
+    uint64_t estimatedSize() const { return offset + block.size(); }
+
+    // Keys must arrive in strictly increasing order
+    void add(std::string_view key, std::string_view value) {
+        if (hashes.empty()) {
+            smallest = key;
+        }
+        putU32(block, static_cast<uint32_t>(key.size()));
+        putU32(block, static_cast<uint32_t>(value.size()));
+        block += key;
+        block += value;
+        last_key = key;
+        hashes.push_back(hashBytes(key));
+        if (block.size() >= options.block_bytes) {
+            flushBlock();
+        }
+    }
+
+    // Write index, filter and footer, then fsync. Returns the file size.
+    uint64_t finish() {
+        flushBlock();
+        std::string index_block;
+        putU32(index_block, static_cast<uint32_t>(smallest.size()));
+        index_block += smallest;
+        index_block += index;
+
+        size_t bit_count = std::max<size_t>(64, hashes.size() * options.bloom_bits_per_key);
+        std::vector<uint8_t> bits((bit_count + 7) / 8, 0);
+        bit_count = bits.size() * 8;
+        // k = bits per key * ln 2 minimises the false positive rate
+        uint32_t probes = static_cast<uint32_t>(std::clamp<size_t>(options.bloom_bits_per_key * 69 / 100, 1, 30));
+        for (uint64_t hash : hashes) {
+            uint64_t delta = (hash >> 33) | (hash << 31);
+            for (uint32_t i = 0; i < probes; i++) {
+                uint64_t bit = hash % bit_count;
+                bits[bit / 8] |= static_cast<uint8_t>(1u << (bit % 8));
+                hash += delta;
+            }
+        }
+
+        std::string tail = index_block;
+        uint64_t index_offset = offset;
+        uint64_t bloom_offset = index_offset + index_block.size();
+        tail.append(reinterpret_cast<const char*>(bits.data()), bits.size());
+        putU64(tail, index_offset);
+        putU64(tail, index_block.size());
+        putU64(tail, bloom_offset);
+        putU64(tail, bits.size());
+        putU32(tail, probes);
+        putU64(tail, hashes.size());
+        putU64(tail, SSTable::kMagic);
+        writeFully(fd, tail, "SSTable write");
+        syncFile(fd);
+        ::close(fd);
+        fd = -1;
+        return offset + tail.size();
+    }
+};
+
+// Log-structured merge tree. Writes go to a write-ahead log and a sorted
+// memtable; full memtables are flushed by a background thread to L0
+// SSTables, and leveled compaction merges them down so that every level
+// below L0 holds non-overlapping files and is ten times larger than the one
+// above it. The set of live files is recorded in a MANIFEST that is rewritten
+// atomically after every flush and compaction.
+class LsmEngine {
+private:
+    using TablePtr = std::shared_ptr<const SSTable>;
+
+    struct Memtable {
+        std::map<std::string, std::string, std::less<>> entries;
+        size_t bytes = 0;
+        uint64_t log_number = 0;
+        std::shared_ptr<WriteAheadLog> log;
+    };
+
+    // Files per level. L0 is ordered newest first and may overlap; deeper
+    // levels are sorted by smallest key and never overlap. Versions are
+    // immutable so readers can search one without holding the mutex.
+    struct Version {
+        std::vector<std::vector<TablePtr>> levels;
+    };
+
+    std::string directory;
+    LsmOptions options;
+
+    std::mutex mutex;
+    std::condition_variable work_ready;   // wakes the background thread
+    std::condition_variable work_done;    // wakes stalled writers and waiters
+    std::shared_ptr<Memtable> memtable;
+    std::shared_ptr<const Memtable> immutable;
+    std::shared_ptr<const Version> version;
+    std::vector<std::string> compact_pointer;  // round-robin position per level
+    uint64_t next_file_number;
+    uint64_t log_start;                   // logs below this are fully flushed
+    bool compacting;
+    bool stopping;
+    std::string background_error;
+    LsmStats stats;
+    std::atomic<uint64_t> bloom_skips;
+    std::thread background;
+
+    std::string fileName(uint64_t number, const char* suffix) const {
+        char name[32];
+        std::snprintf(name, sizeof(name), "/%06llu%s", static_cast<unsigned long long>(number), suffix);
+        return directory + name;
+    }
+
+    uint64_t levelTarget(size_t level) const {
+        uint64_t target = options.level1_bytes;
+        for (size_t i = 1; i < level; i++) {
+            target *= 10;
+        }
+        return target;
+    }
+
+    static uint64_t levelBytes(const std::vector<TablePtr>& files) {
+        uint64_t total = 0;
+        for (const auto& file : files) {
+            total += file->fileSize();
+        }
+        return total;
+    }
+
+    // Called with the mutex held
+    void writeManifest(const Version& v) {
+        std::ostringstream out;
+        out << "next_file " << next_file_number << "\n";
+        out << "log_start " << log_start << "\n";
+        for (size_t level = 0; level < v.levels.size(); level++) {
+            for (const auto& file : v.levels[level]) {
+                out << "file " << level << " " << file->fileNumber() << "\n";
+            }
+        }
+        std::string temp = directory + "/MANIFEST.tmp";
+        int fd = ::open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            throw std::runtime_error("Cannot write manifest: " + std::string(std::strerror(errno)));
+        }
+        try {
+            writeFully(fd, out.str(), "Manifest write");
+            syncFile(fd);
+        } catch (...) {
+            ::close(fd);
+            throw;
+        }
+        ::close(fd);
+        if (std::rename(temp.c_str(), (directory + "/MANIFEST").c_str()) != 0) {
+            throw std::runtime_error("Cannot install manifest: " + std::string(std::strerror(errno)));
+        }
+        // Callers unlink the files the old MANIFEST named next, so the
+        // rename has to be on disk first
+        syncDirectory(directory);
+    }
+
+    void rotateMemtable(std::unique_lock<std::mutex>& lock) {
+        // Only one immutable memtable at a time; stall until it is flushed
+        work_done.wait(lock, [this] { return !immutable || !background_error.empty(); });
+        if (!background_error.empty()) {
+            throw std::runtime_error(background_error);
+        }
+        immutable = memtable;
+        memtable = newMemtable();
+        work_ready.notify_one();
+    }
+
+    std::shared_ptr<Memtable> newMemtable() {
+        auto fresh = std::make_shared<Memtable>();
+        fresh->log_number = next_file_number++;
+        fresh->log = std::make_shared<WriteAheadLog>();
+        fresh->log->open(fileName(fresh->log_number, ".log"), [](std::string_view, std::string_view) {});
+        // Writes acknowledged as durable in the log are lost with it if its
+        // directory entry is not
+        syncDirectory(directory);
+        return fresh;
+    }
+
+    // Write sorted entries from a merged source into one or more tables
+    template<typename Source>
+    std::vector<TablePtr> writeTables(Source& source, bool split, uint64_t& bytes_written) {
+        std::vector<TablePtr> outputs;
+        while (source.valid()) {
+            uint64_t number;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                number = next_file_number++;
+            }
+            std::string path = fileName(number, ".sst");
+            SSTableWriter writer(path, options);
+            while (source.valid() && (!split || writer.estimatedSize() < options.table_file_bytes)) {
+                writer.add(source.key(), source.value());
+                source.next();
+            }
+            bytes_written += writer.finish();
+            outputs.push_back(std::make_shared<const SSTable>(path, number));
+        }
+        // The new tables' entries reach disk before a MANIFEST names them
+        if (!outputs.empty()) {
+            syncDirectory(directory);
+        }
+        return outputs;
+    }
+
+    struct MemtableSource {
+        std::map<std::string, std::string, std::less<>>::const_iterator it, end;
+        bool valid() const { return it != end; }
+        std::string_view key() const { return it->first; }
+        std::string_view value() const { return it->second; }
+        void next() { ++it; }
+    };
+
+    // K-way merge of table iterators. Inputs are ranked newest first; when
+    // several hold the same key only the newest value survives.
+    struct MergeSource {
+        std::vector<SSTable::Iterator> inputs;
+        int current = -1;
+
+        void pick() {
+            current = -1;
+            for (size_t i = 0; i < inputs.size(); i++) {
+                if (inputs[i].valid() && (current < 0 || inputs[i].key() < inputs[current].key())) {
+                    current = static_cast<int>(i);
+                }
+            }
+        }
+        bool valid() const { return current >= 0; }
+        std::string_view key() const { return inputs[current].key(); }
+        std::string_view value() const { return inputs[current].value(); }
+        void next() {
+            std::string key_copy(inputs[current].key());
+            for (auto& input : inputs) {
+                while (input.valid() && input.key() == key_copy) {
+                    input.next();
+                }
+            }
+            pick();
+        }
+    };
+
+    void flushImmutable() {
+        std::shared_ptr<const Memtable> source_table;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            source_table = immutable;
+        }
+        MemtableSource source{source_table->entries.begin(), source_table->entries.end()};
+        uint64_t written = 0;
+        std::vector<TablePtr> outputs = writeTables(source, false, written);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        auto next = std::make_shared<Version>(*version);
+        next->levels[0].insert(next->levels[0].begin(), outputs.begin(), outputs.end());
+        uint64_t old_log_start = log_start;
+        log_start = source_table->log_number + 1;
+        writeManifest(*next);
+        version = next;
+        immutable.reset();
+        stats.flush_bytes += written;
+        for (uint64_t number = old_log_start; number < log_start; number++) {
+            ::unlink(fileName(number, ".log").c_str());
+        }
+    }
+
+    // Pick the most urgent compaction, merge it and install the result.
+    // Returns false when every level is within its budget.
+    bool compactOnce() {
+        std::shared_ptr<const Version> base;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            base = version;
+        }
+        size_t level = options.max_levels;
+        std::vector<TablePtr> upper;
+        if (base->levels[0].size() >= options.level0_file_trigger) {
+            level = 0;
+            upper = base->levels[0];
+        } else {
+            for (size_t l = 1; l + 1 < options.max_levels; l++) {
+                const auto& files = base->levels[l];
+                if (files.empty() || levelBytes(files) <= levelTarget(l)) {
+                    continue;
+                }
+                level = l;
+                // Rotate through the key space so every file gets its turn
+                auto it = std::find_if(files.begin(), files.end(), [&](const TablePtr& file) {
+                    return file->smallestKey() > compact_pointer[l];
+                });
+                upper.push_back(it == files.end() ? files.front() : *it);
+                break;
+            }
+        }
+        if (upper.empty()) {
+            return false;
+        }
+
+        std::string lo = upper.front()->smallestKey();
+        std::string hi = upper.front()->largestKey();
+        for (const auto& file : upper) {
+            lo = std::min(lo, file->smallestKey());
+            hi = std::max(hi, file->largestKey());
+        }
+        std::vector<TablePtr> lower;
+        for (const auto& file : base->levels[level + 1]) {
+            if (file->overlaps(lo, hi)) {
+                lower.push_back(file);
+            }
+        }
+
+        std::vector<TablePtr> outputs;
+        uint64_t written = 0;
+        bool trivial_move = level > 0 && lower.empty();
+        if (trivial_move) {
+            outputs = upper;
+        } else {
+            MergeSource merge;
+            for (const auto& file : upper) {
+                merge.inputs.emplace_back(file.get());
+            }
+            for (const auto& file : lower) {
+                merge.inputs.emplace_back(file.get());
+            }
+            merge.pick();
+            outputs = writeTables(merge, true, written);
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        // Flushes only add to L0, so every input is still present
+        auto next = std::make_shared<Version>(*version);
+        auto removeInputs = [](std::vector<TablePtr>& files, const std::vector<TablePtr>& inputs) {
+            files.erase(std::remove_if(files.begin(), files.end(), [&](const TablePtr& file) {
+                return std::find(inputs.begin(), inputs.end(), file) != inputs.end();
+            }), files.end());
+        };
+        removeInputs(next->levels[level], upper);
+        removeInputs(next->levels[level + 1], lower);
+        auto& target = next->levels[level + 1];
+        target.insert(target.end(), outputs.begin(), outputs.end());
+        std::sort(target.begin(), target.end(), [](const TablePtr& a, const TablePtr& b) {
+            return a->smallestKey() < b->smallestKey();
+        });
+        compact_pointer[level] = hi;
+        writeManifest(*next);
+        version = next;
+        stats.compaction_bytes += written;
+        stats.compactions++;
+        if (!trivial_move) {
+            // Open readers keep their file descriptors, so unlinking is safe
+            for (const auto& file : upper) {
+                ::unlink(fileName(file->fileNumber(), ".sst").c_str());
+            }
+            for (const auto& file : lower) {
+                ::unlink(fileName(file->fileNumber(), ".sst").c_str());
+            }
+        }
+        return true;
+    }
+
+    void backgroundLoop() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            work_ready.wait(lock, [this] {
+                return stopping || (background_error.empty() && (immutable || compacting));
+            });
+            if (stopping) {
+                // An unflushed memtable is still in its log and is replayed on open
+                return;
+            }
+            bool flush = immutable != nullptr;
+            lock.unlock();
+            try {
+                if (flush) {
+                    flushImmutable();
+                    lock.lock();
+                    compacting = true;
+                } else {
+                    bool more = compactOnce();
+                    lock.lock();
+                    compacting = more;
+                }
+            } catch (const std::exception& e) {
+                lock.lock();
+                background_error = e.what();
+                compacting = false;
+            }
+            work_done.notify_all();
+        }
+    }
+
+public:
+    LsmEngine(const std::string& dataDirectory, const LsmOptions& lsmOptions)
+        : directory(dataDirectory), options(lsmOptions), compact_pointer(lsmOptions.max_levels),
+          next_file_number(1), log_start(0), compacting(true), stopping(false), bloom_skips(0) {
+        ::mkdir(directory.c_str(), 0755);
+        auto loaded = std::make_shared<Version>();
+        loaded->levels.resize(options.max_levels);
+
+        std::vector<std::pair<size_t, uint64_t>> files;
+        std::ifstream manifest(directory + "/MANIFEST");
+        std::string word;
+        while (manifest >> word) {
+            if (word == "next_file") {
+                manifest >> next_file_number;
+            } else if (word == "log_start") {
+                manifest >> log_start;
+            } else if (word == "file") {
+                size_t level;
+                uint64_t number;
+                manifest >> level >> number;
+                files.emplace_back(level, number);
+            }
+        }
+        for (const auto& [level, number] : files) {
+            loaded->levels[level].push_back(std::make_shared<const SSTable>(fileName(number, ".sst"), number));
+        }
+        for (size_t level = 1; level < loaded->levels.size(); level++) {
+            std::sort(loaded->levels[level].begin(), loaded->levels[level].end(),
+                      [](const TablePtr& a, const TablePtr& b) { return a->smallestKey() < b->smallestKey(); });
+        }
+        version = loaded;
+
+        // Replay logs that were not flushed before the last shutdown, and
+        // remove leftovers (tables of an interrupted compaction, old logs)
+        memtable = std::make_shared<Memtable>();
+        std::vector<uint64_t> logs;
+        if (DIR* dir = ::opendir(directory.c_str())) {
+            while (dirent* item = ::readdir(dir)) {
+                std::string name = item->d_name;
+                unsigned long long number = 0;
+                char suffix[8] = {0};
+                if (std::sscanf(name.c_str(), "%llu.%3s", &number, suffix) != 2) {
+                    continue;
+                }
+                bool live = std::any_of(files.begin(), files.end(),
+                                        [&](const auto& file) { return file.second == number; });
+                if (std::strcmp(suffix, "log") == 0 && number >= log_start) {
+                    logs.push_back(number);
+                } else if (!live) {
+                    ::unlink((directory + "/" + name).c_str());
+                }
+                next_file_number = std::max<uint64_t>(next_file_number, number + 1);
+            }
+            ::closedir(dir);
+        }
+        std::sort(logs.begin(), logs.end());
+        for (uint64_t number : logs) {
+            WriteAheadLog replay;
+            replay.open(fileName(number, ".log"), [this](std::string_view key, std::string_view value) {
+                auto [it, inserted] = memtable->entries.insert_or_assign(std::string(key), std::string(value));
+                memtable->bytes += key.size() + value.size();
+                (void)it;
+                (void)inserted;
+            });
+        }
+        // The replayed entries now belong to the new log's memtable, so the
+        // old logs stay until that memtable is flushed
+        auto fresh = newMemtable();
+        fresh->entries.swap(memtable->entries);
+        fresh->bytes = memtable->bytes;
+        memtable = fresh;
+
+        background = std::thread([this] { backgroundLoop(); });
+    }
+
+    LsmEngine(const LsmEngine&) = delete;
+    LsmEngine& operator=(const LsmEngine&) = delete;
+
+    ~LsmEngine() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        work_ready.notify_one();
+        background.join();
+    }
+
+    // Buffer a write in the memtable and its log. Returns the log and the
+    // position to wait on, so batches can share one durability wait.
+    std::pair<std::shared_ptr<WriteAheadLog>, uint64_t> putAsync(std::string_view key, std::string_view value) {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (!background_error.empty()) {
+            throw std::runtime_error(background_error);
+        }
+        if (memtable->bytes >= options.memtable_bytes) {
+            rotateMemtable(lock);
+        }
+        uint64_t lsn = memtable->log->append(key, value);
+        auto [it, inserted] = memtable->entries.insert_or_assign(std::string(key), std::string(value));
+        (void)it;
+        (void)inserted;
+        memtable->bytes += key.size() + value.size();
+        stats.user_bytes += key.size() + value.size();
+        stats.wal_bytes += 12 + key.size() + value.size();
+        return {memtable->log, lsn};
+    }
+
+    void put(std::string_view key, std::string_view value) {
+        auto [log, lsn] = putAsync(key, value);
+        log->waitDurable(lsn);
+    }
+
+    std::optional<std::string> get(std::string_view key) {
+        std::shared_ptr<const Memtable> frozen;
+        std::shared_ptr<const Version> current;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = memtable->entries.find(key);
+            if (it != memtable->entries.end()) {
+                return it->second;
+            }
+            frozen = immutable;
+            current = version;
+        }
+        if (frozen) {
+            auto it = frozen->entries.find(key);
+            if (it != frozen->entries.end()) {
+                return it->second;
+            }
+        }
+        uint64_t hash = hashBytes(key);
+        for (const auto& file : current->levels[0]) {
+            if (!file->overlaps(key, key)) {
+                continue;
+            }
+            if (!file->mayContain(hash)) {
+                bloom_skips++;
+                continue;
+            }
+            if (auto value = file->get(key)) {
+                return value;
+            }
+        }
+        for (size_t level = 1; level < current->levels.size(); level++) {
+            const auto& files = current->levels[level];
+            auto it = std::lower_bound(files.begin(), files.end(), key,
+                                       [](const TablePtr& file, std::string_view k) {
+                                           return std::string_view(file->largestKey()) < k;
+                                       });
+            if (it == files.end() || !(*it)->overlaps(key, key)) {
+                continue;
+            }
+            if (!(*it)->mayContain(hash)) {
+                bloom_skips++;
+                continue;
+            }
+            if (auto value = (*it)->get(key)) {
+                return value;
+            }
+        }
+        return std::nullopt;
+    }
+
+    // Flush the memtable and wait until no compaction is pending
+    void flushAndSettle() {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (!memtable->entries.empty()) {
+            rotateMemtable(lock);
+        }
+        compacting = true;
+        work_ready.notify_one();
+        work_done.wait(lock, [this] { return (!immutable && !compacting) || !background_error.empty(); });
+        if (!background_error.empty()) {
+            throw std::runtime_error(background_error);
+        }
+    }
+
+    LsmStats statistics() {
+        std::lock_guard<std::mutex> lock(mutex);
+        LsmStats out = stats;
+        out.bloom_skips = bloom_skips;
+        for (const auto& files : version->levels) {
+            out.files_per_level.push_back(files.size());
+            out.table_bytes += levelBytes(files);
+        }
+        return out;
+    }
+};
+
+#endif // LSM_ENGINE_H
@@ -0,0 +1,166 @@
+#ifndef ORDERED_INDEX_H
+#define ORDERED_INDEX_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <span>
+#include <memory>
+#include <shared_mutex>
+#include <mutex>
+#include <algorithm>
+
+// B+-tree over keys only, kept next to the hash table so that range and
+// prefix queries can walk keys in order. Leaves are chained, so a scan costs
+// one descent plus the leaves it actually reads. Readers copy at most one
+// leaf at a time under the shared lock and never hold it between calls.
+class OrderedIndex {
+private:
+    static constexpr size_t kFanout = 64;
+
+    struct Node {
+        bool leaf;
+        // In a leaf: the keys. In an internal node: keys[i] is the smallest
+        // key reachable through children[i + 1].
+        std::vector<std::string> keys;
+        std::vector<std::unique_ptr<Node>> children;
+        Node* next = nullptr;  // right sibling, leaves only
+
+        explicit Node(bool isLeaf) : leaf(isLeaf) {}
+    };
+
+    std::unique_ptr<Node> root;
+    size_t count;
+    mutable std::shared_mutex mutex;
+
+    // Insert below node; on overflow split it and return the new right
+    // sibling together with the separator key for the parent
+    std::unique_ptr<Node> insertInto(Node* node, std::string_view key, std::string& separator, bool& added) {
+        if (node->leaf) {
+            auto it = std::lower_bound(node->keys.begin(), node->keys.end(), key);
+            if (it != node->keys.end() && *it == key) {
+                return nullptr;
+            }
+            node->keys.emplace(it, key);
+            added = true;
+        } else {
+            size_t child = std::upper_bound(node->keys.begin(), node->keys.end(), key) - node->keys.begin();
+            std::string child_separator;
+            auto sibling = insertInto(node->children[child].get(), key, child_separator, added);
+            if (!sibling) {
+                return nullptr;
+            }
+            node->keys.insert(node->keys.begin() + child, std::move(child_separator));
+            node->children.insert(node->children.begin() + child + 1, std::move(sibling));
+        }
+        if (node->keys.size() <= kFanout) {
+            return nullptr;
+        }
+
+        auto right = std::make_unique<Node>(node->leaf);
+        size_t half = node->keys.size() / 2;
+        if (node->leaf) {
+            right->keys.assign(std::make_move_iterator(node->keys.begin() + half),
+                               std::make_move_iterator(node->keys.end()));
+            node->keys.resize(half);
+            separator = right->keys.front();
+            right->next = node->next;
+            node->next = right.get();
+        } else {
+            // The middle key moves up instead of being copied
+            separator = std::move(node->keys[half]);
+            right->keys.assign(std::make_move_iterator(node->keys.begin() + half + 1),
+                               std::make_move_iterator(node->keys.end()));
+            right->children.assign(std::make_move_iterator(node->children.begin() + half + 1),
+                                   std::make_move_iterator(node->children.end()));
+            node->keys.resize(half);
+            node->children.resize(half + 1);
+        }
+        return right;
+    }
+
+    void insertLocked(std::string_view key) {
+        std::string separator;
+        bool added = false;
+        auto sibling = insertInto(root.get(), key, separator, added);
+        if (sibling) {
+            auto parent = std::make_unique<Node>(false);
+            parent->keys.push_back(std::move(separator));
+            parent->children.push_back(std::move(root));
+            parent->children.push_back(std::move(sibling));
+            root = std::move(parent);
+        }
+        count += added;
+    }
+
+public:
+    OrderedIndex() : root(std::make_unique<Node>(true)), count(0) {}
+
+    size_t size() const {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        return count;
+    }
+
+    // Add a key; does nothing if it is already present
+    void insert(std::string_view key) {
+        std::unique_lock<std::shared_mutex> lock(mutex);
+        insertLocked(key);
+    }
+
+    // Add many keys under one lock, cheapest when they arrive sorted
+    void insertMany(std::span<const std::string_view> keys) {
+        std::unique_lock<std::shared_mutex> lock(mutex);
+        for (std::string_view key : keys) {
+            insertLocked(key);
+        }
+    }
+
+    // Remove a key if present. Leaves are allowed to shrink, even to empty,
+    // without rebalancing; separators stay valid for routing and scans skip
+    // empty leaves through the sibling chain.
+    void erase(std::string_view key) {
+        std::unique_lock<std::shared_mutex> lock(mutex);
+        Node* node = root.get();
+        while (!node->leaf) {
+            size_t child = std::upper_bound(node->keys.begin(), node->keys.end(), key) - node->keys.begin();
+            node = node->children[child].get();
+        }
+        auto it = std::lower_bound(node->keys.begin(), node->keys.end(), key);
+        if (it != node->keys.end() && *it == key) {
+            node->keys.erase(it);
+            count--;
+        }
+    }
+
+    // Append up to max keys in order, starting at from (inclusive or
+    // exclusive) and stopping before hi when hi is given. Returns false once
+    // the end of the range has been reached.
+    bool collect(std::string_view from, bool inclusive, const std::string* hi, size_t max,
+                 std::vector<std::string>& out) const {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        const Node* node = root.get();
+        while (!node->leaf) {
+            size_t child = std::upper_bound(node->keys.begin(), node->keys.end(), from) - node->keys.begin();
+            node = node->children[child].get();
+        }
+        auto it = inclusive ? std::lower_bound(node->keys.begin(), node->keys.end(), from)
+                            : std::upper_bound(node->keys.begin(), node->keys.end(), from);
+        size_t pos = it - node->keys.begin();
+        while (node) {
+            for (; pos < node->keys.size(); pos++) {
+                if (hi && node->keys[pos] >= *hi) {
+                    return false;
+                }
+                if (out.size() == max) {
+                    return true;
+                }
+                out.push_back(node->keys[pos]);
+            }
+            node = node->next;
+            pos = 0;
+        }
+        return false;
+    }
+};
+
+#endif // ORDERED_INDEX_H
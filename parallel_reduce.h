@@ -0,0 +1,156 @@
+#ifndef PARALLEL_REDUCE_H
+#define PARALLEL_REDUCE_H
+
+#include <iterator>
+#include <ranges>
+#include <optional>
+#include <concepts>
+#include <utility>
+#include <algorithm>
+#include <thread>
+#include <cstddef>
+
+#include "work_stealing_pool.h"
+
+// Pieces of parallel_reduce's input shorter than this are not split
+// unless the caller passes a smaller grain
+constexpr size_t kDefaultReduceGrain = 1024;
+
+// Decides where parallel_reduce stops splitting, adapting to how the work
+// spreads: the input is first cut into about two pieces per thread, and a
+// piece is only cut further once another thread has stolen it, because
+// that is when a thread is idle. Balanced work is not split into pieces
+// smaller than it needs to be; unbalanced work keeps being split where
+// it is slow.
+struct ReduceSplitter {
+    size_t threads;
+    size_t splits;
+    size_t grain;
+
+    bool trySplit(size_t length, bool stolen) {
+        if (length / 2 < grain) {
+            return false;
+        }
+        if (stolen) {
+            splits = std::max(threads, splits / 2);
+            return true;
+        }
+        if (splits > 0) {
+            splits /= 2;
+            return true;
+        }
+        return false;
+    }
+
+    static ReduceSplitter forPool(size_t grain) {
+        size_t threads = WorkStealingPool::getInstance().concurrency();
+        return ReduceSplitter{threads, threads > 1 ? 2 * threads : 0, std::max<size_t>(grain, 1)};
+    }
+};
+
+// Reduce [first, last) to one T: pieces the splitter stops at go to
+// leaf(first, last), and their results meet in combine() on the way back
+// up, so each piece accumulates on its own
+template<typename T, typename I, typename Leaf, typename Combine>
+T reduceRange(I first, I last, Leaf& leaf, Combine& combine, ReduceSplitter splitter, bool stolen) {
+    size_t length = static_cast<size_t>(last - first);
+    if (!splitter.trySplit(length, stolen)) {
+        return leaf(first, last);
+    }
+    I middle = first + (last - first) / 2;
+    std::optional<T> left;
+    std::optional<T> right;
+    std::thread::id forked_on = std::this_thread::get_id();
+    WorkStealingPool::getInstance().join(
+        [&] { left.emplace(reduceRange<T>(first, middle, leaf, combine, splitter, false)); },
+        [&] {
+            bool moved = std::this_thread::get_id() != forked_on;
+            right.emplace(reduceRange<T>(middle, last, leaf, combine, splitter, moved));
+        });
+    return combine(std::move(*left), std::move(*right));
+}
+
+// Reduce [first, last) on the WorkStealingPool: every element goes
+// through map, and the results are folded together with combine, starting
+// from identity. Returns identity for an empty range.
+//
+// combine must be associative and identity neutral for it, since the
+// input is folded in pieces whose results are combined in an order that
+// depends on the split, though left before right. map(x) may return T, or
+// any type combine also accepts as its second argument: a histogram's
+// map can return a bucket number that combine(histogram, bucket) counts,
+// as long as combine(histogram, histogram) merges two of them. The
+// accumulator is passed to combine as an rvalue, so taking it by value
+// and returning it avoids copies. map and combine are called from several
+// threads at once.
+//
+// grain is the shortest piece worth handing to another thread; raise it
+// when map is cheap, lower it when a few elements already take long.
+template<std::random_access_iterator I, typename T, typename Map, typename Combine>
+T parallel_reduce(I first, I last, T identity, Map map, Combine combine,
+                  size_t grain = kDefaultReduceGrain) {
+    auto fold = [&identity, &map, &combine](I begin, I end) {
+        T accumulator = identity;
+        for (; begin != end; ++begin) {
+            accumulator = combine(std::move(accumulator), map(*begin));
+        }
+        return accumulator;
+    };
+    return reduceRange<T>(first, last, fold, combine, ReduceSplitter::forPool(grain), false);
+}
+
+// The same over a container, span or view, e.g. std::views::iota
+template<std::ranges::random_access_range R, typename T, typename Map, typename Combine>
+T parallel_reduce(R&& range, T identity, Map map, Combine combine, size_t grain = kDefaultReduceGrain) {
+    auto first = std::ranges::begin(range);
+    return parallel_reduce(first, first + std::ranges::distance(range), std::move(identity), std::move(map),
+                           std::move(combine), grain);
+}
+
+// The same over the integers [first, last)
+template<std::integral N, typename T, typename Map, typename Combine>
+T parallel_reduce(N first, N last, T identity, Map map, Combine combine, size_t grain = kDefaultReduceGrain) {
+    if (last <= first) {
+        return identity;
+    }
+    return parallel_reduce(std::views::iota(first, last), std::move(identity), std::move(map),
+                           std::move(combine), grain);
+}
+
+// Like parallel_reduce, but hands whole pieces of the input to
+// reduce_chunk(first, last), which returns their T, for when a piece is
+// best reduced by a kernel of its own, such as the SIMD kernels of
+// simd_reduce.h. The pieces are never shorter than grain unless the
+// whole input is.
+template<std::random_access_iterator I, typename T, typename ReduceChunk, typename Combine>
+T parallel_reduce_chunks(I first, I last, T identity, ReduceChunk reduce_chunk, Combine combine,
+                         size_t grain = kDefaultReduceGrain) {
+    if (first == last) {
+        return identity;
+    }
+    return reduceRange<T>(first, last, reduce_chunk, combine, ReduceSplitter::forPool(grain), false);
+}
+
+template<std::ranges::random_access_range R, typename T, typename ReduceChunk, typename Combine>
+T parallel_reduce_chunks(R&& range, T identity, ReduceChunk reduce_chunk, Combine combine,
+                         size_t grain = kDefaultReduceGrain) {
+    auto first = std::ranges::begin(range);
+    return parallel_reduce_chunks(first, first + std::ranges::distance(range), std::move(identity),
+                                  std::move(reduce_chunk), std::move(combine), grain);
+}
+
+// Over the integers [first, last), handing reduce_chunk the bounds of
+// each piece as integers too
+template<std::integral N, typename T, typename ReduceChunk, typename Combine>
+T parallel_reduce_chunks(N first, N last, T identity, ReduceChunk reduce_chunk, Combine combine,
+                         size_t grain = kDefaultReduceGrain) {
+    if (last <= first) {
+        return identity;
+    }
+    // An iota iterator holds its number, so even the end one dereferences
+    auto bounds = [&reduce_chunk](auto begin, auto end) { return reduce_chunk(*begin, *end); };
+    auto numbers = std::views::iota(first, last);
+    return reduceRange<T>(numbers.begin(), numbers.end(), bounds, combine, ReduceSplitter::forPool(grain), false);
+}
+
+#endif // PARALLEL_REDUCE_H
@@ -0,0 +1,145 @@
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <span>
+#include <utility>
+#include <limits>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+
+#include "parallel_reduce.h"
+
+// Runs the reductions parallel_reduce replaces hand-rolled thread loops
+// for, each against a plain loop over the same data that checks its
+// result:
+//   1. the sum of an int array, over a span
+//   2. its minimum and maximum together, over a vector's iterators
+//   3. a 256-bucket histogram of it, counted into per-piece accumulators
+//   4. the dot product of two float arrays, over their indices
+// Usage: parallel_reduce_demo [elements]
+
+constexpr size_t kBuckets = 256;
+
+using Histogram = std::vector<uint64_t>;
+
+// Counts one bucket number into a histogram, or merges two histograms
+struct CountBucket {
+    Histogram operator()(Histogram histogram, size_t bucket) const {
+        histogram[bucket]++;
+        return histogram;
+    }
+
+    Histogram operator()(Histogram histogram, const Histogram& other) const {
+        for (size_t i = 0; i < kBuckets; i++) {
+            histogram[i] += other[i];
+        }
+        return histogram;
+    }
+};
+
+template<typename F>
+double millisecondsOf(F&& f) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void report(const char* label, double parallel_ms, double loop_ms, bool match) {
+    std::cout << std::left << std::setw(12) << label << std::right << std::fixed << std::setprecision(2)
+              << std::setw(10) << parallel_ms << " ms parallel_reduce " << std::setw(10) << loop_ms
+              << " ms loop  " << (match ? "match" : "MISMATCH") << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    size_t elements = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 20000000;
+    if (elements == 0) {
+        std::cerr << "Usage: parallel_reduce_demo [elements]" << std::endl;
+        return 1;
+    }
+
+    std::vector<int> values(elements);
+    std::vector<float> a(elements);
+    std::vector<float> b(elements);
+    uint64_t state = 1;
+    for (size_t i = 0; i < elements; i++) {
+        state = state * 6364136223846793005ull + 1442695040888963407ull;
+        values[i] = static_cast<int>(state >> 33) - (1 << 30);
+        a[i] = static_cast<float>((state >> 20) & 0xffff) / 65536.0f;
+        b[i] = static_cast<float>((state >> 40) & 0xffff) / 65536.0f - 0.5f;
+    }
+    std::cout << elements << " elements, " << WorkStealingPool::getInstance().concurrency()
+              << " threads in the pool" << std::endl;
+    bool all_match = true;
+
+    // 1. Sum
+    std::span<const int> view(values);
+    int64_t sum = 0;
+    int64_t loop_sum = 0;
+    double parallel_ms = millisecondsOf([&] {
+        sum = parallel_reduce(view, int64_t(0), [](int x) { return int64_t(x); }, std::plus<int64_t>());
+    });
+    double loop_ms = millisecondsOf([&] {
+        for (int x : values) {
+            loop_sum += x;
+        }
+    });
+    report("sum", parallel_ms, loop_ms, sum == loop_sum);
+    all_match = all_match && sum == loop_sum;
+
+    // 2. Minimum and maximum in one pass
+    using MinMax = std::pair<int, int>;
+    MinMax extremes;
+    MinMax loop_extremes{std::numeric_limits<int>::max(), std::numeric_limits<int>::min()};
+    parallel_ms = millisecondsOf([&] {
+        extremes = parallel_reduce(values.begin(), values.end(), loop_extremes,
+                                   [](int x) { return MinMax{x, x}; },
+                                   [](MinMax l, MinMax r) {
+                                       return MinMax{std::min(l.first, r.first), std::max(l.second, r.second)};
+                                   });
+    });
+    loop_ms = millisecondsOf([&] {
+        for (int x : values) {
+            loop_extremes.first = std::min(loop_extremes.first, x);
+            loop_extremes.second = std::max(loop_extremes.second, x);
+        }
+    });
+    report("min/max", parallel_ms, loop_ms, extremes == loop_extremes);
+    all_match = all_match && extremes == loop_extremes;
+
+    // 3. Histogram of the top eight bits
+    auto bucketOf = [](int x) { return static_cast<size_t>(static_cast<uint32_t>(x) >> 24); };
+    Histogram histogram;
+    Histogram loop_histogram(kBuckets, 0);
+    parallel_ms = millisecondsOf([&] {
+        histogram = parallel_reduce(view, Histogram(kBuckets, 0), bucketOf, CountBucket());
+    });
+    loop_ms = millisecondsOf([&] {
+        for (int x : values) {
+            loop_histogram[bucketOf(x)]++;
+        }
+    });
+    report("histogram", parallel_ms, loop_ms, histogram == loop_histogram);
+    all_match = all_match && histogram == loop_histogram;
+
+    // 4. Dot product, accumulated in double; the pieces add up in another
+    // order than the loop does, so the results only agree to rounding
+    double dot = 0;
+    double loop_dot = 0;
+    parallel_ms = millisecondsOf([&] {
+        dot = parallel_reduce(size_t(0), elements, 0.0,
+                              [&a, &b](size_t i) { return double(a[i]) * double(b[i]); }, std::plus<double>());
+    });
+    loop_ms = millisecondsOf([&] {
+        for (size_t i = 0; i < elements; i++) {
+            loop_dot += double(a[i]) * double(b[i]);
+        }
+    });
+    bool dot_match = std::abs(dot - loop_dot) <= 1e-9 * std::max(1.0, std::abs(loop_dot));
+    report("dot product", parallel_ms, loop_ms, dot_match);
+    all_match = all_match && dot_match;
+
+    return all_match ? 0 : 1;
+}
@@ -1,28 +1,79 @@
 #include <iostream>
+#include <iomanip>
 #include <thread>
 #include <vector>
 #include <mutex>
 #include <atomic>
 #include <numeric>
+#include <chrono>
+#include <functional>
+
+#include "parallel_reduce.h"
+
+// Ranges up to this many numbers are summed on one thread: handing half
+// of a smaller range to another thread costs more than summing it
+constexpr size_t kSumGrain = 1 << 16;
+
+// Function to calculate sum sequentially for verification
+size_t sequential_sum(size_t first, size_t last) {
+    size_t sum = 0;
+    for (size_t i = first; i < last; i++) {
+        sum += i;
+    }
+    return sum;
+}
+
+// Sums one piece of parallel_sum's range. Four running sums take four
+// numbers per branch and let the additions overlap; a loop of one add and
+// one branch per number runs at the speed of its branch, which on some
+// CPUs halves whenever the loop happens to straddle a 32-byte boundary.
+size_t sum_piece(size_t first, size_t last) {
+    size_t sums[4] = {0, 0, 0, 0};
+    size_t i = first;
+    for (; last - i >= 4; i += 4) {
+        sums[0] += i;
+        sums[1] += i + 1;
+        sums[2] += i + 2;
+        sums[3] += i + 3;
+    }
+    for (; i < last; i++) {
+        sums[0] += i;
+    }
+    return (sums[0] + sums[1]) + (sums[2] + sums[3]);
+}
 
 /**
- * Calculates the sum of numbers in a range using parallel processing
+ * Calculates the sum of numbers in a range using parallel processing.
+ * The range is reduced on the process-wide work-stealing pool, so no
+ * threads are created per call and idle cores take over whatever pieces
+ * are left.
  * @param first Starting number of the range (inclusive)
  * @param last Ending number of the range (exclusive)
  * @return The sum of all numbers in the range
  */
 size_t parallel_sum(size_t first, size_t last) {
+    return parallel_reduce_chunks(first, last, size_t(0), sum_piece, std::plus<size_t>(), kSumGrain);
+}
+
+/**
+ * The version parallel_sum replaced, kept for comparison: it starts and
+ * joins one thread per hardware thread on every call
+ * @param first Starting number of the range (inclusive)
+ * @param last Ending number of the range (exclusive)
+ * @return The sum of all numbers in the range
+ */
+size_t thread_per_call_sum(size_t first, size_t last) {
     // Determine optimal thread count based on hardware
-    const size_t thread_count = std::thread::hardware_concurrency() > 0 ? 
+    const size_t thread_count = std::thread::hardware_concurrency() > 0 ?
                               std::thread::hardware_concurrency() : 4;
-    
+
     // Calculate input size and chunk size for each thread
     const size_t input_size = last - first;
     const size_t chunk_size = input_size / thread_count;
-    
+
     // Vector to store partial sums from each thread
     std::vector<size_t> partial_sums(thread_count, 0);
-    
+
     // Vector to store thread objects
     std::vector<std::thread> processing_threads;
     processing_threads.reserve(thread_count);  // Prevent reallocation
@@ -34,13 +85,13 @@ size_t parallel_sum(size_t first, size_t last) {
                 // Calculate range for this thread
                 size_t start = first + (thread_id * chunk_size);
                 size_t end = first + ((thread_id + 1) * chunk_size);
-                
+
                 // Calculate partial sum for this chunk
                 size_t local_sum = 0;
                 for (size_t number = start; number < end; number++) {
                     local_sum += number;
                 }
-                
+
                 // Store result in thread-specific slot
                 partial_sums[thread_id] = local_sum;
             }
@@ -68,25 +119,54 @@ size_t parallel_sum(size_t first, size_t last) {
     return total_sum;
 }
 
-// Function to calculate sum sequentially for verification
-size_t sequential_sum(size_t first, size_t last) {
-    size_t sum = 0;
-    for (size_t i = first; i < last; i++) {
-        sum += i;
-    }
-    return sum;
+// Mean microseconds per call of sum over [0, range_end), repeated until
+// about 0.2 s have passed
+template<typename Sum>
+double time_call(Sum sum, size_t range_end, size_t& result) {
+    volatile size_t end = range_end;
+    size_t calls = 0;
+    auto start = std::chrono::steady_clock::now();
+    std::chrono::duration<double, std::micro> elapsed{0};
+    do {
+        result = sum(0, end);
+        calls++;
+        elapsed = std::chrono::steady_clock::now() - start;
+    } while (elapsed.count() < 200000);
+    return elapsed.count() / calls;
 }
 
 int main() {
     const size_t RANGE_END = 1000000;
-    
+
     // Calculate and verify results
     size_t parallel_result = parallel_sum(0, RANGE_END);
     size_t sequential_result = sequential_sum(0, RANGE_END);
-    
+
     std::cout << "Parallel sum result: " << parallel_result << "\n";
     std::cout << "Sequential sum result: " << sequential_result << "\n";
     std::cout << "Results match: " << (parallel_result == sequential_result ? "Yes" : "No") << "\n";
-    
-    return 0;
+
+    // Time each version per call, from ranges too small to split up;
+    // "one piece" is parallel_sum's leaf over the whole range on this
+    // thread, what the pool costs is the difference to it
+    std::cout << "\n" << WorkStealingPool::getInstance().concurrency() << " threads in the pool; microseconds per call:\n"
+              << std::setw(12) << "range" << std::setw(14) << "sequential" << std::setw(14) << "one piece"
+              << std::setw(14) << "pool" << std::setw(18) << "thread per call" << "\n";
+    bool all_match = parallel_result == sequential_result;
+    for (size_t range_end : {size_t(1000), size_t(100000), size_t(10000000), size_t(1000000000)}) {
+        size_t expected = 0;
+        size_t piece = 0;
+        size_t pooled = 0;
+        size_t spawned = 0;
+        double sequential_us = time_call(sequential_sum, range_end, expected);
+        double piece_us = time_call(sum_piece, range_end, piece);
+        double pool_us = time_call(parallel_sum, range_end, pooled);
+        double spawned_us = time_call(thread_per_call_sum, range_end, spawned);
+        all_match = all_match && piece == expected && pooled == expected && spawned == expected;
+        std::cout << std::setw(12) << range_end << std::fixed << std::setprecision(1) << std::setw(14)
+                  << sequential_us << std::setw(14) << piece_us << std::setw(14) << pool_us << std::setw(18) << spawned_us << "\n";
+    }
+    std::cout << "All results match: " << (all_match ? "Yes" : "No") << "\n";
+
+    return all_match ? 0 : 1;
 }
@@ -0,0 +1,179 @@
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <random>
+#include <thread>
+#include <chrono>
+#include <stdexcept>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "database_connection.h"
+
+// Runs a leader and a follower as two processes on one host, replicating
+// through a shared-memory ring. The leader (a child process) writes keys
+// while the follower (this process) serves reads with bounded staleness;
+// then the leader dies without disconnecting, the follower notices,
+// promotes itself, and takes a write.
+// Usage: replication_demo [keys] [ring_name] [max_staleness_ms]
+
+std::string makeKey(size_t i) {
+    char key[32];
+    std::snprintf(key, sizeof(key), "user:%010zu", i);
+    return key;
+}
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Writes keys in batches, then a marker, then exits as if it crashed
+[[noreturn]] void runLeader(const std::string& ring_name, size_t keys) {
+    try {
+        DatabaseConnection& db = DatabaseConnection::getInstance();
+        ConnectionOptions options;
+        options.replicate_to = ring_name;
+        options.echo_inserts = false;
+        db.connect("leader://" + ring_name, options);
+        // Shipping starts once the follower has asked for its copy
+        while (db.replicationStats().full_syncs == 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::pair<std::string, std::string>> batch;
+        for (size_t i = 0; i < keys; i++) {
+            batch.emplace_back(makeKey(i), "value-" + std::to_string(i));
+            if (batch.size() == 1000 || i + 1 == keys) {
+                db.insertBatch(batch);
+                batch.clear();
+            }
+        }
+        db.insert("leader:done", std::to_string(keys));
+        ReplicationStats stats = db.replicationStats();
+        std::cout << "[leader]   wrote " << keys << " keys in " << std::fixed << std::setprecision(2)
+                  << secondsSince(start) << " s, shipped " << stats.shipped << " records" << std::endl;
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        std::cout << "[leader]   exiting without disconnecting" << std::endl;
+    } catch (const std::exception& e) {
+        std::cerr << "[leader]   error: " << e.what() << std::endl;
+        std::_Exit(1);
+    }
+    std::_Exit(0);
+}
+
+int main(int argc, char* argv[]) {
+    size_t keys = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 200000;
+    std::string ring_name = argc > 2 ? argv[2] : "/replication_demo";
+    int staleness_ms = argc > 3 ? std::atoi(argv[3]) : 50;
+    if (keys == 0 || ring_name.empty() || ring_name[0] != '/') {
+        std::cerr << "Usage: replication_demo [keys] [ring_name] [max_staleness_ms]" << std::endl;
+        return 1;
+    }
+
+    pid_t leader = ::fork();
+    if (leader < 0) {
+        std::perror("fork");
+        return 1;
+    }
+    if (leader == 0) {
+        runLeader(ring_name, keys);
+    }
+
+    try {
+        DatabaseConnection& db = DatabaseConnection::getInstance();
+        ConnectionOptions options;
+        options.follow = ring_name;
+        options.max_staleness = std::chrono::milliseconds(staleness_ms);
+        options.echo_inserts = false;
+        // The leader creates the ring; wait for it to appear
+        for (int attempt = 0;; attempt++) {
+            try {
+                db.connect("follower://" + ring_name, options);
+                break;
+            } catch (const std::runtime_error&) {
+                if (attempt == 200) {
+                    throw;
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+        }
+
+        try {
+            db.insert("follower:write", "x");
+        } catch (const std::runtime_error& e) {
+            std::cout << "[follower] expected error: " << e.what() << std::endl;
+        }
+
+        while (db.replicationStats().staleness_ms == UINT64_MAX) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+
+        // Read random keys while the leader writes. A key may not exist yet,
+        // but whatever is read must be the value the leader wrote.
+        std::mt19937_64 rng(1);
+        size_t reads = 0;
+        size_t found = 0;
+        size_t stale = 0;
+        uint64_t worst_staleness = 0;
+        auto start = std::chrono::steady_clock::now();
+        auto next_check = start;
+        for (;;) {
+            size_t i = rng() % keys;
+            {
+                // Holds the key's shard lock until the end of this block
+                LookupResult result = db.lookup(makeKey(i));
+                reads++;
+                if (result) {
+                    found++;
+                    if (*result != "value-" + std::to_string(i)) {
+                        throw std::runtime_error("Follower read a wrong value for " + makeKey(i));
+                    }
+                } else if (result.status() == LookupStatus::kStale) {
+                    stale++;
+                }
+            }
+            if (std::chrono::steady_clock::now() >= next_check) {
+                next_check += std::chrono::milliseconds(10);
+                ReplicationStats stats = db.replicationStats();
+                if (stats.staleness_ms != UINT64_MAX) {
+                    worst_staleness = std::max(worst_staleness, stats.staleness_ms);
+                }
+                if (db.lookup("leader:done")) {
+                    break;
+                }
+            }
+        }
+        std::cout << "[follower] " << reads << " reads in " << std::fixed << std::setprecision(2)
+                  << secondsSince(start) << " s while the leader wrote: " << found << " found, " << stale
+                  << " refused as stale, worst observed staleness " << worst_staleness << " ms" << std::endl;
+
+        // Wait for the leader to die, then take over
+        start = std::chrono::steady_clock::now();
+        while (db.replicationStats().peer_alive) {
+            ::waitpid(leader, nullptr, WNOHANG);
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        }
+        std::cout << "[follower] leader gone after " << std::setprecision(2) << secondsSince(start) << " s"
+                  << std::endl;
+        db.promote();
+        db.insert("follower:write", "accepted after promotion");
+
+        size_t missing = 0;
+        for (size_t i = 0; i < keys; i++) {
+            missing += !db.lookup(makeKey(i));
+        }
+        std::cout << "[follower] promoted: " << keys - missing << "/" << keys << " keys present, "
+                  << "follower:write = " << db.query("follower:write") << std::endl;
+        db.disconnect();
+        ::waitpid(leader, nullptr, 0);
+        return missing == 0 ? 0 : 1;
+    } catch (const std::exception& e) {
+        std::cerr << "[follower] error: " << e.what() << std::endl;
+        ::kill(leader, SIGKILL);
+        ::waitpid(leader, nullptr, 0);
+        return 1;
+    }
+}
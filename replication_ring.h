@@ -0,0 +1,289 @@
+#ifndef REPLICATION_RING_H
+#define REPLICATION_RING_H
+
+#include <string>
+#include <string_view>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Byte ring in POSIX shared memory that carries one leader process's
+// writes to one follower process on the same host. The leader writes
+// records at head and the follower consumes them from tail; both are byte
+// counts that only grow, so head - tail is what is in flight. Each side
+// also publishes its pid and a heartbeat, so the other can tell when it
+// has died: a leader whose follower is gone stops waiting for ring space,
+// and a follower whose leader is gone may be promoted.
+//
+// A record is
+//   [u32 payload length][u8 type][3 bytes padding][u64 expiry][u32 key length][key][value]
+// where the expiry is in milliseconds since the Unix epoch, or 0, and the
+// payload is the key and value. Records wrap around the end of the ring.
+class ReplicationRing {
+public:
+    enum class RecordType : uint8_t {
+        kPut = 1,
+        kSyncBegin = 2,   // the follower drops its data; a full copy follows
+        kSyncEnd = 3,     // the full copy is complete
+    };
+
+    struct Record {
+        RecordType type;
+        uint64_t expires_at;
+        std::string_view key;
+        std::string_view value;
+    };
+
+    // Bits of the shared state word
+    static constexpr uint32_t kSyncRequested = 1;   // the follower needs a full copy
+    static constexpr uint32_t kOverrun = 2;         // records were dropped; the copy is incomplete
+    static constexpr uint32_t kFenced = 4;          // a follower was promoted; the leader must stop
+
+    // A side that has not beaten for this long is taken to be dead
+    static constexpr uint64_t kPatienceMs = 1000;
+
+private:
+    static constexpr uint64_t kMagic = 0x52504c52494e4731ull;   // "RPLRING1"
+    static constexpr size_t kRecordHeader = 20;
+
+    struct Header {
+        std::atomic<uint64_t> magic;   // set last, once the rest is
+        uint64_t capacity;
+        alignas(64) std::atomic<uint64_t> head;
+        alignas(64) std::atomic<uint64_t> tail;
+        alignas(64) std::atomic<uint32_t> state;
+        std::atomic<int32_t> leader_pid;
+        std::atomic<int32_t> follower_pid;
+        std::atomic<uint64_t> leader_beat;     // wall milliseconds
+        std::atomic<uint64_t> follower_beat;
+    };
+
+    std::string name;
+    Header* header = nullptr;
+    char* data = nullptr;
+    size_t mapped_bytes = 0;
+    bool owner = false;
+    std::string scratch;   // record bytes that wrapped around the end
+
+    static uint64_t wallMillis() {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+                   std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    static bool alive(int32_t pid, uint64_t beat) {
+        if (pid <= 0 || (::kill(pid, 0) != 0 && errno != EPERM)) {
+            return false;
+        }
+        uint64_t now = wallMillis();
+        return beat + kPatienceMs >= now;
+    }
+
+    void map(int fd, size_t bytes) {
+        void* mapping = ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (mapping == MAP_FAILED) {
+            throw std::runtime_error("Cannot map replication ring " + name + ": " + std::strerror(errno));
+        }
+        mapped_bytes = bytes;
+        header = static_cast<Header*>(mapping);
+        data = static_cast<char*>(mapping) + sizeof(Header);
+    }
+
+    void copyIn(uint64_t position, const char* bytes, size_t length) {
+        if (length == 0) {
+            return;
+        }
+        size_t offset = position % header->capacity;
+        size_t first = std::min(length, static_cast<size_t>(header->capacity - offset));
+        std::memcpy(data + offset, bytes, first);
+        std::memcpy(data, bytes + first, length - first);
+    }
+
+    void copyOut(uint64_t position, char* bytes, size_t length) const {
+        size_t offset = position % header->capacity;
+        size_t first = std::min(length, static_cast<size_t>(header->capacity - offset));
+        std::memcpy(bytes, data + offset, first);
+        std::memcpy(bytes + first, data, length - first);
+    }
+
+    static void putU32(char* out, uint32_t v) { std::memcpy(out, &v, 4); }
+
+    static uint32_t getU32(const char* p) {
+        uint32_t v;
+        std::memcpy(&v, p, 4);
+        return v;
+    }
+
+public:
+    ReplicationRing() = default;
+    ReplicationRing(const ReplicationRing&) = delete;
+    ReplicationRing& operator=(const ReplicationRing&) = delete;
+
+    ~ReplicationRing() {
+        if (header) {
+            ::munmap(header, mapped_bytes);
+        }
+        if (owner) {
+            ::shm_unlink(name.c_str());
+        }
+    }
+
+    // Create the ring as its leader, replacing any ring a dead leader left
+    // under the same name. Names follow shm_open: "/name".
+    void create(const std::string& ring_name, size_t capacity) {
+        name = ring_name;
+        ::shm_unlink(name.c_str());
+        int fd = ::shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (fd < 0) {
+            throw std::runtime_error("Cannot create replication ring " + name + ": " + std::strerror(errno));
+        }
+        size_t bytes = sizeof(Header) + capacity;
+        if (::ftruncate(fd, static_cast<off_t>(bytes)) != 0) {
+            ::close(fd);
+            ::shm_unlink(name.c_str());
+            throw std::runtime_error("Cannot size replication ring " + name + ": " + std::strerror(errno));
+        }
+        map(fd, bytes);
+        owner = true;
+        // Fresh shared memory is zeroed, which is every atomic's start value
+        header->capacity = capacity;
+        header->leader_beat.store(wallMillis());
+        header->leader_pid.store(static_cast<int32_t>(::getpid()));
+        header->magic.store(kMagic, std::memory_order_release);
+    }
+
+    // Open the ring a running leader created, as its follower, and ask for
+    // a full copy of the leader's data
+    void attach(const std::string& ring_name) {
+        name = ring_name;
+        int fd = ::shm_open(name.c_str(), O_RDWR, 0);
+        if (fd < 0) {
+            throw std::runtime_error("Cannot open replication ring " + name + ": " + std::strerror(errno));
+        }
+        struct stat info;
+        if (::fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < sizeof(Header)) {
+            ::close(fd);
+            throw std::runtime_error("Replication ring " + name + " is not initialized");
+        }
+        map(fd, static_cast<size_t>(info.st_size));
+        if (header->magic.load(std::memory_order_acquire) != kMagic || header->capacity + sizeof(Header) != mapped_bytes) {
+            throw std::runtime_error("Replication ring " + name + " is not initialized");
+        }
+        // A ring left behind by a leader that died is about to be replaced
+        if (!leaderAlive()) {
+            throw std::runtime_error("Replication ring " + name + " has no live leader");
+        }
+        if (alive(header->follower_pid.load(), header->follower_beat.load())) {
+            throw std::runtime_error("Replication ring " + name + " already has a follower");
+        }
+        header->follower_beat.store(wallMillis());
+        header->follower_pid.store(static_cast<int32_t>(::getpid()));
+        header->state.fetch_or(kSyncRequested);
+    }
+
+    // The shared name stops resolving; both sides keep their mappings
+    void unlink() {
+        ::shm_unlink(name.c_str());
+        owner = false;
+    }
+
+    uint32_t state() const { return header->state.load(); }
+    void setState(uint32_t bits) { header->state.fetch_or(bits); }
+    void clearState(uint32_t bits) { header->state.fetch_and(~bits); }
+
+    void beatLeader() { header->leader_beat.store(wallMillis(), std::memory_order_relaxed); }
+    void beatFollower() { header->follower_beat.store(wallMillis(), std::memory_order_relaxed); }
+
+    // Called by a leader that is shutting down cleanly
+    void leave() {
+        if (header) {
+            header->leader_pid.store(0);
+        }
+    }
+
+    bool leaderAlive() const { return alive(header->leader_pid.load(), header->leader_beat.load()); }
+    bool followerAlive() const { return alive(header->follower_pid.load(), header->follower_beat.load()); }
+
+    uint64_t head() const { return header->head.load(std::memory_order_acquire); }
+    uint64_t inFlight() const { return header->head.load() - header->tail.load(); }
+
+    // Leader only, from one thread at a time. Waits while the ring is full
+    // for as long as the follower is alive; returns false without writing
+    // if it is not.
+    bool push(RecordType type, std::string_view key, std::string_view value, uint64_t expires_at) {
+        size_t size = kRecordHeader + key.size() + value.size();
+        if (size > header->capacity) {
+            throw std::runtime_error("Record does not fit in the replication ring");
+        }
+        uint64_t head = header->head.load(std::memory_order_relaxed);
+        while (header->capacity - (head - header->tail.load(std::memory_order_acquire)) < size) {
+            if (!followerAlive()) {
+                return false;
+            }
+            beatLeader();
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+        char record[kRecordHeader] = {};
+        putU32(record, static_cast<uint32_t>(key.size() + value.size()));
+        record[4] = static_cast<char>(type);
+        std::memcpy(record + 8, &expires_at, 8);
+        putU32(record + 16, static_cast<uint32_t>(key.size()));
+        copyIn(head, record, kRecordHeader);
+        copyIn(head + kRecordHeader, key.data(), key.size());
+        copyIn(head + kRecordHeader + key.size(), value.data(), value.size());
+        header->head.store(head + size, std::memory_order_release);
+        return true;
+    }
+
+    // Follower only. Pass each record before position until to apply, in
+    // order, freeing its space once applied; the views in a record last
+    // until apply returns. Returns the number of records.
+    template<typename Apply>
+    size_t consume(uint64_t until, Apply apply) {
+        size_t count = 0;
+        uint64_t tail = header->tail.load(std::memory_order_relaxed);
+        while (tail < until) {
+            char record[kRecordHeader];
+            copyOut(tail, record, kRecordHeader);
+            uint32_t payload = getU32(record);
+            uint32_t key_length = getU32(record + 16);
+            if (key_length > payload || tail + kRecordHeader + payload > until) {
+                throw std::runtime_error("Corrupt record in replication ring " + name);
+            }
+            Record parsed;
+            parsed.type = static_cast<RecordType>(record[4]);
+            std::memcpy(&parsed.expires_at, record + 8, 8);
+            uint64_t start = tail + kRecordHeader;
+            size_t offset = start % header->capacity;
+            if (offset + payload <= header->capacity) {
+                parsed.key = std::string_view(data + offset, key_length);
+                parsed.value = std::string_view(data + offset + key_length, payload - key_length);
+            } else {
+                scratch.resize(payload);
+                copyOut(start, scratch.data(), payload);
+                parsed.key = std::string_view(scratch).substr(0, key_length);
+                parsed.value = std::string_view(scratch).substr(key_length);
+            }
+            apply(parsed);
+            tail = start + payload;
+            header->tail.store(tail, std::memory_order_release);
+            // A long backlog must not make the leader think we died
+            if (++count % 1024 == 0) {
+                beatFollower();
+            }
+        }
+        return count;
+    }
+};
+
+#endif // REPLICATION_RING_H
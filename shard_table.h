@@ -0,0 +1,768 @@
+#ifndef SHARD_TABLE_H
+#define SHARD_TABLE_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <utility>
+#include <unordered_map>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <sys/mman.h>
+
+#include "value_codec.h"
+
+// 64-bit FNV-1a with a final avalanche step. Unlike std::hash its output is
+// fixed, so it can be stored in files that outlive the process. It reads a
+// byte at a time, so in-memory tables hash with std::hash instead.
+inline uint64_t hashBytes(std::string_view bytes) {
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (unsigned char byte : bytes) {
+        h = (h ^ byte) * 0x100000001b3ull;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+// Reference to bytes in a StringArena: block number, offset and length in
+// twelve bytes, instead of the 32 of a std::string plus its heap block
+struct ArenaRef {
+    uint32_t block = 0;
+    uint32_t offset = 0;
+    uint32_t length = 0;
+};
+
+// Append-only byte storage. Strings are copied into large blocks that never
+// move, so a view into the arena stays valid until the arena is destroyed,
+// and one allocation serves thousands of small strings. Space is reclaimed
+// only by copying the live strings into a fresh arena.
+class StringArena {
+private:
+    static constexpr size_t kBlockSize = 256 << 10;
+
+    std::vector<std::unique_ptr<char[]>> blocks;
+    size_t tail_used;      // bytes used in the last regular block
+    size_t tail_block;     // index of the block small strings go to
+    size_t total_bytes;
+
+public:
+    StringArena() : tail_used(kBlockSize), tail_block(0), total_bytes(0) {}
+
+    ArenaRef append(std::string_view bytes) {
+        ArenaRef ref;
+        ref.length = static_cast<uint32_t>(bytes.size());
+        if (bytes.empty()) {
+            return ref;
+        }
+        if (bytes.size() > kBlockSize / 4) {
+            // Large strings get a block of their own so they do not waste
+            // the rest of a shared block
+            blocks.push_back(std::make_unique_for_overwrite<char[]>(bytes.size()));
+            ref.block = static_cast<uint32_t>(blocks.size() - 1);
+        } else {
+            if (tail_used + bytes.size() > kBlockSize) {
+                blocks.push_back(std::make_unique_for_overwrite<char[]>(kBlockSize));
+                tail_block = blocks.size() - 1;
+                tail_used = 0;
+            }
+            ref.block = static_cast<uint32_t>(tail_block);
+            ref.offset = static_cast<uint32_t>(tail_used);
+            tail_used += bytes.size();
+        }
+        std::memcpy(blocks[ref.block].get() + ref.offset, bytes.data(), bytes.size());
+        total_bytes += bytes.size();
+        return ref;
+    }
+
+    std::string_view view(ArenaRef ref) const {
+        if (ref.length == 0) {
+            return std::string_view();
+        }
+        return std::string_view(blocks[ref.block].get() + ref.offset, ref.length);
+    }
+
+    size_t bytes() const { return total_bytes; }
+    size_t blockCount() const { return blocks.size(); }
+};
+
+// Open-addressing hash table used by every shard. Slots hold only a hash tag
+// and an index into the entry store, so a probe touches one small slot
+// before the key is compared. Callers hash keys themselves, which lets the
+// batch APIs hash everything up front and prefetch slots ahead of use.
+// Entries live in fixed-size chunks and erased ones are recycled, so an
+// entry keeps its index and address for as long as it is in the table.
+// When the slot array fills up, the entries move to a new one a few at a
+// time, on each write and from advanceRehash(), instead of all in one
+// stall; until the old array is drained, lookups probe both.
+// Key and value bytes live in a StringArena; with interning enabled, equal
+// short values share one copy. Overwritten and erased bytes are counted as
+// garbage until compact() copies the live bytes into a new arena.
+// With compression enabled, values are stored encoded against a dictionary
+// trained on the table's own values (see value_codec.h); readValue()
+// decodes them, while valueOf() returns the stored bytes.
+class ShardTable {
+public:
+    static constexpr uint32_t kNoNode = UINT32_MAX;
+    // Longer values are rarely repeated verbatim and not worth hashing
+    static constexpr size_t kInternMaxBytes = 64;
+    // Shorter values would not shrink enough to pay for their header
+    static constexpr size_t kCompressMinBytes = 16;
+    // A first dictionary is trained once this many values are stored, and
+    // a new one once as many have been written since the last training
+    // compressing a fifth worse than the values it was trained on
+    static constexpr size_t kTrainMinValues = 1024;
+
+    struct Entry {
+        ArenaRef key;
+        ArenaRef value;
+        uint64_t hash = 0;
+        uint32_t index = 0;        // position in the entry store, never changes
+        uint32_t node = kNoNode;   // owner-defined tag, e.g. a cache policy node
+        bool live = false;
+        bool interned = false;     // value is shared through the intern table
+        bool compressed = false;   // value is encoded against the dictionary
+    };
+
+    struct StorageStats {
+        size_t entries = 0;
+        size_t arena_bytes = 0;        // bytes appended to the arena
+        size_t garbage_bytes = 0;      // of which no longer referenced
+        size_t arena_blocks = 0;
+        size_t interned_values = 0;    // distinct shared values
+        size_t intern_hits = 0;        // writes that reused a shared value
+        size_t compactions = 0;
+        size_t table_bytes = 0;        // slots and entry chunks
+        size_t value_bytes = 0;        // live values as written
+        size_t stored_value_bytes = 0; // the same values as stored
+        size_t compressed_values = 0;
+        size_t dictionary_bytes = 0;
+        size_t trainings = 0;
+    };
+
+private:
+    // The index is stored complemented, so that a slot of zero bytes is
+    // empty and a fresh slot array can come zeroed from calloc
+    struct Slot {
+        uint32_t tag;
+        uint32_t code;
+
+        static Slot of(uint32_t tag, uint32_t index) { return Slot{tag, ~index}; }
+        uint32_t index() const { return ~code; }
+        void setIndex(uint32_t index) { code = ~index; }
+    };
+
+    // Fixed-size array of empty slots. A large one is mapped fresh, and
+    // its pages are zeroed by the kernel as they are first touched, so
+    // allocating it costs nothing up front, which a rehash that is meant
+    // not to stall depends on. It is mapped directly because malloc
+    // raises its own mapping threshold as blocks are freed and would then
+    // zero the next one in full.
+    class SlotArray {
+    private:
+        static constexpr size_t kMapBytes = 256 << 10;
+
+        Slot* data = nullptr;
+        size_t count = 0;
+
+        void release() {
+            if (!data) {
+                return;
+            }
+            if (count * sizeof(Slot) >= kMapBytes) {
+                ::munmap(data, count * sizeof(Slot));
+            } else {
+                std::free(data);
+            }
+        }
+
+    public:
+        SlotArray() = default;
+
+        explicit SlotArray(size_t slot_count) : count(slot_count) {
+            size_t bytes = slot_count * sizeof(Slot);
+            if (bytes >= kMapBytes) {
+                void* mapping = ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                data = mapping == MAP_FAILED ? nullptr : static_cast<Slot*>(mapping);
+            } else {
+                data = static_cast<Slot*>(std::calloc(slot_count, sizeof(Slot)));
+            }
+            if (!data) {
+                throw std::bad_alloc();
+            }
+        }
+
+        SlotArray(SlotArray&& other) noexcept
+            : data(std::exchange(other.data, nullptr)), count(std::exchange(other.count, 0)) {}
+
+        SlotArray& operator=(SlotArray&& other) noexcept {
+            if (this != &other) {
+                release();
+                data = std::exchange(other.data, nullptr);
+                count = std::exchange(other.count, 0);
+            }
+            return *this;
+        }
+
+        SlotArray(const SlotArray&) = delete;
+        SlotArray& operator=(const SlotArray&) = delete;
+
+        ~SlotArray() { release(); }
+
+        size_t size() const { return count; }
+        bool empty() const { return count == 0; }
+        Slot& operator[](size_t pos) { return data[pos]; }
+        const Slot& operator[](size_t pos) const { return data[pos]; }
+        const Slot* begin() const { return data; }
+        const Slot* end() const { return data + count; }
+    };
+
+    struct Interned {
+        ArenaRef ref;
+        uint32_t uses;
+    };
+
+    static constexpr uint32_t kEmpty = UINT32_MAX;
+    static constexpr uint32_t kTombstone = UINT32_MAX - 1;
+    static constexpr size_t kChunkShift = 10;
+    static constexpr size_t kChunkSize = size_t(1) << kChunkShift;
+    // Old slots moved to the new array by each write during a rehash. At
+    // least 4 guarantees the old array is drained before the new one fills
+    // up, even when a rehash only drops tombstones and keeps the size.
+    static constexpr size_t kRehashStep = 16;
+
+    SlotArray slots;
+    std::vector<std::unique_ptr<Entry[]>> chunks;
+    // Erased entries, reused before new ones are added: a list linked
+    // through their node fields, so erasing never allocates
+    uint32_t free_head;
+    uint32_t next_entry;
+    size_t live_count;
+    size_t used_slots;   // live entries plus tombstones, in slots only
+    size_t mask;
+    // The slot array being drained into slots during a rehash, empty
+    // otherwise. Slots before drained have moved and are tombstones now,
+    // which keeps the probe sequences through them intact.
+    SlotArray draining;
+    size_t draining_mask;
+    size_t drained;
+    StringArena arena;
+    size_t garbage;
+    bool interning;
+    // Views point into the arena, which outlives every entry in this map
+    std::unordered_map<std::string_view, Interned> interned;
+    size_t intern_hits;
+    size_t compactions;
+    bool compressing;
+    std::shared_ptr<const ValueDictionary> dictionary;
+    std::string encoded;          // scratch for the value being written
+    size_t value_bytes;
+    size_t stored_value_bytes;
+    size_t compressed_count;
+    size_t trainings;
+    // Values written since the dictionary was last replaced, their bytes
+    // as written and as stored, and the ratio the dictionary achieved on
+    // the values it was trained on
+    size_t written_since_training;
+    size_t raw_since_training;
+    size_t stored_since_training;
+    double trained_ratio;
+
+    static uint32_t tagOf(uint64_t hash) { return static_cast<uint32_t>(hash >> 32); }
+
+    static bool occupied(const Slot& slot) { return slot.index() < kTombstone; }
+
+    Entry* probe(const SlotArray& array, size_t array_mask, std::string_view key, uint64_t hash) {
+        uint32_t tag = tagOf(hash);
+        for (size_t pos = hash & array_mask;; pos = (pos + 1) & array_mask) {
+            const Slot& slot = array[pos];
+            if (slot.index() == kEmpty) {
+                return nullptr;
+            }
+            if (occupied(slot) && slot.tag == tag && keyOf(at(slot.index())) == key) {
+                return &at(slot.index());
+            }
+        }
+    }
+
+    // The slot holding index in array, or nullptr if it is not there
+    static Slot* slotOf(SlotArray& array, size_t array_mask, uint32_t index, uint64_t hash) {
+        for (size_t pos = hash & array_mask;; pos = (pos + 1) & array_mask) {
+            if (array[pos].index() == index) {
+                return &array[pos];
+            }
+            if (array[pos].index() == kEmpty) {
+                return nullptr;
+            }
+        }
+    }
+
+    // Start moving the entries to a new slot array of the given size,
+    // dropping tombstones; finishes any rehash still under way first
+    void startRehash(size_t slot_count) {
+        finishRehash();
+        draining = std::move(slots);
+        draining_mask = mask;
+        drained = 0;
+        slots = SlotArray(slot_count);
+        mask = slot_count - 1;
+        used_slots = 0;
+    }
+
+    // Move up to count old slots, releasing the old array once done
+    void stepRehash(size_t count) {
+        size_t end = std::min(draining.size(), drained + count);
+        for (; drained < end; drained++) {
+            Slot& slot = draining[drained];
+            if (!occupied(slot)) {
+                continue;
+            }
+            size_t pos = at(slot.index()).hash & mask;
+            while (slots[pos].index() != kEmpty) {
+                pos = (pos + 1) & mask;
+            }
+            slots[pos] = slot;
+            used_slots++;
+            slot.setIndex(kTombstone);
+        }
+        if (drained == draining.size()) {
+            draining = SlotArray();
+        }
+    }
+
+    void finishRehash() {
+        if (!draining.empty()) {
+            stepRehash(draining.size());
+        }
+    }
+
+    // Rebuild the slot array at the given size in one go, dropping tombstones
+    void rehash(size_t slot_count) {
+        finishRehash();
+        SlotArray fresh(slot_count);
+        size_t new_mask = slot_count - 1;
+        for (const Slot& slot : slots) {
+            if (!occupied(slot)) {
+                continue;
+            }
+            size_t pos = at(slot.index()).hash & new_mask;
+            while (fresh[pos].index() != kEmpty) {
+                pos = (pos + 1) & new_mask;
+            }
+            fresh[pos] = slot;
+        }
+        slots = std::move(fresh);
+        mask = new_mask;
+        used_slots = live_count;
+    }
+
+    uint32_t allocateEntry() {
+        if (free_head != kNoNode) {
+            uint32_t index = free_head;
+            free_head = at(index).node;
+            return index;
+        }
+        if ((next_entry >> kChunkShift) == chunks.size()) {
+            chunks.push_back(std::make_unique<Entry[]>(kChunkSize));
+        }
+        Entry& entry = at(next_entry);
+        entry.index = next_entry;
+        return next_entry++;
+    }
+
+    // The bytes to store for value and whether they are compressed; the
+    // view may point into the encoded scratch buffer
+    std::pair<std::string_view, bool> encode(std::string_view value) {
+        if (!dictionary || value.size() < kCompressMinBytes) {
+            return {value, false};
+        }
+        lzCompress(value, dictionary.get(), encoded);
+        if (encoded.size() >= value.size()) {
+            return {value, false};
+        }
+        return {encoded, true};
+    }
+
+    // Stored bytes are only ever encoded with the current dictionary
+    size_t rawLength(std::string_view stored, bool compressed) const {
+        if (!compressed) {
+            return stored.size();
+        }
+        const char* p = stored.data();
+        return getVarint(p, p + stored.size());
+    }
+
+    void storeValue(Entry& entry, std::string_view value, bool compressed) {
+        entry.compressed = compressed;
+        value_bytes += rawLength(value, compressed);
+        stored_value_bytes += value.size();
+        compressed_count += compressed;
+        entry.interned = interning && !value.empty() && value.size() <= kInternMaxBytes;
+        if (!entry.interned) {
+            entry.value = arena.append(value);
+            return;
+        }
+        auto it = interned.find(value);
+        if (it != interned.end()) {
+            it->second.uses++;
+            intern_hits++;
+            entry.value = it->second.ref;
+            return;
+        }
+        ArenaRef ref = arena.append(value);
+        interned.emplace(arena.view(ref), Interned{ref, 1});
+        entry.value = ref;
+    }
+
+    // Encoding is deterministic, so equal values store equal bytes
+    void overwrite(Entry& entry, std::string_view value, bool compressed) {
+        if (valueOf(entry) != value || entry.compressed != compressed) {
+            releaseValue(entry);
+            storeValue(entry, value, compressed);
+        }
+    }
+
+    void releaseValue(Entry& entry) {
+        value_bytes -= rawLength(valueOf(entry), entry.compressed);
+        stored_value_bytes -= entry.value.length;
+        compressed_count -= entry.compressed;
+        if (!entry.interned) {
+            garbage += entry.value.length;
+            return;
+        }
+        auto it = interned.find(arena.view(entry.value));
+        if (--it->second.uses == 0) {
+            garbage += entry.value.length;
+            interned.erase(it);
+        }
+    }
+
+public:
+    ShardTable()
+        : slots(16), free_head(kNoNode), next_entry(0), live_count(0), used_slots(0), mask(15), draining_mask(0),
+          drained(0), garbage(0), interning(false), intern_hits(0), compactions(0), compressing(false),
+          value_bytes(0), stored_value_bytes(0), compressed_count(0), trainings(0), written_since_training(0),
+          raw_since_training(0), stored_since_training(0), trained_ratio(1.0) {}
+
+    size_t size() const { return live_count; }
+
+    // Only affects values written from now on
+    void setInterning(bool enabled) { interning = enabled; }
+    // Values are stored as written until the first dictionary is set
+    void setCompression(bool enabled) { compressing = enabled; }
+
+    Entry& at(uint32_t index) { return chunks[index >> kChunkShift][index & (kChunkSize - 1)]; }
+    const Entry& at(uint32_t index) const { return chunks[index >> kChunkShift][index & (kChunkSize - 1)]; }
+
+    // Views stay valid until the entry changes or the table is compacted.
+    // valueOf() is the value as stored, which may be compressed.
+    std::string_view keyOf(const Entry& entry) const { return arena.view(entry.key); }
+    std::string_view valueOf(const Entry& entry) const { return arena.view(entry.value); }
+
+    // The value as written: a view of the stored bytes, or of scratch if it
+    // had to be decompressed there
+    std::string_view readValue(const Entry& entry, std::string& scratch) const {
+        if (!entry.compressed) {
+            return valueOf(entry);
+        }
+        lzDecompress(valueOf(entry), dictionary.get(), scratch);
+        return scratch;
+    }
+
+    // Visit (key, value, entry) for every live entry, values as written.
+    // A decompressed value's view is only valid during its visit.
+    template<typename Visit>
+    void forEach(Visit visit) const {
+        std::string scratch;
+        for (uint32_t i = 0; i < next_entry; i++) {
+            const Entry& entry = at(i);
+            if (entry.live) {
+                visit(keyOf(entry), readValue(entry, scratch), entry);
+            }
+        }
+    }
+
+    // Up to count values as written, spread evenly over the table
+    std::vector<std::string> sampleValues(size_t count) const {
+        std::vector<std::string> samples;
+        size_t stride = std::max<size_t>(1, live_count / std::max<size_t>(1, count));
+        size_t seen = 0;
+        std::string scratch;
+        for (uint32_t i = 0; i < next_entry && samples.size() < count; i++) {
+            const Entry& entry = at(i);
+            if (entry.live && seen++ % stride == 0) {
+                samples.emplace_back(readValue(entry, scratch));
+            }
+        }
+        return samples;
+    }
+
+    bool trained() const { return dictionary != nullptr; }
+
+    // Whether a (new) dictionary is worth training
+    bool needsTraining() const {
+        if (!compressing) {
+            return false;
+        }
+        if (!dictionary) {
+            return live_count >= kTrainMinValues;
+        }
+        return written_since_training >= std::max(kTrainMinValues, live_count / 2) &&
+               static_cast<double>(raw_since_training) < trained_ratio * 0.8 * stored_since_training;
+    }
+
+    // Re-encode every live value with a new dictionary into a fresh arena,
+    // which compacts the table at the same time. Invalidates every view
+    // handed out.
+    void setDictionary(std::shared_ptr<const ValueDictionary> fresh_dictionary) {
+        std::vector<std::string> values;
+        values.reserve(live_count);
+        std::string scratch;
+        for (uint32_t i = 0; i < next_entry; i++) {
+            const Entry& entry = at(i);
+            values.emplace_back(entry.live ? readValue(entry, scratch) : std::string_view());
+        }
+        dictionary = std::move(fresh_dictionary);
+        StringArena old = std::move(arena);
+        arena = StringArena();
+        interned.clear();
+        value_bytes = stored_value_bytes = compressed_count = 0;
+        for (uint32_t i = 0; i < next_entry; i++) {
+            Entry& entry = at(i);
+            if (!entry.live) {
+                continue;
+            }
+            entry.key = arena.append(old.view(entry.key));
+            auto [stored, compressed] = encode(values[i]);
+            storeValue(entry, stored, compressed);
+        }
+        garbage = 0;
+        trainings++;
+        trained_ratio = stored_value_bytes ? static_cast<double>(value_bytes) / stored_value_bytes : 1.0;
+        written_since_training = raw_since_training = stored_since_training = 0;
+    }
+
+    void clear() {
+        slots = SlotArray(16);
+        chunks.clear();
+        free_head = kNoNode;
+        next_entry = 0;
+        live_count = 0;
+        used_slots = 0;
+        mask = 15;
+        draining = SlotArray();
+        drained = 0;
+        interned.clear();
+        arena = StringArena();
+        garbage = 0;
+        dictionary.reset();
+        value_bytes = stored_value_bytes = compressed_count = 0;
+        written_since_training = raw_since_training = stored_since_training = 0;
+        trained_ratio = 1.0;
+    }
+
+    // Bring the home slot of a hash into cache ahead of a lookup
+    void prefetchSlot(uint64_t hash) const {
+        __builtin_prefetch(&slots[hash & mask]);
+    }
+
+    // Bring the entry the home slot points at into cache. Reads the slot,
+    // so it should run after prefetchSlot has had time to land.
+    void prefetchEntry(uint64_t hash) const {
+        const Slot& slot = slots[hash & mask];
+        if (occupied(slot)) {
+            __builtin_prefetch(&at(slot.index()));
+        }
+    }
+
+    bool rehashing() const { return !draining.empty(); }
+
+    // Move up to count slots of a rehash under way, so that an idle table
+    // finishes it without waiting for writes
+    void advanceRehash(size_t count) {
+        if (!draining.empty()) {
+            stepRehash(count);
+        }
+    }
+
+    // Size the slot array for count more keys up front, so that loading
+    // them does not rehash along the way
+    void reserve(size_t count) {
+        size_t needed = slots.size();
+        while ((live_count + count) * 2 > needed) {
+            needed *= 2;
+        }
+        if (needed != slots.size()) {
+            rehash(needed);
+        }
+    }
+
+    Entry* find(std::string_view key, uint64_t hash) {
+        if (Entry* entry = probe(slots, mask, key, hash)) {
+            return entry;
+        }
+        return draining.empty() ? nullptr : probe(draining, draining_mask, key, hash);
+    }
+
+    const Entry* find(std::string_view key, uint64_t hash) const {
+        return const_cast<ShardTable*>(this)->find(key, hash);
+    }
+
+    // Insert or overwrite. Returns the entry and whether the key is new.
+    std::pair<Entry*, bool> upsert(std::string_view key, std::string_view raw_value, uint64_t hash) {
+        if (!draining.empty()) {
+            stepRehash(kRehashStep);
+        }
+        auto [value, compressed] = encode(raw_value);
+        if (dictionary) {
+            written_since_training++;
+            raw_since_training += raw_value.size();
+            stored_since_training += value.size();
+        }
+        uint32_t tag = tagOf(hash);
+        size_t reuse = SIZE_MAX;
+        size_t pos = hash & mask;
+        for (;; pos = (pos + 1) & mask) {
+            const Slot& slot = slots[pos];
+            if (slot.index() == kEmpty) {
+                break;
+            }
+            if (slot.index() == kTombstone) {
+                if (reuse == SIZE_MAX) {
+                    reuse = pos;
+                }
+                continue;
+            }
+            if (slot.tag == tag && keyOf(at(slot.index())) == key) {
+                Entry& entry = at(slot.index());
+                overwrite(entry, value, compressed);
+                return {&entry, false};
+            }
+        }
+        // A key not yet moved is overwritten where it is
+        if (!draining.empty()) {
+            if (Entry* entry = probe(draining, draining_mask, key, hash)) {
+                overwrite(*entry, value, compressed);
+                return {entry, false};
+            }
+        }
+        if (reuse != SIZE_MAX) {
+            pos = reuse;
+        } else {
+            // Keep live entries plus tombstones at or below 3/4 of the
+            // slots; grow only if live entries alone would cross half.
+            // kRehashStep keeps a rehash from running into the next, but
+            // one that does is finished first.
+            if ((used_slots + 1) * 4 > slots.size() * 3) {
+                finishRehash();
+                if ((used_slots + 1) * 4 > slots.size() * 3) {
+                    startRehash((live_count + 1) * 2 > slots.size() ? slots.size() * 2 : slots.size());
+                    stepRehash(kRehashStep);
+                }
+                pos = hash & mask;
+                while (slots[pos].index() != kEmpty) {
+                    pos = (pos + 1) & mask;
+                }
+            }
+            used_slots++;
+        }
+        uint32_t index = allocateEntry();
+        Entry& entry = at(index);
+        entry.key = arena.append(key);
+        storeValue(entry, value, compressed);
+        entry.hash = hash;
+        entry.node = kNoNode;
+        entry.live = true;
+        slots[pos] = Slot::of(tag, index);
+        live_count++;
+        return {&entry, true};
+    }
+
+    // Remove a key, leaving a tombstone in its slot. Returns false if absent.
+    bool erase(std::string_view key, uint64_t hash) {
+        Entry* entry = find(key, hash);
+        if (!entry) {
+            return false;
+        }
+        eraseEntry(entry->index);
+        return true;
+    }
+
+    // Remove the entry stored at index; the slot is located by entry index
+    void eraseEntry(uint32_t index) {
+        Entry& entry = at(index);
+        Slot* slot = slotOf(slots, mask, index, entry.hash);
+        if (!slot) {
+            slot = slotOf(draining, draining_mask, index, entry.hash);
+        }
+        slot->setIndex(kTombstone);
+        garbage += entry.key.length;
+        releaseValue(entry);
+        entry.live = false;
+        entry.node = free_head;
+        free_head = index;
+        live_count--;
+    }
+
+    // Worth compacting once at least half the arena (and 1 MB) is garbage
+    bool needsCompaction() const {
+        return garbage >= (1 << 20) && garbage * 2 >= arena.bytes();
+    }
+
+    // Copy live keys and values into a fresh arena, sharing interned values
+    // again, and free the old one. Invalidates every view handed out.
+    void compact() {
+        StringArena fresh;
+        std::unordered_map<std::string_view, Interned> fresh_interned;
+        for (uint32_t i = 0; i < next_entry; i++) {
+            Entry& entry = at(i);
+            if (!entry.live) {
+                continue;
+            }
+            entry.key = fresh.append(keyOf(entry));
+            if (!entry.interned) {
+                entry.value = fresh.append(valueOf(entry));
+                continue;
+            }
+            std::string_view value = valueOf(entry);
+            auto it = fresh_interned.find(value);
+            if (it == fresh_interned.end()) {
+                ArenaRef ref = fresh.append(value);
+                it = fresh_interned.emplace(fresh.view(ref), Interned{ref, 0}).first;
+            }
+            it->second.uses++;
+            entry.value = it->second.ref;
+        }
+        interned.swap(fresh_interned);
+        arena = std::move(fresh);
+        garbage = 0;
+        compactions++;
+    }
+
+    StorageStats storageStats() const {
+        StorageStats stats;
+        stats.entries = live_count;
+        stats.arena_bytes = arena.bytes();
+        stats.garbage_bytes = garbage;
+        stats.arena_blocks = arena.blockCount();
+        stats.interned_values = interned.size();
+        stats.intern_hits = intern_hits;
+        stats.compactions = compactions;
+        stats.table_bytes = (slots.size() + draining.size()) * sizeof(Slot) + chunks.size() * kChunkSize * sizeof(Entry);
+        stats.value_bytes = value_bytes;
+        stats.stored_value_bytes = stored_value_bytes;
+        stats.compressed_values = compressed_count;
+        stats.dictionary_bytes = dictionary ? dictionary->size() : 0;
+        stats.trainings = trainings;
+        return stats;
+    }
+};
+
+#endif // SHARD_TABLE_H
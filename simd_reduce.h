@@ -0,0 +1,549 @@
+#ifndef SIMD_REDUCE_H
+#define SIMD_REDUCE_H
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <cstdint>
+#include <cstddef>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define SIMD_REDUCE_X86 1
+#include <immintrin.h>
+#endif
+
+// Reduction kernels over arrays of int32_t and float: sum, minimum,
+// maximum and dot product, each written for plain scalar code, SSE2, AVX2
+// (with FMA) and AVX-512. reductionKernels() picks the widest set this CPU
+// and OS support the first time it is called, so one binary runs
+// everywhere; kernelsFor() returns a specific set, for comparisons.
+//
+// Integer sums are exact in int64_t, and so are dot products as long as
+// the result fits; past that they wrap, at every level alike. Float kernels
+// accumulate in float across many lanes, so they round differently from
+// a scalar loop, usually less. Minimum and maximum of an empty array are
+// the type's largest and lowest value; with NaNs in a float array they
+// are unspecified.
+
+enum class SimdLevel { kScalar, kSse2, kAvx2, kAvx512 };
+
+struct ReductionKernels {
+    SimdLevel level;
+    const char* name;
+    int64_t (*sum_i32)(const int32_t* values, size_t count);
+    int32_t (*min_i32)(const int32_t* values, size_t count);
+    int32_t (*max_i32)(const int32_t* values, size_t count);
+    int64_t (*dot_i32)(const int32_t* a, const int32_t* b, size_t count);
+    float (*sum_f32)(const float* values, size_t count);
+    float (*min_f32)(const float* values, size_t count);
+    float (*max_f32)(const float* values, size_t count);
+    float (*dot_f32)(const float* a, const float* b, size_t count);
+};
+
+// Scalar kernels, also used for the elements left over after the vectors
+
+inline int64_t sumI32Scalar(const int32_t* values, size_t count) {
+    int64_t sum = 0;
+    for (size_t i = 0; i < count; i++) {
+        sum += values[i];
+    }
+    return sum;
+}
+
+template<bool kMax>
+int32_t extremeI32Scalar(const int32_t* values, size_t count) {
+    int32_t extreme = kMax ? std::numeric_limits<int32_t>::min() : std::numeric_limits<int32_t>::max();
+    for (size_t i = 0; i < count; i++) {
+        extreme = kMax ? std::max(extreme, values[i]) : std::min(extreme, values[i]);
+    }
+    return extreme;
+}
+
+inline int64_t dotI32Scalar(const int32_t* a, const int32_t* b, size_t count) {
+    uint64_t dot = 0;
+    for (size_t i = 0; i < count; i++) {
+        dot += uint64_t(int64_t(a[i]) * b[i]);
+    }
+    return int64_t(dot);
+}
+
+inline float sumF32Scalar(const float* values, size_t count) {
+    float sum = 0;
+    for (size_t i = 0; i < count; i++) {
+        sum += values[i];
+    }
+    return sum;
+}
+
+template<bool kMax>
+float extremeF32Scalar(const float* values, size_t count) {
+    float extreme = kMax ? std::numeric_limits<float>::lowest() : std::numeric_limits<float>::max();
+    for (size_t i = 0; i < count; i++) {
+        extreme = kMax ? std::max(extreme, values[i]) : std::min(extreme, values[i]);
+    }
+    return extreme;
+}
+
+inline float dotF32Scalar(const float* a, const float* b, size_t count) {
+    float dot = 0;
+    for (size_t i = 0; i < count; i++) {
+        dot += a[i] * b[i];
+    }
+    return dot;
+}
+
+#ifdef SIMD_REDUCE_X86
+
+// The vector int32 sums never widen to 64 bits, which would cost a
+// shuffle per vector. Each lane keeps two int32 sums instead: s of the
+// values, wrapping, and h of their top halves (v >> 16). With v split as
+// h * 65536 + l, l in [0, 65535], the lane's true sum is
+// H * 65536 + L, and L = s - H * 65536 modulo 2^32 is exact as long as it
+// stays below 2^32. Lanes are therefore flushed every kSumBlock values.
+constexpr size_t kSumBlock = 1 << 15;
+
+inline int64_t flushSumLanes(const int32_t* sums, const int32_t* highs, size_t lanes) {
+    int64_t total = 0;
+    for (size_t lane = 0; lane < lanes; lane++) {
+        uint32_t low = uint32_t(sums[lane]) - (uint32_t(highs[lane]) << 16);
+        total += int64_t(highs[lane]) * 65536 + low;
+    }
+    return total;
+}
+
+// SSE2, which every x86-64 CPU has
+
+inline int64_t sumI32Sse2(const int32_t* values, size_t count) {
+    int64_t total = 0;
+    size_t i = 0;
+    while (count - i >= 4) {
+        size_t block_end = i + std::min((count - i) / 4, kSumBlock) * 4;
+        __m128i sums = _mm_setzero_si128();
+        __m128i highs = _mm_setzero_si128();
+        for (; i < block_end; i += 4) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(values + i));
+            sums = _mm_add_epi32(sums, v);
+            highs = _mm_add_epi32(highs, _mm_srai_epi32(v, 16));
+        }
+        alignas(16) int32_t s[4];
+        alignas(16) int32_t h[4];
+        _mm_store_si128(reinterpret_cast<__m128i*>(s), sums);
+        _mm_store_si128(reinterpret_cast<__m128i*>(h), highs);
+        total += flushSumLanes(s, h, 4);
+    }
+    return total + sumI32Scalar(values + i, count - i);
+}
+
+// SSE2 has no pminsd/pmaxsd, so the comparison picks through masks
+template<bool kMax>
+int32_t extremeI32Sse2(const int32_t* values, size_t count) {
+    int32_t identity = extremeI32Scalar<kMax>(nullptr, 0);
+    __m128i extreme = _mm_set1_epi32(identity);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(values + i));
+        __m128i take = kMax ? _mm_cmpgt_epi32(v, extreme) : _mm_cmplt_epi32(v, extreme);
+        extreme = _mm_or_si128(_mm_and_si128(take, v), _mm_andnot_si128(take, extreme));
+    }
+    alignas(16) int32_t lanes[4];
+    _mm_store_si128(reinterpret_cast<__m128i*>(lanes), extreme);
+    int32_t result = extremeI32Scalar<kMax>(lanes, 4);
+    int32_t rest = extremeI32Scalar<kMax>(values + i, count - i);
+    return kMax ? std::max(result, rest) : std::min(result, rest);
+}
+
+// SSE2 only multiplies unsigned 32-bit lanes (pmuludq). Reading a and b
+// as unsigned adds 2^32 * b when a < 0 and 2^32 * a when b < 0 to the
+// 64-bit product, and those are subtracted again.
+inline int64_t dotI32Sse2(const int32_t* a, const int32_t* b, size_t count) {
+    const __m128i odd_dwords = _mm_set_epi32(-1, 0, -1, 0);
+    __m128i dot = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+        __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+        __m128i fix = _mm_add_epi32(_mm_and_si128(_mm_srai_epi32(va, 31), vb),
+                                    _mm_and_si128(_mm_srai_epi32(vb, 31), va));
+        __m128i even = _mm_sub_epi64(_mm_mul_epu32(va, vb), _mm_slli_epi64(fix, 32));
+        __m128i odd = _mm_sub_epi64(_mm_mul_epu32(_mm_srli_epi64(va, 32), _mm_srli_epi64(vb, 32)),
+                                    _mm_and_si128(fix, odd_dwords));
+        dot = _mm_add_epi64(dot, _mm_add_epi64(even, odd));
+    }
+    alignas(16) uint64_t lanes[2];
+    _mm_store_si128(reinterpret_cast<__m128i*>(lanes), dot);
+    return int64_t(lanes[0] + lanes[1] + uint64_t(dotI32Scalar(a + i, b + i, count - i)));
+}
+
+// Float adds take four cycles, so the float kernels keep four
+// independent accumulators to have several in flight
+
+inline float sumF32Sse2(const float* values, size_t count) {
+    __m128 s0 = _mm_setzero_ps(), s1 = _mm_setzero_ps(), s2 = _mm_setzero_ps(), s3 = _mm_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        s0 = _mm_add_ps(s0, _mm_loadu_ps(values + i));
+        s1 = _mm_add_ps(s1, _mm_loadu_ps(values + i + 4));
+        s2 = _mm_add_ps(s2, _mm_loadu_ps(values + i + 8));
+        s3 = _mm_add_ps(s3, _mm_loadu_ps(values + i + 12));
+    }
+    for (; i + 4 <= count; i += 4) {
+        s0 = _mm_add_ps(s0, _mm_loadu_ps(values + i));
+    }
+    alignas(16) float lanes[4];
+    _mm_store_ps(lanes, _mm_add_ps(_mm_add_ps(s0, s1), _mm_add_ps(s2, s3)));
+    return sumF32Scalar(lanes, 4) + sumF32Scalar(values + i, count - i);
+}
+
+template<bool kMax>
+float extremeF32Sse2(const float* values, size_t count) {
+    auto pick = [](__m128 x, __m128 y) { return kMax ? _mm_max_ps(x, y) : _mm_min_ps(x, y); };
+    __m128 e0 = _mm_set1_ps(extremeF32Scalar<kMax>(nullptr, 0)), e1 = e0, e2 = e0, e3 = e0;
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        e0 = pick(e0, _mm_loadu_ps(values + i));
+        e1 = pick(e1, _mm_loadu_ps(values + i + 4));
+        e2 = pick(e2, _mm_loadu_ps(values + i + 8));
+        e3 = pick(e3, _mm_loadu_ps(values + i + 12));
+    }
+    for (; i + 4 <= count; i += 4) {
+        e0 = pick(e0, _mm_loadu_ps(values + i));
+    }
+    alignas(16) float lanes[5];
+    _mm_store_ps(lanes, pick(pick(e0, e1), pick(e2, e3)));
+    lanes[4] = extremeF32Scalar<kMax>(values + i, count - i);
+    return extremeF32Scalar<kMax>(lanes, 5);
+}
+
+inline float dotF32Sse2(const float* a, const float* b, size_t count) {
+    __m128 d0 = _mm_setzero_ps(), d1 = _mm_setzero_ps(), d2 = _mm_setzero_ps(), d3 = _mm_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        d0 = _mm_add_ps(d0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        d1 = _mm_add_ps(d1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+        d2 = _mm_add_ps(d2, _mm_mul_ps(_mm_loadu_ps(a + i + 8), _mm_loadu_ps(b + i + 8)));
+        d3 = _mm_add_ps(d3, _mm_mul_ps(_mm_loadu_ps(a + i + 12), _mm_loadu_ps(b + i + 12)));
+    }
+    for (; i + 4 <= count; i += 4) {
+        d0 = _mm_add_ps(d0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+    }
+    alignas(16) float lanes[4];
+    _mm_store_ps(lanes, _mm_add_ps(_mm_add_ps(d0, d1), _mm_add_ps(d2, d3)));
+    return sumF32Scalar(lanes, 4) + dotF32Scalar(a + i, b + i, count - i);
+}
+
+// AVX2 with FMA
+
+__attribute__((target("avx2,fma")))
+inline int64_t sumI32Avx2(const int32_t* values, size_t count) {
+    int64_t total = 0;
+    size_t i = 0;
+    while (count - i >= 8) {
+        size_t block_end = i + std::min((count - i) / 8, kSumBlock) * 8;
+        __m256i sums = _mm256_setzero_si256();
+        __m256i highs = _mm256_setzero_si256();
+        for (; i < block_end; i += 8) {
+            __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(values + i));
+            sums = _mm256_add_epi32(sums, v);
+            highs = _mm256_add_epi32(highs, _mm256_srai_epi32(v, 16));
+        }
+        alignas(32) int32_t s[8];
+        alignas(32) int32_t h[8];
+        _mm256_store_si256(reinterpret_cast<__m256i*>(s), sums);
+        _mm256_store_si256(reinterpret_cast<__m256i*>(h), highs);
+        total += flushSumLanes(s, h, 8);
+    }
+    return total + sumI32Scalar(values + i, count - i);
+}
+
+template<bool kMax>
+__attribute__((target("avx2,fma")))
+int32_t extremeI32Avx2(const int32_t* values, size_t count) {
+    __m256i extreme = _mm256_set1_epi32(extremeI32Scalar<kMax>(nullptr, 0));
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(values + i));
+        extreme = kMax ? _mm256_max_epi32(extreme, v) : _mm256_min_epi32(extreme, v);
+    }
+    alignas(32) int32_t lanes[9];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(lanes), extreme);
+    lanes[8] = extremeI32Scalar<kMax>(values + i, count - i);
+    return extremeI32Scalar<kMax>(lanes, 9);
+}
+
+// vpmuldq multiplies the even signed lanes into 64 bits; the odd ones are
+// shifted down into even places first
+__attribute__((target("avx2,fma")))
+inline int64_t dotI32Avx2(const int32_t* a, const int32_t* b, size_t count) {
+    __m256i dot = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+        __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+        __m256i even = _mm256_mul_epi32(va, vb);
+        __m256i odd = _mm256_mul_epi32(_mm256_srli_epi64(va, 32), _mm256_srli_epi64(vb, 32));
+        dot = _mm256_add_epi64(dot, _mm256_add_epi64(even, odd));
+    }
+    alignas(32) uint64_t lanes[4];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(lanes), dot);
+    return int64_t(lanes[0] + lanes[1] + lanes[2] + lanes[3] + uint64_t(dotI32Scalar(a + i, b + i, count - i)));
+}
+
+__attribute__((target("avx2,fma")))
+inline float sumF32Avx2(const float* values, size_t count) {
+    __m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps(), s2 = _mm256_setzero_ps(), s3 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32) {
+        s0 = _mm256_add_ps(s0, _mm256_loadu_ps(values + i));
+        s1 = _mm256_add_ps(s1, _mm256_loadu_ps(values + i + 8));
+        s2 = _mm256_add_ps(s2, _mm256_loadu_ps(values + i + 16));
+        s3 = _mm256_add_ps(s3, _mm256_loadu_ps(values + i + 24));
+    }
+    for (; i + 8 <= count; i += 8) {
+        s0 = _mm256_add_ps(s0, _mm256_loadu_ps(values + i));
+    }
+    alignas(32) float lanes[8];
+    _mm256_store_ps(lanes, _mm256_add_ps(_mm256_add_ps(s0, s1), _mm256_add_ps(s2, s3)));
+    return sumF32Scalar(lanes, 8) + sumF32Scalar(values + i, count - i);
+}
+
+template<bool kMax>
+__attribute__((target("avx2,fma")))
+float extremeF32Avx2(const float* values, size_t count) {
+    __m256 e0 = _mm256_set1_ps(extremeF32Scalar<kMax>(nullptr, 0)), e1 = e0, e2 = e0, e3 = e0;
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32) {
+        if constexpr (kMax) {
+            e0 = _mm256_max_ps(e0, _mm256_loadu_ps(values + i));
+            e1 = _mm256_max_ps(e1, _mm256_loadu_ps(values + i + 8));
+            e2 = _mm256_max_ps(e2, _mm256_loadu_ps(values + i + 16));
+            e3 = _mm256_max_ps(e3, _mm256_loadu_ps(values + i + 24));
+        } else {
+            e0 = _mm256_min_ps(e0, _mm256_loadu_ps(values + i));
+            e1 = _mm256_min_ps(e1, _mm256_loadu_ps(values + i + 8));
+            e2 = _mm256_min_ps(e2, _mm256_loadu_ps(values + i + 16));
+            e3 = _mm256_min_ps(e3, _mm256_loadu_ps(values + i + 24));
+        }
+    }
+    for (; i + 8 <= count; i += 8) {
+        e0 = kMax ? _mm256_max_ps(e0, _mm256_loadu_ps(values + i)) : _mm256_min_ps(e0, _mm256_loadu_ps(values + i));
+    }
+    alignas(32) float lanes[9];
+    if constexpr (kMax) {
+        _mm256_store_ps(lanes, _mm256_max_ps(_mm256_max_ps(e0, e1), _mm256_max_ps(e2, e3)));
+    } else {
+        _mm256_store_ps(lanes, _mm256_min_ps(_mm256_min_ps(e0, e1), _mm256_min_ps(e2, e3)));
+    }
+    lanes[8] = extremeF32Scalar<kMax>(values + i, count - i);
+    return extremeF32Scalar<kMax>(lanes, 9);
+}
+
+__attribute__((target("avx2,fma")))
+inline float dotF32Avx2(const float* a, const float* b, size_t count) {
+    __m256 d0 = _mm256_setzero_ps(), d1 = _mm256_setzero_ps(), d2 = _mm256_setzero_ps(), d3 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32) {
+        d0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), d0);
+        d1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), d1);
+        d2 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 16), _mm256_loadu_ps(b + i + 16), d2);
+        d3 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 24), _mm256_loadu_ps(b + i + 24), d3);
+    }
+    for (; i + 8 <= count; i += 8) {
+        d0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), d0);
+    }
+    alignas(32) float lanes[8];
+    _mm256_store_ps(lanes, _mm256_add_ps(_mm256_add_ps(d0, d1), _mm256_add_ps(d2, d3)));
+    return sumF32Scalar(lanes, 8) + dotF32Scalar(a + i, b + i, count - i);
+}
+
+// AVX-512 (the F subset). GCC 12's AVX-512 intrinsics trip its own
+// uninitialized-variable warnings when inlined into target functions.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+__attribute__((target("avx512f")))
+inline int64_t sumI32Avx512(const int32_t* values, size_t count) {
+    int64_t total = 0;
+    size_t i = 0;
+    while (count - i >= 16) {
+        size_t block_end = i + std::min((count - i) / 16, kSumBlock) * 16;
+        __m512i sums = _mm512_setzero_si512();
+        __m512i highs = _mm512_setzero_si512();
+        for (; i < block_end; i += 16) {
+            __m512i v = _mm512_loadu_si512(values + i);
+            sums = _mm512_add_epi32(sums, v);
+            highs = _mm512_add_epi32(highs, _mm512_srai_epi32(v, 16));
+        }
+        alignas(64) int32_t s[16];
+        alignas(64) int32_t h[16];
+        _mm512_store_si512(s, sums);
+        _mm512_store_si512(h, highs);
+        total += flushSumLanes(s, h, 16);
+    }
+    return total + sumI32Scalar(values + i, count - i);
+}
+
+template<bool kMax>
+__attribute__((target("avx512f")))
+int32_t extremeI32Avx512(const int32_t* values, size_t count) {
+    __m512i extreme = _mm512_set1_epi32(extremeI32Scalar<kMax>(nullptr, 0));
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m512i v = _mm512_loadu_si512(values + i);
+        extreme = kMax ? _mm512_max_epi32(extreme, v) : _mm512_min_epi32(extreme, v);
+    }
+    alignas(64) int32_t lanes[17];
+    _mm512_store_si512(lanes, extreme);
+    lanes[16] = extremeI32Scalar<kMax>(values + i, count - i);
+    return extremeI32Scalar<kMax>(lanes, 17);
+}
+
+__attribute__((target("avx512f")))
+inline int64_t dotI32Avx512(const int32_t* a, const int32_t* b, size_t count) {
+    __m512i dot = _mm512_setzero_si512();
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m512i va = _mm512_loadu_si512(a + i);
+        __m512i vb = _mm512_loadu_si512(b + i);
+        __m512i even = _mm512_mul_epi32(va, vb);
+        __m512i odd = _mm512_mul_epi32(_mm512_srli_epi64(va, 32), _mm512_srli_epi64(vb, 32));
+        dot = _mm512_add_epi64(dot, _mm512_add_epi64(even, odd));
+    }
+    alignas(64) uint64_t lanes[8];
+    _mm512_store_si512(lanes, dot);
+    uint64_t sum = uint64_t(dotI32Scalar(a + i, b + i, count - i));
+    for (uint64_t lane : lanes) {
+        sum += lane;
+    }
+    return int64_t(sum);
+}
+
+__attribute__((target("avx512f")))
+inline float sumF32Avx512(const float* values, size_t count) {
+    __m512 s0 = _mm512_setzero_ps(), s1 = _mm512_setzero_ps(), s2 = _mm512_setzero_ps(), s3 = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 64 <= count; i += 64) {
+        s0 = _mm512_add_ps(s0, _mm512_loadu_ps(values + i));
+        s1 = _mm512_add_ps(s1, _mm512_loadu_ps(values + i + 16));
+        s2 = _mm512_add_ps(s2, _mm512_loadu_ps(values + i + 32));
+        s3 = _mm512_add_ps(s3, _mm512_loadu_ps(values + i + 48));
+    }
+    for (; i + 16 <= count; i += 16) {
+        s0 = _mm512_add_ps(s0, _mm512_loadu_ps(values + i));
+    }
+    alignas(64) float lanes[16];
+    _mm512_store_ps(lanes, _mm512_add_ps(_mm512_add_ps(s0, s1), _mm512_add_ps(s2, s3)));
+    return sumF32Scalar(lanes, 16) + sumF32Scalar(values + i, count - i);
+}
+
+template<bool kMax>
+__attribute__((target("avx512f")))
+float extremeF32Avx512(const float* values, size_t count) {
+    __m512 e0 = _mm512_set1_ps(extremeF32Scalar<kMax>(nullptr, 0)), e1 = e0, e2 = e0, e3 = e0;
+    size_t i = 0;
+    for (; i + 64 <= count; i += 64) {
+        if constexpr (kMax) {
+            e0 = _mm512_max_ps(e0, _mm512_loadu_ps(values + i));
+            e1 = _mm512_max_ps(e1, _mm512_loadu_ps(values + i + 16));
+            e2 = _mm512_max_ps(e2, _mm512_loadu_ps(values + i + 32));
+            e3 = _mm512_max_ps(e3, _mm512_loadu_ps(values + i + 48));
+        } else {
+            e0 = _mm512_min_ps(e0, _mm512_loadu_ps(values + i));
+            e1 = _mm512_min_ps(e1, _mm512_loadu_ps(values + i + 16));
+            e2 = _mm512_min_ps(e2, _mm512_loadu_ps(values + i + 32));
+            e3 = _mm512_min_ps(e3, _mm512_loadu_ps(values + i + 48));
+        }
+    }
+    for (; i + 16 <= count; i += 16) {
+        e0 = kMax ? _mm512_max_ps(e0, _mm512_loadu_ps(values + i)) : _mm512_min_ps(e0, _mm512_loadu_ps(values + i));
+    }
+    alignas(64) float lanes[17];
+    if constexpr (kMax) {
+        _mm512_store_ps(lanes, _mm512_max_ps(_mm512_max_ps(e0, e1), _mm512_max_ps(e2, e3)));
+    } else {
+        _mm512_store_ps(lanes, _mm512_min_ps(_mm512_min_ps(e0, e1), _mm512_min_ps(e2, e3)));
+    }
+    lanes[16] = extremeF32Scalar<kMax>(values + i, count - i);
+    return extremeF32Scalar<kMax>(lanes, 17);
+}
+
+__attribute__((target("avx512f")))
+inline float dotF32Avx512(const float* a, const float* b, size_t count) {
+    __m512 d0 = _mm512_setzero_ps(), d1 = _mm512_setzero_ps(), d2 = _mm512_setzero_ps(), d3 = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 64 <= count; i += 64) {
+        d0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), d0);
+        d1 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16), d1);
+        d2 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 32), _mm512_loadu_ps(b + i + 32), d2);
+        d3 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 48), _mm512_loadu_ps(b + i + 48), d3);
+    }
+    for (; i + 16 <= count; i += 16) {
+        d0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), d0);
+    }
+    alignas(64) float lanes[16];
+    _mm512_store_ps(lanes, _mm512_add_ps(_mm512_add_ps(d0, d1), _mm512_add_ps(d2, d3)));
+    return sumF32Scalar(lanes, 16) + dotF32Scalar(a + i, b + i, count - i);
+}
+
+#pragma GCC diagnostic pop
+
+#endif // SIMD_REDUCE_X86
+
+// The widest level both the CPU and the OS (which must save the wider
+// registers) support, read through CPUID
+inline SimdLevel detectSimdLevel() {
+#ifdef SIMD_REDUCE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        return SimdLevel::kAvx512;
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        return SimdLevel::kAvx2;
+    }
+    return SimdLevel::kSse2;
+#else
+    return SimdLevel::kScalar;
+#endif
+}
+
+// The kernels of one level; throws if this CPU cannot run them
+inline const ReductionKernels& kernelsFor(SimdLevel level) {
+    static const ReductionKernels scalar{SimdLevel::kScalar, "scalar",
+        sumI32Scalar, extremeI32Scalar<false>, extremeI32Scalar<true>, dotI32Scalar,
+        sumF32Scalar, extremeF32Scalar<false>, extremeF32Scalar<true>, dotF32Scalar};
+    if (level > detectSimdLevel()) {
+        throw std::runtime_error("This CPU does not support the requested SIMD level!");
+    }
+    switch (level) {
+#ifdef SIMD_REDUCE_X86
+    case SimdLevel::kSse2: {
+        static const ReductionKernels sse2{SimdLevel::kSse2, "SSE2",
+            sumI32Sse2, extremeI32Sse2<false>, extremeI32Sse2<true>, dotI32Sse2,
+            sumF32Sse2, extremeF32Sse2<false>, extremeF32Sse2<true>, dotF32Sse2};
+        return sse2;
+    }
+    case SimdLevel::kAvx2: {
+        static const ReductionKernels avx2{SimdLevel::kAvx2, "AVX2",
+            sumI32Avx2, extremeI32Avx2<false>, extremeI32Avx2<true>, dotI32Avx2,
+            sumF32Avx2, extremeF32Avx2<false>, extremeF32Avx2<true>, dotF32Avx2};
+        return avx2;
+    }
+    case SimdLevel::kAvx512: {
+        static const ReductionKernels avx512{SimdLevel::kAvx512, "AVX-512",
+            sumI32Avx512, extremeI32Avx512<false>, extremeI32Avx512<true>, dotI32Avx512,
+            sumF32Avx512, extremeF32Avx512<false>, extremeF32Avx512<true>, dotF32Avx512};
+        return avx512;
+    }
+#endif
+    default:
+        return scalar;
+    }
+}
+
+// The best kernels for this machine, chosen once
+inline const ReductionKernels& reductionKernels() {
+    static const ReductionKernels& best = kernelsFor(detectSimdLevel());
+    return best;
+}
+
+#endif // SIMD_REDUCE_H
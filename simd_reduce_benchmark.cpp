@@ -0,0 +1,216 @@
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <array>
+#include <string>
+#include <functional>
+#include <algorithm>
+#include <limits>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+
+#include "simd_reduce.h"
+#include "parallel_reduce.h"
+
+// Checks every reduction kernel level this CPU supports against exact
+// results and measures how many GB/s each reads from an array small
+// enough to stay in cache. A single measurement swings by half with clock
+// and host noise, so every kernel is timed in several rounds, all levels
+// in turn in each, and the median is shown. Then reduces a large array with
+// parallel_reduce_chunks, one kernel call per piece, next to the
+// element-at-a-time parallel_reduce.
+// Usage: simd_reduce_benchmark [in_cache_elements] [large_elements]
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+constexpr int kRounds = 7;
+
+// GB/s reading bytes per call, calling kernel repeatedly for about 20 ms
+template<typename Kernel>
+double gigabytesPerSecond(Kernel kernel, size_t bytes) {
+    volatile double sink = 0;
+    size_t calls = 0;
+    auto start = std::chrono::steady_clock::now();
+    double seconds = 0;
+    do {
+        for (int i = 0; i < 16; i++) {
+            sink = sink + double(kernel());
+        }
+        calls += 16;
+        seconds = secondsSince(start);
+    } while (seconds < 0.02);
+    return double(bytes) * calls / seconds / 1e9;
+}
+
+// Float kernels sum in another order than the reference, so they only
+// agree to within float rounding of the magnitudes involved
+bool closeEnough(double result, double exact, double magnitude) {
+    return std::abs(result - exact) <= 1e-5 * magnitude + 1e-30;
+}
+
+struct Data {
+    std::vector<int32_t> ints_a;
+    std::vector<int32_t> ints_b;
+    std::vector<float> floats_a;
+    std::vector<float> floats_b;
+
+    explicit Data(size_t count) : ints_a(count), ints_b(count), floats_a(count), floats_b(count) {
+        uint64_t state = 7;
+        for (size_t i = 0; i < count; i++) {
+            state = state * 6364136223846793005ull + 1442695040888963407ull;
+            ints_a[i] = static_cast<int32_t>(state >> 32);
+            ints_b[i] = static_cast<int32_t>(state >> 16);
+            floats_a[i] = static_cast<float>((state >> 40) & 0xffffff) / 16777216.0f - 0.25f;
+            floats_b[i] = static_cast<float>((state >> 8) & 0xffffff) / 16777216.0f;
+        }
+    }
+};
+
+// Runs each of a level's kernels over data, returning false if one
+// disagrees with the exact result
+bool check(const ReductionKernels& kernels, const Data& data) {
+    size_t n = data.ints_a.size();
+    const int32_t* ia = data.ints_a.data();
+    const int32_t* ib = data.ints_b.data();
+    const float* fa = data.floats_a.data();
+    const float* fb = data.floats_b.data();
+
+    int64_t sum = 0;
+    uint64_t dot = 0;   // wraps like the kernels if it overflows
+    int32_t low = INT32_MAX;
+    int32_t high = INT32_MIN;
+    double float_sum = 0;
+    double float_abs = 0;
+    double float_dot = 0;
+    double float_dot_abs = 0;
+    float float_low = std::numeric_limits<float>::max();
+    float float_high = std::numeric_limits<float>::lowest();
+    for (size_t i = 0; i < n; i++) {
+        sum += ia[i];
+        dot += uint64_t(int64_t(ia[i]) * ib[i]);
+        low = std::min(low, ia[i]);
+        high = std::max(high, ia[i]);
+        float_sum += fa[i];
+        float_abs += std::abs(fa[i]);
+        float_dot += double(fa[i]) * fb[i];
+        float_dot_abs += std::abs(double(fa[i]) * fb[i]);
+        float_low = std::min(float_low, fa[i]);
+        float_high = std::max(float_high, fa[i]);
+    }
+
+    return kernels.sum_i32(ia, n) == sum && kernels.dot_i32(ia, ib, n) == int64_t(dot) &&
+           kernels.min_i32(ia, n) == low && kernels.max_i32(ia, n) == high &&
+           closeEnough(kernels.sum_f32(fa, n), float_sum, float_abs) &&
+           closeEnough(kernels.dot_f32(fa, fb, n), float_dot, float_dot_abs) &&
+           kernels.min_f32(fa, n) == float_low && kernels.max_f32(fa, n) == float_high;
+}
+
+// One round of GB/s for each of a level's kernels, in table order
+std::array<double, 8> timeKernels(const ReductionKernels& kernels, const Data& data) {
+    size_t n = data.ints_a.size();
+    const int32_t* ia = data.ints_a.data();
+    const int32_t* ib = data.ints_b.data();
+    const float* fa = data.floats_a.data();
+    const float* fb = data.floats_b.data();
+    size_t bytes = n * 4;
+    return {gigabytesPerSecond([&] { return kernels.sum_i32(ia, n); }, bytes),
+            gigabytesPerSecond([&] { return kernels.min_i32(ia, n); }, bytes),
+            gigabytesPerSecond([&] { return kernels.max_i32(ia, n); }, bytes),
+            gigabytesPerSecond([&] { return kernels.dot_i32(ia, ib, n); }, 2 * bytes),
+            gigabytesPerSecond([&] { return kernels.sum_f32(fa, n); }, bytes),
+            gigabytesPerSecond([&] { return kernels.min_f32(fa, n); }, bytes),
+            gigabytesPerSecond([&] { return kernels.max_f32(fa, n); }, bytes),
+            gigabytesPerSecond([&] { return kernels.dot_f32(fa, fb, n); }, 2 * bytes)};
+}
+
+int main(int argc, char* argv[]) {
+    size_t in_cache = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 4096;
+    size_t large = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 16000000;
+    if (in_cache == 0 || large == 0) {
+        std::cerr << "Usage: simd_reduce_benchmark [in_cache_elements] [large_elements]" << std::endl;
+        return 1;
+    }
+
+    bool all_ok = true;
+    std::cout << "Selected kernels: " << reductionKernels().name << std::endl;
+    Data small(in_cache);
+    std::vector<SimdLevel> levels;
+    for (SimdLevel level : {SimdLevel::kScalar, SimdLevel::kSse2, SimdLevel::kAvx2, SimdLevel::kAvx512}) {
+        if (level <= detectSimdLevel()) {
+            levels.push_back(level);
+        }
+    }
+    // rates[level][kernel] holds one measurement per round
+    std::vector<std::array<std::vector<double>, 8>> rates(levels.size());
+    for (int round = 0; round < kRounds; round++) {
+        for (size_t l = 0; l < levels.size(); l++) {
+            std::array<double, 8> measured = timeKernels(kernelsFor(levels[l]), small);
+            for (size_t k = 0; k < 8; k++) {
+                rates[l][k].push_back(measured[k]);
+            }
+        }
+    }
+    std::cout << "GB/s over " << in_cache << " elements, median of " << kRounds << " rounds:" << std::endl
+              << std::left << std::setw(9) << "level" << std::right << std::setw(9) << "sum i32" << std::setw(9)
+              << "min i32" << std::setw(9) << "max i32" << std::setw(9) << "dot i32" << std::setw(9) << "sum f32"
+              << std::setw(9) << "min f32" << std::setw(9) << "max f32" << std::setw(9) << "dot f32" << std::endl;
+    for (size_t l = 0; l < levels.size(); l++) {
+        const ReductionKernels& kernels = kernelsFor(levels[l]);
+        bool ok = check(kernels, small);
+        all_ok = all_ok && ok;
+        std::cout << std::left << std::setw(9) << kernels.name << std::right << std::fixed << std::setprecision(1);
+        for (std::vector<double>& rounds : rates[l]) {
+            std::nth_element(rounds.begin(), rounds.begin() + kRounds / 2, rounds.end());
+            std::cout << std::setw(9) << rounds[kRounds / 2];
+        }
+        std::cout << (ok ? "" : "  WRONG") << std::endl;
+    }
+
+    // The parallel driver, handing each piece to the selected kernels
+    Data data(large);
+    const ReductionKernels& kernels = reductionKernels();
+    const std::vector<int32_t>& ints = data.ints_a;
+    const std::vector<float>& a = data.floats_a;
+    const std::vector<float>& b = data.floats_b;
+    constexpr size_t kGrain = 1 << 16;
+
+    auto start = std::chrono::steady_clock::now();
+    int64_t element_sum = parallel_reduce(ints, int64_t(0), [](int32_t x) { return int64_t(x); },
+                                          std::plus<int64_t>(), kGrain);
+    double element_seconds = secondsSince(start);
+    start = std::chrono::steady_clock::now();
+    int64_t chunk_sum = parallel_reduce_chunks(ints, int64_t(0), [&kernels](auto first, auto last) {
+        return kernels.sum_i32(&*first, last - first);
+    }, std::plus<int64_t>(), kGrain);
+    double chunk_seconds = secondsSince(start);
+    all_ok = all_ok && element_sum == chunk_sum;
+    std::cout << std::setprecision(2) << "\nsum of " << large << " ints: " << element_seconds * 1e3
+              << " ms element by element, " << chunk_seconds * 1e3 << " ms with " << kernels.name
+              << " chunks" << (element_sum == chunk_sum ? "" : "  WRONG") << std::endl;
+
+    start = std::chrono::steady_clock::now();
+    double element_dot = parallel_reduce(size_t(0), large, 0.0,
+                                         [&a, &b](size_t i) { return double(a[i]) * b[i]; },
+                                         std::plus<double>(), kGrain);
+    element_seconds = secondsSince(start);
+    start = std::chrono::steady_clock::now();
+    double chunk_dot = parallel_reduce_chunks(size_t(0), large, 0.0, [&](size_t first, size_t last) {
+        return double(kernels.dot_f32(a.data() + first, b.data() + first, last - first));
+    }, std::plus<double>(), kGrain);
+    chunk_seconds = secondsSince(start);
+    double magnitude = 0;
+    for (size_t i = 0; i < large; i++) {
+        magnitude += std::abs(double(a[i]) * b[i]);
+    }
+    bool dot_ok = closeEnough(chunk_dot, element_dot, magnitude);
+    all_ok = all_ok && dot_ok;
+    std::cout << "dot product of " << large << " floats: " << element_seconds * 1e3
+              << " ms element by element in double, " << chunk_seconds * 1e3 << " ms with " << kernels.name
+              << " chunks" << (dot_ok ? "" : "  WRONG") << std::endl;
+
+    return all_ok ? 0 : 1;
+}
@@ -0,0 +1,219 @@
+#ifndef SNAPSHOT_FILE_H
+#define SNAPSHOT_FILE_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <optional>
+#include <stdexcept>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "file_io.h"
+#include "shard_table.h"
+
+// Immutable checkpoint of the table, opened with mmap and read in place.
+// Layout, using only file-relative offsets so the mapping can live anywhere:
+//   Header | Bucket[bucket_count] | heap of records [u32 klen][u32 vlen][key][value]
+// Integers are little-endian, like the WAL's, so a snapshot opens on any
+// host. Buckets form a linear-probing index keyed by hashBytes, whose
+// output is fixed across builds; offset 0 marks an empty bucket since the
+// heap always starts after the header.
+class SnapshotFile {
+private:
+    struct Header {
+        char magic[8];
+        uint64_t entry_count;
+        uint64_t bucket_count;
+        uint64_t heap_offset;
+        uint64_t file_size;
+    };
+
+    struct Bucket {
+        uint64_t hash;
+        uint64_t offset;
+    };
+
+    static constexpr char kMagic[8] = {'K', 'V', 'S', 'N', 'A', 'P', '0', '1'};
+    // Encoded sizes: the magic and four u64s, and two u64s
+    static constexpr size_t kHeaderSize = 40;
+    static constexpr size_t kBucketSize = 16;
+
+    int fd;
+    const char* base;
+    size_t length;
+    Header header;
+
+    Bucket bucketAt(uint64_t i) const {
+        const char* p = base + kHeaderSize + i * kBucketSize;
+        return Bucket{getLittleEndian64(p), getLittleEndian64(p + 8)};
+    }
+
+    std::string_view keyAt(uint64_t offset) const {
+        return std::string_view(base + offset + 8, getLittleEndian32(base + offset));
+    }
+
+    std::string_view valueAt(uint64_t offset) const {
+        uint32_t key_length = getLittleEndian32(base + offset);
+        return std::string_view(base + offset + 8 + key_length, getLittleEndian32(base + offset + 4));
+    }
+
+public:
+    SnapshotFile() : fd(-1), base(nullptr), length(0), header{} {}
+
+    SnapshotFile(const SnapshotFile&) = delete;
+    SnapshotFile& operator=(const SnapshotFile&) = delete;
+
+    ~SnapshotFile() {
+        if (base) {
+            ::munmap(const_cast<char*>(base), length);
+        }
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    }
+
+    // Map an existing snapshot. Only the header is read, so this costs the
+    // same for ten keys as for fifty million. Returns false if there is none.
+    bool open(const std::string& path) {
+        fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            if (errno == ENOENT) {
+                return false;
+            }
+            throw std::runtime_error("Cannot open snapshot " + path + ": " + std::strerror(errno));
+        }
+        struct stat info;
+        if (::fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < kHeaderSize) {
+            throw std::runtime_error("Snapshot " + path + " is truncated");
+        }
+        length = static_cast<size_t>(info.st_size);
+        void* mapping = ::mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+        if (mapping == MAP_FAILED) {
+            throw std::runtime_error("Cannot map snapshot " + path + ": " + std::strerror(errno));
+        }
+        base = static_cast<const char*>(mapping);
+        std::memcpy(header.magic, base, sizeof(kMagic));
+        header.entry_count = getLittleEndian64(base + 8);
+        header.bucket_count = getLittleEndian64(base + 16);
+        header.heap_offset = getLittleEndian64(base + 24);
+        header.file_size = getLittleEndian64(base + 32);
+        if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 || header.file_size != length ||
+            header.heap_offset != kHeaderSize + header.bucket_count * kBucketSize) {
+            throw std::runtime_error("Snapshot " + path + " is corrupt");
+        }
+        return true;
+    }
+
+    size_t size() const { return header.entry_count; }
+
+    std::optional<std::string_view> find(std::string_view key) const {
+        if (header.bucket_count == 0) {
+            return std::nullopt;
+        }
+        uint64_t hash = hashBytes(key);
+        uint64_t mask = header.bucket_count - 1;
+        for (uint64_t i = hash & mask;; i = (i + 1) & mask) {
+            Bucket bucket = bucketAt(i);
+            if (bucket.offset == 0) {
+                return std::nullopt;
+            }
+            if (bucket.hash == hash && keyAt(bucket.offset) == key) {
+                return valueAt(bucket.offset);
+            }
+        }
+    }
+
+    // Visit every (key, value) in heap order
+    template<typename Visit>
+    void forEach(Visit visit) const {
+        for (uint64_t offset = header.heap_offset; offset < length;) {
+            std::string_view key = keyAt(offset);
+            std::string_view value = valueAt(offset);
+            visit(key, value);
+            offset += 8 + key.size() + value.size();
+        }
+    }
+
+    struct Record {
+        std::string_view key;
+        std::string_view value;
+    };
+
+    // Write records (unique keys) to path. The file is written next to its
+    // final name, fsynced and renamed into place, and the directory is
+    // synced, so readers only ever see a complete snapshot and a crash
+    // after write() returns cannot bring back the old one.
+    static void write(const std::string& path, const std::vector<Record>& records) {
+        uint64_t bucket_count = 0;
+        if (!records.empty()) {
+            bucket_count = 1;
+            while (bucket_count < records.size() * 2) {
+                bucket_count <<= 1;
+            }
+        }
+        uint64_t heap_offset = kHeaderSize + bucket_count * kBucketSize;
+
+        std::string buckets(bucket_count * kBucketSize, '\0');
+        uint64_t offset = heap_offset;
+        for (const Record& record : records) {
+            uint64_t hash = hashBytes(record.key);
+            uint64_t i = hash & (bucket_count - 1);
+            while (getLittleEndian64(&buckets[i * kBucketSize + 8]) != 0) {
+                i = (i + 1) & (bucket_count - 1);
+            }
+            putLittleEndian64(&buckets[i * kBucketSize], hash);
+            putLittleEndian64(&buckets[i * kBucketSize + 8], offset);
+            offset += 8 + record.key.size() + record.value.size();
+        }
+
+        char out[kHeaderSize];
+        std::memcpy(out, kMagic, sizeof(kMagic));
+        putLittleEndian64(out + 8, records.size());
+        putLittleEndian64(out + 16, bucket_count);
+        putLittleEndian64(out + 24, heap_offset);
+        putLittleEndian64(out + 32, offset);
+
+        std::string temp_path = path + ".tmp";
+        int out_fd = ::open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (out_fd < 0) {
+            throw std::runtime_error("Cannot create snapshot " + temp_path + ": " + std::strerror(errno));
+        }
+        try {
+            writeFully(out_fd, std::string_view(out, kHeaderSize), "Snapshot write");
+            writeFully(out_fd, buckets, "Snapshot write");
+            std::string chunk;
+            for (const Record& record : records) {
+                char lengths[8];
+                putLittleEndian32(lengths, static_cast<uint32_t>(record.key.size()));
+                putLittleEndian32(lengths + 4, static_cast<uint32_t>(record.value.size()));
+                chunk.append(lengths, 8);
+                chunk.append(record.key);
+                chunk.append(record.value);
+                if (chunk.size() >= (1 << 20)) {
+                    writeFully(out_fd, chunk, "Snapshot write");
+                    chunk.clear();
+                }
+            }
+            writeFully(out_fd, chunk, "Snapshot write");
+            syncFile(out_fd);
+        } catch (...) {
+            ::close(out_fd);
+            throw;
+        }
+        ::close(out_fd);
+        if (std::rename(temp_path.c_str(), path.c_str()) != 0) {
+            throw std::runtime_error("Cannot install snapshot " + path + ": " + std::strerror(errno));
+        }
+        size_t slash = path.rfind('/');
+        syncDirectory(slash == std::string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash));
+    }
+};
+
+#endif // SNAPSHOT_FILE_H
@@ -0,0 +1,198 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+
+// Hierarchical timing wheel for expiry deadlines, in ticks of the owner's
+// choosing. Four levels of 256 slots cover 2^32 ticks; a timer sits in the
+// level whose slot width matches how far away its deadline is, and moves
+// down a level each time the wheel reaches its slot, so every timer is
+// handled a bounded number of times no matter how many there are.
+// Scheduling and cancelling are O(1): each timer is a node of an intrusive
+// circular list, indexed by a stable id chosen by the owner (e.g. a table
+// entry index), and each slot is a sentinel node of the same array.
+// Nothing is allocated until the first timer is scheduled.
+class TimerWheel {
+private:
+    static constexpr size_t kLevels = 4;
+    static constexpr size_t kSlotBits = 8;
+    static constexpr size_t kSlots = size_t(1) << kSlotBits;
+    // Sentinels: every slot of every level, then the due and cascade lists
+    static constexpr uint32_t kDue = kLevels * kSlots;
+    static constexpr uint32_t kCascade = kDue + 1;
+    static constexpr uint32_t kSentinels = kCascade + 1;
+
+    struct Node {
+        uint32_t prev;
+        uint32_t next;
+        uint64_t deadline;   // 0 if not scheduled
+    };
+
+    std::vector<Node> nodes;   // sentinels first, then one node per id
+    uint64_t current;          // next tick to process
+    size_t count;
+
+    bool emptyList(uint32_t sentinel) const { return nodes[sentinel].next == sentinel; }
+
+    void unlink(uint32_t n) {
+        nodes[nodes[n].prev].next = nodes[n].next;
+        nodes[nodes[n].next].prev = nodes[n].prev;
+    }
+
+    void pushBack(uint32_t sentinel, uint32_t n) {
+        uint32_t last = nodes[sentinel].prev;
+        nodes[n].prev = last;
+        nodes[n].next = sentinel;
+        nodes[last].next = n;
+        nodes[sentinel].prev = n;
+    }
+
+    // Move every node of one list to the end of another in O(1)
+    void splice(uint32_t from, uint32_t to) {
+        if (emptyList(from)) {
+            return;
+        }
+        uint32_t first = nodes[from].next;
+        uint32_t last = nodes[from].prev;
+        uint32_t tail = nodes[to].prev;
+        nodes[tail].next = first;
+        nodes[first].prev = tail;
+        nodes[last].next = to;
+        nodes[to].prev = last;
+        nodes[from].next = nodes[from].prev = from;
+    }
+
+    static uint32_t slotOf(size_t level, uint64_t tick) {
+        return static_cast<uint32_t>(level * kSlots + ((tick >> (level * kSlotBits)) & (kSlots - 1)));
+    }
+
+    // File a node under the slot that the wheel reaches no later than its
+    // deadline. Deadlines beyond the top level's reach wait in its last
+    // slot and are filed again from there.
+    void place(uint32_t n) {
+        uint64_t deadline = nodes[n].deadline;
+        if (deadline < current) {
+            pushBack(kDue, n);
+            return;
+        }
+        uint64_t delta = deadline - current;
+        for (size_t level = 0; level < kLevels - 1; level++) {
+            if (delta < (uint64_t(1) << ((level + 1) * kSlotBits))) {
+                pushBack(slotOf(level, deadline), n);
+                return;
+            }
+        }
+        uint64_t reach = current + (uint64_t(1) << (kLevels * kSlotBits)) - 1;
+        pushBack(slotOf(kLevels - 1, std::min(deadline, reach)), n);
+    }
+
+    uint32_t nodeOf(uint32_t id) const { return kSentinels + id; }
+
+public:
+    TimerWheel() : current(0), count(0) {}
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+
+    // Deadline of id, or 0 if it has no timer
+    uint64_t deadlineOf(uint32_t id) const {
+        return nodeOf(id) < nodes.size() ? nodes[nodeOf(id)].deadline : 0;
+    }
+
+    // Set or replace the timer of id. A deadline already passed fires on
+    // the next expire(); 0 is taken as 1. An empty wheel restarts at now,
+    // so time it spent idle is never walked tick by tick.
+    void schedule(uint32_t id, uint64_t deadline, uint64_t now) {
+        if (nodes.empty()) {
+            nodes.resize(kSentinels);
+            for (uint32_t s = 0; s < kSentinels; s++) {
+                nodes[s] = Node{s, s, 0};
+            }
+        }
+        if (count == 0) {
+            current = now;
+        }
+        uint32_t n = nodeOf(id);
+        if (n >= nodes.size()) {
+            nodes.resize(std::max<size_t>(n + 1, nodes.size() * 3 / 2), Node{0, 0, 0});
+        }
+        if (nodes[n].deadline != 0) {
+            unlink(n);
+        } else {
+            count++;
+        }
+        nodes[n].deadline = std::max<uint64_t>(deadline, 1);
+        place(n);
+    }
+
+    // Returns false if id had no timer
+    bool cancel(uint32_t id) {
+        uint32_t n = nodeOf(id);
+        if (n >= nodes.size() || nodes[n].deadline == 0) {
+            return false;
+        }
+        unlink(n);
+        nodes[n].deadline = 0;
+        count--;
+        return true;
+    }
+
+    // Advance the wheel towards now and append the ids whose deadline is at
+    // or before now to expired, removing their timers. Does at most limit
+    // units of work, a unit being one timer expired or refiled or one tick
+    // passed, and returns false if it stopped because of the limit; call it
+    // again to continue from where it left off.
+    bool expire(uint64_t now, size_t limit, std::vector<uint32_t>& expired) {
+        if (nodes.empty()) {
+            current = std::max(current, now + 1);
+            return true;
+        }
+        for (size_t work = 0; work < limit; work++) {
+            if (!emptyList(kDue)) {
+                uint32_t n = nodes[kDue].next;
+                unlink(n);
+                nodes[n].deadline = 0;
+                count--;
+                expired.push_back(n - kSentinels);
+                continue;
+            }
+            if (!emptyList(kCascade)) {
+                uint32_t n = nodes[kCascade].next;
+                unlink(n);
+                place(n);
+                continue;
+            }
+            if (current > now) {
+                return true;
+            }
+            if (count == 0) {
+                current = now + 1;
+                return true;
+            }
+            // Slots of the upper levels that start at this tick move down
+            // first; their timers can only land in later slots or in this
+            // tick's level 0 slot, never back in a slot being emptied
+            for (size_t level = kLevels - 1; level > 0; level--) {
+                if ((current & ((uint64_t(1) << (level * kSlotBits)) - 1)) == 0) {
+                    splice(slotOf(level, current), kCascade);
+                }
+            }
+            if (!emptyList(kCascade)) {
+                continue;
+            }
+            splice(slotOf(0, current), kDue);
+            current++;
+        }
+        return false;
+    }
+
+    void clear() {
+        nodes.clear();
+        count = 0;
+    }
+};
+
+#endif // TIMER_WHEEL_H
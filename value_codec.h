@@ -0,0 +1,330 @@
+#ifndef VALUE_CODEC_H
+#define VALUE_CODEC_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <span>
+#include <queue>
+#include <algorithm>
+#include <utility>
+#include <stdexcept>
+#include <cstring>
+#include <cstdint>
+#include <cstddef>
+
+// LZ77-style compression for short values that look alike, such as JSON
+// records with the same field names. One value on its own has little to
+// match against, so matches may also reach back into a dictionary of
+// substrings common to many values; only the parts a value does not share
+// with the dictionary cost real bytes.
+//
+// An encoded value is [varint raw length] then sequences of
+//   [token][varint extra literal length][literals][varint offset][varint extra match length]
+// where the token's high nibble is the literal count and its low nibble the
+// match length minus 4 (15 in either means an extra length follows). The
+// offset counts back from the current output position through the
+// dictionary placed in front of the output. The last sequence ends after
+// its literals.
+
+inline void putVarint(std::string& out, uint64_t v) {
+    while (v >= 0x80) {
+        out.push_back(static_cast<char>(v | 0x80));
+        v >>= 7;
+    }
+    out.push_back(static_cast<char>(v));
+}
+
+inline uint64_t getVarint(const char*& p, const char* end) {
+    uint64_t v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (p == end) {
+            throw std::runtime_error("Truncated compressed value");
+        }
+        uint8_t byte = static_cast<uint8_t>(*p++);
+        v |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if (byte < 0x80) {
+            return v;
+        }
+    }
+    throw std::runtime_error("Malformed varint in compressed value");
+}
+
+inline uint32_t readU32(const char* p) {
+    uint32_t v;
+    std::memcpy(&v, p, 4);
+    return v;
+}
+
+// Length of the common prefix of a and b, up to limit, eight bytes a step
+inline size_t commonPrefix(const char* a, const char* b, size_t limit) {
+    size_t length = 0;
+    while (length + 8 <= limit) {
+        uint64_t x;
+        uint64_t y;
+        std::memcpy(&x, a + length, 8);
+        std::memcpy(&y, b + length, 8);
+        if (x != y) {
+            return length + (__builtin_ctzll(x ^ y) >> 3);
+        }
+        length += 8;
+    }
+    while (length < limit && a[length] == b[length]) {
+        length++;
+    }
+    return length;
+}
+
+// Substrings that recur across a sample of values, with the most useful
+// ones last so that matches against them get the shortest offsets, and a
+// hash index from every 4-byte sequence to its last position, chained to
+// the earlier positions with the same hash
+class ValueDictionary {
+public:
+    static constexpr size_t kHashBits = 13;
+    // Positions tried per lookup; the dictionary is where most of a value's
+    // bytes are found, so it pays to look past the first candidate
+    static constexpr size_t kMaxCandidates = 8;
+
+private:
+    // Segments are scored by the k-mers they contain, each k-mer counted by
+    // how often it occurs across the sample
+    static constexpr size_t kKmer = 8;
+    static constexpr size_t kSegment = 64;
+    static constexpr size_t kCountBits = 20;
+
+    std::string bytes;
+    std::vector<uint32_t> heads;   // position + 1, or 0
+    std::vector<uint32_t> chain;   // per position, the previous one with its hash, + 1
+
+    static uint64_t kmerHash(const char* p) {
+        uint64_t v;
+        std::memcpy(&v, p, 8);
+        return (v * 0x9E3779B97F4A7C15ull) >> (64 - kCountBits);
+    }
+
+public:
+    ValueDictionary() = default;
+
+    explicit ValueDictionary(std::string contents)
+        : bytes(std::move(contents)), heads(size_t(1) << kHashBits, 0), chain(bytes.size(), 0) {
+        for (size_t pos = 0; pos + 4 <= bytes.size(); pos++) {
+            uint32_t& head = heads[hash4(bytes.data() + pos)];
+            chain[pos] = head;
+            head = static_cast<uint32_t>(pos + 1);
+        }
+    }
+
+    static uint32_t hash4(const char* p) {
+        return (readU32(p) * 2654435761u) >> (32 - kHashBits);
+    }
+
+    std::string_view view() const { return bytes; }
+    size_t size() const { return bytes.size(); }
+
+    // Longest match for the bytes at p (at most limit of them) among the
+    // positions whose first 4 bytes hash alike; returns {length, position}
+    std::pair<size_t, size_t> longestMatch(const char* p, size_t limit, uint32_t hash) const {
+        std::pair<size_t, size_t> best{0, 0};
+        if (heads.empty()) {
+            return best;
+        }
+        uint32_t link = heads[hash];
+        for (size_t tries = 0; link != 0 && tries < kMaxCandidates; tries++) {
+            size_t pos = link - 1;
+            size_t length = commonPrefix(bytes.data() + pos, p, std::min(limit, bytes.size() - pos));
+            if (length > best.first) {
+                best = {length, pos};
+            }
+            link = chain[pos];
+        }
+        return best;
+    }
+
+    // Pick up to capacity bytes of segments from the samples, greedily by
+    // how many k-mer occurrences they cover that no chosen segment covers
+    // yet. Scores only fall as segments are chosen, so a candidate whose
+    // recomputed score still tops the queue is the true best.
+    static ValueDictionary train(std::span<const std::string> samples, size_t capacity) {
+        std::vector<uint32_t> counts(size_t(1) << kCountBits, 0);
+        for (const std::string& sample : samples) {
+            for (size_t pos = 0; pos + kKmer <= sample.size(); pos++) {
+                counts[kmerHash(sample.data() + pos)]++;
+            }
+        }
+        auto score = [&counts](std::string_view segment) {
+            uint64_t total = 0;
+            for (size_t pos = 0; pos + kKmer <= segment.size(); pos++) {
+                total += counts[kmerHash(segment.data() + pos)];
+            }
+            return total;
+        };
+
+        struct Candidate {
+            uint64_t score;
+            std::string_view segment;
+            bool operator<(const Candidate& other) const { return score < other.score; }
+        };
+        std::priority_queue<Candidate> queue;
+        for (const std::string& sample : samples) {
+            for (size_t start = 0; start + kKmer <= sample.size(); start += kSegment / 2) {
+                std::string_view segment = std::string_view(sample).substr(start, kSegment);
+                queue.push({score(segment), segment});
+            }
+        }
+
+        std::vector<std::string_view> chosen;
+        size_t total = 0;
+        while (!queue.empty() && total < capacity) {
+            Candidate best = queue.top();
+            queue.pop();
+            best.score = score(best.segment);
+            if (best.score == 0) {
+                continue;
+            }
+            if (!queue.empty() && best.score < queue.top().score) {
+                queue.push(best);
+                continue;
+            }
+            std::string_view segment = best.segment.substr(0, capacity - total);
+            chosen.push_back(segment);
+            total += segment.size();
+            for (size_t pos = 0; pos + kKmer <= segment.size(); pos++) {
+                counts[kmerHash(segment.data() + pos)] = 0;
+            }
+        }
+
+        std::string contents;
+        contents.reserve(total);
+        for (auto it = chosen.rbegin(); it != chosen.rend(); ++it) {
+            contents.append(*it);
+        }
+        return ValueDictionary(std::move(contents));
+    }
+};
+
+// Encode input into out (replacing its contents), matching against the
+// input itself and against dict if one is given
+inline void lzCompress(std::string_view input, const ValueDictionary* dict, std::string& out) {
+    static constexpr size_t kMinMatch = 4;
+    static constexpr size_t kLocalBits = 8;
+    out.clear();
+    putVarint(out, input.size());
+    std::string_view dictionary = dict ? dict->view() : std::string_view();
+    uint32_t local[size_t(1) << kLocalBits] = {};   // position + 1, or 0
+
+    const char* in = input.data();
+    size_t n = input.size();
+    size_t anchor = 0;
+    auto emit = [&](size_t literal_end, size_t match_length, size_t offset) {
+        size_t literals = literal_end - anchor;
+        size_t extra_match = match_length >= kMinMatch ? match_length - kMinMatch : 0;
+        uint8_t token = static_cast<uint8_t>((std::min<size_t>(literals, 15) << 4) | std::min<size_t>(extra_match, 15));
+        out.push_back(static_cast<char>(token));
+        if (literals >= 15) {
+            putVarint(out, literals - 15);
+        }
+        out.append(in + anchor, literals);
+        if (match_length == 0) {
+            return;
+        }
+        putVarint(out, offset);
+        if (extra_match >= 15) {
+            putVarint(out, extra_match - 15);
+        }
+    };
+    size_t pos = 0;
+    while (pos + kMinMatch <= n) {
+        uint32_t hash = ValueDictionary::hash4(in + pos);
+        size_t best_length = 0;
+        size_t best_offset = 0;
+        uint32_t& slot = local[hash >> (ValueDictionary::kHashBits - kLocalBits)];
+        if (slot != 0) {
+            size_t from = slot - 1;
+            best_length = commonPrefix(in + from, in + pos, n - pos);
+            best_offset = pos - from;
+        }
+        slot = static_cast<uint32_t>(pos + 1);
+        if (dict) {
+            auto [length, from] = dict->longestMatch(in + pos, n - pos, hash);
+            if (length > best_length) {
+                best_length = length;
+                best_offset = dictionary.size() - from + pos;
+            }
+        }
+        if (best_length < kMinMatch) {
+            pos++;
+            continue;
+        }
+        emit(pos, best_length, best_offset);
+        size_t end = pos + best_length;
+        for (pos++; pos < end && pos + kMinMatch <= n; pos++) {
+            local[ValueDictionary::hash4(in + pos) >> (ValueDictionary::kHashBits - kLocalBits)] =
+                static_cast<uint32_t>(pos + 1);
+        }
+        pos = end;
+        anchor = end;
+    }
+    emit(n, 0, 0);
+}
+
+// Decode what lzCompress produced with the same dictionary into out,
+// replacing its contents
+inline void lzDecompress(std::string_view encoded, const ValueDictionary* dict, std::string& out) {
+    const char* p = encoded.data();
+    const char* end = p + encoded.size();
+    size_t raw_length = getVarint(p, end);
+    std::string_view dictionary = dict ? dict->view() : std::string_view();
+    out.clear();
+    out.reserve(raw_length);
+    auto corrupt = []() {
+        throw std::runtime_error("Corrupt compressed value");
+    };
+    while (p < end) {
+        uint8_t token = static_cast<uint8_t>(*p++);
+        size_t literals = token >> 4;
+        if (literals == 15) {
+            literals += getVarint(p, end);
+        }
+        if (static_cast<size_t>(end - p) < literals || out.size() + literals > raw_length) {
+            corrupt();
+        }
+        out.append(p, literals);
+        p += literals;
+        if (p == end) {
+            break;
+        }
+        size_t offset = getVarint(p, end);
+        size_t length = (token & 15) + 4;
+        if ((token & 15) == 15) {
+            length += getVarint(p, end);
+        }
+        if (offset == 0 || offset > out.size() + dictionary.size() || out.size() + length > raw_length) {
+            corrupt();
+        }
+        // The capacity reserved above keeps appends from out's own bytes
+        // from reallocating under the source pointer
+        if (offset <= out.size()) {
+            size_t from = out.size() - offset;
+            if (offset >= length) {
+                out.append(out.data() + from, length);
+            } else {
+                for (size_t i = 0; i < length; i++) {
+                    out.push_back(out[from + i]);
+                }
+            }
+            continue;
+        }
+        size_t from = dictionary.size() - (offset - out.size());
+        size_t in_dictionary = std::min(length, dictionary.size() - from);
+        out.append(dictionary.data() + from, in_dictionary);
+        for (size_t i = in_dictionary; i < length; i++) {
+            out.push_back(out[i - in_dictionary]);
+        }
+    }
+    if (out.size() != raw_length) {
+        corrupt();
+    }
+}
+
+#endif // VALUE_CODEC_H
@@ -0,0 +1,79 @@
+#ifndef VALUE_INDEX_H
+#define VALUE_INDEX_H
+
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+#include <cstddef>
+
+// Secondary index from a value to the entries holding it, for one shard.
+// Entries are named by a stable id chosen by the owner (a table entry
+// index) and values by their hash, so the index stores no bytes of its
+// own; the owner compares the candidates' values to rule out collisions.
+// Each value's ids are kept in a vector, and each id remembers its place
+// in it, so adding and removing are O(1) even for a value thousands of
+// keys share. Not thread-safe.
+class ValueIndex {
+private:
+    static constexpr uint32_t kAbsent = UINT32_MAX;
+
+    std::unordered_map<uint64_t, std::vector<uint32_t>> members;
+    std::vector<uint64_t> value_of;    // per id, the hash it is filed under
+    std::vector<uint32_t> position;    // per id, its place in members, or kAbsent
+    size_t count = 0;
+
+public:
+    // File id under value_hash, moving it if it was filed elsewhere
+    void set(uint32_t id, uint64_t value_hash) {
+        if (id >= position.size()) {
+            position.resize(id + 1, kAbsent);
+            value_of.resize(id + 1, 0);
+        }
+        if (position[id] != kAbsent) {
+            if (value_of[id] == value_hash) {
+                return;
+            }
+            remove(id);
+        }
+        std::vector<uint32_t>& ids = members[value_hash];
+        position[id] = static_cast<uint32_t>(ids.size());
+        value_of[id] = value_hash;
+        ids.push_back(id);
+        count++;
+    }
+
+    void remove(uint32_t id) {
+        if (id >= position.size() || position[id] == kAbsent) {
+            return;
+        }
+        auto it = members.find(value_of[id]);
+        std::vector<uint32_t>& ids = it->second;
+        uint32_t last = ids.back();
+        ids[position[id]] = last;
+        position[last] = position[id];
+        ids.pop_back();
+        if (ids.empty()) {
+            members.erase(it);
+        }
+        position[id] = kAbsent;
+        count--;
+    }
+
+    // Ids filed under value_hash; valid until the next change
+    const std::vector<uint32_t>* find(uint64_t value_hash) const {
+        auto it = members.find(value_hash);
+        return it == members.end() ? nullptr : &it->second;
+    }
+
+    size_t size() const { return count; }
+    size_t distinctValues() const { return members.size(); }
+
+    void clear() {
+        members.clear();
+        value_of.clear();
+        position.clear();
+        count = 0;
+    }
+};
+
+#endif // VALUE_INDEX_H
@@ -0,0 +1,127 @@
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <stdexcept>
+#include <cstdio>
+#include <cstdlib>
+
+#include "database_connection.h"
+
+// Shows the value index and watch():
+//   1. finds the keys holding one status value through keysWithValue()
+//      and, for comparison, by scanning every key with lookup()
+//   2. writes keys while two watchers follow them, one keeping up and one
+//      sleeping in its callback, and times the writes with and without
+//      the watchers
+// Usage: watch_demo [keys] [slow_watcher_ms]
+
+std::string makeKey(size_t i) {
+    char key[32];
+    std::snprintf(key, sizeof(key), "order:%010zu", i);
+    return key;
+}
+
+// Ten status values, one of which only one key in a thousand has
+std::string statusOf(size_t i) {
+    static const char* statuses[] = {"pending", "paid", "packed", "shipped", "delivered",
+                                     "returned", "cancelled", "on-hold", "refunded", "lost"};
+    return i % 1000 == 0 ? "disputed" : statuses[i % 10];
+}
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+double writeAll(DatabaseConnection& db, size_t keys, const std::string& suffix) {
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < keys; i++) {
+        db.insert(makeKey(i), statusOf(i) + suffix);
+    }
+    return secondsSince(start);
+}
+
+int main(int argc, char* argv[]) {
+    size_t keys = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 200000;
+    int slow_ms = argc > 2 ? std::atoi(argv[2]) : 5;
+    if (keys == 0 || slow_ms < 0) {
+        std::cerr << "Usage: watch_demo [keys] [slow_watcher_ms]" << std::endl;
+        return 1;
+    }
+
+    try {
+        DatabaseConnection& db = DatabaseConnection::getInstance();
+        ConnectionOptions options;
+        options.value_index = true;
+        options.echo_inserts = false;
+        db.connect("watch://demo", options);
+        double unwatched = writeAll(db, keys, "");
+
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::string> indexed = db.keysWithValue("disputed");
+        double index_us = secondsSince(start) * 1e6;
+
+        start = std::chrono::steady_clock::now();
+        std::vector<std::string> scanned;
+        for (size_t i = 0; i < keys; i++) {
+            std::string key = makeKey(i);
+            LookupResult result = db.lookup(key);
+            if (result && *result == "disputed") {
+                scanned.push_back(key);
+            }
+        }
+        double scan_us = secondsSince(start) * 1e6;
+        if (indexed != scanned) {
+            throw std::runtime_error("The value index and the scan disagree");
+        }
+        std::cout << std::fixed << std::setprecision(0) << indexed.size() << " keys are disputed: "
+                  << index_us << " us with the value index, " << scan_us << " us scanning every key" << std::endl;
+
+        // A fast watcher checks that it sees every update to its keys; a
+        // slow one sleeps in its callback and falls behind
+        std::atomic<uint64_t> fast_changes{0};
+        std::atomic<uint64_t> fast_batches{0};
+        std::atomic<uint64_t> out_of_order{0};
+        std::atomic<uint64_t> slow_changes{0};
+        std::atomic<uint64_t> slow_batches{0};
+        std::atomic<uint64_t> slow_dropped{0};
+        uint64_t fast = db.watch("order:", [&](const WatchBatch& batch) {
+            for (const Change& change : batch.changes) {
+                size_t i = std::strtoull(change.key.c_str() + 6, nullptr, 10);
+                if (change.type != ChangeType::kUpdate || change.value != statusOf(i) + ":v2") {
+                    out_of_order++;
+                }
+            }
+            fast_changes += batch.changes.size();
+            fast_batches++;
+        });
+        uint64_t slow = db.watch("order:00000", [&](const WatchBatch& batch) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(slow_ms));
+            slow_changes += batch.changes.size();
+            slow_dropped += batch.dropped;
+            slow_batches++;
+        }, 1024);
+
+        double watched = writeAll(db, keys, ":v2");
+        db.unwatch(fast);
+        db.unwatch(slow);
+
+        std::cout << std::setprecision(2) << keys << " writes took " << unwatched << " s without watchers and "
+                  << watched << " s with them" << std::endl;
+        std::cout << "fast watcher: " << fast_changes << " changes in " << fast_batches << " batches, "
+                  << out_of_order << " unexpected" << std::endl;
+        std::cout << "slow watcher: " << slow_changes << " changes in " << slow_batches << " batches, "
+                  << slow_dropped << " dropped while it slept" << std::endl;
+        if (db.keysWithValue("disputed").size() != 0 || db.keysWithValue("disputed:v2").size() != indexed.size()) {
+            throw std::runtime_error("The value index missed an update");
+        }
+        db.disconnect();
+        return fast_changes == keys && out_of_order == 0 ? 0 : 1;
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,353 @@
+#ifndef WORK_STEALING_POOL_H
+#define WORK_STEALING_POOL_H
+
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <array>
+#include <memory>
+#include <exception>
+#include <utility>
+#include <cstdint>
+#include <cstddef>
+
+// A job lives in the stack frame of the join() that created it, which
+// waits for it before returning, so jobs are never allocated or copied
+struct PoolJob {
+    void (*invoke)(PoolJob*);
+    std::atomic<bool> done{false};
+    std::exception_ptr error;
+};
+
+// Chase-Lev work-stealing deque of jobs (Le, Pop, Cohen and Zappa Nardelli,
+// "Correct and Efficient Work-Stealing for Weak Memory Models", 2013). The
+// owning thread pushes and pops at the bottom; any other thread may steal
+// from the top. The fences of the paper are folded into sequentially
+// consistent loads and stores. join() pushes at most one job per nesting
+// level, so a fixed capacity suffices: push() fails when it is full and
+// the caller runs the job itself.
+class WorkDeque {
+private:
+    static constexpr int64_t kCapacity = 1024;
+
+    alignas(64) std::atomic<int64_t> top{0};
+    alignas(64) std::atomic<int64_t> bottom{0};
+    std::atomic<PoolJob*> jobs[kCapacity] = {};
+
+public:
+    // Owner only
+    bool push(PoolJob* job) {
+        int64_t b = bottom.load(std::memory_order_relaxed);
+        if (b - top.load(std::memory_order_acquire) >= kCapacity) {
+            return false;
+        }
+        jobs[b & (kCapacity - 1)].store(job, std::memory_order_relaxed);
+        bottom.store(b + 1);
+        return true;
+    }
+
+    // Owner only; the job pushed last, or nullptr if thieves took them all
+    PoolJob* pop() {
+        int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+        bottom.store(b);
+        int64_t t = top.load();
+        if (t > b) {
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        PoolJob* job = jobs[b & (kCapacity - 1)].load(std::memory_order_relaxed);
+        if (t == b) {
+            // The last job: race the thieves for it
+            if (!top.compare_exchange_strong(t, t + 1)) {
+                job = nullptr;
+            }
+            bottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return job;
+    }
+
+    // Any thread; the job pushed first, or nullptr if there is none or
+    // another thread got it first
+    PoolJob* steal() {
+        int64_t t = top.load();
+        int64_t b = bottom.load();
+        if (t >= b) {
+            return nullptr;
+        }
+        PoolJob* job = jobs[t & (kCapacity - 1)].load(std::memory_order_relaxed);
+        if (!top.compare_exchange_strong(t, t + 1)) {
+            return nullptr;
+        }
+        return job;
+    }
+
+    bool empty() const { return top.load() >= bottom.load(); }
+};
+
+// Process-wide pool for fork-join parallelism. join(a, b) runs a and b,
+// possibly at the same time: it offers b to other threads by pushing it
+// on the calling thread's deque, runs a, and then takes b back and runs it
+// itself unless an idle worker stole it meanwhile. Algorithms split their
+// input recursively with join(), and work spreads to idle threads a large
+// piece at a time, balancing itself however uneven the pieces turn out.
+//
+// The pool starts one worker fewer than there are hardware threads; a
+// thread outside the pool that calls join() takes the remaining place
+// while it waits, so that no core sits idle. Each outside thread claims a
+// deque of its own for the length of its join, so any number of them can
+// fork work at once without waiting on each other; past kOutsideSlots at
+// a time, further ones run their joins sequentially. While a join waits
+// for a stolen job, its thread runs other jobs instead of blocking.
+class WorkStealingPool {
+private:
+    static constexpr size_t kOutsideSlots = 64;
+
+    struct alignas(64) Participant {
+        WorkDeque deque;
+        uint64_t rng;   // picks steal victims
+    };
+
+    // A deque for outside threads, made the first time one claims it and
+    // kept for the next, so thieves never see it freed
+    struct OutsideSlot {
+        std::atomic<bool> taken{false};
+        std::atomic<Participant*> participant{nullptr};
+    };
+
+    std::vector<std::unique_ptr<Participant>> participants;   // one per worker
+    std::vector<std::thread> workers;
+    std::array<OutsideSlot, kOutsideSlots> outside;
+    std::atomic<size_t> outside_used{0};   // slots below this may hold jobs
+
+    // Idle workers sleep until a job is pushed. Pushers only take the
+    // lock when someone is asleep; sleepers re-check the deques after
+    // announcing themselves, so a push cannot slip past both.
+    std::mutex sleep_mutex;
+    std::condition_variable sleep_wake;
+    std::atomic<size_t> sleepers{0};
+    uint64_t epoch = 0;
+    bool stop = false;
+
+    static inline thread_local Participant* current = nullptr;
+    static inline thread_local WorkStealingPool* current_pool = nullptr;
+
+    WorkStealingPool() {
+        size_t hardware = std::thread::hardware_concurrency();
+        size_t worker_count = hardware > 1 ? hardware - 1 : 0;
+        for (size_t i = 0; i < worker_count; i++) {
+            participants.push_back(std::make_unique<Participant>());
+            participants.back()->rng = 0x9e3779b97f4a7c15ull * (i + 1);
+        }
+        for (size_t i = 0; i < worker_count; i++) {
+            workers.emplace_back([this, i] { workerLoop(*participants[i]); });
+        }
+    }
+
+    // A free outside slot's index, or kOutsideSlots if all are taken
+    size_t claimOutsideSlot() {
+        for (size_t i = 0; i < kOutsideSlots; i++) {
+            OutsideSlot& slot = outside[i];
+            if (slot.taken.load(std::memory_order_relaxed) || slot.taken.exchange(true, std::memory_order_acquire)) {
+                continue;
+            }
+            if (!slot.participant.load(std::memory_order_relaxed)) {
+                auto* participant = new Participant();
+                participant->rng = 0xbf58476d1ce4e5b9ull * (i + 1);
+                slot.participant.store(participant, std::memory_order_release);
+            }
+            size_t used = outside_used.load();
+            while (used <= i && !outside_used.compare_exchange_weak(used, i + 1)) {
+            }
+            return i;
+        }
+        return kOutsideSlots;
+    }
+
+    template<typename F>
+    struct StackJob : PoolJob {
+        F& function;
+
+        explicit StackJob(F& f) : function(f) { invoke = &run; }
+
+        static void run(PoolJob* job) {
+            auto* self = static_cast<StackJob*>(job);
+            try {
+                self->function();
+            } catch (...) {
+                self->error = std::current_exception();
+            }
+            self->done.store(true, std::memory_order_release);
+        }
+    };
+
+    // A job from any deque but self's, or nullptr
+    PoolJob* stealFor(Participant& self) {
+        size_t worker_count = participants.size();
+        size_t count = worker_count + outside_used.load();
+        self.rng ^= self.rng << 13;
+        self.rng ^= self.rng >> 7;
+        self.rng ^= self.rng << 17;
+        size_t start = self.rng % count;
+        for (size_t k = 0; k < count; k++) {
+            size_t index = (start + k) % count;
+            Participant* victim = index < worker_count
+                                      ? participants[index].get()
+                                      : outside[index - worker_count].participant.load(std::memory_order_acquire);
+            if (!victim || victim == &self) {
+                continue;
+            }
+            if (PoolJob* job = victim->deque.steal()) {
+                return job;
+            }
+        }
+        return nullptr;
+    }
+
+    void announce() {
+        if (sleepers.load() > 0) {
+            {
+                std::lock_guard<std::mutex> lock(sleep_mutex);
+                epoch++;
+            }
+            sleep_wake.notify_one();
+        }
+    }
+
+    void workerLoop(Participant& self) {
+        current = &self;
+        current_pool = this;
+        for (;;) {
+            PoolJob* job = nullptr;
+            // Spin briefly before sleeping: joins come in quick succession
+            for (int attempt = 0; attempt < 64 && !job; attempt++) {
+                job = stealFor(self);
+                if (!job) {
+                    std::this_thread::yield();
+                }
+            }
+            if (!job) {
+                uint64_t seen;
+                {
+                    std::lock_guard<std::mutex> lock(sleep_mutex);
+                    if (stop) {
+                        return;
+                    }
+                    seen = epoch;
+                    sleepers++;
+                }
+                job = stealFor(self);
+                std::unique_lock<std::mutex> lock(sleep_mutex);
+                if (!job) {
+                    sleep_wake.wait(lock, [this, seen] { return stop || epoch != seen; });
+                }
+                sleepers--;
+                if (!job) {
+                    continue;
+                }
+            }
+            job->invoke(job);
+        }
+    }
+
+    // Run other jobs until job is done
+    void waitFor(Participant& self, PoolJob& job) {
+        while (!job.done.load(std::memory_order_acquire)) {
+            if (PoolJob* other = self.deque.pop()) {
+                other->invoke(other);
+            } else if (PoolJob* stolen = stealFor(self)) {
+                stolen->invoke(stolen);
+            } else {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    template<typename A, typename B>
+    void joinHere(Participant& self, A& a, B& b) {
+        StackJob<B> job_b(b);
+        if (!self.deque.push(&job_b)) {
+            a();
+            b();
+            return;
+        }
+        announce();
+        try {
+            a();
+        } catch (...) {
+            // b may be running on another thread with references into
+            // this frame, so it has to finish first
+            if (self.deque.pop() != &job_b) {
+                waitFor(self, job_b);
+            }
+            throw;
+        }
+        if (self.deque.pop() == &job_b) {
+            b();
+            return;
+        }
+        waitFor(self, job_b);
+        if (job_b.error) {
+            std::rethrow_exception(job_b.error);
+        }
+    }
+
+public:
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    ~WorkStealingPool() {
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex);
+            stop = true;
+        }
+        sleep_wake.notify_all();
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+        for (OutsideSlot& slot : outside) {
+            delete slot.participant.load();
+        }
+    }
+
+    static WorkStealingPool& getInstance() {
+        static WorkStealingPool instance;
+        return instance;
+    }
+
+    // Threads that run jobs, counting the outside thread's place
+    size_t concurrency() const { return participants.size() + 1; }
+
+    // Run a and b, in parallel if a thread is free, and return once both
+    // have. An exception from either is rethrown after both have finished.
+    template<typename A, typename B>
+    void join(A&& a, B&& b) {
+        if (current_pool == this) {
+            joinHere(*current, a, b);
+            return;
+        }
+        size_t index = claimOutsideSlot();
+        if (index == kOutsideSlots) {
+            a();
+            b();
+            return;
+        }
+        OutsideSlot& slot = outside[index];
+        current = slot.participant.load(std::memory_order_relaxed);
+        current_pool = this;
+        try {
+            joinHere(*current, a, b);
+        } catch (...) {
+            current = nullptr;
+            current_pool = nullptr;
+            slot.taken.store(false, std::memory_order_release);
+            throw;
+        }
+        current = nullptr;
+        current_pool = nullptr;
+        slot.taken.store(false, std::memory_order_release);
+    }
+};
+
+#endif // WORK_STEALING_POOL_H
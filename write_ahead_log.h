@@ -0,0 +1,307 @@
+#ifndef WRITE_AHEAD_LOG_H
+#define WRITE_AHEAD_LOG_H
+
+#include <iostream>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <stdexcept>
+#include <span>
+#include <vector>
+#include <utility>
+#include <type_traits>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "file_io.h"
+
+// Append-only log of inserts. Each record on disk is
+//   [u32 payload length][u32 crc32 of payload][u32 key length][key][value]
+// in little-endian order. A group of inserts that must survive a crash
+// together shares one record whose key length is kGroupMarker, followed by
+//   [u32 count] then [u32 key length][u32 value length][key][value] per insert
+// under the single checksum. An insert that expires has key length
+// kExpiringMarker, followed by
+//   [u64 expiry in milliseconds since the Unix epoch][u32 key length][key][value]
+// Writers copy their record into a shared buffer and
+// then wait for it to become durable. The first waiter that finds no flush in
+// progress becomes the leader: it gives writers that are still appending up
+// to kGroupWindow to join, then writes everything buffered so far and
+// issues a single fsync on behalf of the whole group. A lone writer waits
+// no longer than one yield, since nothing is appended meanwhile.
+class WriteAheadLog {
+private:
+    static constexpr size_t kHeaderSize = 8;
+    static constexpr uint32_t kGroupMarker = UINT32_MAX;
+    static constexpr uint32_t kExpiringMarker = UINT32_MAX - 1;
+    static constexpr std::chrono::microseconds kGroupWindow{50};
+
+    int fd;
+    std::mutex mutex;
+    std::condition_variable flushed;
+    std::string pending;      // appended but not yet written
+    uint64_t appended_lsn;    // end offset of the last appended record
+    uint64_t durable_lsn;     // end offset known to be on disk
+    bool flushing;
+    std::string error;        // sticky failure from a leader's flush
+    uint64_t sync_count;
+
+    static void putU32(char* out, uint32_t v) { putLittleEndian32(out, v); }
+
+    static uint32_t getU32(const char* p) { return getLittleEndian32(p); }
+
+    static void appendU32(std::string& out, uint32_t v) {
+        char bytes[4];
+        putU32(bytes, v);
+        out.append(bytes, 4);
+    }
+
+    // Fill in the header of a record whose payload follows it, then buffer it
+    uint64_t enqueue(std::string& record) {
+        std::string_view payload = std::string_view(record).substr(kHeaderSize);
+        putU32(&record[0], static_cast<uint32_t>(payload.size()));
+        putU32(&record[4], crc32(payload));
+
+        std::lock_guard<std::mutex> lock(mutex);
+        pending += record;
+        appended_lsn += record.size();
+        return appended_lsn;
+    }
+
+    // Replayers that know about expiry get it as a third argument; others
+    // see an expiring insert as a plain one
+    template<typename Apply>
+    static bool applyExpiring(std::string_view payload, Apply& apply) {
+        if (payload.size() < 16) {
+            return false;
+        }
+        uint64_t expires_at = getU32(payload.data() + 4) | (static_cast<uint64_t>(getU32(payload.data() + 8)) << 32);
+        uint32_t key_length = getU32(payload.data() + 12);
+        if (key_length > payload.size() - 16) {
+            return false;
+        }
+        std::string_view key = payload.substr(16, key_length);
+        std::string_view value = payload.substr(16 + key_length);
+        if constexpr (std::is_invocable_v<Apply&, std::string_view, std::string_view, uint64_t>) {
+            apply(key, value, expires_at);
+        } else {
+            apply(key, value);
+        }
+        return true;
+    }
+
+    // Apply every insert of a group payload, or none if it is malformed.
+    // Returns the number applied.
+    template<typename Apply>
+    static size_t applyGroup(std::string_view payload, Apply& apply) {
+        if (payload.size() < 8) {
+            return 0;
+        }
+        uint32_t count = getU32(payload.data() + 4);
+        std::vector<std::pair<std::string_view, std::string_view>> items;
+        size_t offset = 8;
+        for (uint32_t i = 0; i < count; i++) {
+            if (payload.size() - offset < 8) {
+                return 0;
+            }
+            uint32_t key_length = getU32(payload.data() + offset);
+            uint32_t value_length = getU32(payload.data() + offset + 4);
+            offset += 8;
+            if (payload.size() - offset < static_cast<size_t>(key_length) + value_length) {
+                return 0;
+            }
+            items.emplace_back(payload.substr(offset, key_length), payload.substr(offset + key_length, value_length));
+            offset += key_length + value_length;
+        }
+        for (const auto& [key, value] : items) {
+            apply(key, value);
+        }
+        return items.size();
+    }
+
+public:
+    WriteAheadLog() : fd(-1), appended_lsn(0), durable_lsn(0), flushing(false), sync_count(0) {}
+
+    WriteAheadLog(const WriteAheadLog&) = delete;
+    WriteAheadLog& operator=(const WriteAheadLog&) = delete;
+
+    ~WriteAheadLog() {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    }
+
+    // Feed every intact record to apply(key, value), or for an expiring
+    // insert to apply(key, value, expires_at) if that is callable, cut off
+    // a torn or corrupted tail left by a crash, then open the file for
+    // appending. Returns the number of records replayed.
+    template<typename Apply>
+    size_t open(const std::string& path, Apply apply) {
+        std::string contents;
+        {
+            std::ifstream in(path, std::ios::binary);
+            contents.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        }
+        size_t offset = 0;
+        size_t replayed = 0;
+        while (contents.size() - offset >= kHeaderSize) {
+            uint32_t length = getU32(contents.data() + offset);
+            uint32_t checksum = getU32(contents.data() + offset + 4);
+            if (length < 4 || contents.size() - offset - kHeaderSize < length) {
+                break;
+            }
+            std::string_view payload(contents.data() + offset + kHeaderSize, length);
+            uint32_t key_length = getU32(payload.data());
+            if (crc32(payload) != checksum) {
+                break;
+            }
+            if (key_length == kGroupMarker) {
+                replayed += applyGroup(payload, apply);
+            } else if (key_length == kExpiringMarker) {
+                if (!applyExpiring(payload, apply)) {
+                    break;
+                }
+                replayed++;
+            } else if (key_length > length - 4) {
+                break;
+            } else {
+                apply(payload.substr(4, key_length), payload.substr(4 + key_length));
+                replayed++;
+            }
+            offset += kHeaderSize + length;
+        }
+
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT, 0644);
+        if (fd < 0) {
+            throw std::runtime_error("Cannot open WAL " + path + ": " + std::strerror(errno));
+        }
+        if (offset < contents.size()) {
+            std::cout << "WAL: discarding " << contents.size() - offset
+                      << " bytes of torn tail" << std::endl;
+            if (::ftruncate(fd, static_cast<off_t>(offset)) != 0) {
+                throw std::runtime_error(std::string("WAL truncate failed: ") + std::strerror(errno));
+            }
+        }
+        ::lseek(fd, static_cast<off_t>(offset), SEEK_SET);
+        appended_lsn = durable_lsn = offset;
+        return replayed;
+    }
+
+    // Buffer one record and return the log position that must become
+    // durable before the insert may be acknowledged
+    uint64_t append(std::string_view key, std::string_view value) {
+        std::string record(kHeaderSize + 4, '\0');
+        record.reserve(kHeaderSize + 4 + key.size() + value.size());
+        putU32(&record[kHeaderSize], static_cast<uint32_t>(key.size()));
+        record.append(key);
+        record.append(value);
+        return enqueue(record);
+    }
+
+    // Like append(), for an insert that expires at expires_at, in
+    // milliseconds since the Unix epoch
+    uint64_t appendExpiring(std::string_view key, std::string_view value, uint64_t expires_at) {
+        std::string record(kHeaderSize, '\0');
+        record.reserve(kHeaderSize + 16 + key.size() + value.size());
+        appendU32(record, kExpiringMarker);
+        appendU32(record, static_cast<uint32_t>(expires_at));
+        appendU32(record, static_cast<uint32_t>(expires_at >> 32));
+        appendU32(record, static_cast<uint32_t>(key.size()));
+        record.append(key);
+        record.append(value);
+        return enqueue(record);
+    }
+
+    // Buffer several inserts as one record, so replay applies all of them
+    // or, if the tail was torn, none
+    uint64_t appendGroup(std::span<const std::pair<std::string_view, std::string_view>> items) {
+        std::string record(kHeaderSize, '\0');
+        appendU32(record, kGroupMarker);
+        appendU32(record, static_cast<uint32_t>(items.size()));
+        for (const auto& [key, value] : items) {
+            appendU32(record, static_cast<uint32_t>(key.size()));
+            appendU32(record, static_cast<uint32_t>(value.size()));
+            record.append(key);
+            record.append(value);
+        }
+        return enqueue(record);
+    }
+
+    // Block until everything up to lsn is on disk, leading a group flush if
+    // nobody else is
+    void waitDurable(uint64_t lsn) {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (durable_lsn < lsn) {
+            if (!error.empty()) {
+                throw std::runtime_error(error);
+            }
+            if (flushing) {
+                flushed.wait(lock);
+                continue;
+            }
+            flushing = true;
+            // Let writers that are about to append join this flush: keep
+            // yielding while the log is still growing, up to kGroupWindow
+            auto window_end = std::chrono::steady_clock::now() + kGroupWindow;
+            for (uint64_t seen = 0; seen != appended_lsn && std::chrono::steady_clock::now() < window_end;) {
+                seen = appended_lsn;
+                lock.unlock();
+                std::this_thread::yield();
+                lock.lock();
+            }
+            std::string batch;
+            batch.swap(pending);
+            uint64_t target = appended_lsn;
+            lock.unlock();
+            try {
+                writeFully(fd, batch, "WAL write");
+                syncFile(fd);
+            } catch (const std::exception& e) {
+                lock.lock();
+                error = e.what();
+                flushing = false;
+                flushed.notify_all();
+                throw;
+            }
+            lock.lock();
+            durable_lsn = target;
+            flushing = false;
+            sync_count++;
+            flushed.notify_all();
+        }
+    }
+
+    // Whether everything up to lsn is on disk already, without waiting
+    bool isDurable(uint64_t lsn) {
+        std::lock_guard<std::mutex> lock(mutex);
+        return durable_lsn >= lsn;
+    }
+
+    uint64_t syncs() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return sync_count;
+    }
+
+    // Drop every record once a checkpoint has made them redundant. The
+    // caller must keep new appends out; log positions stay monotonic so
+    // threads still waiting on an older position are released normally.
+    void reset() {
+        waitDurable(appended_lsn);
+        std::lock_guard<std::mutex> lock(mutex);
+        if (::ftruncate(fd, 0) != 0) {
+            throw std::runtime_error(std::string("WAL truncate failed: ") + std::strerror(errno));
+        }
+        ::lseek(fd, 0, SEEK_SET);
+        syncFile(fd);
+    }
+};
+
+#endif // WRITE_AHEAD_LOG_H
@@ -0,0 +1,607 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <shared_mutex>
+#include <mutex>
+#include <algorithm>
+#include <filesystem>
+#include <stdexcept>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+
+#include "database_connection.h"
+#include "kv_protocol.h"
+
+// YCSB-style benchmark. Loads [records] keys, then runs [operations]
+// operations of one of the standard mixes on [threads] threads:
+//   A  50% read, 50% update                 zipfian
+//   B  95% read,  5% update                 zipfian
+//   C  100% read                            zipfian
+//   D  95% read,  5% insert                 latest (recent inserts are hot)
+//   E  95% scan,  5% insert                 zipfian start, 1-100 keys
+//   F  50% read, 50% read-modify-write      zipfian
+// --distribution uniform replaces zipfian in any of them. --hot-keys N
+// serves the N hottest keys from DatabaseConnection's per-CPU replicas and
+// adds what it detected to the results. Backends:
+//   memory    DatabaseConnection in memory
+//   wal       DatabaseConnection with a write-ahead log
+//   lsm       DatabaseConnection on the LSM engine (no scans)
+//   mvcc      DatabaseConnection with transactions; RMW is transactional
+//   server    a running kv_server at --address (no scans)
+//   baseline  std::map behind one shared_mutex, for reference
+// Throughput and per-operation latency histograms are written as JSON.
+// Usage: ycsb_benchmark [--workload A] [--backend memory] [--threads 4]
+//          [--records 100000] [--operations 1000000] [--value-size 100]
+//          [--distribution zipfian] [--hot-keys 0] [--address unix:/tmp/kv_server.sock]
+//          [--output ycsb_<workload>_<backend>.json]
+
+std::string makeKey(uint64_t keynum) {
+    char key[32];
+    std::snprintf(key, sizeof(key), "user%012llu", static_cast<unsigned long long>(keynum));
+    return key;
+}
+
+// Above every key makeKey produces
+const std::string kKeyLimit = "user:";
+
+// Zipfian over [0, items) with the YCSB constant 0.99, using the rejection
+// free method of Gray et al. zeta(n) is computed once up front.
+class ZipfianGenerator {
+private:
+    static constexpr double kTheta = 0.99;
+
+    uint64_t items;
+    double alpha;
+    double zetan;
+    double eta;
+    double half_pow_theta;
+
+    static double zeta(uint64_t n) {
+        double sum = 0;
+        for (uint64_t i = 1; i <= n; i++) {
+            sum += 1.0 / std::pow(static_cast<double>(i), kTheta);
+        }
+        return sum;
+    }
+
+public:
+    explicit ZipfianGenerator(uint64_t count) : items(count) {
+        double zeta2 = zeta(2);
+        zetan = zeta(items);
+        alpha = 1.0 / (1.0 - kTheta);
+        eta = (1 - std::pow(2.0 / items, 1 - kTheta)) / (1 - zeta2 / zetan);
+        half_pow_theta = 1 + std::pow(0.5, kTheta);
+    }
+
+    // Rank drawn from the distribution: 0 is the most popular
+    template<typename Rng>
+    uint64_t next(Rng& rng) const {
+        double u = std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+        double uz = u * zetan;
+        if (uz < 1.0) {
+            return 0;
+        }
+        if (uz < half_pow_theta) {
+            return 1;
+        }
+        return std::min(items - 1, static_cast<uint64_t>(items * std::pow(eta * u - eta + 1, alpha)));
+    }
+};
+
+// Latency histogram with 16 linear buckets per power of two of
+// nanoseconds, so every bucket is within about 6% of its values
+class LatencyHistogram {
+private:
+    static constexpr size_t kSub = 16;
+    std::vector<uint64_t> counts;
+    uint64_t total = 0;
+    uint64_t sum_ns = 0;
+    uint64_t max_ns = 0;
+
+    static size_t bucketOf(uint64_t ns) {
+        if (ns < kSub) {
+            return ns;
+        }
+        int exponent = 63 - __builtin_clzll(ns);
+        return kSub + (exponent - 4) * kSub + ((ns >> (exponent - 4)) - kSub);
+    }
+
+    static uint64_t upperBound(size_t bucket) {
+        if (bucket < kSub) {
+            return bucket;
+        }
+        size_t exponent = (bucket - kSub) / kSub + 4;
+        size_t sub = (bucket - kSub) % kSub;
+        return ((kSub + sub + 1) << (exponent - 4)) - 1;
+    }
+
+public:
+    LatencyHistogram() : counts(kSub + 60 * kSub, 0) {}
+
+    void record(uint64_t ns) {
+        counts[bucketOf(ns)]++;
+        total++;
+        sum_ns += ns;
+        max_ns = std::max(max_ns, ns);
+    }
+
+    void merge(const LatencyHistogram& other) {
+        for (size_t i = 0; i < counts.size(); i++) {
+            counts[i] += other.counts[i];
+        }
+        total += other.total;
+        sum_ns += other.sum_ns;
+        max_ns = std::max(max_ns, other.max_ns);
+    }
+
+    uint64_t count() const { return total; }
+
+    double percentileMicros(double p) const {
+        uint64_t rank = static_cast<uint64_t>(std::ceil(p * total));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < counts.size(); i++) {
+            seen += counts[i];
+            if (seen >= rank && seen > 0) {
+                return std::min(upperBound(i), max_ns) / 1000.0;
+            }
+        }
+        return max_ns / 1000.0;
+    }
+
+    void writeJson(std::ostream& out) const {
+        out << "{\"count\": " << total << ", \"mean_us\": " << (total ? sum_ns / 1000.0 / total : 0.0)
+            << ", \"p50_us\": " << percentileMicros(0.50) << ", \"p95_us\": " << percentileMicros(0.95)
+            << ", \"p99_us\": " << percentileMicros(0.99) << ", \"p999_us\": " << percentileMicros(0.999)
+            << ", \"max_us\": " << max_ns / 1000.0 << ", \"histogram_us\": [";
+        bool first = true;
+        for (size_t i = 0; i < counts.size(); i++) {
+            if (counts[i] == 0) {
+                continue;
+            }
+            out << (first ? "" : ", ") << "[" << upperBound(i) / 1000.0 << ", " << counts[i] << "]";
+            first = false;
+        }
+        out << "]}";
+    }
+};
+
+// What the workloads need from a store. Operations take the calling
+// thread's index so backends with per-thread state (connections) can keep
+// it without locking.
+class Backend {
+public:
+    virtual ~Backend() = default;
+    virtual void prepare(size_t threads) { (void)threads; }
+    virtual void load(const std::vector<std::pair<std::string, std::string>>& batch) = 0;
+    virtual bool read(size_t thread, const std::string& key, std::string& value) = 0;
+    virtual void write(size_t thread, const std::string& key, const std::string& value) = 0;
+    virtual bool supportsScan() const { return false; }
+    virtual size_t scan(size_t thread, const std::string& start, size_t count) {
+        (void)thread;
+        (void)start;
+        (void)count;
+        throw std::runtime_error("Scans are not supported by this backend");
+    }
+    // Read a key and write back a modified value. Not atomic unless the
+    // backend says otherwise.
+    virtual void readModifyWrite(size_t thread, const std::string& key, const std::string& value) {
+        std::string current;
+        read(thread, key, current);
+        write(thread, key, value);
+    }
+    // Extra members for the results object, each preceded by a comma
+    virtual void writeJson(std::ostream& out) { (void)out; }
+};
+
+class DatabaseBackend : public Backend {
+private:
+    DatabaseConnection& db;
+    bool transactional;
+    bool scans;
+    std::string cleanup;
+
+public:
+    DatabaseBackend(const std::string& mode, bool ordered, size_t hot_keys)
+        : db(DatabaseConnection::getInstance()), transactional(mode == "mvcc"), scans(ordered) {
+        ConnectionOptions options;
+        options.echo_inserts = false;
+        options.ordered_index = ordered;
+        options.hot_keys = hot_keys;
+        if (mode == "wal") {
+            cleanup = "ycsb_benchmark.wal";
+            std::filesystem::remove(cleanup);
+            options.wal_path = cleanup;
+        } else if (mode == "lsm") {
+            cleanup = "ycsb_benchmark_lsm";
+            std::filesystem::remove_all(cleanup);
+            options.lsm_directory = cleanup;
+            options.ordered_index = false;
+            options.hot_keys = 0;
+            scans = false;
+        } else if (mode == "mvcc") {
+            options.transactions = true;
+        } else if (mode != "memory") {
+            throw std::runtime_error("Unknown backend " + mode);
+        }
+        db.connect("ycsb://" + mode, options);
+    }
+
+    ~DatabaseBackend() override {
+        db.disconnect();
+        if (!cleanup.empty()) {
+            std::filesystem::remove_all(cleanup);
+        }
+    }
+
+    void load(const std::vector<std::pair<std::string, std::string>>& batch) override {
+        db.insertBatch(batch);
+    }
+
+    bool read(size_t, const std::string& key, std::string& value) override {
+        LookupResult result = db.lookup(key);
+        if (!result) {
+            return false;
+        }
+        value.assign(result.value());
+        return true;
+    }
+
+    void write(size_t, const std::string& key, const std::string& value) override {
+        db.insert(key, value);
+    }
+
+    bool supportsScan() const override {
+        return scans;
+    }
+
+    size_t scan(size_t, const std::string& start, size_t count) override {
+        size_t seen = 0;
+        for (auto cursor = db.range(start, kKeyLimit, count); cursor.valid(); cursor.next()) {
+            seen += !cursor.value().empty();
+        }
+        return seen;
+    }
+
+    void writeJson(std::ostream& out) override {
+        HotKeyStats stats = db.hotKeyStats();
+        if (stats.sampled_reads == 0) {
+            return;
+        }
+        out << ",\n  \"hot_keys\": {\"sampled_reads\": " << stats.sampled_reads << ", \"replicated\": "
+            << stats.replicated << ", \"replica_hits\": " << stats.replica_hits << ", \"promotions\": "
+            << stats.promotions << ", \"invalidations\": " << stats.invalidations << ", \"top\": [";
+        bool first = true;
+        for (const HotKey& hot : db.hotKeys()) {
+            out << (first ? "" : ", ") << "{\"key\": \"" << hot.key << "\", \"heat\": " << hot.heat
+                << ", \"replicated\": " << (hot.replicated ? "true" : "false") << "}";
+            first = false;
+        }
+        out << "]}";
+    }
+
+    void readModifyWrite(size_t thread, const std::string& key, const std::string& value) override {
+        if (!transactional) {
+            Backend::readModifyWrite(thread, key, value);
+            return;
+        }
+        for (;;) {
+            auto tx = db.begin();
+            tx.get(key);
+            tx.put(key, value);
+            if (tx.commit()) {
+                return;
+            }
+        }
+    }
+};
+
+class ServerBackend : public Backend {
+private:
+    KvAddress address;
+    std::vector<std::unique_ptr<KvClient>> clients;   // one connection per thread plus the loader
+
+    static void check(const KvResponse& response) {
+        if (response.status == KvStatus::kError) {
+            throw std::runtime_error("Server error: " + std::string(response.value));
+        }
+    }
+
+public:
+    explicit ServerBackend(const std::string& target) : address(KvAddress::parse(target)) {
+        clients.push_back(std::make_unique<KvClient>(address));
+    }
+
+    void prepare(size_t threads) override {
+        while (clients.size() < threads) {
+            clients.push_back(std::make_unique<KvClient>(address));
+        }
+    }
+
+    // The whole batch is pipelined
+    void load(const std::vector<std::pair<std::string, std::string>>& batch) override {
+        KvClient& client = *clients[0];
+        for (const auto& [key, value] : batch) {
+            client.put(key, value);
+        }
+        client.flush();
+        for (size_t i = 0; i < batch.size(); i++) {
+            check(client.read());
+        }
+    }
+
+    bool read(size_t thread, const std::string& key, std::string& value) override {
+        KvClient& client = *clients[thread];
+        client.get(key);
+        client.flush();
+        KvResponse response = client.read();
+        check(response);
+        if (response.status != KvStatus::kOk) {
+            return false;
+        }
+        value.assign(response.value);
+        return true;
+    }
+
+    void write(size_t thread, const std::string& key, const std::string& value) override {
+        KvClient& client = *clients[thread];
+        client.put(key, value);
+        client.flush();
+        check(client.read());
+    }
+};
+
+// What the store looked like before sharding: one ordered map, one lock
+class BaselineBackend : public Backend {
+private:
+    std::map<std::string, std::string, std::less<>> data;
+    std::shared_mutex mutex;
+
+public:
+    void load(const std::vector<std::pair<std::string, std::string>>& batch) override {
+        std::unique_lock<std::shared_mutex> lock(mutex);
+        for (const auto& [key, value] : batch) {
+            data[key] = value;
+        }
+    }
+
+    bool read(size_t, const std::string& key, std::string& value) override {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        auto it = data.find(key);
+        if (it == data.end()) {
+            return false;
+        }
+        value = it->second;
+        return true;
+    }
+
+    void write(size_t, const std::string& key, const std::string& value) override {
+        std::unique_lock<std::shared_mutex> lock(mutex);
+        data[key] = value;
+    }
+
+    bool supportsScan() const override { return true; }
+
+    size_t scan(size_t, const std::string& start, size_t count) override {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        size_t seen = 0;
+        for (auto it = data.lower_bound(start); it != data.end() && seen < count; ++it) {
+            seen += !it->second.empty();
+        }
+        return seen;
+    }
+};
+
+struct Workload {
+    char name;
+    double read;
+    double update;
+    double insert;
+    double scan;
+    double read_modify_write;
+    bool latest;   // reads favour the most recent inserts
+};
+
+Workload workloadFor(char name) {
+    switch (name) {
+    case 'A': return {'A', 0.50, 0.50, 0, 0, 0, false};
+    case 'B': return {'B', 0.95, 0.05, 0, 0, 0, false};
+    case 'C': return {'C', 1.00, 0, 0, 0, 0, false};
+    case 'D': return {'D', 0.95, 0, 0.05, 0, 0, true};
+    case 'E': return {'E', 0, 0, 0.05, 0.95, 0, false};
+    case 'F': return {'F', 0.50, 0, 0, 0, 0.50, false};
+    }
+    throw std::runtime_error(std::string("Unknown workload ") + name + ", expected A-F");
+}
+
+enum OpType { kRead, kUpdate, kInsert, kScan, kReadModifyWrite, kOpTypes };
+const char* const kOpNames[kOpTypes] = {"READ", "UPDATE", "INSERT", "SCAN", "READ-MODIFY-WRITE"};
+
+std::unique_ptr<Backend> makeBackend(const std::string& name, const std::string& address, bool ordered,
+                                     size_t hot_keys) {
+    if (name == "baseline") {
+        return std::make_unique<BaselineBackend>();
+    }
+    if (name == "server") {
+        return std::make_unique<ServerBackend>(address);
+    }
+    return std::make_unique<DatabaseBackend>(name, ordered, hot_keys);
+}
+
+int main(int argc, char* argv[]) {
+    std::map<std::string, std::string> args = {
+        {"workload", "A"}, {"backend", "memory"}, {"threads", "4"}, {"records", "100000"},
+        {"operations", "1000000"}, {"value-size", "100"}, {"distribution", "zipfian"}, {"hot-keys", "0"},
+        {"address", "unix:/tmp/kv_server.sock"}, {"output", ""},
+    };
+    const char* usage = "Usage: ycsb_benchmark [--workload A] [--backend memory] [--threads 4]\n"
+                        "         [--records 100000] [--operations 1000000] [--value-size 100]\n"
+                        "         [--distribution zipfian] [--hot-keys 0] [--address unix:/tmp/kv_server.sock]\n"
+                        "         [--output ycsb_<workload>_<backend>.json]\n"
+                        "Workloads A-F; backends memory, wal, lsm, mvcc, server, baseline\n";
+    for (int i = 1; i < argc; i++) {
+        std::string flag = argv[i];
+        if (flag == "--help" || flag == "-h") {
+            std::cout << usage;
+            return 0;
+        }
+        if (flag.rfind("--", 0) != 0 || !args.count(flag.substr(2))) {
+            std::cerr << "Unknown option " << flag << "\n" << usage;
+            return 1;
+        }
+        if (i + 1 >= argc) {
+            std::cerr << flag << " needs a value\n" << usage;
+            return 1;
+        }
+        args[flag.substr(2)] = argv[++i];
+    }
+
+    try {
+        const Workload workload = workloadFor(static_cast<char>(std::toupper(args["workload"][0])));
+        const size_t threads = std::max<size_t>(1, std::stoull(args["threads"]));
+        const uint64_t records = std::max<uint64_t>(1, std::stoull(args["records"]));
+        const uint64_t operations = std::stoull(args["operations"]);
+        const size_t value_size = std::stoull(args["value-size"]);
+        const bool uniform = args["distribution"] == "uniform";
+        if (!uniform && args["distribution"] != "zipfian") {
+            throw std::runtime_error("Distribution must be zipfian or uniform");
+        }
+
+        auto backend = makeBackend(args["backend"], args["address"], workload.scan > 0, std::stoull(args["hot-keys"]));
+        if (workload.scan > 0 && !backend->supportsScan()) {
+            throw std::runtime_error("Backend " + args["backend"] + " cannot run workload E");
+        }
+        backend->prepare(threads);
+
+        using Clock = std::chrono::steady_clock;
+        auto load_start = Clock::now();
+        std::vector<std::pair<std::string, std::string>> batch;
+        for (uint64_t i = 0; i < records; i++) {
+            batch.emplace_back(makeKey(i), std::string(value_size, static_cast<char>('a' + i % 26)));
+            if (batch.size() == 1000 || i + 1 == records) {
+                backend->load(batch);
+                batch.clear();
+            }
+        }
+        double load_seconds = std::chrono::duration<double>(Clock::now() - load_start).count();
+
+        // Inserts take the next key number; reads in D chase the newest
+        std::atomic<uint64_t> next_key(records);
+        ZipfianGenerator zipfian(records);
+        std::vector<std::array<LatencyHistogram, kOpTypes>> histograms(threads);
+        std::vector<std::string> errors(threads);
+        std::vector<std::thread> workers;
+        auto run_start = Clock::now();
+        for (size_t t = 0; t < threads; t++) {
+            workers.emplace_back([&, t]() {
+                try {
+                    std::mt19937_64 rng(t * 7919 + 1);
+                    std::uniform_real_distribution<double> coin(0.0, 1.0);
+                    std::string value(value_size, 'x');
+                    std::string result;
+                    auto chooseKey = [&]() {
+                        uint64_t limit = next_key.load(std::memory_order_relaxed);
+                        if (workload.latest) {
+                            uint64_t back = uniform ? rng() % limit : zipfian.next(rng);
+                            return limit - 1 - std::min(back, limit - 1);
+                        }
+                        if (uniform) {
+                            return rng() % limit;
+                        }
+                        // Scatter the popular ranks over the key space
+                        return hashBytes(std::to_string(zipfian.next(rng))) % records;
+                    };
+                    uint64_t share = operations / threads + (t < operations % threads);
+                    for (uint64_t n = 0; n < share; n++) {
+                        double pick = coin(rng);
+                        value[rng() % value_size] = static_cast<char>('a' + rng() % 26);
+                        OpType type;
+                        auto begin = Clock::now();
+                        if ((pick -= workload.read) < 0) {
+                            type = kRead;
+                            backend->read(t, makeKey(chooseKey()), result);
+                        } else if ((pick -= workload.update) < 0) {
+                            type = kUpdate;
+                            backend->write(t, makeKey(chooseKey()), value);
+                        } else if ((pick -= workload.insert) < 0) {
+                            type = kInsert;
+                            backend->write(t, makeKey(next_key.fetch_add(1)), value);
+                        } else if ((pick -= workload.scan) < 0) {
+                            type = kScan;
+                            backend->scan(t, makeKey(chooseKey()), 1 + rng() % 100);
+                        } else {
+                            type = kReadModifyWrite;
+                            backend->readModifyWrite(t, makeKey(chooseKey()), value);
+                        }
+                        histograms[t][type].record(
+                            std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - begin).count());
+                    }
+                } catch (const std::exception& e) {
+                    errors[t] = e.what();
+                }
+            });
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        double run_seconds = std::chrono::duration<double>(Clock::now() - run_start).count();
+        for (const auto& error : errors) {
+            if (!error.empty()) {
+                throw std::runtime_error(error);
+            }
+        }
+
+        std::array<LatencyHistogram, kOpTypes> totals;
+        for (const auto& thread_histograms : histograms) {
+            for (size_t op = 0; op < kOpTypes; op++) {
+                totals[op].merge(thread_histograms[op]);
+            }
+        }
+
+        std::ostringstream json;
+        json << std::fixed << std::setprecision(3);
+        json << "{\n  \"workload\": \"" << workload.name << "\",\n  \"backend\": \"" << args["backend"]
+             << "\",\n  \"distribution\": \"" << args["distribution"] << "\",\n  \"threads\": " << threads
+             << ",\n  \"records\": " << records << ",\n  \"operations\": " << operations
+             << ",\n  \"value_size\": " << value_size << ",\n  \"load\": {\"seconds\": " << load_seconds
+             << ", \"ops_per_sec\": " << records / load_seconds << "},\n  \"run\": {\"seconds\": " << run_seconds
+             << ", \"ops_per_sec\": " << operations / run_seconds << "},\n  \"latency\": {";
+        bool first = true;
+        for (size_t op = 0; op < kOpTypes; op++) {
+            if (totals[op].count() == 0) {
+                continue;
+            }
+            json << (first ? "" : ",") << "\n    \"" << kOpNames[op] << "\": ";
+            totals[op].writeJson(json);
+            first = false;
+        }
+        json << "\n  }";
+        backend->writeJson(json);
+        json << "\n}\n";
+
+        // connect() and the server log to stdout, so results go to a file
+        std::string output = args["output"];
+        if (output.empty()) {
+            output = std::string("ycsb_") + workload.name + "_" + args["backend"] + ".json";
+        }
+        std::ofstream(output) << json.str();
+        std::cout << "Workload " << workload.name << " on " << args["backend"] << ": " << std::fixed
+                  << std::setprecision(0) << operations / run_seconds << " ops/sec, results in " << output
+                  << std::endl;
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}